@@ -6,15 +6,22 @@
 #include <event-queue/event_queue_impl.hpp>
 #include <util/util.hpp>
 #include <media-streams/media_stream.hpp>
+#include <track-negotiators/av1.hpp>
 #include <track-negotiators/h264.hpp>
+#include <track-negotiators/h265.hpp>
 #include <track-negotiators/opus.hpp>
 #include <track-negotiators/pcmu.hpp>
+#include <rtp-packetizer/av1_packetizer.hpp>
 #include <rtp-packetizer/h264_packetizer.hpp>
+#include <rtp-packetizer/h265_packetizer.hpp>
+#include <rtp-packetizer/opus_packetizer.hpp>
 #include <rtp-packetizer/pcmu_packetizer.hpp>
 #include <rtp-repacketizer/h264_repacketizer.hpp>
+#include <rtp-repacketizer/h265_repacketizer.hpp>
 #include <rtp-client/rtp_client.hpp>
 #include <rtsp-client/rtsp_stream.hpp>
 #include <fifo-file-client/fifo_file_client.hpp>
+#include <shm-ring-client/shm_ring_client.hpp>
 #include <nabto/nabto_device_webrtc.hpp>
 
 #include <rtc/global.hpp>
@@ -109,7 +116,17 @@ int main(int argc, char** argv) {
     nabto::FifoFileClientPtr fifoVideo = nullptr;
     nabto::FifoFileClientPtr fifoAudio = nullptr;
     bool repacketH264 = opts["repacketH264"].get<bool>();
-    auto rtpVideoNegotiator = nabto::H264Negotiator::create();
+    std::string videoCodec = opts["videoCodec"].get<std::string>();
+    bool h265 = videoCodec == "h265";
+    bool av1 = videoCodec == "av1";
+    nabto::TrackNegotiatorPtr rtpVideoNegotiator;
+    if (h265) {
+        rtpVideoNegotiator = nabto::H265Negotiator::create();
+    } else if (av1) {
+        rtpVideoNegotiator = nabto::AV1Negotiator::create();
+    } else {
+        rtpVideoNegotiator = nabto::H264Negotiator::create();
+    }
     auto rtpAudioNegotiator = nabto::OpusNegotiator::create();
     // auto rtpAudioNegotiator = nabto::PcmuNegotiator::create();
 
@@ -117,9 +134,13 @@ int main(int argc, char** argv) {
         std::string rtspUrl = opts["rtspUrl"].get<std::string>();
         bool preferTcp = opts["preferTcp"].get<bool>();
         nabto::RtspStreamConf conf = { "frontdoor", rtspUrl, rtpVideoNegotiator, rtpAudioNegotiator, nullptr, nullptr, preferTcp};
-        if (repacketH264) {
+        if (h265) {
+            conf.videoRepack = nabto::H265RepacketizerFactory::create();
+        } else if (repacketH264 && !av1) {
             conf.videoRepack = nabto::H264RepacketizerFactory::create();
         }
+        conf.prewarm = opts["rtspPrewarm"].get<bool>();
+        conf.linger = std::chrono::seconds(opts["rtspLinger"].get<int>());
         rtsp = nabto::RtspStream::create(conf);
         medias.push_back(rtsp);
     } catch (std::exception& ex) {
@@ -127,11 +148,16 @@ int main(int argc, char** argv) {
         try {
             try {
                 // Try add audio
-                // FIFO only supports PCMU
-                rtpAudioNegotiator = nabto::PcmuNegotiator::create();
-
+                // FIFO audio is either PCMU or Ogg encapsulated Opus
                 std::string fifoPath = opts["fifoAudioPath"].get<std::string>();
-                auto fifoPacketizer = nabto::PcmuPacketizerFactory::create("frontdoor-audio");
+                nabto::RtpPacketizerFactoryPtr fifoPacketizer;
+                if (opts.contains("fifoAudioCodec") && opts["fifoAudioCodec"].get<std::string>() == "opus") {
+                    rtpAudioNegotiator = nabto::OpusNegotiator::create();
+                    fifoPacketizer = nabto::OpusPacketizerFactory::create("frontdoor-audio");
+                } else {
+                    rtpAudioNegotiator = nabto::PcmuNegotiator::create();
+                    fifoPacketizer = nabto::PcmuPacketizerFactory::create("frontdoor-audio");
+                }
 
                 nabto::FifoFileClientConf conf = { "frontdoor-audio", fifoPath, rtpAudioNegotiator, fifoPacketizer };
                 fifoAudio = nabto::FifoFileClient::create(conf);
@@ -142,18 +168,36 @@ int main(int argc, char** argv) {
                 // ignore missing audio
             }
 
-            auto fifoPacketizer = nabto::H264PacketizerFactory::create("frontdoor-video");
-            std::string fifoPath = opts["fifoPath"].get<std::string>();
+            nabto::RtpPacketizerFactoryPtr fifoPacketizer;
+            if (h265) {
+                fifoPacketizer = nabto::H265PacketizerFactory::create("frontdoor-video");
+            } else if (av1) {
+                fifoPacketizer = nabto::AV1PacketizerFactory::create("frontdoor-video");
+            } else {
+                fifoPacketizer = nabto::H264PacketizerFactory::create("frontdoor-video");
+            }
+            if (opts.contains("shmRingPath")) {
+                nabto::ShmRingClientConf conf;
+                conf.trackId = "frontdoor-video";
+                conf.socketPath = opts["shmRingPath"].get<std::string>();
+                conf.negotiator = rtpVideoNegotiator;
+                conf.packetizer = fifoPacketizer;
+                medias.push_back(nabto::ShmRingClient::create(conf));
+            } else {
+                std::string fifoPath = opts["fifoPath"].get<std::string>();
 
-            nabto::FifoFileClientConf conf = { "frontdoor-video", fifoPath, rtpVideoNegotiator, fifoPacketizer };
-            fifoVideo = nabto::FifoFileClient::create(conf);
+                nabto::FifoFileClientConf conf = { "frontdoor-video", fifoPath, rtpVideoNegotiator, fifoPacketizer };
+                fifoVideo = nabto::FifoFileClient::create(conf);
 
-            medias.push_back(fifoVideo);
+                medias.push_back(fifoVideo);
+            }
         } catch (std::exception& ex) {
             // fifoPath was not set, default to RTP.
             uint16_t port = opts["rtpPort"].get<uint16_t>();
             nabto::RtpClientConf videoConf = { "frontdoor-video", "127.0.0.1", port, rtpVideoNegotiator, nullptr };
-            if (repacketH264) {
+            if (h265) {
+                videoConf.repacketizer = nabto::H265RepacketizerFactory::create();
+            } else if (repacketH264 && !av1) {
                 videoConf.repacketizer = nabto::H264RepacketizerFactory::create();
             }
 
@@ -379,9 +423,13 @@ bool parse_options(int argc, char** argv, json& opts)
             ("k,privatekey", "Raw private key to use", cxxopts::value<std::string>())
             ("r,rtsp", "Use RTSP at the provided url instead of RTP (eg. rtsp://127.0.0.l:8554/video)", cxxopts::value<std::string>())
             ("rtsp-use-udp", "If set, the RTSP client will use UDP as transport for RTP data")
+            ("rtsp-prewarm", "If set, the RTSP session is set up at startup and kept while there are no viewers")
+            ("rtsp-linger", "Seconds to keep the RTSP session after the last viewer leaves", cxxopts::value<int>()->default_value("0"))
             ("rtp-port", "Port number to use if NOT using RTSP", cxxopts::value<uint16_t>()->default_value("6000"))
             ("f,fifo", "Use FIFO file descriptor at the provided path for video instead of RTP", cxxopts::value<std::string>())
             ("fifo-audio", "Use FIFO file descriptor at the provided path for audio instead of RTP", cxxopts::value<std::string>())
+            ("fifo-audio-codec", "Codec of the audio FIFO (pcmu|opus). Opus must be Ogg encapsulated", cxxopts::value<std::string>()->default_value("pcmu"))
+            ("shm-ring", "Read video frames from a shared memory ring served on the provided unix socket path instead of RTP", cxxopts::value<std::string>())
             ("c,cloud-domain", "Optional. Domain for the cloud deployment. This is used to derive JWKS URL, JWKS issuer, and frontend URL", cxxopts::value<std::string>()->default_value("smartcloud.nabto.com"))
             ("H,home-dir", "Set which dir to store IAM data", cxxopts::value<std::string>())
             ("iam-reset", "If set, will reset the IAM state and exit")
@@ -393,6 +441,7 @@ bool parse_options(int argc, char** argv, json& opts)
             * both the certificates in CAPATH and the certificates in CAINFO.
             */
             ("cacert", "Optional. Path to a CA certificate file; overrides CURL_CA_BUNDLE env var if set.", cxxopts::value<std::string>())
+            ("video-codec", "Codec of the RTP, RTSP or FIFO video feed (h264|h265|av1)", cxxopts::value<std::string>()->default_value("h264"))
             ("disable-h264-repacketizer", "If set, H264 will be forwarded as-is instead of repacketizing to proper MTU")
 
             ("h,help", "Shows this help text");
@@ -446,13 +495,26 @@ bool parse_options(int argc, char** argv, json& opts)
         else {
             opts["preferTcp"] = true;
         }
+        opts["rtspPrewarm"] = result.count("rtsp-prewarm") > 0;
+        opts["rtspLinger"] = result["rtsp-linger"].as<int>();
 
 
         opts["rtpPort"] = result["rtp-port"].as<uint16_t>();
+        std::string videoCodec = result["video-codec"].as<std::string>();
+        if (videoCodec == "h264" || videoCodec == "h265" || videoCodec == "av1") {
+            opts["videoCodec"] = videoCodec;
+        } else {
+            std::cout << "Invalid video codec specified. expected: h264|h265|av1 got: " << videoCodec << std::endl;
+            return true;
+        }
+        if (result.count("shm-ring")) {
+            opts["shmRingPath"] = result["shm-ring"].as<std::string>();
+        }
         if (result.count("fifo")) {
             opts["fifoPath"] = result["fifo"].as<std::string>();
             if (result.count("fifo-audio")) {
                 opts["fifoAudioPath"] = result["fifo-audio"].as<std::string>();
+                opts["fifoAudioCodec"] = result["fifo-audio-codec"].as<std::string>();
             }
         }
         else if (result.count("fifo-audio")) {
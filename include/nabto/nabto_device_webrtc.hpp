@@ -4,6 +4,7 @@
 #include <plog/Log.h>
 #include <plog/Init.h>
 
+#include <chrono>
 #include <memory>
 #include <functional>
 #include <string>
@@ -24,6 +25,7 @@ class NabtoDeviceWebrtc;
 class EventQueue;
 class MediaTrack;
 class Datachannel;
+class FramePacketizer;
 
 class NabtoDeviceWebrtcImpl;
 typedef std::shared_ptr<NabtoDeviceWebrtcImpl> NabtoDeviceWebrtcImplPtr;
@@ -36,6 +38,7 @@ typedef std::shared_ptr<NabtoDeviceWebrtc> NabtoDeviceWebrtcPtr;
 typedef std::shared_ptr<EventQueue> EventQueuePtr;
 typedef std::shared_ptr<MediaTrack> MediaTrackPtr;
 typedef std::shared_ptr<Datachannel> DatachannelPtr;
+typedef std::shared_ptr<FramePacketizer> FramePacketizerPtr;
 
 typedef std::function<void()> QueueEvent;
 
@@ -70,6 +73,14 @@ typedef std::function<bool(NabtoDeviceConnectionRef connRef, const std::string&
  */
 typedef std::function<void(uint8_t* buffer, size_t length)> MediaRecvCallback;
 
+/**
+ * Callback receiving an RTP packet from a FramePacketizer.
+ *
+ * @param packet [in] The RTP packet. Only valid during the call.
+ * @param length [in] Length of the packet
+ */
+typedef std::function<void(const uint8_t* packet, size_t length)> FramePacketCallback;
+
 
 /**
  * Smart pointer handling lifetime of the NabtoDevice context to ensure it is not freed until all components has freed their resources.
@@ -141,6 +152,26 @@ private:
 
 };
 
+/**
+ * Packetizer turning encoded frames into RTP packets for `MediaTrack::sendFrame()`.
+ *
+ * The H264, Opus and PCMU packetizers of the rtp-packetizer module implement this interface. A packetizer holds the RTP state (SSRC, payload type, sequence number) of a single track, so each track needs its own.
+ */
+class FramePacketizer {
+public:
+    virtual ~FramePacketizer() {}
+
+    /**
+     * Packetize an encoded frame and pass each resulting RTP packet to cb.
+     *
+     * @param data [in]       The encoded frame. Only read during the call.
+     * @param length [in]     Length of the frame
+     * @param timestamp [in]  Presentation time of the frame. Only the difference to the first frame is used.
+     * @param cb [in]         Called with each RTP packet
+     */
+    virtual void packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb) = 0;
+};
+
 /**
  * A MediaTrack represents a WebRTC track, and is used to send or receive media data on.
  */
@@ -201,6 +232,41 @@ public:
     */
     bool send(const uint8_t* buffer, size_t length);
 
+    /**
+     * Send an RTP packet on this track given as a separate header and payload.
+     *
+     * The two buffers are sent as one packet. This is used when forwarding the same payload to several tracks which only differ in their RTP headers, so the payload does not have to be copied into a buffer per track first.
+     *
+     * @param header [in]        Buffer containing the RTP header
+     * @param headerLength [in]  Length of the header buffer
+     * @param payload [in]       Buffer containing the rest of the packet
+     * @param payloadLength [in] Length of the payload buffer
+     * @return True iff the RTC track is open and ready to send
+    */
+    bool send(const uint8_t* header, size_t headerLength, const uint8_t* payload, size_t payloadLength);
+
+    /**
+     * Set the packetizer used by `sendFrame()`.
+     *
+     * @param packetizer [in] Packetizer created with the SSRC and payload type negotiated for this track
+    */
+    void setFramePacketizer(FramePacketizerPtr packetizer);
+
+    /**
+     * Packetize an encoded frame and send it on this track.
+     *
+     * This lets an in-process encoder feed the track directly instead of producing RTP or writing to a FIFO. The frame is packetized straight into the packets being sent. The data is only read during the call, so the caller keeps ownership of the buffer and can reuse it once the call returns.
+     *
+     * Until the track has sent a keyframe after opening or after being attached to a new connection, frames which are not keyframes are dropped so the client decoder starts at a keyframe. Must not be called concurrently for the same track.
+     *
+     * @param data [in]       The encoded frame: a whole H264 access unit in the format the packetizer is configured for, one Opus packet, or PCMU samples.
+     * @param length [in]     Length of the frame
+     * @param timestamp [in]  Presentation time of the frame
+     * @param isKeyframe [in] True if the frame can be decoded without earlier frames. Always true for audio.
+     * @return True iff the track is open and the frame was sent
+    */
+    bool sendFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, bool isKeyframe);
+
     /**
      * Set callback to be called when data is received on this track.
      *
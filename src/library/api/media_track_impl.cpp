@@ -1,5 +1,7 @@
 #include "media_track_impl.hpp"
 
+#include <cstring>
+
 namespace nabto {
 
 MediaTrackImpl::MediaTrackImpl(const std::string& trackId, const std::string& sdp)
@@ -48,6 +50,53 @@ bool MediaTrackImpl::send(const uint8_t* buffer, size_t length)
     return false;
 }
 
+bool MediaTrackImpl::send(const uint8_t* header, size_t headerLength, const uint8_t* payload, size_t payloadLength)
+{
+    if (rtcTrack_ && rtcTrack_->isOpen()) {
+        try {
+            // libdatachannel encrypts the packet in place, so it needs a
+            // buffer of its own. We assemble the packet directly into that
+            // buffer instead of letting the caller build an intermediate copy.
+            rtc::binary packet(headerLength + payloadLength);
+            memcpy(packet.data(), header, headerLength);
+            memcpy(packet.data() + headerLength, payload, payloadLength);
+            rtcTrack_->send(std::move(packet));
+            return true;
+        } catch (std::exception& ex) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void MediaTrackImpl::setFramePacketizer(FramePacketizerPtr packetizer)
+{
+    framePacketizer_ = packetizer;
+}
+
+bool MediaTrackImpl::sendFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, bool isKeyframe)
+{
+    if (framePacketizer_ == nullptr) {
+        NPLOGE << "sendFrame() called on track " << trackId_ << " without a frame packetizer";
+        return false;
+    }
+    if (!rtcTrack_ || !rtcTrack_->isOpen()) {
+        waitingForKeyframe_ = true;
+        return false;
+    }
+    if (waitingForKeyframe_) {
+        if (!isKeyframe) {
+            return false;
+        }
+        waitingForKeyframe_ = false;
+    }
+    bool ok = true;
+    framePacketizer_->packetizeFrame(data, length, timestamp, [this, &ok](const uint8_t* packet, size_t packetLength) {
+        ok = send(packet, packetLength) && ok;
+    });
+    return ok;
+}
+
 void MediaTrackImpl::setReceiveCallback(MediaRecvCallback cb)
 {
     recvCb_ = cb;
@@ -79,6 +128,8 @@ void MediaTrackImpl::connectionClosed()
 void MediaTrackImpl::setRtcTrack(std::shared_ptr<rtc::Track> track) {
     rtcTrack_ = track;
     sdp_ = track->description().generateSdp();
+    // A track of a new connection has a new decoder behind it.
+    waitingForKeyframe_ = true;
 }
 
 void MediaTrackImpl::handleTrackMessage(rtc::message_ptr msg)
@@ -14,6 +14,9 @@ public:
     std::string getSdp();
     void setSdp(const std::string& sdp);
     bool send(const uint8_t* buffer, size_t length);
+    bool send(const uint8_t* header, size_t headerLength, const uint8_t* payload, size_t payloadLength);
+    void setFramePacketizer(FramePacketizerPtr packetizer);
+    bool sendFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, bool isKeyframe);
     void setReceiveCallback(MediaRecvCallback cb);
     void setCloseCallback(std::function<void()> cb);
     void setErrorState(enum MediaTrack::ErrorState state);
@@ -33,6 +36,10 @@ private:
 
     enum MediaTrack::ErrorState state_ = MediaTrack::ErrorState::OK;
     std::shared_ptr<rtc::Track> rtcTrack_ = nullptr;
+
+    FramePacketizerPtr framePacketizer_ = nullptr;
+    // Set until a keyframe has been sent on the current rtc track while it is open.
+    bool waitingForKeyframe_ = true;
 };
 
 } // namespace nabto
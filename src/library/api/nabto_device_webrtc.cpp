@@ -90,6 +90,21 @@ bool MediaTrack::send(const uint8_t* buffer, size_t length)
     return impl_->send(buffer, length);
 }
 
+bool MediaTrack::send(const uint8_t* header, size_t headerLength, const uint8_t* payload, size_t payloadLength)
+{
+    return impl_->send(header, headerLength, payload, payloadLength);
+}
+
+void MediaTrack::setFramePacketizer(FramePacketizerPtr packetizer)
+{
+    return impl_->setFramePacketizer(packetizer);
+}
+
+bool MediaTrack::sendFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, bool isKeyframe)
+{
+    return impl_->sendFrame(data, length, timestamp, isKeyframe);
+}
+
 
 void MediaTrack::setReceiveCallback(MediaRecvCallback cb)
 {
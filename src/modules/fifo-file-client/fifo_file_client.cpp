@@ -1,11 +1,27 @@
 #include "fifo_file_client.hpp"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 
-const int FIFO_BUFFER_SIZE = 4096;
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+// Data is read from the FIFO in chunks of up to this size. This matches the
+// default pipe capacity on Linux so a full pipe is drained with a single read.
+const size_t FIFO_BUFFER_SIZE = 64 * 1024;
+// Packetized data is copied into pooled buffers of this size and shared by all
+// viewers. Larger if the packetizer is configured with a larger MTU.
+const int FIFO_RTP_BUFFER_SIZE = 2048;
 
 
 namespace nabto {
@@ -19,13 +35,24 @@ FifoFileClient::FifoFileClient(const FifoFileClientConf& conf)
     : trackId_(conf.trackId),
     filePath_(conf.filePath),
     negotiator_(conf.negotiator),
-    packetizer_(conf.packetizer)
+    packetizer_(conf.packetizer),
+    queueConf_(conf.sendQueue),
+    sendWorker_(conf.sendWorker),
+    bufferPool_(RtpBufferPool::create(std::max((size_t)FIFO_RTP_BUFFER_SIZE, conf.packetizer->maxPacketSize())))
 {
-
+    if (sendWorker_ == nullptr) {
+        sendWorker_ = MediaSendWorker::defaultWorker();
+    }
+    auto negotiator = negotiator_;
+    gopCache_ = createGopCache(conf.gopCache,
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, bufferPool_, queueConf_);
 }
 
 FifoFileClient::~FifoFileClient()
 {
+    stop();
 }
 
 bool FifoFileClient::isTrack(const std::string& trackId)
@@ -60,7 +87,7 @@ void FifoFileClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr m
 
     FifoTrack track = {
         media,
-        packetizer_->createPacketizer(ssrc, pt)
+        std::make_shared<RtpRepacketizer>(ssrc, pt)
     };
 
     doAddConnection(ref, track);
@@ -69,20 +96,15 @@ void FifoFileClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr m
 void FifoFileClient::removeConnection(NabtoDeviceConnectionRef ref)
 {
     NPLOGD << "Removing Nabto Connection from fifo";
-    size_t mediaTracksSize = 0;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-
-        try {
-            mediaTracks_.erase(ref);
-        } catch (std::out_of_range& ex) {
-            NPLOGE << "Tried to remove non-existing connection";
-        }
-        mediaTracksSize = mediaTracks_.size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto track = mediaTracks_.find(ref);
+    if (track.has_value()) {
+        track->queue->close();
     }
+    size_t mediaTracksSize = mediaTracks_.erase(ref);
     if (mediaTracksSize == 0) {
         NPLOGD << "Connection was last one. Stopping";
-        stop();
+        stop(lock);
     }
     else {
         NPLOGD << "Still " << mediaTracksSize << " Connections. Not stopping";
@@ -94,40 +116,116 @@ void FifoFileClient::start()
 {
     NPLOGI << "Starting fifo Client listen on file " << filePath_;
     stopped_ = false;
-    thread_ = std::thread(fifoRunner, this);
+    // Packets for all viewers are made with the negotiated source SSRC and
+    // payload type and rewritten per viewer.
+    sourcePacketizer_ = packetizer_->createPacketizer(negotiator_->ssrc(), negotiator_->payloadType());
+#ifdef __linux__
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ >= 0 && stopFd_ >= 0) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = stopFd_;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &ev);
+    }
+#else
+    if (pipe(stopPipe_) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(stopPipe_[i], F_SETFL, fcntl(stopPipe_[i], F_GETFL) | O_NONBLOCK);
+            fcntl(stopPipe_[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
+    thread_ = std::thread([this]() { fifoRunner(); });
 }
 
 void FifoFileClient::stop()
 {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop(lock);
+}
 
+void FifoFileClient::stop(std::unique_lock<std::mutex>& lock)
+{
     NPLOGD << "Fifo Client stopped";
-    bool stopped = false;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (stopped_) {
-            stopped = stopped_;
-        }
-        else {
-            stopped_ = true;
-            close(fd_);
-            if (fdRecv_) {
-                close(fdRecv_);
-                fdRecv_ = 0;
-            }
-        }
-    }
-    if (!stopped && thread_.joinable()) {
-        thread_.join();
+    // Viewers added after this find the client stopped and start it again.
+    for (const auto& [key, value] : *mediaTracks_.snapshot()) {
+        value.queue->close();
     }
     mediaTracks_.clear();
+    if (stopped_) {
+        return;
+    }
+    stopped_ = true;
+    // The reader thread closes the FIFO itself once it wakes up.
+#ifdef __linux__
+    uint64_t one = 1;
+    auto ret = write(stopFd_, &one, sizeof(one));
+#else
+    uint8_t one = 1;
+    auto ret = write(stopPipe_[1], &one, sizeof(one));
+#endif
+    (void)ret;
+    if (fdRecv_) {
+        close(fdRecv_);
+        fdRecv_ = 0;
+    }
+    // Only the thread of this run is joined. A start() meanwhile waits for
+    // it in waitForTeardown() before reusing the reader resources.
+    std::thread thread = std::move(thread_);
+    tearingDown_ = true;
+    lock.unlock();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+#ifdef __linux__
+    close(epollFd_);
+    close(stopFd_);
+    epollFd_ = -1;
+    stopFd_ = -1;
+#else
+    close(stopPipe_[0]);
+    close(stopPipe_[1]);
+    stopPipe_[0] = stopPipe_[1] = -1;
+#endif
+    if (gopCache_ != nullptr) {
+        gopCache_->clear();
+    }
     NPLOGD << "FIFO Client thread joined";
+
+    lock.lock();
+    tearingDown_ = false;
+    teardownCond_.notify_all();
 }
 
-void FifoFileClient::doAddConnection(NabtoDeviceConnectionRef ref, FifoTrack track)
+void FifoFileClient::waitForTeardown(std::unique_lock<std::mutex>& lock)
 {
+    teardownCond_.wait(lock, [this]() { return !tearingDown_; });
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    mediaTracks_[ref] = track;
+void FifoFileClient::doAddConnection(NabtoDeviceConnectionRef ref, FifoTrack track)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    waitForTeardown(lock);
+    auto existing = mediaTracks_.find(ref);
+    if (existing.has_value()) {
+        existing->queue->close();
+    }
+    auto negotiator = negotiator_;
+    track.queue = ViewerQueue::create(queueConf_, sendWorker_,
+        [track](const RtpBufferRef& buffer) {
+            // Only the RTP header differs between viewers, the payload is sent from the shared buffer.
+            uint8_t header[RTP_FIXED_HEADER_SIZE];
+            size_t headerLen = track.repacketizer->rewriteHeader(buffer->data(), buffer->size(), header, sizeof(header));
+            if (headerLen > 0) {
+                track.track->send(header, headerLen, buffer->data() + headerLen, buffer->size() - headerLen);
+            }
+        },
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, ref);
+    mediaTracks_.insert(ref, track);
     NPLOGD << "Adding fifo connection";
     if (stopped_) {
         start();
@@ -170,70 +268,205 @@ void FifoFileClient::doAddConnection(NabtoDeviceConnectionRef ref, FifoTrack tra
 
 }
 
-void FifoFileClient::fifoRunner(FifoFileClient* self)
+std::optional<ViewerQueueStats> FifoFileClient::queueStats(NabtoDeviceConnectionRef ref)
 {
-    char buffer[FIFO_BUFFER_SIZE];
-    char* ptr = buffer;
-    int count = 0;
+    auto track = mediaTracks_.find(ref);
+    if (!track.has_value()) {
+        return std::nullopt;
+    }
+    return track->queue->stats();
+}
 
-    self->fd_ = open(self->filePath_.c_str(), O_RDONLY, O_NONBLOCK);
+void FifoFileClient::sendPacket(const SubscriberSet<FifoTrack>::Snapshot& tracks, const uint8_t* packet, size_t length)
+{
+    RtpBufferRef buffer = bufferPool_->acquire();
+    if (length > buffer->capacity()) {
+        NPLOGE << "Packet of " << length << " bytes is too large, dropping it";
+        return;
+    }
+    memcpy(buffer->data(), packet, length);
+    buffer->setSize(length);
+
+    fanOutPacket(tracks, gopCache_, buffer, [this](NabtoDeviceConnectionRef ref) {
+        NPLOGW << "Viewer send queue overflowed, disconnecting viewer from FIFO stream";
+        // Removing the last viewer stops the client, which joins this thread.
+        std::weak_ptr<FifoFileClient> weak = weak_from_this();
+        sendWorker_->post([weak, ref]() {
+            if (auto self = weak.lock()) {
+                self->removeConnection(ref);
+            }
+        });
+    });
+}
 
-    NPLOGI << "file opened at: " << self->filePath_ << " fd: " << self->fd_;
+void FifoFileClient::packetize(const uint8_t* data, size_t length)
+{
+    // The data is packetized once, and the packets are shared by the send queues of all viewers.
+    auto tracks = mediaTracks_.snapshot();
+    sourcePacketizer_->incoming(data, length, [this, &tracks](const uint8_t* packet, size_t packetLength) {
+        sendPacket(*tracks, packet, packetLength);
+    });
+}
 
-    fd_set rfdset;
-    int maxfd;
-    int retval = 0;
+void FifoFileClient::flushPacketizer()
+{
+    auto tracks = mediaTracks_.snapshot();
+    sourcePacketizer_->flush([this, &tracks](const uint8_t* packet, size_t length) {
+        sendPacket(*tracks, packet, length);
+    });
+}
 
-    struct timeval tv;
-    tv.tv_sec = 5;
-    tv.tv_usec = 0;
+bool FifoFileClient::openFifo()
+{
+    // Opening non-blocking returns at once even if no writer has the FIFO
+    // open. The FIFO is not reported readable before a writer connects, so a
+    // FIFO reopened after its writer left is idle until the next writer.
+    fd_ = open(filePath_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+        NPLOGE << "Failed to open FIFO " << filePath_ << ": " << strerror(errno);
+        return false;
+    }
+#ifdef __linux__
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd_, &ev) != 0) {
+        NPLOGE << "Failed to watch FIFO " << filePath_ << ": " << strerror(errno);
+        closeFifo();
+        return false;
+    }
+#endif
+    return true;
+}
 
-    FD_ZERO(&rfdset);
-    FD_SET(self->fd_, &rfdset);
+bool FifoFileClient::reopenFifo()
+{
+    // The FIFO is opened again before the old descriptor is closed. If it had
+    // no reader for a moment, the data of a writer connecting meanwhile would
+    // be discarded with the pipe.
+    int oldFd = fd_;
+    bool ok = openFifo();
+#ifdef __linux__
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, oldFd, NULL);
+#endif
+    close(oldFd);
+    return ok;
+}
 
+void FifoFileClient::closeFifo()
+{
+    if (fd_ < 0) {
+        return;
+    }
+#ifdef __linux__
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd_, NULL);
+#endif
+    close(fd_);
+    fd_ = -1;
+}
 
-    while ((retval = select(self->fd_+1, &rfdset, NULL, NULL, &tv)) != -1) {
-        tv.tv_sec = 5;
+#ifdef __linux__
 
-        {
-            std::lock_guard<std::mutex> lock(self->mutex_);
-            if (self->stopped_) {
-                break;
-            }
+int FifoFileClient::waitReadable(int timeoutMs)
+{
+    struct epoll_event events[2];
+    int n;
+    do {
+        n = epoll_wait(epollFd_, events, 2, timeoutMs);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+#else
+
+int FifoFileClient::waitReadable(int timeoutMs)
+{
+    struct pollfd fds[2] = { { fd_, POLLIN, 0 }, { stopPipe_[0], POLLIN, 0 } };
+    int n;
+    do {
+        n = poll(fds, 2, timeoutMs);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+#endif
+
+void FifoFileClient::fifoRunner()
+{
+    int count = 0;
+    std::vector<uint8_t> data(FIFO_BUFFER_SIZE);
+
+    if (!openFifo()) {
+        return;
+    }
+    NPLOGI << "file opened at: " << filePath_ << " fd: " << fd_;
+
+    // Data held back by the packetizer is flushed when the producer has been
+    // quiet for this long. Without pending data the thread sleeps until the
+    // FIFO is readable or the client is stopped.
+    std::chrono::milliseconds idleFlush = sourcePacketizer_->idleFlushTimeout();
+    bool pending = false;
+
+    while (!stopped_) {
+        int timeout = (idleFlush.count() > 0 && pending) ? (int)idleFlush.count() : -1;
+        int n = waitReadable(timeout);
+        if (stopped_) {
+            break;
         }
-        if (!retval) {
-            NPLOGD << "Select timeout: " << retval;
+        if (n < 0) {
+            NPLOGE << "Failed to wait for FIFO data: " << strerror(errno);
+            break;
+        }
+        if (n == 0) {
+            flushPacketizer();
+            pending = false;
             continue;
         }
 
         try {
-            int r = read(self->fd_, buffer, FIFO_BUFFER_SIZE);
-            if (r == 0) {
-                continue;
-            }
-            count++;
-            if (count % 100 == 0) {
-                std::cout << ".";
-            }
-            if (count % 1600 == 0) {
-                std::cout << std::endl;
-                count = 0;
-            }
-
-            std::vector<uint8_t> data(buffer, buffer+r);
-            {
-                std::lock_guard<std::mutex> lock(self->mutex_);
-                for (const auto& [key, value] : self->mediaTracks_) {
-                    auto packets = value.packetizer->incoming(data);
-                    for (auto p : packets) {
-                        value.track->send(p.data(), p.size());
+            // Drain the FIFO before waiting again.
+            while (!stopped_) {
+                ssize_t r = read(fd_, data.data(), data.size());
+                if (r > 0) {
+                    count++;
+                    if (count % 100 == 0) {
+                        std::cout << ".";
+                    }
+                    if (count % 1600 == 0) {
+                        std::cout << std::endl;
+                        count = 0;
+                    }
+                    packetize(data.data(), r);
+                    pending = true;
+                    if ((size_t)r < data.size()) {
+                        // The FIFO is most likely empty, save the read returning EAGAIN.
+                        break;
+                    }
+                } else if (r == 0) {
+                    // The writer closed the FIFO. The data it wrote is
+                    // complete, so send what the packetizer holds back and
+                    // wait for the next writer.
+                    NPLOGI << "FIFO writer closed " << filePath_ << ", waiting for a new writer";
+                    flushPacketizer();
+                    pending = false;
+                    if (!reopenFifo()) {
+                        return;
+                    }
+                    break;
+                } else if (errno == EINTR) {
+                    continue;
+                } else {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        NPLOGE << "Failed to read from FIFO: " << strerror(errno);
                     }
+                    break;
                 }
             }
         } catch (std::exception& ex) {
             NPLOGE << "Failed to read from FIFO: " << ex.what();
         }
     }
+    closeFifo();
     NPLOGI << "File reader thread returning";
 }
 
@@ -1,10 +1,18 @@
 #pragma once
 #include <media-streams/media_stream.hpp>
+#include <media-streams/subscriber_set.hpp>
+#include <media-streams/media_send_worker.hpp>
+#include <media-streams/gop_cache.hpp>
+#include <media-streams/viewer_fanout.hpp>
 #include <track-negotiators/track_negotiator.hpp>
 #include <rtp-packetizer/rtp_packetizer.hpp>
+#include <rtp-repacketizer/rtp_repacketizer.hpp>
 
+#include <condition_variable>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <fstream>
 
@@ -17,8 +25,10 @@ class FifoTrack
 {
 public:
     MediaTrackPtr track;
-    RtpPacketizerPtr packetizer = nullptr;
-
+    // Rewrites the SSRC and payload type of the shared packets for this track.
+    RtpRepacketizerPtr repacketizer = nullptr;
+    // Packets are queued here and sent by a MediaSendWorker.
+    ViewerQueuePtr queue = nullptr;
 };
 
 class FifoFileClientConf {
@@ -27,6 +37,12 @@ public:
     std::string filePath;
     TrackNegotiatorPtr negotiator;
     RtpPacketizerFactoryPtr packetizer;
+    // Size and overflow policy of the send queue of each viewer.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued data. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // Replay the current GOP to new viewers so they get a picture right away.
+    GopCacheConf gopCache;
 };
 
 class FifoFileClient : public MediaStream, public std::enable_shared_from_this<FifoFileClient>
@@ -50,24 +66,62 @@ public:
 
     TrackNegotiatorPtr getTrackNegotiator() { return negotiator_; }
 
+    // Send queue depth and drop counters of a viewer, if it is connected.
+    std::optional<ViewerQueueStats> queueStats(NabtoDeviceConnectionRef ref);
+
 private:
     void start();
     void stop();
+    // Stop with mutex_ held by lock. The lock is released while the reader thread is joined.
+    void stop(std::unique_lock<std::mutex>& lock);
+    // Wait until a stop() in another thread has joined the reader thread and released its resources.
+    void waitForTeardown(std::unique_lock<std::mutex>& lock);
     void doAddConnection(NabtoDeviceConnectionRef ref, FifoTrack track);
-    static void fifoRunner(FifoFileClient* self);
+    void fifoRunner();
+    // Open the FIFO without waiting for a writer and start watching it.
+    bool openFifo();
+    // Open the FIFO for the next writer after the current one closed it.
+    bool reopenFifo();
+    void closeFifo();
+    // Wait until the FIFO is readable or stop() is called. timeoutMs < 0
+    // waits forever. Returns like poll(): 0 on timeout, < 0 on error.
+    int waitReadable(int timeoutMs);
+    void packetize(const uint8_t* data, size_t length);
+    void flushPacketizer();
+    void sendPacket(const SubscriberSet<FifoTrack>::Snapshot& tracks, const uint8_t* packet, size_t length);
 
     std::string trackId_;
     std::string filePath_;
 
-    bool stopped_ = true;
+    std::atomic<bool> stopped_{true};
+    // Serializes start/stop and adding and removing viewers, so removing the
+    // last viewer and stopping is one decision. Not used when forwarding data.
     std::mutex mutex_;
-    std::map<NabtoDeviceConnectionRef, FifoTrack> mediaTracks_;
+    // Set while stop() joins the reader thread without holding mutex_.
+    bool tearingDown_ = false;
+    std::condition_variable teardownCond_;
+    SubscriberSet<FifoTrack> mediaTracks_;
     TrackNegotiatorPtr negotiator_;
     RtpPacketizerFactoryPtr packetizer_;
+    // Packetizes the FIFO data once for all viewers. Only used on the FIFO reader thread.
+    RtpPacketizerPtr sourcePacketizer_ = nullptr;
+    ViewerQueueConf queueConf_;
+    MediaSendWorkerPtr sendWorker_;
+    RtpBufferPoolPtr bufferPool_;
+    // Only used on the FIFO reader thread. nullptr if disabled.
+    GopCachePtr gopCache_ = nullptr;
     std::thread thread_;
 
-    int fd_;
-    int fdRecv_;
+    // Only used on the FIFO reader thread.
+    int fd_ = -1;
+    int fdRecv_ = 0;
+#ifdef __linux__
+    int epollFd_ = -1;
+    // Signalled by stop() to wake up the reader thread.
+    int stopFd_ = -1;
+#else
+    int stopPipe_[2] = { -1, -1 };
+#endif
 
 };
 } // namespace
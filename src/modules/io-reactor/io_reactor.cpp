@@ -0,0 +1,339 @@
+#include "io_reactor.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+namespace nabto {
+
+#ifdef __linux__
+// epoll data used for the stop eventfd. Registrations start at 1.
+const IoReactor::Registration STOP_REGISTRATION = 0;
+#endif
+
+IoReactorPtr IoReactor::create(size_t threadCount)
+{
+    return std::make_shared<IoReactor>(threadCount);
+}
+
+IoReactorPtr IoReactor::defaultReactor()
+{
+    static IoReactorPtr reactor = IoReactor::create(1);
+    return reactor;
+}
+
+IoReactor::IoReactor(size_t threadCount)
+    : threadCount_(threadCount)
+{
+    if (threadCount_ == 0) {
+        threadCount_ = std::thread::hardware_concurrency();
+        if (threadCount_ == 0) {
+            threadCount_ = 1;
+        }
+    }
+#ifdef __linux__
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ < 0 || stopFd_ < 0) {
+        std::string err = "Failed to create epoll reactor: ";
+        err += strerror(errno);
+        NPLOGE << err;
+        throw std::runtime_error(err);
+    }
+    // Level triggered, once written all threads will see it and exit.
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = STOP_REGISTRATION;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &ev);
+#else
+    if (pipe(wakeupPipe_) != 0) {
+        std::string err = "Failed to create reactor wakeup pipe: ";
+        err += strerror(errno);
+        NPLOGE << err;
+        throw std::runtime_error(err);
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wakeupPipe_[i], F_SETFL, fcntl(wakeupPipe_[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wakeupPipe_[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    start();
+}
+
+IoReactor::~IoReactor()
+{
+    stop();
+#ifdef __linux__
+    close(epollFd_);
+    close(stopFd_);
+#else
+    close(wakeupPipe_[0]);
+    close(wakeupPipe_[1]);
+#endif
+}
+
+void IoReactor::start()
+{
+    NPLOGD << "Starting IO reactor with " << threadCount_ << " threads";
+    for (size_t i = 0; i < threadCount_; i++) {
+        threads_.push_back(std::thread([this]() { run(); }));
+    }
+}
+
+void IoReactor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+    }
+#ifdef __linux__
+    uint64_t one = 1;
+    auto ret = write(stopFd_, &one, sizeof(one));
+    (void)ret;
+#else
+    wakeup();
+#endif
+    for (auto& t : threads_) {
+        if (t.get_id() == std::this_thread::get_id()) {
+            // Stopped from within a callback, the thread exits once the
+            // callback returns.
+            t.detach();
+        } else if (t.joinable()) {
+            t.join();
+        }
+    }
+    threads_.clear();
+    NPLOGD << "IO reactor stopped";
+}
+
+IoReactor::Registration IoReactor::addReader(int fd, IoReadyCallback cb)
+{
+    return add(fd, cb, false);
+}
+
+IoReactor::Registration IoReactor::addWriter(int fd, IoReadyCallback cb)
+{
+    return add(fd, cb, true);
+}
+
+IoReactor::Registration IoReactor::add(int fd, IoReadyCallback cb, bool writer)
+{
+    auto handler = std::make_shared<Handler>();
+    handler->fd = fd;
+    handler->cb = cb;
+    handler->writer = writer;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Registration reg = nextRegistration_++;
+    handlers_[reg] = handler;
+#ifdef __linux__
+    struct epoll_event ev = {};
+    ev.events = (wantsRead(*handler) ? EPOLLIN : 0) | (wantsWrite(*handler) ? EPOLLOUT : 0) | EPOLLONESHOT;
+    ev.data.u64 = reg;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        std::string err = "Failed to add socket to reactor: ";
+        err += strerror(errno);
+        NPLOGE << err;
+        handlers_.erase(reg);
+        throw std::runtime_error(err);
+    }
+#else
+    wakeup();
+#endif
+    return reg;
+}
+
+void IoReactor::removeReader(Registration reg)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = handlers_.find(reg);
+    if (it == handlers_.end()) {
+        return;
+    }
+    HandlerPtr handler = it->second;
+    handlers_.erase(it);
+#ifdef __linux__
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, handler->fd, NULL);
+#else
+    wakeup();
+#endif
+    if (handler->running && handler->runningThread != std::this_thread::get_id()) {
+        cond_.wait(lock, [handler]() { return !handler->running; });
+    }
+}
+
+void IoReactor::setWritable(Registration reg, bool writable)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handlers_.find(reg);
+    if (it == handlers_.end() || it->second->writable == writable) {
+        return;
+    }
+    HandlerPtr handler = it->second;
+    handler->writable = writable;
+    // A running callback is rearmed with the new events when it returns.
+    if (handler->armed && !handler->running) {
+        rearm(reg, handler);
+    }
+}
+
+void IoReactor::dispatch(Registration reg)
+{
+    HandlerPtr handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = handlers_.find(reg);
+        if (it == handlers_.end()) {
+            // Removed after readiness was reported
+            return;
+        }
+        handler = it->second;
+        if (handler->running) {
+            // Reported again after setWritable() rearmed it. The socket is
+            // level triggered, so the readiness is reported again once the
+            // running callback returns.
+            return;
+        }
+        handler->armed = false;
+        handler->running = true;
+        handler->runningThread = std::this_thread::get_id();
+    }
+
+    try {
+        handler->cb();
+    } catch (std::exception& ex) {
+        NPLOGE << "IO reactor callback failed: " << ex.what();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    handler->running = false;
+    if (handlers_.find(reg) != handlers_.end()) {
+        rearm(reg, handler);
+    }
+    cond_.notify_all();
+}
+
+#ifdef __linux__
+
+void IoReactor::rearm(Registration reg, const HandlerPtr& handler)
+{
+    struct epoll_event ev = {};
+    ev.events = (wantsRead(*handler) ? EPOLLIN : 0) | (wantsWrite(*handler) ? EPOLLOUT : 0) | EPOLLONESHOT;
+    ev.data.u64 = reg;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, handler->fd, &ev);
+    handler->armed = true;
+}
+
+void IoReactor::run()
+{
+    // With several threads, only take one event at a time so a ready socket
+    // is never stuck behind a slow callback on another thread.
+    const int maxEvents = threadCount_ == 1 ? 16 : 1;
+    struct epoll_event events[16];
+    while (true) {
+        int n = epoll_wait(epollFd_, events, maxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            NPLOGE << "epoll_wait failed: " << strerror(errno);
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == STOP_REGISTRATION) {
+                return;
+            }
+            dispatch(events[i].data.u64);
+        }
+    }
+}
+
+#else
+
+void IoReactor::rearm(Registration reg, const HandlerPtr& handler)
+{
+    handler->armed = true;
+    wakeup();
+}
+
+void IoReactor::wakeup()
+{
+    uint8_t b = 1;
+    auto ret = write(wakeupPipe_[1], &b, 1);
+    (void)ret;
+}
+
+void IoReactor::run()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<Registration> regs;
+    while (true) {
+        std::unique_lock<std::mutex> pollLock(pollMutex_);
+        fds.clear();
+        regs.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopped_) {
+                return;
+            }
+            fds.push_back({ wakeupPipe_[0], POLLIN, 0 });
+            for (const auto& [reg, handler] : handlers_) {
+                if (handler->armed) {
+                    fds.push_back({ handler->fd, (short)((wantsRead(*handler) ? POLLIN : 0) | (wantsWrite(*handler) ? POLLOUT : 0)), 0 });
+                    regs.push_back(reg);
+                }
+            }
+        }
+
+        int n = poll(fds.data(), fds.size(), -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            NPLOGE << "poll failed: " << strerror(errno);
+            return;
+        }
+        if (fds[0].revents != 0) {
+            uint8_t buf[64];
+            while (read(wakeupPipe_[0], buf, sizeof(buf)) > 0) {}
+        }
+
+        // Take one ready socket, the next thread polling picks up the rest.
+        Registration ready = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 1; i < fds.size(); i++) {
+                if (fds[i].revents & (POLLIN | POLLOUT | POLLERR | POLLHUP)) {
+                    auto it = handlers_.find(regs[i-1]);
+                    if (it != handlers_.end() && it->second->armed) {
+                        it->second->armed = false;
+                        ready = regs[i-1];
+                        break;
+                    }
+                }
+            }
+        }
+        pollLock.unlock();
+        if (ready != 0) {
+            dispatch(ready);
+        }
+    }
+}
+
+#endif
+
+} // namespace
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+namespace nabto {
+
+class IoReactor;
+typedef std::shared_ptr<IoReactor> IoReactorPtr;
+
+typedef std::function<void()> IoReadyCallback;
+
+/**
+ * Reactor dispatching socket readiness to callbacks on a fixed number of
+ * threads.
+ *
+ * Sockets are registered with addReader(). When a socket becomes readable, its
+ * callback is invoked on one of the reactor threads. addWriter() does the same
+ * for writability, eg. to learn when a non-blocking connect has completed. A callback is never
+ * invoked concurrently with itself, so it can read from the socket without
+ * further locking. The callback should read until the socket would block or
+ * some fairness limit is reached; if data remains when the callback returns it
+ * is invoked again.
+ *
+ * Registered sockets should be non-blocking. The reactor must not be destroyed
+ * from within one of its own callbacks.
+ *
+ * On Linux, the reactor is implemented with epoll (EPOLLONESHOT) and is shut
+ * down through an eventfd. On other platforms it falls back to poll() with a
+ * self-pipe, where the threads take turns polling.
+ */
+class IoReactor : public std::enable_shared_from_this<IoReactor> {
+public:
+    typedef uint64_t Registration;
+
+    /**
+     * Create a reactor running threadCount threads. If threadCount is 0,
+     * one thread per core is used.
+     */
+    static IoReactorPtr create(size_t threadCount = 1);
+
+    /**
+     * Get the process wide reactor used by clients which are not configured
+     * with a reactor. It is created on first use and runs a single thread.
+     */
+    static IoReactorPtr defaultReactor();
+
+    IoReactor(size_t threadCount);
+    ~IoReactor();
+
+    /**
+     * Register a socket. cb is invoked on a reactor thread whenever the socket
+     * is readable until removeReader() is called.
+     *
+     * @return registration used to remove the socket again.
+     */
+    Registration addReader(int fd, IoReadyCallback cb);
+
+    /**
+     * Register a socket. cb is invoked on a reactor thread whenever the socket
+     * is writable until removeReader() is called. A socket can not have a
+     * reader and a writer registered at the same time.
+     *
+     * @return registration used to remove the socket again.
+     */
+    Registration addWriter(int fd, IoReadyCallback cb);
+
+    /**
+     * Also invoke the callback of a reader while its socket is writable, eg.
+     * to send data queued because the send buffer was full. The callback
+     * cannot tell readable from writable, so it should try both. Can be
+     * called from within the callback.
+     */
+    void setWritable(Registration reg, bool writable);
+
+    /**
+     * Unregister a socket added with addReader() or addWriter(). When this returns, the callback is not running and
+     * will not be invoked again, so the socket can be closed. If called from
+     * within the callback itself, it returns immediately and the callback is
+     * not invoked again.
+     */
+    void removeReader(Registration reg);
+
+    /**
+     * Stop and join all reactor threads. Called by the destructor.
+     */
+    void stop();
+
+    size_t threadCount() const { return threadCount_; }
+
+private:
+    class Handler {
+    public:
+        int fd;
+        IoReadyCallback cb;
+        bool writer = false;
+        // A reader which is also waiting for the socket to be writable.
+        bool writable = false;
+        bool armed = true;
+        bool running = false;
+        std::thread::id runningThread;
+    };
+    typedef std::shared_ptr<Handler> HandlerPtr;
+
+    void start();
+    void run();
+    Registration add(int fd, IoReadyCallback cb, bool writer);
+    void dispatch(Registration reg);
+    void rearm(Registration reg, const HandlerPtr& handler);
+    static bool wantsRead(const Handler& handler) { return !handler.writer; }
+    static bool wantsWrite(const Handler& handler) { return handler.writer || handler.writable; }
+
+    size_t threadCount_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stopped_ = false;
+    Registration nextRegistration_ = 1;
+    std::map<Registration, HandlerPtr> handlers_;
+
+#ifdef __linux__
+    int epollFd_ = -1;
+    int stopFd_ = -1;
+#else
+    void wakeup();
+
+    // Only one thread polls at a time, the others wait to take over.
+    std::mutex pollMutex_;
+    int wakeupPipe_[2] = { -1, -1 };
+#endif
+};
+
+} // namespace
@@ -0,0 +1,136 @@
+#include "gop_cache.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <cstring>
+
+namespace nabto {
+
+// Timestamp distance between replayed frames. 1 ms at the 90 kHz video clock.
+const uint32_t GOP_REPLAY_FRAME_SPACING = 90;
+
+namespace {
+
+const size_t RTP_HEADER_MIN_SIZE = 12;
+
+uint32_t rtpTimestamp(const uint8_t* packet)
+{
+    return ((uint32_t)packet[4] << 24) | ((uint32_t)packet[5] << 16) | ((uint32_t)packet[6] << 8) | packet[7];
+}
+
+bool isRtcp(const uint8_t* packet)
+{
+    // RTCP multiplexed on the RTP port (RFC 5761 section 4)
+    uint8_t pt = packet[1] & 0x7F;
+    return pt >= 72 && pt <= 76;
+}
+
+} // namespace
+
+GopCachePtr GopCache::create(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool)
+{
+    return std::make_shared<GopCache>(conf, isKeyframe, pool);
+}
+
+GopCache::GopCache(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool)
+    : conf_(conf), isKeyframe_(isKeyframe), pool_(pool)
+{
+    packets_.reserve(conf_.maxPackets);
+}
+
+void GopCache::add(const RtpBufferRef& packet)
+{
+    const uint8_t* data = packet->data();
+    size_t length = packet->size();
+    if (length < RTP_HEADER_MIN_SIZE || isRtcp(data)) {
+        return;
+    }
+    uint32_t timestamp = rtpTimestamp(data);
+
+    if (isKeyframe_(data, length)) {
+        if (!caching_ || sawDelta_) {
+            packets_.clear();
+            caching_ = true;
+            sawDelta_ = false;
+        }
+        keyframeTimestamp_ = timestamp;
+    } else if (timestamp != keyframeTimestamp_) {
+        // Packets following the first keyframe packet with the same
+        // timestamp are the rest of the keyframe.
+        sawDelta_ = true;
+    }
+
+    if (!caching_) {
+        return;
+    }
+    if (packets_.size() >= conf_.maxPackets) {
+        NPLOGD << "GOP does not fit in the cache of " << conf_.maxPackets << " packets, waiting for the next keyframe";
+        packets_.clear();
+        caching_ = false;
+        return;
+    }
+    packets_.push_back(packet);
+}
+
+bool GopCache::replay(ViewerQueue& queue)
+{
+    if (packets_.empty()) {
+        return false;
+    }
+    if (packets_.size() > queue.stats().capacity) {
+        NPLOGW << "Cached GOP of " << packets_.size() << " packets does not fit in the send queue, not replaying it";
+        return false;
+    }
+
+    size_t frames = 1;
+    for (size_t i = 1; i < packets_.size(); i++) {
+        if (rtpTimestamp(packets_[i]->data()) != rtpTimestamp(packets_[i-1]->data())) {
+            frames++;
+        }
+    }
+
+    uint32_t last = rtpTimestamp(packets_.back()->data());
+    size_t frame = 0;
+    for (size_t i = 0; i < packets_.size(); i++) {
+        if (i > 0 && rtpTimestamp(packets_[i]->data()) != rtpTimestamp(packets_[i-1]->data())) {
+            frame++;
+        }
+        uint32_t timestamp = last - (uint32_t)(frames - 1 - frame) * GOP_REPLAY_FRAME_SPACING;
+        if (timestamp == rtpTimestamp(packets_[i]->data())) {
+            queue.push(packets_[i]);
+        } else {
+            RtpBufferRef copy = withTimestamp(packets_[i], timestamp);
+            if (copy) {
+                queue.push(copy);
+            }
+        }
+    }
+    NPLOGD << "Replayed " << packets_.size() << " cached packets in " << frames << " frames to new viewer";
+    return true;
+}
+
+void GopCache::clear()
+{
+    packets_.clear();
+    caching_ = false;
+    sawDelta_ = false;
+}
+
+RtpBufferRef GopCache::withTimestamp(const RtpBufferRef& packet, uint32_t timestamp)
+{
+    RtpBufferPoolPtr pool = packet->size() > pool_->bufferCapacity() ? packet->pool() : pool_;
+    RtpBufferRef copy = pool->acquire();
+    if (packet->size() > copy->capacity()) {
+        return RtpBufferRef();
+    }
+    memcpy(copy->data(), packet->data(), packet->size());
+    copy->setSize(packet->size());
+    uint8_t* data = copy->data();
+    data[4] = (uint8_t)(timestamp >> 24);
+    data[5] = (uint8_t)(timestamp >> 16);
+    data[6] = (uint8_t)(timestamp >> 8);
+    data[7] = (uint8_t)timestamp;
+    return copy;
+}
+
+} // namespace
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "rtp_buffer_pool.hpp"
+#include "viewer_queue.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace nabto {
+
+class GopCache;
+typedef std::shared_ptr<GopCache> GopCachePtr;
+
+class GopCacheConf {
+public:
+    // Replay the packets since the last keyframe to new viewers. Only use
+    // this for video codecs where the negotiator or packetizer can detect
+    // keyframes.
+    bool enabled = false;
+    // Max number of packets cached. If a GOP is longer than this, nothing is
+    // replayed until the next keyframe. Viewer send queues are made large
+    // enough to hold a full cache.
+    size_t maxPackets = 1024;
+};
+
+/**
+ * Cache of the current group of pictures of an RTP video source.
+ *
+ * The cache holds the packets from the start of the last keyframe
+ * (including parameter sets sent before it) up to the newest packet. Packets
+ * with the same timestamp belong to the same frame. When a viewer joins, the
+ * cache is replayed into its send queue before the first live packet, so the
+ * viewer can decode a picture right away instead of waiting for the next
+ * keyframe.
+ *
+ * The timestamps of the replayed frames are moved forward so they
+ * are spaced a millisecond apart and end at the timestamp of the newest
+ * frame. The viewer then decodes through the cached frames immediately and
+ * continues with live frames without a jump. Sequence numbers are left as
+ * they are, as the cached packets are contiguous with the live packets.
+ *
+ * The cache is not thread safe. It is used from the ingest thread only, which
+ * is also the producer of the viewer queues.
+ */
+class GopCache {
+public:
+    /**
+     * @param conf       max size of the cache
+     * @param isKeyframe detects packets starting a keyframe
+     * @param pool       pool used for the copies of replayed RTP packets
+     *                   whose timestamp is rewritten. Packets larger than its
+     *                   buffers are copied from the pool they came from.
+     */
+    static GopCachePtr create(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool);
+
+    GopCache(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool);
+
+    /**
+     * Add a packet received from the source.
+     */
+    void add(const RtpBufferRef& packet);
+
+    /**
+     * Push the cached packets into the queue of a new viewer.
+     *
+     * @return false if nothing was replayed, either because the cache is
+     * empty or because it does not fit in the queue.
+     */
+    bool replay(ViewerQueue& queue);
+
+    void clear();
+
+    // Number of cached packets.
+    size_t size() const { return packets_.size(); }
+
+private:
+    RtpBufferRef withTimestamp(const RtpBufferRef& packet, uint32_t timestamp);
+
+    GopCacheConf conf_;
+    KeyframePredicate isKeyframe_;
+    RtpBufferPoolPtr pool_;
+
+    std::vector<RtpBufferRef> packets_;
+    // True from a keyframe until the GOP overflows the cache.
+    bool caching_ = false;
+    // True once a packet which is not part of the keyframe has been cached.
+    // The next keyframe packet then starts a new GOP.
+    bool sawDelta_ = false;
+    uint32_t keyframeTimestamp_ = 0;
+};
+
+} // namespace
@@ -0,0 +1,185 @@
+#include "media_send_worker.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+namespace nabto {
+
+// Max packets sent from one queue before moving on to the next queue.
+const size_t SEND_WORKER_BURST = 32;
+
+MediaSendWorkerPtr MediaSendWorker::create(size_t threadCount)
+{
+    return std::make_shared<MediaSendWorker>(threadCount);
+}
+
+MediaSendWorkerPtr MediaSendWorker::defaultWorker()
+{
+    static MediaSendWorkerPtr worker = MediaSendWorker::create(1);
+    return worker;
+}
+
+MediaSendWorker::MediaSendWorker(size_t threadCount)
+    : threadCount_(threadCount)
+{
+    if (threadCount_ == 0) {
+        threadCount_ = std::thread::hardware_concurrency();
+        if (threadCount_ == 0) {
+            threadCount_ = 1;
+        }
+    }
+    for (size_t i = 0; i < threadCount_; i++) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    for (size_t i = 0; i < threadCount_; i++) {
+        threads_.push_back(std::thread([this, i]() { run(i); }));
+    }
+}
+
+MediaSendWorker::~MediaSendWorker()
+{
+    stop();
+}
+
+void MediaSendWorker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+    }
+    sleepCond_.notify_all();
+    for (auto& t : threads_) {
+        if (t.get_id() == std::this_thread::get_id()) {
+            t.detach();
+        } else if (t.joinable()) {
+            t.join();
+        }
+    }
+    threads_.clear();
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->runList.clear();
+    }
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+    tasks_.clear();
+}
+
+size_t MediaSendWorker::shardFor(uint64_t key)
+{
+    if (key == 0) {
+        return nextShard_.fetch_add(1, std::memory_order_relaxed) % shards_.size();
+    }
+    return std::hash<uint64_t>()(key) % shards_.size();
+}
+
+void MediaSendWorker::schedule(ViewerQueuePtr queue)
+{
+    Shard& shard = *shards_[queue->shard() % shards_.size()];
+    // Count the queue before publishing it, so a thread taking it right
+    // away never decrements pending_ below zero.
+    pending_.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.runList.push_back(queue);
+    }
+    wakeup();
+}
+
+void MediaSendWorker::post(std::function<void()> task)
+{
+    pending_.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks_.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void MediaSendWorker::wakeup()
+{
+    // A thread going to sleep increments sleepers_ before checking pending_,
+    // so either it sees the new work or we see it sleeping.
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        sleepCond_.notify_one();
+    }
+}
+
+std::function<void()> MediaSendWorker::takeTask()
+{
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+    if (tasks_.empty()) {
+        return nullptr;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    return task;
+}
+
+ViewerQueuePtr MediaSendWorker::take(size_t index)
+{
+    {
+        // Own shard first, oldest first.
+        Shard& own = *shards_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.runList.empty()) {
+            ViewerQueuePtr queue = own.runList.front();
+            own.runList.pop_front();
+            return queue;
+        }
+    }
+    for (size_t i = 1; i < shards_.size(); i++) {
+        // Steal from the back of the other shards, so their owners keep the
+        // queues they are about to run.
+        Shard& other = *shards_[(index + i) % shards_.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.runList.empty()) {
+            ViewerQueuePtr queue = other.runList.back();
+            other.runList.pop_back();
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return queue;
+        }
+    }
+    return nullptr;
+}
+
+void MediaSendWorker::run(size_t index)
+{
+    while (true) {
+        std::function<void()> task = takeTask();
+        if (task) {
+            pending_.fetch_sub(1, std::memory_order_seq_cst);
+            try {
+                task();
+            } catch (std::exception& ex) {
+                NPLOGE << "Posted task failed: " << ex.what();
+            }
+            continue;
+        }
+        ViewerQueuePtr queue = take(index);
+        if (queue != nullptr) {
+            pending_.fetch_sub(1, std::memory_order_seq_cst);
+            if (queue->run(SEND_WORKER_BURST)) {
+                // More packets are queued, go to the back of the run list so
+                // other viewers get their turn.
+                schedule(queue);
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        if (stopped_) {
+            return;
+        }
+        sleepers_.fetch_add(1, std::memory_order_seq_cst);
+        sleepCond_.wait(lock, [this]() { return stopped_ || pending_.load(std::memory_order_seq_cst) > 0; });
+        sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+        if (stopped_) {
+            return;
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "viewer_queue.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nabto {
+
+/**
+ * Pool of threads sending queued media packets to viewers.
+ *
+ * Sending includes the SRTP protection done by libdatachannel, so spreading
+ * viewers across threads lets the send side scale with the number of cores.
+ *
+ * Each thread owns a shard with its own run list. A ViewerQueue is assigned a
+ * shard when created and schedules itself on that shard when it goes from
+ * empty to non-empty. A thread with nothing to do steals from the back of the
+ * other shards' run lists. A queue is only in one run list at a time and is
+ * drained by one thread at a time, so packets for a track are always sent in
+ * order.
+ */
+class MediaSendWorker : public std::enable_shared_from_this<MediaSendWorker> {
+public:
+    /**
+     * Create a worker running threadCount threads. If threadCount is 0, one
+     * thread per core is used.
+     */
+    static MediaSendWorkerPtr create(size_t threadCount = 1);
+
+    /**
+     * Get the process wide worker used by clients which are not configured
+     * with a worker. It is created on first use and runs a single thread.
+     */
+    static MediaSendWorkerPtr defaultWorker();
+
+    MediaSendWorker(size_t threadCount);
+    ~MediaSendWorker();
+
+    /**
+     * Get the shard for a new queue. Queues with the same non-zero key (eg.
+     * the connection ref, so audio and video of a connection share a thread)
+     * get the same shard. Key 0 assigns shards round robin.
+     */
+    size_t shardFor(uint64_t key);
+
+    /**
+     * Add a queue to the run list of its shard. Called by ViewerQueue.
+     */
+    void schedule(ViewerQueuePtr queue);
+
+    /**
+     * Run a task on one of the threads, eg. to do work which must not be done
+     * on the ingest thread of a source. Tasks run before queued packets.
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * Stop and join all threads. Called by the destructor.
+     */
+    void stop();
+
+    size_t threadCount() const { return threadCount_; }
+
+    // Number of times a thread took work from another thread's shard.
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    class Shard {
+    public:
+        std::mutex mutex;
+        std::deque<ViewerQueuePtr> runList;
+    };
+
+    void run(size_t index);
+    ViewerQueuePtr take(size_t index);
+    std::function<void()> takeTask();
+    void wakeup();
+
+    size_t threadCount_;
+    std::vector<std::unique_ptr<Shard> > shards_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> nextShard_{0};
+
+    std::mutex tasksMutex_;
+    std::deque<std::function<void()> > tasks_;
+
+    // Number of queues in all run lists and posted tasks
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<uint64_t> steals_{0};
+
+    std::mutex sleepMutex_;
+    std::condition_variable sleepCond_;
+    bool stopped_ = false;
+};
+
+} // namespace
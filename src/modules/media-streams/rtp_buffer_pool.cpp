@@ -0,0 +1,101 @@
+#include "rtp_buffer_pool.hpp"
+
+namespace nabto {
+
+RtpBufferRef& RtpBufferRef::operator=(const RtpBufferRef& other)
+{
+    // tmp releases the buffer previously referenced when going out of scope
+    RtpBufferRef tmp(other);
+    std::swap(buffer_, tmp.buffer_);
+    return *this;
+}
+
+RtpBufferRef& RtpBufferRef::operator=(RtpBufferRef&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        buffer_ = other.buffer_;
+        other.buffer_ = nullptr;
+    }
+    return *this;
+}
+
+bool RtpBufferRef::unique() const
+{
+    return buffer_ != nullptr && buffer_->refCount_.load(std::memory_order_acquire) == 1;
+}
+
+void RtpBufferRef::retain()
+{
+    if (buffer_ != nullptr) {
+        buffer_->refCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RtpBufferRef::release()
+{
+    if (buffer_ != nullptr && buffer_->refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // Last reference. Move the pool reference out of the buffer before
+        // giving it back, as the buffer can be handed out again immediately.
+        // If this was the last reference to the pool, it is destroyed after
+        // giveBack() returns.
+        RtpBufferPoolPtr pool = std::move(buffer_->pool_);
+        pool->giveBack(buffer_);
+    }
+    buffer_ = nullptr;
+}
+
+RtpBufferPoolPtr RtpBufferPool::create(size_t bufferCapacity, size_t initialCount)
+{
+    return std::make_shared<RtpBufferPool>(bufferCapacity, initialCount);
+}
+
+RtpBufferPool::RtpBufferPool(size_t bufferCapacity, size_t initialCount)
+    : bufferCapacity_(bufferCapacity)
+{
+    buffers_.reserve(initialCount);
+    free_.reserve(initialCount);
+    for (size_t i = 0; i < initialCount; i++) {
+        buffers_.push_back(std::make_unique<RtpBuffer>(bufferCapacity_));
+        free_.push_back(buffers_.back().get());
+    }
+}
+
+RtpBufferPool::~RtpBufferPool()
+{
+}
+
+RtpBufferRef RtpBufferPool::acquire()
+{
+    RtpBuffer* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            // All buffers are in use, grow the pool. The free list must be
+            // able to hold every buffer so giveBack() never allocates.
+            buffers_.push_back(std::make_unique<RtpBuffer>(bufferCapacity_));
+            free_.reserve(buffers_.size());
+            buffer = buffers_.back().get();
+        } else {
+            buffer = free_.back();
+            free_.pop_back();
+        }
+    }
+    buffer->size_ = 0;
+    buffer->pool_ = shared_from_this();
+    return RtpBufferRef(buffer);
+}
+
+size_t RtpBufferPool::bufferCount()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_.size();
+}
+
+void RtpBufferPool::giveBack(RtpBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(buffer);
+}
+
+} // namespace
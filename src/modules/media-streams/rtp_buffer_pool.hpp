@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nabto {
+
+class RtpBuffer;
+class RtpBufferRef;
+class RtpBufferPool;
+typedef std::shared_ptr<RtpBufferPool> RtpBufferPoolPtr;
+
+/**
+ * Fixed size buffer holding a single RTP/RTCP datagram.
+ *
+ * Buffers are owned by an RtpBufferPool and are reference counted through
+ * RtpBufferRef. When the last reference is dropped, the buffer goes back into
+ * the pool it came from. This allows a received datagram to be shared by all
+ * subscribers of a stream without copying it or allocating per packet.
+ */
+class RtpBuffer {
+public:
+    RtpBuffer(size_t capacity) : data_(capacity) {}
+
+    uint8_t* data() { return data_.data(); }
+    const uint8_t* data() const { return data_.data(); }
+    size_t size() const { return size_; }
+    size_t capacity() const { return data_.size(); }
+
+    // Set the number of valid bytes in the buffer. Must not exceed capacity().
+    void setSize(size_t size) { size_ = size; }
+
+    // Pool the buffer goes back to. Only set while the buffer is referenced.
+    const RtpBufferPoolPtr& pool() const { return pool_; }
+
+private:
+    friend class RtpBufferRef;
+    friend class RtpBufferPool;
+
+    std::vector<uint8_t> data_;
+    size_t size_ = 0;
+    std::atomic<uint32_t> refCount_{0};
+    // Keeps the pool alive while the buffer is in use. Copying a shared_ptr does not allocate.
+    RtpBufferPoolPtr pool_ = nullptr;
+};
+
+/**
+ * Intrusive reference to a pooled RtpBuffer. Copying the reference only
+ * touches the reference count of the buffer.
+ */
+class RtpBufferRef {
+public:
+    RtpBufferRef() {}
+    RtpBufferRef(const RtpBufferRef& other) : buffer_(other.buffer_) { retain(); }
+    RtpBufferRef(RtpBufferRef&& other) noexcept : buffer_(other.buffer_) { other.buffer_ = nullptr; }
+    ~RtpBufferRef() { release(); }
+
+    RtpBufferRef& operator=(const RtpBufferRef& other);
+    RtpBufferRef& operator=(RtpBufferRef&& other) noexcept;
+
+    RtpBuffer* operator->() const { return buffer_; }
+    RtpBuffer& operator*() const { return *buffer_; }
+    RtpBuffer* get() const { return buffer_; }
+    explicit operator bool() const { return buffer_ != nullptr; }
+
+    // True if this is the only reference to the buffer, in which case it can
+    // be reused without going through the pool.
+    bool unique() const;
+
+    void reset() { release(); buffer_ = nullptr; }
+
+    /**
+     * Give up ownership of the reference without releasing it. Used to pass
+     * the buffer through containers holding raw pointers (eg. SpscPtrQueue).
+     * The reference must be taken back with adopt().
+     */
+    RtpBuffer* detach() { RtpBuffer* b = buffer_; buffer_ = nullptr; return b; }
+
+    /**
+     * Take ownership of a reference previously given up with detach().
+     */
+    static RtpBufferRef adopt(RtpBuffer* buffer) { RtpBufferRef ref; ref.buffer_ = buffer; return ref; }
+
+private:
+    friend class RtpBufferPool;
+    explicit RtpBufferRef(RtpBuffer* buffer) : buffer_(buffer) { retain(); }
+
+    void retain();
+    void release();
+
+    RtpBuffer* buffer_ = nullptr;
+};
+
+/**
+ * Pool of RtpBuffers of a fixed capacity.
+ *
+ * The pool preallocates `initialCount` buffers and grows on demand if all
+ * buffers are in use. Once warmed up, acquiring and releasing buffers does not
+ * allocate.
+ */
+class RtpBufferPool : public std::enable_shared_from_this<RtpBufferPool> {
+public:
+    static RtpBufferPoolPtr create(size_t bufferCapacity = 2048, size_t initialCount = 64);
+    RtpBufferPool(size_t bufferCapacity, size_t initialCount);
+    ~RtpBufferPool();
+
+    /**
+     * Get an unused buffer from the pool. The returned buffer has size 0.
+     */
+    RtpBufferRef acquire();
+
+    size_t bufferCapacity() const { return bufferCapacity_; }
+
+    // Total number of buffers owned by the pool, whether in use or not.
+    size_t bufferCount();
+
+private:
+    friend class RtpBufferRef;
+    void giveBack(RtpBuffer* buffer);
+
+    size_t bufferCapacity_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<RtpBuffer> > buffers_;
+    std::vector<RtpBuffer*> free_;
+};
+
+} // namespace
@@ -0,0 +1,274 @@
+#include "rtp_reception_stats.hpp"
+
+#include <random>
+
+namespace nabto {
+
+// Sequence number validation parameters from RFC 3550 appendix A.1
+const uint32_t RTP_MAX_DROPOUT = 3000;
+const uint32_t RTP_MAX_MISORDER = 100;
+const uint32_t RTP_MIN_SEQUENTIAL = 2;
+const uint32_t RTP_SEQ_MOD = 1 << 16;
+// Report blocks which fit in one receiver report.
+const size_t RTP_RECEPTION_MAX_SOURCES = 31;
+
+namespace {
+
+const size_t RTP_HEADER_MIN_SIZE = 12;
+const size_t RTCP_HEADER_SIZE = 8;
+const size_t RTCP_SR_MIN_SIZE = 28;
+const size_t RTCP_REPORT_BLOCK_SIZE = 24;
+const uint8_t RTCP_SR = 200;
+const uint8_t RTCP_RR = 201;
+
+uint32_t readU32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void writeU32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+bool isRtcp(const uint8_t* packet)
+{
+    // RTCP multiplexed on the RTP port (RFC 5761 section 4)
+    uint8_t pt = packet[1] & 0x7F;
+    return pt >= 72 && pt <= 76;
+}
+
+} // namespace
+
+RtpReceptionStatsPtr RtpReceptionStats::create(uint32_t clockRate)
+{
+    return std::make_shared<RtpReceptionStats>(clockRate);
+}
+
+RtpReceptionStats::RtpReceptionStats(uint32_t clockRate)
+    : clockRate_(clockRate == 0 ? 90000 : clockRate), epoch_(std::chrono::steady_clock::now())
+{
+    std::random_device rd;
+    ssrc_ = rd();
+}
+
+void RtpReceptionStats::rtpReceived(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point arrival)
+{
+    if (length < RTP_HEADER_MIN_SIZE || (packet[0] >> 6) != 2 || isRtcp(packet)) {
+        return;
+    }
+    uint16_t seq = (packet[2] << 8) | packet[3];
+    uint32_t timestamp = readU32(packet + 4);
+    uint32_t ssrc = readU32(packet + 8);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Source& s = source(ssrc, arrival);
+    s.lastArrival = arrival;
+    if (!s.valid && s.probation == 0) {
+        // First packet of the source, it must be followed by
+        // RTP_MIN_SEQUENTIAL - 1 packets in sequence to be valid.
+        s.init(seq);
+        s.maxSeq = seq - 1;
+        s.probation = RTP_MIN_SEQUENTIAL;
+    }
+    if (!s.updateSeq(seq)) {
+        return;
+    }
+
+    // Interarrival jitter, RFC 3550 A.8
+    uint32_t arrivalTs = (uint32_t)(uint64_t)(std::chrono::duration<double>(arrival - epoch_).count() * clockRate_);
+    uint32_t transit = arrivalTs - timestamp;
+    if (s.haveTransit) {
+        int32_t d = (int32_t)(transit - s.transit);
+        if (d < 0) {
+            d = -d;
+        }
+        s.jitter += d - ((s.jitter + 8) >> 4);
+    }
+    s.transit = transit;
+    s.haveTransit = true;
+}
+
+bool RtpReceptionStats::senderReportReceived(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point arrival)
+{
+    bool found = false;
+    size_t offset = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (offset + RTCP_HEADER_SIZE <= length) {
+        const uint8_t* p = packet + offset;
+        size_t packetLength = (((p[2] << 8) | p[3]) + 1) * 4;
+        if ((p[0] >> 6) != 2 || offset + packetLength > length) {
+            break;
+        }
+        if (p[1] == RTCP_SR && packetLength >= RTCP_SR_MIN_SIZE) {
+            Source& s = source(readU32(p + 4), arrival);
+            // The middle 32 bits of the NTP timestamp
+            s.lastSr = readU32(p + 10);
+            s.lastSrArrival = arrival;
+            s.haveSr = true;
+            found = true;
+        }
+        offset += packetLength;
+    }
+    return found;
+}
+
+size_t RtpReceptionStats::buildReceiverReport(uint8_t* buffer, size_t length, std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t blocks = 0;
+    for (const auto& [ssrc, s] : sources_) {
+        if (s.valid || s.haveSr) {
+            blocks++;
+        }
+    }
+    size_t total = RTCP_HEADER_SIZE + blocks * RTCP_REPORT_BLOCK_SIZE;
+    if (length < total) {
+        return 0;
+    }
+
+    buffer[0] = 0x80 | (uint8_t)blocks;
+    buffer[1] = RTCP_RR;
+    buffer[2] = (uint8_t)((total / 4 - 1) >> 8);
+    buffer[3] = (uint8_t)((total / 4 - 1) & 0xff);
+    writeU32(buffer + 4, ssrc_);
+
+    uint8_t* block = buffer + RTCP_HEADER_SIZE;
+    for (auto& [ssrc, s] : sources_) {
+        if (!s.valid && !s.haveSr) {
+            continue;
+        }
+        if (s.valid) {
+            // Loss since the last report, RFC 3550 A.3
+            uint64_t expected = (uint64_t)s.cycles + s.maxSeq - s.baseSeq + 1;
+            int64_t expectedInterval = (int64_t)(expected - s.expectedPrior);
+            int64_t receivedInterval = (int64_t)(s.received - s.receivedPrior);
+            int64_t lostInterval = expectedInterval - receivedInterval;
+            s.expectedPrior = expected;
+            s.receivedPrior = s.received;
+            s.fractionLost = (expectedInterval == 0 || lostInterval <= 0) ? 0 : (uint8_t)((lostInterval << 8) / expectedInterval);
+        }
+        RtpReceptionReport r = s.report(ssrc, clockRate_);
+        uint32_t delay = 0;
+        if (s.haveSr) {
+            // Delay since the last SR in 1/65536 seconds
+            delay = (uint32_t)(std::chrono::duration<double>(now - s.lastSrArrival).count() * 65536);
+        }
+        writeU32(block, ssrc);
+        writeU32(block + 4, ((uint32_t)r.fractionLost << 24) | ((uint32_t)r.cumulativeLost & 0xffffff));
+        writeU32(block + 8, r.extendedHighestSeq);
+        writeU32(block + 12, r.jitter);
+        writeU32(block + 16, s.lastSr);
+        writeU32(block + 20, delay);
+        block += RTCP_REPORT_BLOCK_SIZE;
+    }
+    return total;
+}
+
+std::vector<RtpReceptionReport> RtpReceptionStats::reports()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<RtpReceptionReport> reports;
+    for (const auto& [ssrc, s] : sources_) {
+        if (s.valid) {
+            reports.push_back(s.report(ssrc, clockRate_));
+        }
+    }
+    return reports;
+}
+
+RtpReceptionStats::Source& RtpReceptionStats::source(uint32_t ssrc, std::chrono::steady_clock::time_point arrival)
+{
+    auto it = sources_.find(ssrc);
+    if (it != sources_.end()) {
+        return it->second;
+    }
+    if (sources_.size() >= RTP_RECEPTION_MAX_SOURCES) {
+        // Forget the source heard from least recently, eg. the old SSRC of a restarted camera.
+        auto oldest = sources_.begin();
+        for (auto s = sources_.begin(); s != sources_.end(); s++) {
+            if (s->second.lastArrival < oldest->second.lastArrival) {
+                oldest = s;
+            }
+        }
+        sources_.erase(oldest);
+    }
+    Source& s = sources_[ssrc];
+    s.lastArrival = arrival;
+    return s;
+}
+
+void RtpReceptionStats::Source::init(uint16_t seq)
+{
+    baseSeq = seq;
+    maxSeq = seq;
+    badSeq = RTP_SEQ_MOD + 1;
+    cycles = 0;
+    received = 0;
+    receivedPrior = 0;
+    expectedPrior = 0;
+}
+
+bool RtpReceptionStats::Source::updateSeq(uint16_t seq)
+{
+    uint16_t udelta = seq - maxSeq;
+    if (probation > 0) {
+        if (seq == (uint16_t)(maxSeq + 1)) {
+            probation--;
+            maxSeq = seq;
+            if (probation == 0) {
+                init(seq);
+                received++;
+                valid = true;
+                return true;
+            }
+        } else {
+            probation = RTP_MIN_SEQUENTIAL - 1;
+            maxSeq = seq;
+        }
+        return false;
+    } else if (udelta < RTP_MAX_DROPOUT) {
+        // In order, with permissible gap
+        if (seq < maxSeq) {
+            cycles += RTP_SEQ_MOD;
+        }
+        maxSeq = seq;
+    } else if (udelta <= RTP_SEQ_MOD - RTP_MAX_MISORDER) {
+        // Large jump. Two sequential packets after it mean the source restarted.
+        if (seq == badSeq) {
+            init(seq);
+        } else {
+            badSeq = (seq + 1) & (RTP_SEQ_MOD - 1);
+            return false;
+        }
+    }
+    // Otherwise a duplicate or reordered packet, which is counted
+    received++;
+    return true;
+}
+
+RtpReceptionReport RtpReceptionStats::Source::report(uint32_t ssrc, uint32_t clockRate) const
+{
+    RtpReceptionReport r;
+    r.ssrc = ssrc;
+    r.packetsReceived = received;
+    r.extendedHighestSeq = cycles + maxSeq;
+    int64_t expected = (int64_t)cycles + maxSeq - baseSeq + 1;
+    int64_t lost = expected - (int64_t)received;
+    // 24 bit signed field
+    if (lost > 0x7fffff) {
+        lost = 0x7fffff;
+    } else if (lost < -0x800000) {
+        lost = -0x800000;
+    }
+    r.cumulativeLost = (int32_t)lost;
+    r.fractionLost = fractionLost;
+    r.jitter = jitter >> 4;
+    r.jitterMs = (double)r.jitter * 1000 / clockRate;
+    return r;
+}
+
+} // namespace
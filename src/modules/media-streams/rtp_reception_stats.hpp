@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nabto {
+
+class RtpReceptionStats;
+typedef std::shared_ptr<RtpReceptionStats> RtpReceptionStatsPtr;
+
+/**
+ * Reception quality of one RTP source, as reported in an RTCP report block.
+ */
+class RtpReceptionReport {
+public:
+    uint32_t ssrc = 0;
+    uint64_t packetsReceived = 0;
+    // Highest sequence number received, with the number of wraparounds in the upper 16 bits.
+    uint32_t extendedHighestSeq = 0;
+    // Packets expected but not received since the start. Negative if duplicates were received.
+    int32_t cumulativeLost = 0;
+    // Fraction of the packets lost since the previous receiver report, in 1/256.
+    uint8_t fractionLost = 0;
+    // Interarrival jitter in RTP timestamp units and in milliseconds.
+    uint32_t jitter = 0;
+    double jitterMs = 0;
+};
+
+/**
+ * Per SSRC reception statistics of an RTP stream, following RFC 3550
+ * appendix A.1 (sequence number validation), A.3 (loss) and A.8 (jitter).
+ *
+ * The ingest path calls rtpReceived() for every packet and the RTCP path
+ * calls senderReportReceived() and buildReceiverReport(), so the receiver
+ * reports sent to the source carry real loss, jitter and LSR/DLSR values.
+ * The same numbers are available to the application through reports().
+ *
+ * Packets read in one batch share an arrival time, so jitter is measured
+ * at the granularity of the socket reads.
+ */
+class RtpReceptionStats {
+public:
+    /**
+     * @param clockRate  RTP timestamp clock rate of the stream, used for jitter
+     */
+    static RtpReceptionStatsPtr create(uint32_t clockRate);
+
+    RtpReceptionStats(uint32_t clockRate);
+
+    /**
+     * Account for an RTP packet from the source. RTCP packets multiplexed
+     * on the RTP port and packets too short for an RTP header are ignored.
+     */
+    void rtpReceived(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * Take an RTCP packet, possibly compound, from the source and remember
+     * the time of its sender report for the LSR and DLSR fields.
+     *
+     * @return true if the packet contained a sender report.
+     */
+    bool senderReportReceived(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point arrival);
+
+    /**
+     * Write an RTCP receiver report with a report block for each source
+     * into buffer. This starts a new interval for the fraction lost.
+     *
+     * @return the length of the report, 0 if it does not fit in buffer.
+     */
+    size_t buildReceiverReport(uint8_t* buffer, size_t length, std::chrono::steady_clock::time_point now);
+
+    // Current statistics of each source.
+    std::vector<RtpReceptionReport> reports();
+
+    // SSRC used as sender of the receiver reports.
+    uint32_t ssrc() const { return ssrc_; }
+
+private:
+    class Source {
+    public:
+        void init(uint16_t seq);
+        bool updateSeq(uint16_t seq);
+        RtpReceptionReport report(uint32_t ssrc, uint32_t clockRate) const;
+
+        bool valid = false;
+        uint16_t maxSeq = 0;
+        uint32_t cycles = 0;
+        uint32_t baseSeq = 0;
+        uint32_t badSeq = 0;
+        uint32_t probation = 0;
+        uint64_t received = 0;
+        uint64_t expectedPrior = 0;
+        uint64_t receivedPrior = 0;
+        uint8_t fractionLost = 0;
+        bool haveTransit = false;
+        uint32_t transit = 0;
+        // Jitter scaled by 16 as in RFC 3550 A.8
+        uint32_t jitter = 0;
+        bool haveSr = false;
+        uint32_t lastSr = 0;
+        std::chrono::steady_clock::time_point lastSrArrival;
+        std::chrono::steady_clock::time_point lastArrival;
+    };
+
+    Source& source(uint32_t ssrc, std::chrono::steady_clock::time_point arrival);
+
+    uint32_t clockRate_;
+    uint32_t ssrc_;
+    std::chrono::steady_clock::time_point epoch_;
+
+    std::mutex mutex_;
+    std::map<uint32_t, Source> sources_;
+};
+
+} // namespace
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nabto {
+
+/**
+ * Bounded lock-free single producer single consumer queue of pointers.
+ *
+ * Besides push(), the producer can evict the oldest element with
+ * evictOldest() to make room when the queue is full. The consumer and the
+ * producer race for the oldest element through a compare-and-swap on the
+ * head index, so an element is always owned by exactly one of them.
+ *
+ * The queue does not own the pointers, elements left in the queue when it is
+ * destroyed must be removed by the owner first.
+ */
+template <typename T>
+class SpscPtrQueue {
+public:
+    /**
+     * Create a queue able to hold at least capacity elements. The capacity is
+     * rounded up to a power of two.
+     */
+    SpscPtrQueue(size_t capacity)
+    {
+        size_t c = 1;
+        while (c < capacity) {
+            c <<= 1;
+        }
+        capacity_ = c;
+        mask_ = c - 1;
+        slots_ = std::make_unique<std::atomic<T*>[]>(c);
+        for (size_t i = 0; i < c; i++) {
+            slots_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Producer: add an element. Returns false if the queue is full.
+     */
+    bool push(T* item)
+    {
+        uint64_t t = tail_.load(std::memory_order_relaxed);
+        uint64_t h = head_.load(std::memory_order_acquire);
+        if (t - h >= capacity_) {
+            return false;
+        }
+        slots_[t & mask_].store(item, std::memory_order_relaxed);
+        // seq_cst so a consumer checking empty() after clearing its scheduled
+        // flag cannot miss this element (see ViewerQueue).
+        tail_.store(t + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    /**
+     * Producer: remove the oldest element. Returns nullptr if the queue is
+     * empty or the consumer took the element first.
+     */
+    T* evictOldest()
+    {
+        uint64_t h = head_.load(std::memory_order_acquire);
+        if (h == tail_.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        T* item = slots_[h & mask_].load(std::memory_order_relaxed);
+        if (head_.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel)) {
+            return item;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Consumer: remove the oldest element. Returns nullptr if the queue is
+     * empty.
+     */
+    T* pop()
+    {
+        while (true) {
+            uint64_t h = head_.load(std::memory_order_acquire);
+            if (h == tail_.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            T* item = slots_[h & mask_].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_strong(h, h + 1, std::memory_order_acq_rel)) {
+                return item;
+            }
+            // The producer evicted the element, try the next one.
+        }
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_seq_cst);
+    }
+
+    size_t size() const
+    {
+        uint64_t h = head_.load(std::memory_order_acquire);
+        uint64_t t = tail_.load(std::memory_order_acquire);
+        return t > h ? (size_t)(t - h) : 0;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    size_t capacity_;
+    size_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> slots_;
+    // Indices only grow, so a compare-and-swap on head_ cannot suffer from ABA.
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+} // namespace
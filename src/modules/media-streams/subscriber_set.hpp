@@ -0,0 +1,119 @@
+#pragma once
+
+#include <nabto/nabto_device.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace nabto {
+
+/**
+ * Set of subscribers to a media stream keyed by connection.
+ *
+ * The set is published as an immutable flat array which is replaced
+ * atomically whenever a subscriber is added or removed (RCU style). The
+ * ingest thread takes a snapshot once per packet or batch and iterates it
+ * without holding any lock, so connections joining and leaving never block
+ * packet forwarding, and a slow send never blocks a join or leave.
+ *
+ * A subscriber removed while a snapshot is being iterated may receive the
+ * remainder of that packet or batch.
+ */
+template <typename T>
+class SubscriberSet {
+public:
+    typedef std::vector<std::pair<NabtoDeviceConnectionRef, T> > Snapshot;
+    typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+    SubscriberSet() : current_(std::make_shared<const Snapshot>()) {}
+
+    /**
+     * Get the current subscribers. The snapshot never changes, so it can be
+     * used from any thread for as long as it is held.
+     */
+    SnapshotPtr snapshot() const
+    {
+        return std::atomic_load_explicit(&current_, std::memory_order_acquire);
+    }
+
+    /**
+     * Get the subscriber for ref if it exists.
+     */
+    std::optional<T> find(NabtoDeviceConnectionRef ref) const
+    {
+        auto s = snapshot();
+        for (const auto& entry : *s) {
+            if (entry.first == ref) {
+                return entry.second;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * Add or replace the subscriber for ref.
+     *
+     * @return the number of subscribers after the insert.
+     */
+    size_t insert(NabtoDeviceConnectionRef ref, const T& value)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        auto next = std::make_shared<Snapshot>(*current_);
+        bool replaced = false;
+        for (auto& entry : *next) {
+            if (entry.first == ref) {
+                entry.second = value;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            next->emplace_back(ref, value);
+        }
+        return publish(std::move(next));
+    }
+
+    /**
+     * Remove the subscriber for ref if it exists.
+     *
+     * @return the number of subscribers after the removal.
+     */
+    size_t erase(NabtoDeviceConnectionRef ref)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        auto next = std::make_shared<Snapshot>();
+        next->reserve(current_->size());
+        for (const auto& entry : *current_) {
+            if (entry.first != ref) {
+                next->push_back(entry);
+            }
+        }
+        return publish(std::move(next));
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        publish(std::make_shared<Snapshot>());
+    }
+
+    size_t size() const { return snapshot()->size(); }
+
+private:
+    size_t publish(std::shared_ptr<Snapshot> next)
+    {
+        size_t size = next->size();
+        std::atomic_store_explicit(&current_, SnapshotPtr(std::move(next)), std::memory_order_release);
+        return size;
+    }
+
+    // Serializes writers. Readers never take it.
+    std::mutex writeMutex_;
+    // Only written with writeMutex_ held, so writers can read it directly.
+    SnapshotPtr current_;
+};
+
+} // namespace
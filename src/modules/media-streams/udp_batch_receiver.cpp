@@ -0,0 +1,129 @@
+#include "udp_batch_receiver.hpp"
+
+#include <cerrno>
+
+namespace nabto {
+
+double UdpBatchStats::averageBatchFill() const
+{
+    uint64_t b = batches();
+    if (b == 0) {
+        return 0;
+    }
+    return (double)packets() / (double)b;
+}
+
+void UdpBatchStats::reset()
+{
+    batches_.store(0, std::memory_order_relaxed);
+    packets_.store(0, std::memory_order_relaxed);
+}
+
+void UdpBatchStats::add(size_t packets)
+{
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    packets_.fetch_add(packets, std::memory_order_relaxed);
+}
+
+UdpBatchReceiver::UdpBatchReceiver(RtpBufferPoolPtr pool, size_t batchSize)
+    : pool_(pool)
+{
+    if (batchSize == 0) {
+        batchSize = 1;
+    }
+    slots_.resize(batchSize);
+    addrs_.resize(batchSize);
+    addrLens_.resize(batchSize);
+#ifdef __linux__
+    msgs_.resize(batchSize);
+    iovecs_.resize(batchSize);
+#endif
+    used_ = batchSize;
+    prepareSlots();
+}
+
+void UdpBatchReceiver::prepareSlots()
+{
+    // Only slots filled by the previous batch need to be touched. A slot
+    // still referenced elsewhere (eg. queued for a slow viewer) is replaced
+    // with a fresh buffer from the pool.
+    for (size_t i = 0; i < used_; i++) {
+        if (slots_[i].unique()) {
+            slots_[i]->setSize(0);
+        } else {
+            slots_[i] = pool_->acquire();
+        }
+    }
+    used_ = 0;
+}
+
+#ifdef __linux__
+int UdpBatchReceiver::receive(int sock)
+{
+    prepareSlots();
+    size_t n = slots_.size();
+    for (size_t i = 0; i < n; i++) {
+        iovecs_[i].iov_base = slots_[i]->data();
+        iovecs_[i].iov_len = slots_[i]->capacity();
+        msgs_[i].msg_hdr = {};
+        msgs_[i].msg_hdr.msg_name = &addrs_[i];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(addrs_[i]);
+        msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+        msgs_[i].msg_len = 0;
+    }
+
+    int ret;
+    do {
+        ret = recvmmsg(sock, msgs_.data(), n, MSG_WAITFORONE, NULL);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+    for (int i = 0; i < ret; i++) {
+        slots_[i]->setSize(msgs_[i].msg_len);
+        addrLens_[i] = msgs_[i].msg_hdr.msg_namelen;
+    }
+    used_ = ret;
+    if (ret > 0) {
+        stats_.add(ret);
+    }
+    return ret;
+}
+#else
+int UdpBatchReceiver::receive(int sock)
+{
+    prepareSlots();
+    size_t n = slots_.size();
+    size_t count = 0;
+    while (count < n) {
+        // Block for the first datagram, then take what is already queued.
+        int flags = count == 0 ? 0 : MSG_DONTWAIT;
+        addrLens_[count] = sizeof(addrs_[count]);
+        ssize_t len = recvfrom(sock, slots_[count]->data(), slots_[count]->capacity(), flags, (struct sockaddr*)&addrs_[count], &addrLens_[count]);
+        if (len < 0) {
+            if (errno == EINTR && count == 0) {
+                continue;
+            }
+            if (count == 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            // EAGAIN, the socket is drained.
+            break;
+        }
+        slots_[count]->setSize(len);
+        count++;
+    }
+    used_ = count;
+    if (count > 0) {
+        stats_.add(count);
+    }
+    return (int)count;
+}
+#endif
+
+} // namespace
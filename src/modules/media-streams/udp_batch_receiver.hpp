@@ -0,0 +1,89 @@
+#pragma once
+
+#include "rtp_buffer_pool.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <vector>
+
+namespace nabto {
+
+/**
+ * Counters for a UdpBatchReceiver. The counters can be read from any thread
+ * while the receiver is running.
+ */
+class UdpBatchStats {
+public:
+    // Number of calls to receive() which returned datagrams.
+    uint64_t batches() const { return batches_.load(std::memory_order_relaxed); }
+    // Total number of datagrams received.
+    uint64_t packets() const { return packets_.load(std::memory_order_relaxed); }
+
+    // Average number of datagrams returned per batch.
+    double averageBatchFill() const;
+
+    void reset();
+
+private:
+    friend class UdpBatchReceiver;
+    void add(size_t packets);
+
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> packets_{0};
+};
+
+/**
+ * Receives up to `batchSize` datagrams from a UDP socket with a single
+ * syscall into buffers from an RtpBufferPool.
+ *
+ * On Linux this uses recvmmsg, waiting for at least one datagram if the
+ * socket is blocking and then returning what is already queued on the socket.
+ * On other platforms the first datagram is read with the socket's blocking
+ * mode and the rest of the batch is read non-blocking with recvfrom.
+ *
+ * The buffers returned from packet() are only owned by the receiver until the
+ * next call to receive(). Copy the RtpBufferRef to keep a buffer longer.
+ *
+ * A receiver is used from a single thread.
+ */
+class UdpBatchReceiver {
+public:
+    UdpBatchReceiver(RtpBufferPoolPtr pool, size_t batchSize);
+
+    /**
+     * Receive the next batch of datagrams from sock.
+     *
+     * @return the number of datagrams received, 0 if the socket is
+     * non-blocking and no datagrams are queued, or -1 if the socket failed
+     * (eg. was closed).
+     */
+    int receive(int sock);
+
+    const RtpBufferRef& packet(size_t index) const { return slots_[index]; }
+    const struct sockaddr_in& sourceAddress(size_t index) const { return addrs_[index]; }
+    socklen_t sourceAddressLength(size_t index) const { return addrLens_[index]; }
+
+    size_t batchSize() const { return slots_.size(); }
+
+    const UdpBatchStats& stats() const { return stats_; }
+    UdpBatchStats& stats() { return stats_; }
+
+private:
+    void prepareSlots();
+
+    RtpBufferPoolPtr pool_;
+    std::vector<RtpBufferRef> slots_;
+    std::vector<struct sockaddr_in> addrs_;
+    std::vector<socklen_t> addrLens_;
+#ifdef __linux__
+    std::vector<struct mmsghdr> msgs_;
+    std::vector<struct iovec> iovecs_;
+#endif
+    // Number of slots filled by the previous batch.
+    size_t used_ = 0;
+    UdpBatchStats stats_;
+};
+
+} // namespace
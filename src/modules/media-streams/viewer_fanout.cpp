@@ -0,0 +1,16 @@
+#include "viewer_fanout.hpp"
+
+#include <algorithm>
+
+namespace nabto {
+
+GopCachePtr createGopCache(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool, ViewerQueueConf& queueConf)
+{
+    if (!conf.enabled) {
+        return nullptr;
+    }
+    queueConf.capacity = std::max(queueConf.capacity, 2 * conf.maxPackets);
+    return GopCache::create(conf, isKeyframe, pool);
+}
+
+} // namespace
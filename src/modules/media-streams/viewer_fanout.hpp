@@ -0,0 +1,70 @@
+#pragma once
+
+#include "gop_cache.hpp"
+#include "rtp_buffer_pool.hpp"
+#include "viewer_queue.hpp"
+
+#include <nabto/nabto_device.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace nabto {
+
+// Called with a viewer disconnected by the DISCONNECT overflow policy.
+typedef std::function<void(NabtoDeviceConnectionRef ref)> ViewerDisconnectCallback;
+
+/**
+ * Create the GOP cache of a source, nullptr if it is disabled. The capacity
+ * of queueConf is raised so the send queues of the viewers hold a full GOP
+ * replay plus the live packets arriving meanwhile.
+ */
+GopCachePtr createGopCache(const GopCacheConf& conf, KeyframePredicate isKeyframe, RtpBufferPoolPtr pool, ViewerQueueConf& queueConf);
+
+/**
+ * Push a packet from a source to the send queues of its viewers.
+ *
+ * A viewer which has not had a packet yet gets the GOP cache replayed first,
+ * so it starts from the last keyframe instead of waiting for the next one.
+ * The packet is then added to the cache. Called on the ingest thread of the
+ * source, which is the only producer of the queues.
+ *
+ * When the DISCONNECT policy gives up on a viewer, its queue is closed and
+ * onDisconnect is called once, after the packet has been handled. The stream
+ * then removes the viewer as in removeConnection(). Removing the last viewer
+ * stops the source and waits for the ingest thread, so onDisconnect must post
+ * the removal to another thread, eg. with MediaSendWorker::post().
+ *
+ * @param viewers      snapshot of a SubscriberSet whose values have a ViewerQueuePtr named queue
+ * @param gopCache     cache of the source, nullptr if disabled
+ * @param buffer       the packet, shared by all the queues
+ * @param onDisconnect called for viewers disconnected by the DISCONNECT overflow policy
+ */
+template <typename T>
+void fanOutPacket(const std::vector<std::pair<NabtoDeviceConnectionRef, T> >& viewers, const GopCachePtr& gopCache, const RtpBufferRef& buffer, const ViewerDisconnectCallback& onDisconnect)
+{
+    std::vector<NabtoDeviceConnectionRef> disconnected;
+    for (const auto& [ref, viewer] : viewers) {
+        if (viewer.queue->closed()) {
+            // Removed since the snapshot was taken
+            continue;
+        }
+        if (gopCache != nullptr && !viewer.queue->started()) {
+            gopCache->replay(*viewer.queue);
+        }
+        // Sent by the send worker, so a slow viewer only delays itself.
+        if (!viewer.queue->push(buffer) && viewer.queue->stats().disconnected) {
+            viewer.queue->close();
+            disconnected.push_back(ref);
+        }
+    }
+    if (gopCache != nullptr) {
+        gopCache->add(buffer);
+    }
+    for (auto ref : disconnected) {
+        onDisconnect(ref);
+    }
+}
+
+} // namespace
@@ -0,0 +1,139 @@
+#include "viewer_queue.hpp"
+#include "media_send_worker.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+namespace nabto {
+
+ViewerQueuePtr ViewerQueue::create(const ViewerQueueConf& conf, MediaSendWorkerPtr worker, ViewerQueueSink sink, KeyframePredicate isKeyframe, uint64_t shardKey)
+{
+    return std::make_shared<ViewerQueue>(conf, worker, sink, isKeyframe, shardKey);
+}
+
+ViewerQueue::ViewerQueue(const ViewerQueueConf& conf, MediaSendWorkerPtr worker, ViewerQueueSink sink, KeyframePredicate isKeyframe, uint64_t shardKey)
+    : conf_(conf), worker_(worker), sink_(sink), isKeyframe_(isKeyframe), shard_(worker->shardFor(shardKey)), queue_(conf.capacity)
+{
+}
+
+ViewerQueue::~ViewerQueue()
+{
+    RtpBuffer* b;
+    while ((b = queue_.pop()) != nullptr) {
+        RtpBufferRef::adopt(b);
+    }
+}
+
+bool ViewerQueue::push(const RtpBufferRef& buffer)
+{
+    started_ = true;
+    if (closed_ || disconnected_) {
+        return false;
+    }
+    if (waitingForKeyframe_) {
+        if (isKeyframe_ && !isKeyframe_(buffer->data(), buffer->size())) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        waitingForKeyframe_ = false;
+    }
+
+    RtpBufferRef ref = buffer;
+    RtpBuffer* raw = ref.detach();
+    while (!queue_.push(raw)) {
+        if (conf_.policy == ViewerOverflowPolicy::DROP_OLDEST) {
+            RtpBuffer* oldest = queue_.evictOldest();
+            if (oldest != nullptr) {
+                RtpBufferRef::adopt(oldest);
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else if (conf_.policy == ViewerOverflowPolicy::DROP_UNTIL_KEYFRAME) {
+            flush();
+            if (isKeyframe_ && !isKeyframe_(raw->data(), raw->size())) {
+                waitingForKeyframe_ = true;
+                RtpBufferRef::adopt(raw);
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        } else {
+            flush();
+            disconnected_ = true;
+            RtpBufferRef::adopt(raw);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    schedule();
+    return true;
+}
+
+void ViewerQueue::close()
+{
+    closed_ = true;
+    // Let the worker drop whatever is queued.
+    schedule();
+}
+
+ViewerQueueStats ViewerQueue::stats() const
+{
+    ViewerQueueStats s;
+    s.depth = queue_.size();
+    s.capacity = queue_.capacity();
+    s.enqueued = enqueued_.load(std::memory_order_relaxed);
+    s.sent = sent_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.disconnected = disconnected_;
+    return s;
+}
+
+bool ViewerQueue::run(size_t maxPackets)
+{
+    for (size_t i = 0; i < maxPackets; i++) {
+        RtpBuffer* b = queue_.pop();
+        if (b == nullptr) {
+            break;
+        }
+        RtpBufferRef ref = RtpBufferRef::adopt(b);
+        if (closed_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        try {
+            sink_(ref);
+            sent_.fetch_add(1, std::memory_order_relaxed);
+        } catch (std::exception& ex) {
+            NPLOGE << "Failed to send queued packet: " << ex.what();
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // A packet pushed after the queue was found empty either sees
+    // scheduled_ cleared and schedules the queue itself, or is seen by the
+    // empty() check here. Both sides use seq_cst to rule out the case where
+    // neither does.
+    scheduled_.store(false, std::memory_order_seq_cst);
+    if (!queue_.empty() && !scheduled_.exchange(true, std::memory_order_seq_cst)) {
+        return true;
+    }
+    return false;
+}
+
+void ViewerQueue::flush()
+{
+    while (!queue_.empty()) {
+        RtpBuffer* b = queue_.evictOldest();
+        if (b != nullptr) {
+            RtpBufferRef::adopt(b);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void ViewerQueue::schedule()
+{
+    if (!scheduled_.exchange(true, std::memory_order_seq_cst)) {
+        worker_->schedule(shared_from_this());
+    }
+}
+
+} // namespace
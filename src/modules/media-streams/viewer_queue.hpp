@@ -0,0 +1,141 @@
+#pragma once
+
+#include "rtp_buffer_pool.hpp"
+#include "spsc_queue.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace nabto {
+
+class ViewerQueue;
+typedef std::shared_ptr<ViewerQueue> ViewerQueuePtr;
+
+class MediaSendWorker;
+typedef std::shared_ptr<MediaSendWorker> MediaSendWorkerPtr;
+
+/**
+ * What to do when a viewer does not keep up and its send queue is full.
+ */
+enum class ViewerOverflowPolicy {
+    // Drop the oldest queued packet to make room for the new one.
+    DROP_OLDEST,
+    // Drop everything queued and all new packets until the next keyframe.
+    DROP_UNTIL_KEYFRAME,
+    // Drop everything queued and stop sending to the viewer.
+    DISCONNECT
+};
+
+class ViewerQueueConf {
+public:
+    // Max number of packets queued for a viewer.
+    size_t capacity = 512;
+    ViewerOverflowPolicy policy = ViewerOverflowPolicy::DROP_OLDEST;
+};
+
+class ViewerQueueStats {
+public:
+    // Number of packets currently queued
+    size_t depth = 0;
+    size_t capacity = 0;
+    uint64_t enqueued = 0;
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+    bool disconnected = false;
+};
+
+// Sends a queued packet to the viewer. Called on a MediaSendWorker thread.
+typedef std::function<void(const RtpBufferRef& buffer)> ViewerQueueSink;
+
+// Returns true if decoding can start with this packet.
+typedef std::function<bool(const uint8_t* data, size_t length)> KeyframePredicate;
+
+/**
+ * Bounded send queue between a media source and a single viewer.
+ *
+ * The ingest thread pushes shared packet buffers into the queue, and a
+ * MediaSendWorker thread drains it into the viewer's track through the sink.
+ * A viewer with a slow transport thereby only fills its own queue instead of
+ * delaying every other viewer of the same source. When the queue is full, the
+ * overflow policy decides what is dropped.
+ *
+ * push() must only be called from one thread at a time (the ingest thread).
+ */
+class ViewerQueue : public std::enable_shared_from_this<ViewerQueue> {
+public:
+    /**
+     * @param conf       capacity and overflow policy
+     * @param worker     worker draining the queue
+     * @param sink       called for each packet on the worker
+     * @param isKeyframe used by DROP_UNTIL_KEYFRAME to find where to resume. If
+     *                   not set, sending resumes with the next packet.
+     * @param shardKey   queues with the same non-zero key are drained by the
+     *                   same worker thread unless it is stolen by an idle
+     *                   thread. Clients use the connection ref.
+     */
+    static ViewerQueuePtr create(const ViewerQueueConf& conf, MediaSendWorkerPtr worker, ViewerQueueSink sink, KeyframePredicate isKeyframe = nullptr, uint64_t shardKey = 0);
+
+    ViewerQueue(const ViewerQueueConf& conf, MediaSendWorkerPtr worker, ViewerQueueSink sink, KeyframePredicate isKeyframe, uint64_t shardKey);
+    ~ViewerQueue();
+
+    /**
+     * Queue a packet for the viewer.
+     *
+     * @return false if the viewer has been disconnected by the DISCONNECT
+     * policy or the queue is closed.
+     */
+    bool push(const RtpBufferRef& buffer);
+
+    /**
+     * Producer: false until the first packet is pushed. Used to replay cached
+     * packets to a new viewer before it gets live packets.
+     */
+    bool started() const { return started_; }
+
+    /**
+     * Stop sending to the viewer. Queued packets are dropped.
+     */
+    void close();
+
+    // True once close() has been called.
+    bool closed() const { return closed_; }
+
+    ViewerQueueStats stats() const;
+
+    /**
+     * Worker: send up to maxPackets queued packets.
+     *
+     * @return true if the queue must be scheduled again.
+     */
+    bool run(size_t maxPackets);
+
+    // Worker shard the queue is scheduled on
+    size_t shard() const { return shard_; }
+
+private:
+    void flush();
+    void schedule();
+
+    ViewerQueueConf conf_;
+    MediaSendWorkerPtr worker_;
+    ViewerQueueSink sink_;
+    KeyframePredicate isKeyframe_;
+    size_t shard_;
+
+    SpscPtrQueue<RtpBuffer> queue_;
+    // Set while the queue is in the worker's run list or being drained, so
+    // only one worker thread consumes from it at a time.
+    std::atomic<bool> scheduled_{false};
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> disconnected_{false};
+    // Only used by the producer
+    bool waitingForKeyframe_ = false;
+    bool started_ = false;
+
+    std::atomic<uint64_t> enqueued_{0};
+    std::atomic<uint64_t> sent_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+} // namespace
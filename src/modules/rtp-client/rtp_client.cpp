@@ -1,12 +1,18 @@
 #include "rtp_client.hpp"
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <iomanip> // For std::setfill and std::setw
 
 const int RTP_BUFFER_SIZE = 2048;
+const int RTP_HEADER_SLOT_SIZE = 16;
+// Max batches read per reactor wakeup before giving other sockets a turn.
+const int RTP_MAX_BATCHES_PER_WAKEUP = 8;
 
 
 namespace nabto {
@@ -18,18 +24,37 @@ RtpClientPtr RtpClient::create(const RtpClientConf& conf)
 
 RtpClient::RtpClient(const RtpClientConf& conf):
     trackId_(conf.trackId),
-    remoteHost_(conf.remoteHost),
     videoPort_(conf.port),
     remotePort_(conf.port+1),
-    negotiator_(conf.negotiator)
+    remoteHost_(conf.remoteHost),
+    reactor_(conf.reactor),
+    queueConf_(conf.sendQueue),
+    sendWorker_(conf.sendWorker),
+    negotiator_(conf.negotiator),
+    parameterSets_(conf.parameterSets),
+    bufferPool_(RtpBufferPool::create(RTP_BUFFER_SIZE)),
+    receiver_(bufferPool_, conf.batchSize),
+    receptionStats_(RtpReceptionStats::create(conf.negotiator != nullptr ? conf.negotiator->clockRate() : 90000))
 {
     if (conf.repacketizer != nullptr) {
         repack_ = conf.repacketizer;
     }
+    if (reactor_ == nullptr) {
+        reactor_ = IoReactor::defaultReactor();
+    }
+    if (sendWorker_ == nullptr) {
+        sendWorker_ = MediaSendWorker::defaultWorker();
+    }
+    auto negotiator = negotiator_;
+    gopCache_ = createGopCache(conf.gopCache,
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, bufferPool_, queueConf_);
 }
 
 RtpClient::~RtpClient()
 {
+    stop();
 }
 
 
@@ -68,9 +93,13 @@ void RtpClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media)
     int pt = pts.empty() ? 0 : pts[0];
 
     const rtc::SSRC ssrc = negotiator_->ssrc();
+    auto repacketizer = repack_->createPacketizer(media, ssrc, pt);
+    if (!parameterSets_.empty()) {
+        repacketizer->setParameterSets(parameterSets_);
+    }
     RtpTrack track = {
         media,
-        repack_->createPacketizer(media, ssrc, pt),
+        repacketizer,
         ssrc,
         negotiator_->payloadType(),
         pt
@@ -82,8 +111,21 @@ void RtpClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media)
 
 void RtpClient::addConnection(NabtoDeviceConnectionRef ref, RtpTrack track)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    mediaTracks_[ref] = track;
+    std::unique_lock<std::mutex> lock(mutex_);
+    waitForTeardown(lock);
+    auto existing = mediaTracks_.find(ref);
+    if (existing.has_value()) {
+        existing->queue->close();
+    }
+    auto negotiator = negotiator_;
+    track.queue = ViewerQueue::create(queueConf_, sendWorker_,
+        [track](const RtpBufferRef& buffer) {
+            track.send(buffer->data(), buffer->size());
+        },
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, ref);
+    mediaTracks_.insert(ref, track);
     NPLOGD << "Adding RTP connection pt " << track.srcPayloadType << "->" << track.dstPayloadType;
     if (stopped_) {
         start();
@@ -93,15 +135,17 @@ void RtpClient::addConnection(NabtoDeviceConnectionRef ref, RtpTrack track)
         // We are also gonna receive data
         NPLOGD << "    adding Track receiver";
        auto self = shared_from_this();
-       track.track->setReceiveCallback([self, track](uint8_t* buffer, size_t length) {
+       int srcPayloadType = track.srcPayloadType;
+       int dstPayloadType = track.dstPayloadType;
+       track.track->setReceiveCallback([self, srcPayloadType, dstPayloadType](uint8_t* buffer, size_t length) {
             auto rtp = reinterpret_cast<rtc::RtpHeader*>(buffer);
 
             uint8_t pt = rtp->payloadType();
-            if (pt != track.dstPayloadType) {
+            if (pt != dstPayloadType) {
                 return;
             }
 
-            rtp->setPayloadType(track.srcPayloadType);
+            rtp->setPayloadType(srcPayloadType);
 
             struct sockaddr_in addr = {};
             addr.sin_family = AF_INET;
@@ -116,26 +160,38 @@ void RtpClient::addConnection(NabtoDeviceConnectionRef ref, RtpTrack track)
 void RtpClient::removeConnection(NabtoDeviceConnectionRef ref)
 {
     NPLOGD << "Removing Nabto Connection from RTP";
-    size_t mediaTracksSize = 0;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-
-        try {
-            mediaTracks_.erase(ref);
-        }
-        catch (std::out_of_range& ex) {
-            NPLOGE << "Tried to remove non-existing connection";
-        }
-        mediaTracksSize = mediaTracks_.size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto track = mediaTracks_.find(ref);
+    if (track.has_value()) {
+        track->queue->close();
+    }
+    size_t mediaTracksSize = mediaTracks_.erase(ref);
+    if (mediaTracksSize == 0 && keepListening_) {
+        NPLOGD << "Connection was last one. Still listening";
     }
-    if (mediaTracksSize == 0) {
+    else if (mediaTracksSize == 0) {
         NPLOGD << "Connection was last one. Stopping";
-        stop();
+        stop(lock);
     }
     else {
         NPLOGD << "Still " << mediaTracksSize << " Connections. Not stopping";
     }
+}
 
+void RtpClient::keepListening(bool enabled)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    keepListening_ = enabled;
+    if (enabled) {
+        waitForTeardown(lock);
+        if (stopped_) {
+            start();
+        }
+        return;
+    }
+    if (mediaTracks_.size() == 0) {
+        stop(lock);
+    }
 }
 
 void RtpClient::start()
@@ -158,79 +214,127 @@ void RtpClient::start()
     int rcvBufSize = 212992;
     setsockopt(videoRtpSock_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&rcvBufSize),
         sizeof(rcvBufSize));
-    videoThread_ = std::thread(rtpVideoRunner, this);
+    fcntl(videoRtpSock_, F_SETFL, fcntl(videoRtpSock_, F_GETFL) | O_NONBLOCK);
+    SOCKET sock = videoRtpSock_;
+    readerReg_ = reactor_->addReader(sock, [this, sock]() { handleReadable(sock); });
 }
 
 void RtpClient::stop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop(lock);
+}
+
+void RtpClient::stop(std::unique_lock<std::mutex>& lock)
 {
     NPLOGD << "RtpClient stopped";
-    bool stopped = false;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (stopped_) {
-            stopped = stopped_;
-        } else {
-            stopped_ = true;
-            if (videoRtpSock_ != 0) {
-                shutdown(videoRtpSock_, SHUT_RDWR);
-                close(videoRtpSock_);
-            }
-        }
-    }
-    if (!stopped && videoThread_.joinable()) {
-        videoThread_.join();
+    for (const auto& [key, value] : *mediaTracks_.snapshot()) {
+        value.queue->close();
     }
     mediaTracks_.clear();
-    NPLOGD << "RtpClient thread joined";
+    if (stopped_) {
+        return;
+    }
+    stopped_ = true;
+    // Only the socket of this run is torn down. A start() meanwhile waits
+    // for it in waitForTeardown() since the port is still bound.
+    SOCKET sock = videoRtpSock_;
+    IoReactor::Registration reg = readerReg_;
+    videoRtpSock_ = 0;
+    readerReg_ = 0;
+    tearingDown_ = true;
+    lock.unlock();
+
+    // Waits for a running callback, so mutex_ must not be held.
+    reactor_->removeReader(reg);
+    if (sock != 0) {
+        close(sock);
+    }
+    if (gopCache_ != nullptr) {
+        gopCache_->clear();
+    }
+
+    lock.lock();
+    tearingDown_ = false;
+    teardownCond_.notify_all();
+    NPLOGD << "RtpClient removed from reactor";
 }
 
-void RtpClient::rtpVideoRunner(RtpClient* self)
+void RtpClient::waitForTeardown(std::unique_lock<std::mutex>& lock)
 {
-    char buffer[RTP_BUFFER_SIZE];
-    int len;
-    int count = 0;
-    struct sockaddr_in srcAddr;
-    socklen_t srcAddrLen = sizeof(srcAddr);
-    while (true) {
-        {
-            std::lock_guard<std::mutex> lock(self->mutex_);
-            if(self->stopped_) {
-                break;
-            }
-        }
-
-        len = recvfrom(self->videoRtpSock_, buffer, RTP_BUFFER_SIZE, 0, (struct sockaddr*)&srcAddr, &srcAddrLen);
-
-        if (len < 0) {
-            break;
-        }
+    teardownCond_.wait(lock, [this]() { return !tearingDown_; });
+}
 
-        count++;
-        if (count % 100 == 0) {
-            std::cout << ".";
+void RtpClient::handleReadable(SOCKET sock)
+{
+    for (int b = 0; b < RTP_MAX_BATCHES_PER_WAKEUP; b++) {
+        // Drain up to batchSize datagrams with one syscall into pooled buffers shared by all tracks.
+        int n = receiver_.receive(sock);
+        if (n < 0) {
+            NPLOGE << "Failed to read from RTP socket: " << strerror(errno);
+            return;
         }
-        if (count % 1600 == 0) {
-            std::cout << std::endl;
-            count = 0;
+        if (n == 0) {
+            return;
         }
-        if (len < sizeof(rtc::RtpHeader)) {
-            continue;
+
+        if (stopped_) {
+            return;
         }
+        auto arrival = std::chrono::steady_clock::now();
+        // One snapshot per batch. Connections joining or leaving never wait for the fan-out.
+        auto tracks = mediaTracks_.snapshot();
+        for (int i = 0; i < n; i++) {
+            const RtpBufferRef& buffer = receiver_.packet(i);
+            receptionStats_->rtpReceived(buffer->data(), buffer->size(), arrival);
+            packetCount_++;
+            if (packetCount_ % 100 == 0) {
+                std::cout << ".";
+            }
+            if (packetCount_ % 1600 == 0) {
+                std::cout << std::endl;
+                packetCount_ = 0;
+            }
+            if (buffer->size() < sizeof(rtc::RtpHeader)) {
+                continue;
+            }
 
-        {
-            std::lock_guard<std::mutex> lock(self->mutex_);
-            for (const auto& [key, value] : self->mediaTracks_) {
-                try {
-                    auto packets = value.repacketizer->handlePacket(std::vector<uint8_t>(buffer, buffer + len));
-                    for (auto p : packets) {
-                        value.track->send(p.data(), p.size());
+            fanOutPacket(*tracks, gopCache_, buffer, [this](NabtoDeviceConnectionRef ref) {
+                NPLOGW << "Viewer send queue overflowed, disconnecting viewer from RTP stream";
+                // Removing the last viewer stops the client, which waits for this callback.
+                std::weak_ptr<RtpClient> weak = weak_from_this();
+                sendWorker_->post([weak, ref]() {
+                    if (auto self = weak.lock()) {
+                        self->removeConnection(ref);
                     }
-                } catch (std::runtime_error& ex) {
-                    NPLOGE << "Failed to send on track: " << ex.what();
-                }
-            }
+                });
+            });
         }
     }
 }
 
+std::optional<ViewerQueueStats> RtpClient::queueStats(NabtoDeviceConnectionRef ref)
+{
+    auto track = mediaTracks_.find(ref);
+    if (!track.has_value()) {
+        return std::nullopt;
+    }
+    return track->queue->stats();
+}
+
+void RtpTrack::send(const uint8_t* packet, size_t length) const
+{
+    uint8_t header[RTP_HEADER_SLOT_SIZE];
+    size_t headerLen = repacketizer->rewriteHeader(packet, length, header, sizeof(header));
+    if (headerLen > 0) {
+        track->send(header, headerLen, packet + headerLen, length - headerLen);
+        return;
+    }
+
+    auto packets = repacketizer->handlePacket(std::vector<uint8_t>(packet, packet + length));
+    for (const auto& p : packets) {
+        track->send(p.data(), p.size());
+    }
+}
+
 } // namespace
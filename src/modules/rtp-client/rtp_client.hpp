@@ -3,13 +3,23 @@
 #include "rtp_track.hpp"
 
 #include <media-streams/media_stream.hpp>
+#include <media-streams/rtp_buffer_pool.hpp>
+#include <media-streams/udp_batch_receiver.hpp>
+#include <media-streams/subscriber_set.hpp>
+#include <media-streams/media_send_worker.hpp>
+#include <media-streams/gop_cache.hpp>
+#include <media-streams/viewer_fanout.hpp>
+#include <media-streams/rtp_reception_stats.hpp>
+#include <io-reactor/io_reactor.hpp>
 #include <track-negotiators/track_negotiator.hpp>
 #include <rtp-repacketizer/rtp_repacketizer.hpp>
 #include <sys/socket.h>
 
 typedef int SOCKET;
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 namespace nabto {
@@ -24,6 +34,18 @@ public:
     uint16_t port = 0;
     TrackNegotiatorPtr negotiator;
     RtpRepacketizerFactoryPtr repacketizer;
+    // Max number of datagrams read from the socket per syscall.
+    size_t batchSize = 32;
+    // Reactor reading the socket. If not set, IoReactor::defaultReactor() is used.
+    IoReactorPtr reactor = nullptr;
+    // Size and overflow policy of the send queue of each viewer.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued packets. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // Replay the current GOP to new viewers so they get a picture right away.
+    GopCacheConf gopCache;
+    // Out-of-band parameter sets of the source, see RtpRepacketizer::setParameterSets().
+    std::vector<std::vector<uint8_t>> parameterSets;
 };
 
 class RtpClient : public MediaStream, public std::enable_shared_from_this<RtpClient>
@@ -50,25 +72,59 @@ public:
 
     std::string getTrackId();
 
+    // Counters for the batched socket reads, eg. the average batch fill.
+    const UdpBatchStats& ingestStats() { return receiver_.stats(); }
+
+    // Send queue depth and drop counters of a viewer, if it is connected.
+    std::optional<ViewerQueueStats> queueStats(NabtoDeviceConnectionRef ref);
+
+    // Loss and jitter of the received stream, also used for RTCP receiver reports.
+    RtpReceptionStatsPtr receptionStats() { return receptionStats_; }
+
+    // Keep reading the socket while there are no viewers. Enabled by RTSP
+    // sessions while they are playing, so packets keep filling the GOP
+    // cache and the socket is open for as long as the server sends to it.
+    void keepListening(bool enabled);
+
 private:
     void start();
     void stop();
+    // Stop with mutex_ held by lock. The lock is released while the socket is torn down.
+    void stop(std::unique_lock<std::mutex>& lock);
+    // Wait until a stop() in another thread has closed the socket, so the port can be bound again.
+    void waitForTeardown(std::unique_lock<std::mutex>& lock);
     void addConnection(NabtoDeviceConnectionRef ref, RtpTrack track);
-    static void rtpVideoRunner(RtpClient* self);
+    void handleReadable(SOCKET sock);
 
     std::string trackId_;
-    bool stopped_ = true;
+    std::atomic<bool> stopped_{true};
+    std::atomic<bool> keepListening_{false};
+    // Serializes start/stop and adding and removing viewers, so removing the
+    // last viewer and stopping is one decision. Not used when forwarding packets.
     std::mutex mutex_;
+    // Set while stop() tears down a socket without holding mutex_.
+    bool tearingDown_ = false;
+    std::condition_variable teardownCond_;
 
-    std::map<NabtoDeviceConnectionRef, RtpTrack> mediaTracks_;
+    SubscriberSet<RtpTrack> mediaTracks_;
 
     uint16_t videoPort_ = 6000;
     uint16_t remotePort_ = 6002;
     std::string remoteHost_ = "127.0.0.1";
     SOCKET videoRtpSock_ = 0;
-    std::thread videoThread_;
+    IoReactorPtr reactor_;
+    IoReactor::Registration readerReg_ = 0;
+    ViewerQueueConf queueConf_;
+    MediaSendWorkerPtr sendWorker_;
+    // Only used on the reactor thread reading the socket. nullptr if disabled.
+    GopCachePtr gopCache_ = nullptr;
+    int packetCount_ = 0;
     TrackNegotiatorPtr negotiator_;
     RtpRepacketizerFactoryPtr repack_ = RtpRepacketizerFactory::create();
+    std::vector<std::vector<uint8_t>> parameterSets_;
+    RtpBufferPoolPtr bufferPool_;
+    UdpBatchReceiver receiver_;
+    RtpReceptionStatsPtr receptionStats_;
 
 };
 
@@ -5,6 +5,7 @@
 #include <rtc/rtc.hpp>
 #include <track-negotiators/track_negotiator.hpp>
 #include <rtp-repacketizer/rtp_repacketizer.hpp>
+#include <media-streams/viewer_queue.hpp>
 
 #include <memory>
 
@@ -13,11 +14,22 @@ namespace nabto {
 class RtpTrack
 {
 public:
+    /**
+     * Forward a packet received from the RTP source to this track.
+     *
+     * If the repacketizer allows it, only the RTP header is rewritten into a
+     * small header slot and the payload is sent directly from `packet`.
+     * Otherwise the packet is passed through the repacketizer.
+     */
+    void send(const uint8_t* packet, size_t length) const;
+
     MediaTrackPtr track;
     RtpRepacketizerPtr repacketizer;
     rtc::SSRC ssrc;
     int srcPayloadType = 0;
     int dstPayloadType = 0;
+    // Packets for this track are queued here and sent by a MediaSendWorker.
+    ViewerQueuePtr queue = nullptr;
 };
 
 } // namespace
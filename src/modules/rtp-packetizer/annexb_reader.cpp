@@ -0,0 +1,134 @@
+#include "annexb_reader.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace nabto {
+
+const size_t NO_START_CODE = SIZE_MAX;
+
+void AnnexBReader::append(const uint8_t* data, size_t length)
+{
+    // Consumed data is only removed once it is at least half the buffer, so
+    // every byte is moved a bounded number of times.
+    if (nalStart_ > 0 && nalStart_ >= buffer_.size() - nalStart_) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + nalStart_);
+        scanPos_ -= std::min(scanPos_, nalStart_);
+        nalStart_ = 0;
+    }
+    buffer_.insert(buffer_.end(), data, data + length);
+}
+
+bool AnnexBReader::next(const uint8_t** nal, size_t* length, bool* longStartCode)
+{
+    if (syncing_ && !sync()) {
+        return false;
+    }
+
+    while (true) {
+        // search for the start code of the next NAL unit
+        size_t sep = findStartCode(nalStart_ + 4);
+        if (sep == NO_START_CODE) {
+            break;
+        }
+
+        // nalStart_ is at a short start code or at the zero byte of a long one.
+        bool isLong = buffer_[nalStart_ + 2] == 0x00;
+        if (buffer_[sep-1] == 0x00) {
+            // The next NAL unit has a long start code
+            sep--;
+        }
+
+        size_t nalBegin = nalStart_ + (isLong ? 4 : 3);
+        size_t nalEnd = sep;
+        while (nalEnd > nalBegin && buffer_[nalEnd-1] == 0x00) { nalEnd--; }
+        nalStart_ = sep;
+
+        if (nalEnd > nalBegin) {
+            *nal = buffer_.data() + nalBegin;
+            *length = nalEnd - nalBegin;
+            *longStartCode = isLong;
+            return true;
+        }
+    }
+
+    if (buffer_.size() - nalStart_ > maxNalSize_) {
+        NPLOGE << "No start code found in " << buffer_.size() - nalStart_ << " bytes, dropping data";
+        nalStart_ = buffer_.size() - 3;
+        syncing_ = true;
+    }
+    return false;
+}
+
+void AnnexBReader::split(const uint8_t* data, size_t length, const std::function<void(const uint8_t* nal, size_t length)>& cb)
+{
+    size_t nalBegin = NO_START_CODE;
+    size_t pos = 2;
+    while (true) {
+        const uint8_t* hit = pos < length ? (const uint8_t*)memchr(data + pos, 0x01, length - pos) : NULL;
+        size_t one = hit != NULL ? hit - data : length;
+        if (hit != NULL && (data[one-1] != 0x00 || data[one-2] != 0x00)) {
+            pos = one + 1;
+            continue;
+        }
+        if (nalBegin != NO_START_CODE) {
+            // The zero byte of a long start code is trimmed as a trailing zero.
+            size_t end = hit != NULL ? one - 2 : length;
+            while (end > nalBegin && data[end-1] == 0x00) { end--; }
+            if (end > nalBegin) {
+                cb(data + nalBegin, end - nalBegin);
+            }
+        }
+        if (hit == NULL) {
+            return;
+        }
+        nalBegin = one + 1;
+        pos = nalBegin + 2;
+    }
+}
+
+size_t AnnexBReader::findStartCode(size_t from)
+{
+    // A start code is 0x00 0x00 0x01. 0x01 is rare in coded data, so memchr
+    // for it and check the two bytes before each hit. Each byte is scanned once
+    // as scanPos_ remembers where the last call stopped.
+    size_t pos = std::max(scanPos_, from + 2);
+    const uint8_t* data = buffer_.data();
+    size_t size = buffer_.size();
+    while (pos < size) {
+        const void* hit = memchr(data + pos, 0x01, size - pos);
+        if (hit == NULL) {
+            break;
+        }
+        pos = (const uint8_t*)hit - data;
+        if (data[pos-1] == 0x00 && data[pos-2] == 0x00) {
+            scanPos_ = pos + 1;
+            return pos - 2;
+        }
+        pos++;
+    }
+    scanPos_ = size;
+    return NO_START_CODE;
+}
+
+bool AnnexBReader::sync()
+{
+    size_t sep = findStartCode(nalStart_);
+    if (sep == NO_START_CODE) {
+        // Keep the last bytes, they may be the beginning of a start code.
+        if (buffer_.size() - nalStart_ > 3) {
+            nalStart_ = buffer_.size() - 3;
+        }
+        return false;
+    }
+    if (sep > nalStart_ && buffer_[sep-1] == 0x00) {
+        sep--;
+    }
+    nalStart_ = sep;
+    syncing_ = false;
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace nabto {
+
+/**
+ * Splits a byte stream in the Annex B format of H.264 and H.265 into NAL
+ * units. NAL units are separated by the start code 0x000001, optionally with
+ * a leading zero byte (the long start code).
+ *
+ * Data is appended as it is read, and each byte is scanned for start codes
+ * only once regardless of how the data is chunked. Data before the first
+ * start code is skipped, and a NAL unit growing beyond maxNalSize is dropped
+ * until the next start code.
+ */
+class AnnexBReader {
+public:
+    AnnexBReader(size_t maxNalSize) : maxNalSize_(maxNalSize) {}
+
+    /**
+     * Append data from the byte stream. Invalidates NAL units returned by
+     * next().
+     */
+    void append(const uint8_t* data, size_t length);
+
+    /**
+     * Get the next complete NAL unit without start code and trailing zero
+     * bytes. A NAL unit is complete once the start code after it is read.
+     *
+     * @param nal            set to the NAL unit, valid until append() is called
+     * @param length         set to the length of the NAL unit
+     * @param longStartCode  set to true if the NAL unit had the long start code
+     * @return false if there is no complete NAL unit yet.
+     */
+    bool next(const uint8_t** nal, size_t* length, bool* longStartCode);
+
+    /**
+     * Split a buffer holding whole NAL units in the Annex B format, such as
+     * an access unit, without copying it. cb is called with each NAL unit
+     * without start code and trailing zero bytes.
+     */
+    static void split(const uint8_t* data, size_t length, const std::function<void(const uint8_t* nal, size_t length)>& cb);
+
+private:
+    // Find the next start code at or after `from`, resuming where the last scan stopped.
+    size_t findStartCode(size_t from);
+    // Skip data up to the first start code. Returns false if none was found yet.
+    bool sync();
+
+    size_t maxNalSize_;
+    // Unconsumed data is buffer_[nalStart_, buffer_.size()). nalStart_ is the
+    // start code of the NAL unit currently being read.
+    std::vector<uint8_t> buffer_;
+    size_t nalStart_ = 0;
+    // Next position which can hold the last byte (0x01) of a start code.
+    // Bytes before it have been scanned already.
+    size_t scanPos_ = 0;
+    // True until a start code has been seen, or after dropping data.
+    bool syncing_ = true;
+};
+
+} // namespace
@@ -0,0 +1,245 @@
+#include "av1_packetizer.hpp"
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * This can be used to packetize an AV1 bitstream in the low overhead bitstream format of "AV1 Bitstream & Decoding Process Specification" https://aomediacodec.github.io/av1-spec/
+ * into RTP packets as described in "RTP Payload Format For AV1" https://aomediacodec.github.io/av1-rtp-spec/
+ */
+
+namespace nabto {
+
+const uint8_t AV1_OBU_SEQUENCE_HEADER = 1;
+const uint8_t AV1_OBU_TEMPORAL_DELIMITER = 2;
+const uint8_t AV1_OBU_TILE_LIST = 8;
+const uint8_t AV1_OBU_PADDING = 15;
+
+// OBU header bits
+const uint8_t AV1_OBU_FORBIDDEN_BIT = 0x80;
+const uint8_t AV1_OBU_EXTENSION_FLAG = 0x04;
+const uint8_t AV1_OBU_HAS_SIZE_FIELD = 0x02;
+
+// A leb128 value is at most 8 bytes
+const size_t AV1_LEB128_MAX_SIZE = 8;
+
+static uint8_t obuType(uint8_t header) { return (header >> 3) & 0x0F; }
+
+/**
+ * Read a leb128 value. Returns the number of bytes read, or 0 if the value is
+ * not complete within length bytes.
+ */
+static size_t readLeb128(const uint8_t* data, size_t length, uint64_t* value)
+{
+    *value = 0;
+    for (size_t i = 0; i < length && i < AV1_LEB128_MAX_SIZE; i++) {
+        *value |= (uint64_t)(data[i] & 0x7F) << (i * 7);
+        if (!(data[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t leb128Size(size_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t writeLeb128(uint8_t* data, size_t value)
+{
+    size_t i = 0;
+    while (value >= 0x80) {
+        data[i++] = (uint8_t)(value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    data[i++] = (uint8_t)value;
+    return i;
+}
+
+AV1Packetizer::AV1Packetizer(uint32_t ssrc, std::string& trackId, int pt, const AV1PacketizerConf& conf)
+    : conf_(conf), clock_(conf.timestampMode, conf.frameRate)
+{
+    if (conf_.mtu < AV1_MIN_MTU) {
+        conf_.mtu = AV1_MIN_MTU;
+    }
+    rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, 90000);
+    slot_.resize(RTP_HEADER_SIZE + conf_.mtu);
+    // The first byte of the payload is the aggregation header
+    packetEnd_ = RTP_HEADER_SIZE + 1;
+}
+
+std::vector<std::vector<uint8_t> > AV1Packetizer::incoming(const std::vector<uint8_t>& data)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    incoming(data.data(), data.size(), [&ret](const uint8_t* packet, size_t length) {
+        ret.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return ret;
+}
+
+void AV1Packetizer::incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    buffer_.insert(buffer_.end(), data, data + length);
+
+    while (bufferStart_ < buffer_.size()) {
+        const uint8_t* p = buffer_.data() + bufferStart_;
+        size_t available = buffer_.size() - bufferStart_;
+
+        if (syncing_) {
+            // A temporal delimiter OBU with its size field is 0x12 0x00 and
+            // starts every temporal unit.
+            const uint8_t td[] = { (AV1_OBU_TEMPORAL_DELIMITER << 3) | AV1_OBU_HAS_SIZE_FIELD, 0x00 };
+            const uint8_t* found = std::search(p, p + available, td, td + sizeof(td));
+            bufferStart_ += found - p;
+            if (found == p + available) {
+                // Keep a possible first byte of the delimiter
+                if (available > 0 && p[available - 1] == td[0]) {
+                    bufferStart_--;
+                }
+                break;
+            }
+            syncing_ = false;
+            continue;
+        }
+
+        uint8_t header = p[0];
+        size_t headerSize = (header & AV1_OBU_EXTENSION_FLAG) ? 2 : 1;
+        if (available <= headerSize) {
+            break;
+        }
+        uint64_t size = 0;
+        size_t lebSize = readLeb128(p + headerSize, available - headerSize, &size);
+        bool invalid = (header & AV1_OBU_FORBIDDEN_BIT) || !(header & AV1_OBU_HAS_SIZE_FIELD) || size > AV1_MAX_OBU_SIZE ||
+            (lebSize == 0 && available - headerSize >= AV1_LEB128_MAX_SIZE);
+        if (invalid) {
+            NPLOGE << "Invalid AV1 OBU in stream, skipping to the next temporal unit";
+            // The packet being written belongs to a broken temporal unit
+            packetEnd_ = RTP_HEADER_SIZE + 1;
+            elementCount_ = 0;
+            continuation_ = false;
+            bufferStart_++;
+            syncing_ = true;
+            continue;
+        }
+        if (lebSize == 0 || available < headerSize + lebSize + size) {
+            break;
+        }
+
+        // Sent OBUs have no size field, the RTP aggregation has its own length fields
+        uint8_t obuHeader[2] = { (uint8_t)(header & ~AV1_OBU_HAS_SIZE_FIELD), p[1] };
+        handleObu(obuHeader, headerSize, p + headerSize + lebSize, (size_t)size, cb);
+        bufferStart_ += headerSize + lebSize + size;
+    }
+
+    if (bufferStart_ == buffer_.size()) {
+        buffer_.clear();
+        bufferStart_ = 0;
+    } else if (bufferStart_ > buffer_.size() / 2) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + bufferStart_);
+        bufferStart_ = 0;
+    }
+}
+
+void AV1Packetizer::flush(const RtpPacketCallback& cb)
+{
+    sendPacket(true, false, cb);
+}
+
+void AV1Packetizer::handleObu(const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize, const RtpPacketCallback& cb)
+{
+    uint8_t type = obuType(header[0]);
+    if (type == AV1_OBU_TEMPORAL_DELIMITER) {
+        // The previous temporal unit is complete
+        sendPacket(true, false, cb);
+        rtpConf_->timestamp = clock_.nextAccessUnit(rtpConf_->startTimestamp, rtpConf_->timestamp);
+        firstPacket_ = true;
+        sequenceHeader_ = false;
+        return;
+    }
+    if (type == AV1_OBU_TILE_LIST || type == AV1_OBU_PADDING) {
+        return;
+    }
+    if (type == AV1_OBU_SEQUENCE_HEADER) {
+        sequenceHeader_ = true;
+    }
+    addObu(header, headerSize, payload, payloadSize, cb);
+}
+
+void AV1Packetizer::addObu(const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize, const RtpPacketCallback& cb)
+{
+    size_t total = headerSize + payloadSize;
+    size_t offset = 0;
+    while (true) {
+        size_t available = slot_.size() - packetEnd_;
+        size_t remaining = total - offset;
+        size_t len;
+        if (leb128Size(remaining) + remaining <= available) {
+            len = remaining;
+        } else if (available >= 4) {
+            // Fill the packet and continue the OBU in the next one
+            len = available - leb128Size(available);
+        } else {
+            // Too little room left to be worth splitting the OBU
+            sendPacket(false, false, cb);
+            continue;
+        }
+
+        uint8_t* p = slot_.data();
+        lastElementStart_ = packetEnd_;
+        lastElementLengthSize_ = writeLeb128(p + packetEnd_, len);
+        packetEnd_ += lastElementLengthSize_;
+        // The element is the part [offset, offset + len) of the header followed by the payload
+        size_t end = offset + len;
+        if (offset < headerSize) {
+            size_t n = std::min(headerSize, end) - offset;
+            memcpy(p + packetEnd_, header + offset, n);
+            packetEnd_ += n;
+            offset += n;
+        }
+        if (offset < end) {
+            memcpy(p + packetEnd_, payload + offset - headerSize, end - offset);
+            packetEnd_ += end - offset;
+            offset = end;
+        }
+        elementCount_++;
+
+        if (offset == total) {
+            return;
+        }
+        sendPacket(false, true, cb);
+    }
+}
+
+void AV1Packetizer::sendPacket(bool marker, bool continues, const RtpPacketCallback& cb)
+{
+    if (elementCount_ == 0) {
+        return;
+    }
+    uint8_t* p = slot_.data();
+    uint8_t w = 0;
+    if (elementCount_ <= 3) {
+        // With the element count in W, the last element has no length field
+        w = (uint8_t)elementCount_;
+        size_t dataStart = lastElementStart_ + lastElementLengthSize_;
+        memmove(p + lastElementStart_, p + dataStart, packetEnd_ - dataStart);
+        packetEnd_ -= lastElementLengthSize_;
+    }
+    // Aggregation header: Z, Y, W and N
+    p[RTP_HEADER_SIZE] = (continuation_ ? 0x80 : 0) | (continues ? 0x40 : 0) | (w << 4) | (firstPacket_ && sequenceHeader_ ? 0x08 : 0);
+    writeRtpFixedHeader(p, rtpConf_->payloadType, marker, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+    cb(p, packetEnd_);
+
+    packetEnd_ = RTP_HEADER_SIZE + 1;
+    elementCount_ = 0;
+    continuation_ = continues;
+    firstPacket_ = false;
+}
+
+} // namespace
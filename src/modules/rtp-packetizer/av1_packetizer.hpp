@@ -0,0 +1,124 @@
+#pragma once
+
+#include "rtp_packetizer.hpp"
+#include "video_clock.hpp"
+
+#include <rtc/rtppacketizationconfig.hpp>
+
+namespace nabto {
+
+// Default max RTP payload size of a packet
+const size_t AV1_MTU = 1200;
+// Smallest MTU accepted by AV1Packetizer
+const size_t AV1_MIN_MTU = 64;
+// Max size of an OBU. Larger OBUs cannot be buffered and the stream is dropped
+// until the next temporal delimiter.
+const size_t AV1_MAX_OBU_SIZE = 4 * 1024 * 1024;
+
+class AV1PacketizerConf {
+public:
+    // Max RTP payload size of a packet including the aggregation header.
+    size_t mtu = AV1_MTU;
+    VideoTimestampMode timestampMode = VideoTimestampMode::CLOCK;
+    // Frame rate used by FRAME_RATE, and by EXPLICIT for temporal units
+    // without a timestamp.
+    double frameRate = 30;
+    // The end of a temporal unit is only known when the temporal delimiter of
+    // the next one is read. If set, the last packet of a temporal unit is
+    // sent when no data has arrived for this long instead. Only use this if
+    // the producer writes whole temporal units at once. Zero disables this.
+    std::chrono::milliseconds idleFlush{0};
+};
+
+/**
+ * Packetizes an AV1 bitstream in the low overhead bitstream format (AV1
+ * specification section 5.2) into RTP packets following the RTP Payload
+ * Format For AV1. This is the format written by most hardware encoders and by
+ * ffmpeg with `-f obu`. Every OBU must have its size field set.
+ *
+ * OBUs of a temporal unit are packed into packets of up to the MTU, splitting
+ * OBUs across packets where needed. Temporal delimiter, tile list and padding
+ * OBUs are not sent, and the size field of the sent OBUs is removed. The last
+ * packet of a temporal unit gets the marker bit.
+ */
+class AV1Packetizer : public RtpPacketizer
+{
+public:
+    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt, const AV1PacketizerConf& conf = AV1PacketizerConf()) {
+        return std::make_shared<AV1Packetizer>(ssrc, trackId, pt, conf);
+    }
+
+    AV1Packetizer(uint32_t ssrc, std::string& trackId, int pt, const AV1PacketizerConf& conf);
+
+    std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data);
+
+    void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+
+    std::chrono::milliseconds idleFlushTimeout() const { return conf_.idleFlush; }
+
+    void flush(const RtpPacketCallback& cb);
+
+    /**
+     * Set the presentation time of the next temporal unit in the stream which
+     * has not got one yet. Only used with VideoTimestampMode::EXPLICIT. Must
+     * be called on the thread calling incoming(), before the data of the
+     * temporal unit is passed to it.
+     */
+    void addFrameTimestamp(std::chrono::microseconds pts) { clock_.addFrameTimestamp(pts); }
+
+private:
+    // Handle a complete OBU. header is the OBU header without the size field.
+    void handleObu(const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize, const RtpPacketCallback& cb);
+    // Add an OBU to the packet in slot_, sending packets as they fill up.
+    void addObu(const uint8_t* header, size_t headerSize, const uint8_t* payload, size_t payloadSize, const RtpPacketCallback& cb);
+    // Send the packet in slot_ if it holds any OBU elements. continues is
+    // true if the last OBU element continues in the next packet.
+    void sendPacket(bool marker, bool continues, const RtpPacketCallback& cb);
+
+    AV1PacketizerConf conf_;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
+    VideoClock clock_;
+
+    // Unconsumed data is buffer_[bufferStart_, buffer_.size())
+    std::vector<uint8_t> buffer_;
+    size_t bufferStart_ = 0;
+    // Data is skipped until a temporal delimiter while set. Set at the start
+    // of the stream and after an invalid OBU.
+    bool syncing_ = true;
+
+    // The packet being written. It is sent when the next OBU does not fit or
+    // the temporal unit ends.
+    std::vector<uint8_t> slot_;
+    size_t packetEnd_ = 0;
+    size_t elementCount_ = 0;
+    // Start and length field size of the last OBU element in slot_
+    size_t lastElementStart_ = 0;
+    size_t lastElementLengthSize_ = 0;
+    // Set if the first OBU element in slot_ continues an OBU from the
+    // previous packet.
+    bool continuation_ = false;
+    // True until the first packet of the temporal unit is sent.
+    bool firstPacket_ = true;
+    // True if the temporal unit has a sequence header, so its first packet
+    // starts a coded video sequence.
+    bool sequenceHeader_ = false;
+};
+
+class AV1PacketizerFactory : public RtpPacketizerFactory
+{
+public:
+    static RtpPacketizerFactoryPtr create(const std::string& trackId, const AV1PacketizerConf& conf = AV1PacketizerConf()) {
+        return std::make_shared<AV1PacketizerFactory>(trackId, conf);
+    }
+    AV1PacketizerFactory(const std::string& trackId, const AV1PacketizerConf& conf): RtpPacketizerFactory(trackId), conf_(conf) { }
+    RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) {
+        return AV1Packetizer::create(ssrc, trackId_, pt, conf_);
+    }
+    size_t maxPacketSize() const {
+        return RTP_HEADER_SIZE + std::max(conf_.mtu, AV1_MIN_MTU);
+    }
+private:
+    AV1PacketizerConf conf_;
+};
+
+} // namespace
@@ -4,196 +4,310 @@
 #include <nabto/nabto_device_webrtc.hpp>
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 /*
  * This can be used to packetize a H264 byte-stream conforming to the annex B specifications in "H.264 : Advanced video coding for generic audiovisual services" https://www.itu.int/rec/T-REC-H.264-202108-I/en
- * This means NAL units must be separated by the "start code prefix". H264 feeds using the length separator (MP4) will not work.
+ * By default NAL units must be separated by the "start code prefix". H264 feeds using the length separator (MP4) must set H264StreamFormat::LENGTH_PREFIXED, LENGTH_PREFIXED_FRAMES or LENGTH_PREFIXED_TIMESTAMPED_FRAMES.
  */
 
 namespace nabto {
 
-std::vector<uint8_t> shortSep = { 0x00, 0x00, 0x01 };
-
-const int MTU = 1200;
+const uint8_t NAL_SLICE = 1;
 const uint8_t NAL_IDR = 5;
+const uint8_t NAL_SEI = 6;
 const uint8_t NAL_SPS = 7;
 const uint8_t NAL_PPS = 8;
 const uint8_t NAL_AUD = 9;
+const uint8_t NAL_STAPA = 24;
 const uint8_t NAL_FUA = 28;
-const uint8_t RTP_MARKER_MASK = 0x80;
+const uint8_t NAL_F_MASK = 0b10000000;
+const uint8_t NAL_NRI_MASK = 0b01100000;
 
-std::vector<std::vector<uint8_t> > NalUnit::packetize()
+void NalUnit::assign(const uint8_t* data, size_t length)
 {
-    std::vector<std::vector<uint8_t> > ret;
+    data_.assign(data, data + length);
+    header_ = length > 0 ? data[0] : 0;
+    shouldMark_ = false;
+}
 
-    if (empty()) {
-        NPLOGD << "packetizing empty packet";
-        return ret;
-    }
+static size_t writeRtpHeader(rtc::RtpPacketizationConfig& rtpConf, uint8_t* slot, bool marker)
+{
+    return writeRtpFixedHeader(slot, rtpConf.payloadType, marker, rtpConf.sequenceNumber++, rtpConf.timestamp, rtpConf.ssrc);
+}
 
-    rtc::message_vector vec;
-    size_t i = 0;
-    uint8_t nalHead = data_.front();
+static uint8_t setStart(bool isSet, uint8_t type) { return (type & 0x7F) | (isSet << 7); }
+static uint8_t setEnd(bool isSet, uint8_t type) { return (type & 0b1011'1111) | (isSet << 6); }
+
+/**
+ * Packetize a NAL unit as a single RTP packet or as FU-A fragments written
+ * one at a time into slot.
+ */
+static void packetizeNal(rtc::RtpPacketizationConfig& rtpConf, size_t mtu, const uint8_t* data, size_t size, bool marker, uint8_t* slot, const RtpPacketCallback& cb)
+{
+    uint8_t nalHead = data[0];
 
-    if (data_.size() < MTU) {
+    if (size <= mtu) {
         // NAL unit fits in single packet
-        uint8_t* src = data_.data() + i;
-        auto msg = std::make_shared<rtc::Message>((std::byte*)src, (std::byte*)(src + data_.size() - i));
-        vec.push_back(msg);
-    }
-    else {
-        // NAL unit must be split into fragments
-        bool first = true;
-        while (i + 1 < data_.size()) {
-            std::vector<uint8_t> tmp;
-            size_t len = i + 1 + MTU > data_.size() ? data_.size() - i - 1 : MTU;
-            std::vector<uint8_t> fragment = { data_.begin() + i + 1, data_.begin() + i + 1 + len };
-
-            // FU identifier becomes the NAL header, so we must keep NRI from the original NAL unit and change the type to FU-A
-            uint8_t fuIndentifier = (nalHead & 0b11100000) + NAL_FUA;
-            // FU Header stores the original NAL type in the 5 lowest bits
-            uint8_t fuHeader = nalHead & 0b00011111;
-
-            // Set FU Header start/end markers
-            fuHeader = setStart(first, fuHeader);
-            first = false;
-            fuHeader = setEnd((len != MTU), fuHeader);
-
-            tmp.push_back(fuIndentifier);
-            tmp.push_back(fuHeader);
-
-            tmp.insert(tmp.end(), fragment.begin(), fragment.end());
-
-            uint8_t* src = tmp.data();
-            auto msg = std::make_shared<rtc::Message>((std::byte*)src, (std::byte*)(src + tmp.size()));
-            vec.push_back(msg);
-            i += len;
-        }
+        size_t headerLen = writeRtpHeader(rtpConf, slot, marker);
+        memcpy(slot + headerLen, data, size);
+        cb(slot, headerLen + size);
+        return;
     }
 
-    // Insert RTP headers
-    rtp_->outgoing(vec, nullptr);
-
-    for (size_t i = 0; i < vec.size()-1; i++) {
-        ret.push_back(std::vector<uint8_t>((uint8_t*)vec[i]->data(), (uint8_t*)(vec[i]->data() + vec[i]->size())));
+    // NAL unit must be split into fragments
+    // FU identifier becomes the NAL header, so we must keep NRI from the original NAL unit and change the type to FU-A
+    uint8_t fuIndentifier = (nalHead & 0b11100000) + NAL_FUA;
+    size_t fragmentSize = mtu - 2;
+    size_t i = 0;
+    bool first = true;
+    while (i + 1 < size) {
+        size_t len = i + 1 + fragmentSize > size ? size - i - 1 : fragmentSize;
+        bool last = i + 1 + len >= size;
+
+        // FU Header stores the original NAL type in the 5 lowest bits
+        uint8_t fuHeader = nalHead & 0b00011111;
+
+        // Set FU Header start/end markers
+        fuHeader = setStart(first, fuHeader);
+        first = false;
+        fuHeader = setEnd(last, fuHeader);
+
+        size_t headerLen = writeRtpHeader(rtpConf, slot, last && marker);
+        slot[headerLen] = fuIndentifier;
+        slot[headerLen + 1] = fuHeader;
+        memcpy(slot + headerLen + 2, data + i + 1, len);
+        cb(slot, headerLen + 2 + len);
+        i += len;
     }
+}
 
-    auto last = std::vector<uint8_t>((uint8_t*)vec.back()->data(), (uint8_t*)(vec.back()->data() + vec.back()->size()));
-
-    if (shouldMark_) {
-        last[1] = last[1] | RTP_MARKER_MASK;
+void NalUnit::packetize(uint8_t* slot, const RtpPacketCallback& cb)
+{
+    if (empty()) {
+        NPLOGD << "packetizing empty packet";
+        return;
     }
-    ret.push_back(last);
-    return ret;
+    packetizeNal(*rtpConf_, mtu_, data_.data(), data_.size(), shouldMark_, slot, cb);
 }
 
 std::vector<std::vector<uint8_t> > H264Packetizer::incoming(const std::vector<uint8_t>& data)
 {
-    buffer_.insert(buffer_.end(), data.begin(), data.end());
     std::vector<std::vector<uint8_t> > ret;
+    incoming(data.data(), data.size(), [&ret](const uint8_t* packet, size_t length) {
+        ret.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return ret;
+}
 
-    bool isShort = false; // True if current NAL unit uses Short Separator
-    if (buffer_.size() > 3 && buffer_.at(2) == 0x01) {
-        // buffer starts with short separator: 0x00, 0x00, 0x01
-        isShort = true;
+void H264Packetizer::incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    if (conf_.format == H264StreamFormat::ANNEX_B) {
+        incomingAnnexB(data, length, cb);
+    } else {
+        incomingLengthPrefixed(data, length, cb);
     }
+}
 
-    while(1){
-        // search for a second nal unit separator
-        auto it = std::search(buffer_.begin() + 4, buffer_.end(), shortSep.begin(), shortSep.end());
-
-        if (it != buffer_.end()) {
-            // If we found a separator. (if long exists, so does the short)
-            bool nextShort = true;
-            if (*(it-1) == 0x00) {
-                it--;
-                nextShort = false; // we found a long separator
-            }
-
-            auto tmp = std::vector<uint8_t>(buffer_.begin()+(isShort ? 3 : 4), it);
-            while(tmp.back() == 0x00) { tmp.pop_back(); }
-
-            NalUnit nal(tmp, packetizer_);
-
-            std::vector<std::vector<uint8_t>> packets;
-            if (!isShort && !lastNal_.isPsOrAUD()) {
-                /* Long separators are used for NAL units when:
-                 *  - NAL unit type is SPS or PPS
-                 *  - The NAL unit is the first in an Access Unit (AU)
-                 *
-                 * Since parameter sets must come before the encoded video frame, they will start a new AU unless a new AU was just started.
-                 *
-                 * Since we insert AUs if the byte stream does not have them, we should start a new AU on long separators unless lastNal_ is one of AUD, PPS, SPS.
-                 */
-
-                // On new AU, last NAL should be marked and packetized
-                lastNal_.setMarker(true);
-                packets = lastNal_.packetize();
-
-                // We tick RTP timestamp between AUs
-                updateTimestamp();
-
-                if (!nal.isNalType(NAL_AUD)) {
-                    // We start new AU, but stream is not using AUD
-                    // so we add AUD manually.
+void H264Packetizer::incomingAnnexB(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    reader_.append(data, length);
+
+    const uint8_t* nal;
+    size_t nalLength;
+    bool longStartCode;
+    while (reader_.next(&nal, &nalLength, &longStartCode)) {
+        if (longStartCode && !lastNal_.isPsOrAUD()) {
+            /* Long separators are used for NAL units when:
+             *  - NAL unit type is SPS or PPS
+             *  - The NAL unit is the first in an Access Unit (AU)
+             *
+             * Since parameter sets must come before the encoded video frame, they will start a new AU unless a new AU was just started.
+             */
+
+            // On new AU, last NAL should be marked and packetized
+            lastNal_.setMarker(true);
+            sendNal(lastNal_.data(), lastNal_.size(), lastNal_.marker(), cb);
+
+            // We tick RTP timestamp between AUs
+            updateTimestamp();
+        } else {
+            // Packetize last NAL since we know it does not need to be marked
+            sendNal(lastNal_.data(), lastNal_.size(), lastNal_.marker(), cb);
+        }
 
-                    ret.insert(ret.end(), packets.begin(), packets.end());
-                    std::vector<uint8_t> accessUnit = { 0x00, 0x00, 0x00, 0x01, 0x09 };
+        // The current NAL unit is packetized when we know if it ends the AU
+        lastNal_.assign(nal, nalLength);
+    }
+}
 
-                    accessUnit.push_back(nal.makeAudPayload());
-                    lastNal_ = NalUnit(accessUnit, packetizer_);
+void H264Packetizer::incomingLengthPrefixed(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    lengthReader_.append(data, length);
+
+    const uint8_t* nal;
+    size_t nalLength;
+    bool endOfFrame;
+    while (lengthReader_.next(&nal, &nalLength, &endOfFrame)) {
+        if (nalLength == 0) {
+            continue;
+        }
+        if (conf_.format != H264StreamFormat::LENGTH_PREFIXED) {
+            // The frame header tells where the access unit ends, so nothing
+            // is held back.
+            if (frameStart_) {
+                if (conf_.format == H264StreamFormat::LENGTH_PREFIXED_TIMESTAMPED_FRAMES && conf_.timestampMode == VideoTimestampMode::EXPLICIT) {
+                    clock_.addFrameTimestamp(lengthReader_.frameTimestamp());
                 }
-            } else {
-                // Packetize last NAL since we know it does not need to be marked
-                packets = lastNal_.packetize();
+                updateTimestamp();
+                frameStart_ = false;
             }
+            sendNal(nal, nalLength, endOfFrame, cb);
+            frameStart_ = endOfFrame;
+            continue;
+        }
 
-            // Insert last NAL unit
-            ret.insert(ret.end(), packets.begin(), packets.end());
-            // Packetize current NAL unit
-            lastNal_ = nal;
-
-            // Remove current NAL unit from buffer.
-            buffer_ = std::vector<uint8_t>(it, buffer_.end());
-            isShort = nextShort;
-
-
+        if (startsAccessUnit(nal, nalLength)) {
+            lastNal_.setMarker(true);
+            sendNal(lastNal_.data(), lastNal_.size(), lastNal_.marker(), cb);
+            updateTimestamp();
         } else {
-            return ret;
+            sendNal(lastNal_.data(), lastNal_.size(), lastNal_.marker(), cb);
         }
+        lastNal_.assign(nal, nalLength);
     }
-    return ret;
 }
 
-void H264Packetizer::updateTimestamp()
+bool H264Packetizer::startsAccessUnit(const uint8_t* nal, size_t length)
 {
-    std::chrono::milliseconds now = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()
-    );
-
-    auto startTs = rtpConf_->startTimestamp;
-    auto epochDiff = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count();
-    rtpConf_->timestamp = startTs + (epochDiff * 90);
-
+    uint8_t type = nal[0] & 0b00011111;
+    if (type == NAL_SLICE || type == NAL_IDR) {
+        // The first slice of a primary coded picture has first_mb_in_slice
+        // 0, which is coded as a single 1 bit. It starts a new access unit
+        // unless a NAL unit before it already did.
+        bool firstSlice = length > 1 && (nal[1] & 0x80);
+        bool start = firstSlice && vclSeen_;
+        vclSeen_ = true;
+        return start;
+    }
+    // NAL units which can only come before the first slice of an access unit
+    bool prefix = type == NAL_SEI || type == NAL_SPS || type == NAL_PPS || type == NAL_AUD || (type >= 14 && type <= 18);
+    if (prefix && vclSeen_) {
+        vclSeen_ = false;
+        return true;
+    }
+    return false;
+}
 
+void H264Packetizer::packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb)
+{
+    rtpConf_->timestamp = frameTimestamper_.timestamp(rtpConf_->startTimestamp, timestamp);
+
+    // Each NAL unit is sent once the next one is found, so the last one can
+    // get the marker.
+    const uint8_t* prev = nullptr;
+    size_t prevLength = 0;
+    auto nalCb = [&](const uint8_t* nal, size_t nalLength) {
+        if (prev != nullptr) {
+            sendNal(prev, prevLength, false, cb);
+        }
+        prev = nal;
+        prevLength = nalLength;
+    };
+
+    if (conf_.format == H264StreamFormat::ANNEX_B) {
+        AnnexBReader::split(data, length, nalCb);
+    } else {
+        size_t i = 0;
+        while (i + 4 <= length) {
+            size_t nalLength = ((size_t)data[i] << 24) | ((size_t)data[i+1] << 16) | ((size_t)data[i+2] << 8) | data[i+3];
+            if (nalLength > length - i - 4) {
+                NPLOGE << "NAL unit of " << nalLength << " bytes does not fit in the frame, dropping the rest of the frame";
+                break;
+            }
+            if (nalLength > 0) {
+                nalCb(data + i + 4, nalLength);
+            }
+            i += 4 + nalLength;
+        }
+    }
+    if (prev != nullptr) {
+        sendNal(prev, prevLength, true, cb);
+    }
 }
 
-bool NalUnit::isPsOrAUD()
+void H264Packetizer::sendNal(const uint8_t* nal, size_t size, bool marker, const RtpPacketCallback& cb)
 {
-    return isNalType(NAL_SPS) || isNalType(NAL_PPS) || isNalType(NAL_AUD);
+    if (size == 0) {
+        return;
+    }
+    if (conf_.dropAud && (nal[0] & 0b00011111) == NAL_AUD) {
+        if (marker) {
+            flushAggregate(true, cb);
+        }
+        return;
+    }
+
+    // STAP-A header, NAL unit size and NAL unit
+    if (!conf_.aggregate || 1 + 2 + size > conf_.mtu) {
+        flushAggregate(false, cb);
+        packetizeNal(*rtpConf_, conf_.mtu, nal, size, marker, slot_.data(), cb);
+        return;
+    }
+
+    if (aggregateCount_ > 0 && aggregateEnd_ + 2 + size > slot_.size()) {
+        flushAggregate(false, cb);
+    }
+    if (aggregateCount_ == 0) {
+        aggregateEnd_ = H264_RTP_HEADER_SIZE + 1;
+        aggregateHeader_ = 0;
+    }
+    uint8_t nalHead = nal[0];
+    // The F bit is set if any NAL unit has it, and NRI is the highest of the NAL units.
+    aggregateHeader_ |= nalHead & NAL_F_MASK;
+    if ((nalHead & NAL_NRI_MASK) > (aggregateHeader_ & NAL_NRI_MASK)) {
+        aggregateHeader_ = (aggregateHeader_ & NAL_F_MASK) | (nalHead & NAL_NRI_MASK);
+    }
+    uint8_t* p = slot_.data() + aggregateEnd_;
+    p[0] = (uint8_t)(size >> 8);
+    p[1] = (uint8_t)size;
+    memcpy(p + 2, nal, size);
+    aggregateEnd_ += 2 + size;
+    aggregateCount_++;
+
+    if (marker) {
+        flushAggregate(true, cb);
+    }
 }
 
-uint8_t NalUnit::makeAudPayload()
+void H264Packetizer::flushAggregate(bool marker, const RtpPacketCallback& cb)
 {
-    if (isNalType(NAL_SPS) ||
-        isNalType(NAL_PPS) ||
-        isNalType(NAL_IDR)) {
-        return 0x10;
+    if (aggregateCount_ == 0) {
+        return;
     }
-    else {
-        return 0x30;
+    uint8_t* payload = slot_.data() + H264_RTP_HEADER_SIZE;
+    if (aggregateCount_ == 1) {
+        // Nothing to aggregate with, send the NAL unit without the STAP-A overhead.
+        size_t size = aggregateEnd_ - H264_RTP_HEADER_SIZE - 3;
+        memmove(payload, payload + 3, size);
+        aggregateEnd_ = H264_RTP_HEADER_SIZE + size;
+    } else {
+        payload[0] = aggregateHeader_ | NAL_STAPA;
     }
+    writeRtpHeader(*rtpConf_, slot_.data(), marker);
+    aggregateCount_ = 0;
+    cb(slot_.data(), aggregateEnd_);
+}
+
+void H264Packetizer::updateTimestamp()
+{
+    rtpConf_->timestamp = clock_.nextAccessUnit(rtpConf_->startTimestamp, rtpConf_->timestamp);
 }
 
+bool NalUnit::isPsOrAUD()
+{
+    return isNalType(NAL_SPS) || isNalType(NAL_PPS) || isNalType(NAL_AUD);
+}
 
 } // namespace
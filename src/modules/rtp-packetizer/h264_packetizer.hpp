@@ -1,40 +1,101 @@
 #pragma once
 
 #include "rtp_packetizer.hpp"
+#include "annexb_reader.hpp"
+#include "length_prefixed_reader.hpp"
+#include "video_clock.hpp"
 
+#include <nabto/nabto_device_webrtc.hpp>
 #include <rtc/rtc.hpp>
 
 #include <chrono>
 
 namespace nabto {
 
+// Default max RTP payload size of a packet
+const size_t H264_MTU = 1200;
+// Smallest MTU accepted by H264Packetizer
+const size_t H264_MIN_MTU = 64;
+const size_t H264_RTP_HEADER_SIZE = RTP_HEADER_SIZE;
+// Max size of a NAL unit. Without a start code within this many bytes the data is dropped.
+const size_t H264_MAX_NAL_SIZE = 4 * 1024 * 1024;
+
+/**
+ * How NAL units are framed in the source byte stream.
+ */
+enum class H264StreamFormat {
+    // NAL units separated by start codes (H.264 Annex B). Access units are
+    // started by NAL units with the long start code.
+    ANNEX_B,
+    // Each NAL unit is preceded by its length as a 4 byte big endian integer
+    // (AVCC). Access unit boundaries are found from the NAL unit types and
+    // first_mb_in_slice (H.264 7.4.1.2.3).
+    LENGTH_PREFIXED,
+    // As LENGTH_PREFIXED, but each access unit is preceded by its total
+    // length, including the NAL unit length fields, as a 4 byte big endian
+    // integer. The last NAL unit of an access unit is sent as soon as it is
+    // read instead of when the next NAL unit is complete.
+    LENGTH_PREFIXED_FRAMES,
+    // As LENGTH_PREFIXED_FRAMES, but the access unit length is followed by
+    // the presentation time of the access unit in microseconds as an 8 byte
+    // big endian signed integer. With VideoTimestampMode::EXPLICIT it gives
+    // the RTP timestamps, so a producer writing to a FIFO can set them.
+    LENGTH_PREFIXED_TIMESTAMPED_FRAMES
+};
+
+class H264PacketizerConf {
+public:
+    H264StreamFormat format = H264StreamFormat::ANNEX_B;
+    // Max RTP payload size of a packet. Larger NAL units are sent as FU-A
+    // fragments.
+    size_t mtu = H264_MTU;
+    // Aggregate consecutive small NAL units of an access unit (SPS, PPS, SEI,
+    // small slices) into STAP-A packets (RFC 6184 5.7.1).
+    bool aggregate = true;
+    // Do not send access unit delimiters from the stream. RTP marks the end of
+    // an access unit with the marker bit, so they are not needed by receivers.
+    bool dropAud = false;
+    VideoTimestampMode timestampMode = VideoTimestampMode::CLOCK;
+    // Frame rate used by FRAME_RATE, and by EXPLICIT for access units
+    // without a timestamp.
+    double frameRate = 30;
+};
+
 class NalUnit {
 public:
     NalUnit() {}
-    NalUnit(std::vector<uint8_t>& data, std::shared_ptr<rtc::RtpPacketizer> rtp) : data_(data), rtp_(rtp)
-    {
-        header_ = data.front();
-    }
-
-    std::vector<std::vector<uint8_t> > packetize();
+    NalUnit(std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf, size_t mtu) : rtpConf_(rtpConf), mtu_(mtu) {}
+
+    /**
+     * Set the NAL unit data (without start code) and clear the marker. The
+     * memory of the previous NAL unit is reused.
+     */
+    void assign(const uint8_t* data, size_t length);
+
+    /**
+     * Packetize the NAL unit as a single RTP packet or as FU-A fragments.
+     * Each packet is written into `slot`, which must hold
+     * H264_RTP_HEADER_SIZE + mtu bytes, and passed to cb before the next
+     * packet is written. The RTP header is made from the packetization config.
+     */
+    void packetize(uint8_t* slot, const RtpPacketCallback& cb);
 
     bool empty() {return data_.empty();}
 
+    const uint8_t* data() const { return data_.data(); }
+    size_t size() const { return data_.size(); }
+
     void setMarker(bool mark) { shouldMark_ = mark; }
+    bool marker() const { return shouldMark_; }
 
     bool isNalType(uint8_t type) { return (header_ & 0b00011111) == type; }
 
     bool isPsOrAUD();
 
-    uint8_t makeAudPayload();
-
 private:
-    uint8_t setStart(bool isSet, uint8_t type) { return (type & 0x7F) | (isSet << 7); }
-    uint8_t setEnd(bool isSet, uint8_t type) { return (type & 0b1011'1111) | (isSet << 6); }
-
-
     std::vector<uint8_t> data_;
-    std::shared_ptr<rtc::RtpPacketizer> rtp_ = nullptr;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_ = nullptr;
+    size_t mtu_ = H264_MTU;
     uint8_t header_ = 0;
     bool shouldMark_ = false;
 
@@ -43,48 +104,111 @@ private:
 
 
 
-class H264Packetizer : public RtpPacketizer
+/**
+ * Packetizes H.264 into RTP packets following RFC 6184, either from a byte
+ * stream with incoming() or one access unit at a time with packetizeFrame().
+ * The two must not be mixed on the same packetizer.
+ */
+class H264Packetizer : public RtpPacketizer, public FramePacketizer
 {
 public:
-    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt) { return std::make_shared<H264Packetizer>(ssrc, trackId, pt); }
+    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt, const H264PacketizerConf& conf = H264PacketizerConf()) {
+        return std::make_shared<H264Packetizer>(ssrc, trackId, pt, conf);
+    }
 
-    H264Packetizer(uint32_t ssrc, std::string& trackId, int pt) {
+    H264Packetizer(uint32_t ssrc, std::string& trackId, int pt, const H264PacketizerConf& conf)
+        : conf_(conf), clock_(conf.timestampMode, conf.frameRate), frameTimestamper_(90000), reader_(H264_MAX_NAL_SIZE),
+          lengthReader_(H264_MAX_NAL_SIZE, conf.format == H264StreamFormat::LENGTH_PREFIXED_FRAMES,
+                        conf.format == H264StreamFormat::LENGTH_PREFIXED_TIMESTAMPED_FRAMES)
+    {
+        if (conf_.mtu < H264_MIN_MTU) {
+            conf_.mtu = H264_MIN_MTU;
+        }
         rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, 90000);
         // TODO: remove this workaround for https://github.com/paullouisageneau/libdatachannel/issues/1216
         rtpConf_->playoutDelayId = 0;
-        start_ = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()
-        );
-        packetizer_ = std::make_shared<rtc::RtpPacketizer>(rtpConf_);
-
+        lastNal_ = NalUnit(rtpConf_, conf_.mtu);
+        slot_.resize(H264_RTP_HEADER_SIZE + conf_.mtu);
     }
 
     std::vector<std::vector<uint8_t> > packetize(std::vector<uint8_t> data);
 
     std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data);
 
+    void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+
+    /**
+     * Packetize a whole access unit in the configured format. With the
+     * length prefixed formats, the access unit is the length prefixed NAL
+     * units without a frame header. The timestamp mode is not used, the RTP
+     * timestamp comes from the timestamp given.
+     */
+    void packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb);
+
+    /**
+     * Set the presentation time of the next access unit in the stream which
+     * has not got one yet. Only used with VideoTimestampMode::EXPLICIT. Must
+     * be called on the thread calling incoming(), before the data of the
+     * access unit is passed to it. With
+     * H264StreamFormat::LENGTH_PREFIXED_TIMESTAMPED_FRAMES the times are read
+     * from the stream instead.
+     */
+    void addFrameTimestamp(std::chrono::microseconds pts) { clock_.addFrameTimestamp(pts); }
+
 private:
 
+    void incomingAnnexB(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+    void incomingLengthPrefixed(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+    // True if the NAL unit is the first of a new access unit. Only used for
+    // LENGTH_PREFIXED.
+    bool startsAccessUnit(const uint8_t* nal, size_t length);
+
     void updateTimestamp();
 
+    // Send a complete NAL unit, aggregating it with the following ones if it is small.
+    void sendNal(const uint8_t* nal, size_t size, bool marker, const RtpPacketCallback& cb);
+    // Send the NAL units aggregated in slot_ if any.
+    void flushAggregate(bool marker, const RtpPacketCallback& cb);
+
+    H264PacketizerConf conf_;
     std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
-    std::shared_ptr<rtc::RtpPacketizer> packetizer_;
-    std::chrono::milliseconds start_;
-    std::vector<uint8_t> buffer_;
+    VideoClock clock_;
+    FrameTimestamper frameTimestamper_;
+    // Packets are written here one at a time and handed to the callback.
+    std::vector<uint8_t> slot_;
+    // NAL units aggregated in slot_ but not sent yet, and the end of the
+    // STAP-A payload written so far.
+    size_t aggregateCount_ = 0;
+    size_t aggregateEnd_ = 0;
+    // F and NRI bits of the STAP-A header
+    uint8_t aggregateHeader_ = 0;
+
+    AnnexBReader reader_;
+    LengthPrefixedReader lengthReader_;
     NalUnit lastNal_;
+    // LENGTH_PREFIXED: true if a VCL NAL unit has been seen in the current
+    // access unit.
+    bool vclSeen_ = true;
+    // LENGTH_PREFIXED_FRAMES: true if the next NAL unit starts an access unit.
+    bool frameStart_ = true;
 
 };
 
 class H264PacketizerFactory : public RtpPacketizerFactory
 {
 public:
-    static RtpPacketizerFactoryPtr create(const std::string& trackId) {
-        return std::make_shared<H264PacketizerFactory>(trackId);
+    static RtpPacketizerFactoryPtr create(const std::string& trackId, const H264PacketizerConf& conf = H264PacketizerConf()) {
+        return std::make_shared<H264PacketizerFactory>(trackId, conf);
     }
-    H264PacketizerFactory(const std::string& trackId): RtpPacketizerFactory(trackId) { }
+    H264PacketizerFactory(const std::string& trackId, const H264PacketizerConf& conf): RtpPacketizerFactory(trackId), conf_(conf) { }
     RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) {
-        return H264Packetizer::create(ssrc, trackId_, pt);
+        return H264Packetizer::create(ssrc, trackId_, pt, conf_);
     }
+    size_t maxPacketSize() const {
+        return H264_RTP_HEADER_SIZE + std::max(conf_.mtu, H264_MIN_MTU);
+    }
+private:
+    H264PacketizerConf conf_;
 };
 
 } // namespace
@@ -0,0 +1,181 @@
+#include "h265_packetizer.hpp"
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * This can be used to packetize a H265 byte-stream conforming to the annex B specifications in "H.265 : High efficiency video coding" https://www.itu.int/rec/T-REC-H.265
+ */
+
+namespace nabto {
+
+const uint8_t H265_NAL_VPS = 32;
+const uint8_t H265_NAL_AUD = 35;
+const uint8_t H265_NAL_PREFIX_SEI = 39;
+const uint8_t H265_NAL_AP = 48;
+const uint8_t H265_NAL_FU = 49;
+const size_t H265_NAL_HEADER_SIZE = 2;
+
+static uint8_t nalType(const uint8_t* nal) { return (nal[0] >> 1) & 0x3F; }
+static uint8_t nalLayerId(const uint8_t* nal) { return ((nal[0] & 0x01) << 5) | (nal[1] >> 3); }
+static uint8_t nalTid(const uint8_t* nal) { return nal[1] & 0x07; }
+
+H265Packetizer::H265Packetizer(uint32_t ssrc, std::string& trackId, int pt, const H265PacketizerConf& conf)
+    : conf_(conf), clock_(conf.timestampMode, conf.frameRate), reader_(H265_MAX_NAL_SIZE)
+{
+    if (conf_.mtu < H265_MIN_MTU) {
+        conf_.mtu = H265_MIN_MTU;
+    }
+    rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, 90000);
+    slot_.resize(RTP_HEADER_SIZE + conf_.mtu);
+}
+
+std::vector<std::vector<uint8_t> > H265Packetizer::incoming(const std::vector<uint8_t>& data)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    incoming(data.data(), data.size(), [&ret](const uint8_t* packet, size_t length) {
+        ret.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return ret;
+}
+
+void H265Packetizer::incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    reader_.append(data, length);
+
+    const uint8_t* nal;
+    size_t nalLength;
+    bool longStartCode;
+    while (reader_.next(&nal, &nalLength, &longStartCode)) {
+        if (nalLength < H265_NAL_HEADER_SIZE) {
+            continue;
+        }
+        if (startsAccessUnit(nal, nalLength)) {
+            // The pending NAL unit ends the previous access unit
+            sendPending(true, cb);
+            rtpConf_->timestamp = clock_.nextAccessUnit(rtpConf_->startTimestamp, rtpConf_->timestamp);
+        } else {
+            sendPending(false, cb);
+        }
+        pending_.assign(nal, nal + nalLength);
+    }
+}
+
+bool H265Packetizer::startsAccessUnit(const uint8_t* nal, size_t length)
+{
+    uint8_t type = nalType(nal);
+    if (type < H265_NAL_VPS) {
+        // VCL NAL unit. The first slice segment of a picture starts a new
+        // access unit unless a prefix NAL unit already did.
+        bool firstSlice = length > H265_NAL_HEADER_SIZE && (nal[H265_NAL_HEADER_SIZE] & 0x80);
+        bool start = firstSlice && vclSeen_;
+        vclSeen_ = true;
+        return start;
+    }
+    // NAL units which can only come before the first VCL NAL unit of an access unit
+    bool prefix = (type >= H265_NAL_VPS && type <= H265_NAL_AUD) ||
+        type == H265_NAL_PREFIX_SEI ||
+        (type >= 41 && type <= 44) ||
+        (type >= 48 && type <= 55);
+    if (prefix && vclSeen_) {
+        vclSeen_ = false;
+        return true;
+    }
+    return false;
+}
+
+void H265Packetizer::sendPending(bool marker, const RtpPacketCallback& cb)
+{
+    if (pending_.empty()) {
+        return;
+    }
+    size_t size = pending_.size();
+    // Payload header, NAL unit size and NAL unit
+    if (!conf_.aggregate || H265_NAL_HEADER_SIZE + 2 + size > conf_.mtu) {
+        flushAggregate(false, cb);
+        if (size <= conf_.mtu) {
+            // NAL unit fits in single packet
+            writeRtpFixedHeader(slot_.data(), rtpConf_->payloadType, marker, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+            memcpy(slot_.data() + RTP_HEADER_SIZE, pending_.data(), size);
+            cb(slot_.data(), RTP_HEADER_SIZE + size);
+        } else {
+            sendFragmented(marker, cb);
+        }
+        return;
+    }
+
+    if (aggregateCount_ > 0 && aggregateEnd_ + 2 + size > slot_.size()) {
+        flushAggregate(false, cb);
+    }
+    const uint8_t* nal = pending_.data();
+    if (aggregateCount_ == 0) {
+        aggregateEnd_ = RTP_HEADER_SIZE + H265_NAL_HEADER_SIZE;
+        aggregateF_ = false;
+        aggregateLayerId_ = nalLayerId(nal);
+        aggregateTid_ = nalTid(nal);
+    }
+    // F is set if any NAL unit has it, LayerId and TID are the lowest of the NAL units.
+    aggregateF_ = aggregateF_ || (nal[0] & 0x80);
+    aggregateLayerId_ = std::min(aggregateLayerId_, nalLayerId(nal));
+    aggregateTid_ = std::min(aggregateTid_, nalTid(nal));
+    uint8_t* p = slot_.data() + aggregateEnd_;
+    p[0] = (uint8_t)(size >> 8);
+    p[1] = (uint8_t)size;
+    memcpy(p + 2, nal, size);
+    aggregateEnd_ += 2 + size;
+    aggregateCount_++;
+
+    if (marker) {
+        flushAggregate(true, cb);
+    }
+}
+
+void H265Packetizer::sendFragmented(bool marker, const RtpPacketCallback& cb)
+{
+    // The payload header is the NAL unit header with the type changed to FU.
+    // The FU header holds the start and end bits and the original type.
+    const uint8_t* nal = pending_.data();
+    size_t size = pending_.size();
+    uint8_t payloadHdr0 = (nal[0] & 0b10000001) | (H265_NAL_FU << 1);
+    uint8_t payloadHdr1 = nal[1];
+    uint8_t type = nalType(nal);
+    size_t fragmentSize = conf_.mtu - H265_NAL_HEADER_SIZE - 1;
+
+    size_t i = H265_NAL_HEADER_SIZE;
+    while (i < size) {
+        size_t len = std::min(fragmentSize, size - i);
+        bool first = i == H265_NAL_HEADER_SIZE;
+        bool last = i + len == size;
+        uint8_t* p = slot_.data();
+        writeRtpFixedHeader(p, rtpConf_->payloadType, last && marker, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+        p[RTP_HEADER_SIZE] = payloadHdr0;
+        p[RTP_HEADER_SIZE + 1] = payloadHdr1;
+        p[RTP_HEADER_SIZE + 2] = (first ? 0x80 : 0) | (last ? 0x40 : 0) | type;
+        memcpy(p + RTP_HEADER_SIZE + 3, nal + i, len);
+        cb(p, RTP_HEADER_SIZE + 3 + len);
+        i += len;
+    }
+}
+
+void H265Packetizer::flushAggregate(bool marker, const RtpPacketCallback& cb)
+{
+    if (aggregateCount_ == 0) {
+        return;
+    }
+    uint8_t* payload = slot_.data() + RTP_HEADER_SIZE;
+    if (aggregateCount_ == 1) {
+        // Nothing to aggregate with, send the NAL unit without the aggregation overhead.
+        size_t size = aggregateEnd_ - RTP_HEADER_SIZE - H265_NAL_HEADER_SIZE - 2;
+        memmove(payload, payload + H265_NAL_HEADER_SIZE + 2, size);
+        aggregateEnd_ = RTP_HEADER_SIZE + size;
+    } else {
+        payload[0] = (aggregateF_ ? 0x80 : 0) | (H265_NAL_AP << 1) | (aggregateLayerId_ >> 5);
+        payload[1] = (uint8_t)((aggregateLayerId_ & 0x1F) << 3) | aggregateTid_;
+    }
+    writeRtpFixedHeader(slot_.data(), rtpConf_->payloadType, marker, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+    aggregateCount_ = 0;
+    cb(slot_.data(), aggregateEnd_);
+}
+
+} // namespace
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "rtp_packetizer.hpp"
+#include "annexb_reader.hpp"
+#include "video_clock.hpp"
+
+#include <rtc/rtppacketizationconfig.hpp>
+
+namespace nabto {
+
+// Default max RTP payload size of a packet
+const size_t H265_MTU = 1200;
+// Smallest MTU accepted by H265Packetizer
+const size_t H265_MIN_MTU = 64;
+// Max size of a NAL unit. Without a start code within this many bytes the data is dropped.
+const size_t H265_MAX_NAL_SIZE = 4 * 1024 * 1024;
+
+class H265PacketizerConf {
+public:
+    // Max RTP payload size of a packet. Larger NAL units are sent as
+    // fragmentation units.
+    size_t mtu = H265_MTU;
+    // Aggregate consecutive small NAL units of an access unit (VPS, SPS, PPS,
+    // SEI, small slices) into aggregation packets (RFC 7798 4.4.2).
+    bool aggregate = true;
+    VideoTimestampMode timestampMode = VideoTimestampMode::CLOCK;
+    // Frame rate used by FRAME_RATE, and by EXPLICIT for access units
+    // without a timestamp.
+    double frameRate = 30;
+};
+
+/**
+ * Packetizes a H.265 byte stream in the Annex B format into RTP packets
+ * following RFC 7798, without DONL fields (sprop-max-don-diff=0).
+ *
+ * Access unit boundaries are found from the NAL unit types and the
+ * first_slice_segment_in_pic_flag (H.265 7.4.2.4.4). The last packet of an
+ * access unit gets the marker bit.
+ */
+class H265Packetizer : public RtpPacketizer
+{
+public:
+    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt, const H265PacketizerConf& conf = H265PacketizerConf()) {
+        return std::make_shared<H265Packetizer>(ssrc, trackId, pt, conf);
+    }
+
+    H265Packetizer(uint32_t ssrc, std::string& trackId, int pt, const H265PacketizerConf& conf);
+
+    std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data);
+
+    void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+
+    /**
+     * Set the presentation time of the next access unit in the stream which
+     * has not got one yet. Only used with VideoTimestampMode::EXPLICIT. Must
+     * be called on the thread calling incoming(), before the data of the
+     * access unit is passed to it.
+     */
+    void addFrameTimestamp(std::chrono::microseconds pts) { clock_.addFrameTimestamp(pts); }
+
+private:
+    // True if the NAL unit is the first of a new access unit.
+    bool startsAccessUnit(const uint8_t* nal, size_t length);
+    // Send the pending NAL unit, aggregating it with the following ones if it is small.
+    void sendPending(bool marker, const RtpPacketCallback& cb);
+    void sendFragmented(bool marker, const RtpPacketCallback& cb);
+    // Send the NAL units aggregated in slot_ if any.
+    void flushAggregate(bool marker, const RtpPacketCallback& cb);
+
+    H265PacketizerConf conf_;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
+    VideoClock clock_;
+    AnnexBReader reader_;
+
+    // The last complete NAL unit. It is sent once the next one shows whether
+    // it ends the access unit.
+    std::vector<uint8_t> pending_;
+    // True if a VCL NAL unit has been seen in the current access unit.
+    bool vclSeen_ = true;
+
+    // Packets are written here one at a time and handed to the callback.
+    std::vector<uint8_t> slot_;
+    // NAL units aggregated in slot_ but not sent yet, and the end of the
+    // aggregation packet written so far.
+    size_t aggregateCount_ = 0;
+    size_t aggregateEnd_ = 0;
+    // Fields of the payload header of the aggregation packet
+    bool aggregateF_ = false;
+    uint8_t aggregateLayerId_ = 0;
+    uint8_t aggregateTid_ = 0;
+};
+
+class H265PacketizerFactory : public RtpPacketizerFactory
+{
+public:
+    static RtpPacketizerFactoryPtr create(const std::string& trackId, const H265PacketizerConf& conf = H265PacketizerConf()) {
+        return std::make_shared<H265PacketizerFactory>(trackId, conf);
+    }
+    H265PacketizerFactory(const std::string& trackId, const H265PacketizerConf& conf): RtpPacketizerFactory(trackId), conf_(conf) { }
+    RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) {
+        return H265Packetizer::create(ssrc, trackId_, pt, conf_);
+    }
+    size_t maxPacketSize() const {
+        return RTP_HEADER_SIZE + std::max(conf_.mtu, H265_MIN_MTU);
+    }
+private:
+    H265PacketizerConf conf_;
+};
+
+} // namespace
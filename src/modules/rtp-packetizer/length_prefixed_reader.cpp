@@ -0,0 +1,88 @@
+#include "length_prefixed_reader.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+namespace nabto {
+
+const size_t LENGTH_FIELD_SIZE = 4;
+const size_t TIMESTAMP_FIELD_SIZE = 8;
+
+static size_t readLength(const uint8_t* p)
+{
+    return ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+}
+
+static int64_t readTimestamp(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < TIMESTAMP_FIELD_SIZE; i++) {
+        v = (v << 8) | p[i];
+    }
+    return (int64_t)v;
+}
+
+void LengthPrefixedReader::append(const uint8_t* data, size_t length)
+{
+    // Consumed data is only removed once it is at least half the buffer, so
+    // every byte is moved a bounded number of times.
+    if (pos_ > 0 && pos_ >= buffer_.size() - pos_) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+        pos_ = 0;
+    }
+    buffer_.insert(buffer_.end(), data, data + length);
+}
+
+bool LengthPrefixedReader::next(const uint8_t** nal, size_t* length, bool* endOfFrame)
+{
+    while (true) {
+        size_t available = buffer_.size() - pos_;
+        if (frameHeaders_ && frameRemaining_ == 0) {
+            size_t headerSize = LENGTH_FIELD_SIZE + (frameTimestamps_ ? TIMESTAMP_FIELD_SIZE : 0);
+            if (available < headerSize) {
+                return false;
+            }
+            frameRemaining_ = readLength(buffer_.data() + pos_);
+            if (frameTimestamps_) {
+                frameTimestamp_ = std::chrono::microseconds(readTimestamp(buffer_.data() + pos_ + LENGTH_FIELD_SIZE));
+            }
+            pos_ += headerSize;
+            continue;
+        }
+
+        if (available < LENGTH_FIELD_SIZE) {
+            return false;
+        }
+        size_t nalLength = readLength(buffer_.data() + pos_);
+        if (nalLength > maxNalSize_) {
+            drop("NAL unit too large");
+            return false;
+        }
+        if (frameHeaders_ && LENGTH_FIELD_SIZE + nalLength > frameRemaining_) {
+            drop("NAL unit does not fit in its frame");
+            return false;
+        }
+        if (available < LENGTH_FIELD_SIZE + nalLength) {
+            return false;
+        }
+
+        *nal = buffer_.data() + pos_ + LENGTH_FIELD_SIZE;
+        *length = nalLength;
+        pos_ += LENGTH_FIELD_SIZE + nalLength;
+        *endOfFrame = false;
+        if (frameHeaders_) {
+            frameRemaining_ -= LENGTH_FIELD_SIZE + nalLength;
+            *endOfFrame = frameRemaining_ == 0;
+        }
+        return true;
+    }
+}
+
+void LengthPrefixedReader::drop(const char* reason)
+{
+    NPLOGE << "Invalid length prefixed stream (" << reason << "), dropping " << buffer_.size() - pos_ << " bytes";
+    buffer_.clear();
+    pos_ = 0;
+    frameRemaining_ = 0;
+}
+
+} // namespace
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nabto {
+
+/**
+ * Splits a byte stream of NAL units each preceded by its length as a 4 byte
+ * big endian integer (the AVCC/HVCC layout used by MP4 and most encoder
+ * SDKs) into NAL units. NAL boundaries are read from the length fields, so
+ * the NAL unit data is never scanned.
+ *
+ * With frame headers, each access unit is preceded by its total length
+ * (including the length fields of its NAL units) as a 4 byte big endian
+ * integer, so the last NAL unit of an access unit is known as soon as it is
+ * read. With frame timestamps, the frame length is followed by the
+ * presentation time of the access unit in microseconds as an 8 byte big
+ * endian signed integer.
+ *
+ * A length field larger than maxNalSize, or a NAL unit not fitting within
+ * its frame, means the stream is broken. The buffered data is dropped, and
+ * reading continues with the next appended data as the start of a frame (or
+ * NAL unit).
+ */
+class LengthPrefixedReader {
+public:
+    LengthPrefixedReader(size_t maxNalSize, bool frameHeaders, bool frameTimestamps = false)
+        : maxNalSize_(maxNalSize), frameHeaders_(frameHeaders || frameTimestamps), frameTimestamps_(frameTimestamps) {}
+
+    /**
+     * Append data from the byte stream. Invalidates NAL units returned by
+     * next().
+     */
+    void append(const uint8_t* data, size_t length);
+
+    /**
+     * Get the next complete NAL unit.
+     *
+     * @param nal         set to the NAL unit, valid until append() is called
+     * @param length      set to the length of the NAL unit
+     * @param endOfFrame  with frame headers, set to true if the NAL unit is
+     *                    the last of its access unit. Otherwise set to false.
+     * @return false if there is no complete NAL unit yet.
+     */
+    bool next(const uint8_t** nal, size_t* length, bool* endOfFrame);
+
+    /**
+     * With frame timestamps, the presentation time from the header of the
+     * frame of the last NAL unit returned by next().
+     */
+    std::chrono::microseconds frameTimestamp() const { return frameTimestamp_; }
+
+private:
+    void drop(const char* reason);
+
+    size_t maxNalSize_;
+    bool frameHeaders_;
+    bool frameTimestamps_;
+    // Unconsumed data is buffer_[pos_, buffer_.size())
+    std::vector<uint8_t> buffer_;
+    size_t pos_ = 0;
+    // Bytes of the current frame not read yet. Zero when the next bytes are
+    // a frame header.
+    size_t frameRemaining_ = 0;
+    std::chrono::microseconds frameTimestamp_{0};
+};
+
+} // namespace
@@ -0,0 +1,207 @@
+#include "opus_packetizer.hpp"
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <cstring>
+
+namespace nabto {
+
+const uint32_t OPUS_CLOCK_RATE = 48000;
+const size_t OGG_PAGE_HEADER_SIZE = 27;
+const uint8_t OGG_CONTINUED_PACKET = 0x01;
+
+OpusPacketizer::OpusPacketizer(uint32_t ssrc, std::string& trackId, int pt, const OpusPacketizerConf& conf)
+    : conf_(conf)
+{
+    rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, OPUS_CLOCK_RATE);
+    // Typical packets are a few hundred bytes, the slot grows if needed.
+    slot_.resize(RTP_HEADER_SIZE + 1500);
+}
+
+std::vector<std::vector<uint8_t> > OpusPacketizer::incoming(const std::vector<uint8_t>& data)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    incoming(data.data(), data.size(), [&ret](const uint8_t* packet, size_t length) {
+        ret.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return ret;
+}
+
+void OpusPacketizer::incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    if (pos_ > 0 && pos_ >= buffer_.size() - pos_) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+        pos_ = 0;
+    }
+    buffer_.insert(buffer_.end(), data, data + length);
+
+    if (conf_.format == OpusStreamFormat::OGG) {
+        parseOgg(cb);
+    } else {
+        parseLengthPrefixed(cb);
+    }
+}
+
+uint32_t OpusPacketizer::packetSamples(const uint8_t* packet, size_t length)
+{
+    if (length < 1) {
+        return 0;
+    }
+    uint8_t toc = packet[0];
+    uint8_t config = toc >> 3;
+    uint32_t frameSamples;
+    if (config < 12) {
+        // SILK only: 10, 20, 40 or 60 ms
+        const uint32_t silk[] = { 480, 960, 1920, 2880 };
+        frameSamples = silk[config & 3];
+    } else if (config < 16) {
+        // Hybrid: 10 or 20 ms
+        frameSamples = (config & 1) ? 960 : 480;
+    } else {
+        // CELT only: 2.5, 5, 10 or 20 ms
+        const uint32_t celt[] = { 120, 240, 480, 960 };
+        frameSamples = celt[config & 3];
+    }
+
+    uint32_t frames;
+    switch (toc & 3) {
+        case 0: frames = 1; break;
+        case 1:
+        case 2: frames = 2; break;
+        default:
+            if (length < 2) {
+                return 0;
+            }
+            frames = packet[1] & 0x3F;
+    }
+    return frames * frameSamples;
+}
+
+void OpusPacketizer::parseLengthPrefixed(const RtpPacketCallback& cb)
+{
+    while (buffer_.size() - pos_ >= 2) {
+        size_t len = (buffer_[pos_] << 8) | buffer_[pos_ + 1];
+        if (buffer_.size() - pos_ < 2 + len) {
+            return;
+        }
+        payloadSize_ = 0;
+        appendPayload(buffer_.data() + pos_ + 2, len);
+        pos_ += 2 + len;
+        send(cb);
+    }
+}
+
+void OpusPacketizer::parseOgg(const RtpPacketCallback& cb)
+{
+    while (true) {
+        size_t avail = buffer_.size() - pos_;
+        if (avail < OGG_PAGE_HEADER_SIZE) {
+            return;
+        }
+        const uint8_t* page = buffer_.data() + pos_;
+        if (memcmp(page, "OggS", 4) != 0 || page[4] != 0) {
+            // Not at a page boundary, skip to the next capture pattern.
+            size_t i = 1;
+            while (i + 4 <= avail && memcmp(page + i, "OggS", 4) != 0) {
+                i++;
+            }
+            if (i + 4 > avail) {
+                // Keep the last bytes, they may be the beginning of a capture pattern.
+                i = avail - 3;
+            }
+            NPLOGD << "Skipping " << i << " bytes of data not in an Ogg page";
+            pos_ += i;
+            payloadSize_ = 0;
+            skipContinued_ = true;
+            continue;
+        }
+
+        uint8_t segments = page[26];
+        if (avail < OGG_PAGE_HEADER_SIZE + segments) {
+            return;
+        }
+        const uint8_t* lacing = page + OGG_PAGE_HEADER_SIZE;
+        size_t bodySize = 0;
+        for (size_t i = 0; i < segments; i++) {
+            bodySize += lacing[i];
+        }
+        size_t pageSize = OGG_PAGE_HEADER_SIZE + segments + bodySize;
+        if (avail < pageSize) {
+            return;
+        }
+
+        bool continued = (page[5] & OGG_CONTINUED_PACKET) != 0;
+        if (!continued) {
+            // A packet left unfinished by the previous page is incomplete.
+            payloadSize_ = 0;
+            skipContinued_ = false;
+        }
+
+        const uint8_t* body = lacing + segments;
+        for (size_t i = 0; i < segments; i++) {
+            if (!skipContinued_) {
+                appendPayload(body, lacing[i]);
+            }
+            body += lacing[i];
+            if (lacing[i] < 255) {
+                // End of packet
+                if (!skipContinued_) {
+                    send(cb);
+                }
+                payloadSize_ = 0;
+                skipContinued_ = false;
+            }
+        }
+        pos_ += pageSize;
+    }
+}
+
+void OpusPacketizer::packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb)
+{
+    rtpConf_->timestamp = frameTimestamper_.timestamp(rtpConf_->startTimestamp, timestamp);
+    payloadSize_ = 0;
+    appendPayload(data, length);
+    send(cb);
+}
+
+void OpusPacketizer::appendPayload(const uint8_t* data, size_t length)
+{
+    if (payloadSize_ + length > OPUS_MAX_PACKET_SIZE) {
+        // Not Opus, only count it so send() drops the packet.
+        payloadSize_ += length;
+        return;
+    }
+    if (RTP_HEADER_SIZE + payloadSize_ + length > slot_.size()) {
+        slot_.resize(RTP_HEADER_SIZE + payloadSize_ + length);
+    }
+    memcpy(slot_.data() + RTP_HEADER_SIZE + payloadSize_, data, length);
+    payloadSize_ += length;
+}
+
+void OpusPacketizer::send(const RtpPacketCallback& cb)
+{
+    const uint8_t* packet = slot_.data() + RTP_HEADER_SIZE;
+    size_t length = payloadSize_;
+    payloadSize_ = 0;
+    if (length == 0) {
+        return;
+    }
+    if (length > OPUS_MAX_PACKET_SIZE) {
+        NPLOGE << "Opus packet of " << length << " bytes is too large, dropping it";
+        return;
+    }
+    if (length >= 8 && (memcmp(packet, "OpusHead", 8) == 0 || memcmp(packet, "OpusTags", 8) == 0)) {
+        // Ogg Opus header packets, not audio
+        return;
+    }
+    uint32_t samples = packetSamples(packet, length);
+    if (samples == 0) {
+        NPLOGE << "Malformed Opus packet, dropping it";
+        return;
+    }
+
+    writeRtpFixedHeader(slot_.data(), rtpConf_->payloadType, false, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+    rtpConf_->timestamp += samples;
+    cb(slot_.data(), RTP_HEADER_SIZE + length);
+}
+
+} // namespace
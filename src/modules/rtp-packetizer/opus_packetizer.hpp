@@ -0,0 +1,101 @@
+#pragma once
+
+#include "rtp_packetizer.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+#include <rtc/rtppacketizationconfig.hpp>
+
+namespace nabto {
+
+// Largest Opus packet: 120 ms of 2.5 ms frames of max 1275 bytes.
+const size_t OPUS_MAX_PACKET_SIZE = 48 * 1275 + 7;
+
+/**
+ * How Opus packets are framed in the source byte stream.
+ */
+enum class OpusStreamFormat {
+    // Ogg encapsulated Opus (RFC 7845), as written by opusenc or
+    // GStreamer's oggmux. The OpusHead and OpusTags packets are skipped.
+    OGG,
+    // Each Opus packet is preceded by its length as a 16 bit big endian
+    // integer.
+    LENGTH_PREFIXED
+};
+
+class OpusPacketizerConf {
+public:
+    OpusStreamFormat format = OpusStreamFormat::OGG;
+};
+
+/**
+ * Packetizes Opus packets from a byte stream into RTP packets (RFC 7587).
+ *
+ * The RTP timestamp advances by the duration of each packet, found from its
+ * TOC byte, so it follows the audio regardless of how the data is read.
+ */
+class OpusPacketizer : public RtpPacketizer, public FramePacketizer
+{
+public:
+    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt, const OpusPacketizerConf& conf = OpusPacketizerConf()) {
+        return std::make_shared<OpusPacketizer>(ssrc, trackId, pt, conf);
+    }
+
+    OpusPacketizer(uint32_t ssrc, std::string& trackId, int pt, const OpusPacketizerConf& conf);
+
+    std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data);
+
+    void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+
+    /**
+     * Packetize a single Opus packet without any framing.
+     */
+    void packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb);
+
+    /**
+     * Duration of an Opus packet in 48 kHz samples from its TOC byte
+     * (RFC 6716 3.1). Returns 0 if the packet is malformed.
+     */
+    static uint32_t packetSamples(const uint8_t* packet, size_t length);
+
+private:
+    void parseOgg(const RtpPacketCallback& cb);
+    void parseLengthPrefixed(const RtpPacketCallback& cb);
+    // Append data to the payload of the packet being assembled in slot_.
+    void appendPayload(const uint8_t* data, size_t length);
+    // Send the packet assembled in slot_.
+    void send(const RtpPacketCallback& cb);
+
+    OpusPacketizerConf conf_;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
+    FrameTimestamper frameTimestamper_{48000};
+
+    // Unconsumed data is buffer_[pos_, buffer_.size()).
+    std::vector<uint8_t> buffer_;
+    size_t pos_ = 0;
+
+    // RTP header followed by the Opus packet being assembled. Ogg packets can
+    // span pages.
+    std::vector<uint8_t> slot_;
+    size_t payloadSize_ = 0;
+    // The rest of an Ogg packet which started before we synced is skipped.
+    bool skipContinued_ = true;
+};
+
+class OpusPacketizerFactory : public RtpPacketizerFactory
+{
+public:
+    static RtpPacketizerFactoryPtr create(const std::string& trackId, const OpusPacketizerConf& conf = OpusPacketizerConf()) {
+        return std::make_shared<OpusPacketizerFactory>(trackId, conf);
+    }
+    OpusPacketizerFactory(const std::string& trackId, const OpusPacketizerConf& conf): RtpPacketizerFactory(trackId), conf_(conf) { }
+    RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) {
+        return OpusPacketizer::create(ssrc, trackId_, pt, conf_);
+    }
+    size_t maxPacketSize() const {
+        return RTP_HEADER_SIZE + OPUS_MAX_PACKET_SIZE;
+    }
+private:
+    OpusPacketizerConf conf_;
+};
+
+} // namespace
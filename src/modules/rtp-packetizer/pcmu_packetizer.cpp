@@ -1,33 +1,77 @@
 #include "pcmu_packetizer.hpp"
 #include <nabto/nabto_device_webrtc.hpp>
 
-#include "rtc/message.hpp"
-#include <rtc/rtppacketizer.hpp>
-
 #include <algorithm>
+#include <cstring>
 
 namespace nabto {
 
+PcmuPacketizer::PcmuPacketizer(uint32_t ssrc, std::string& trackId, int pt, const PcmuPacketizerConf& conf)
+    : conf_(conf)
+{
+    if (conf_.ptime.count() <= 0) {
+        NPLOGW << "Invalid PCMU ptime " << conf_.ptime.count() << " ms, using 20 ms";
+        conf_.ptime = std::chrono::milliseconds(20);
+    }
+    rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, 8000);
+    packetSize_ = conf_.ptime.count() * PCMU_BYTES_PER_MS;
+    slot_.resize(RTP_HEADER_SIZE + packetSize_);
+}
 
 std::vector<std::vector<uint8_t> > PcmuPacketizer::incoming(const std::vector<uint8_t>& data)
 {
-    buffer_.insert(buffer_.end(), data.begin(), data.end());
     std::vector<std::vector<uint8_t> > ret;
+    incoming(data.data(), data.size(), [&ret](const uint8_t* packet, size_t length) {
+        ret.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return ret;
+}
 
-    // PCMU timestamp should match sample count in packets, so we packetize in fixed 1024 byte payloads
-    while (buffer_.size() >= 1024) {
-        auto msg = std::make_shared<rtc::Message>((std::byte*)buffer_.data(), (std::byte*)(buffer_.data() + 1024));
-        rtc::message_vector vec;
-        vec.push_back(msg);
-        buffer_.erase(buffer_.begin(), buffer_.begin()+1024);
-        rtpConf_->timestamp += 1024;
-        packetizer_->outgoing(vec, nullptr);
-
-        for (size_t i = 0; i < vec.size(); i++) {
-            ret.push_back(std::vector<uint8_t>((uint8_t*)vec[i]->data(), (uint8_t*)(vec[i]->data() + vec[i]->size())));
+void PcmuPacketizer::incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+{
+    while (length > 0) {
+        size_t n = std::min(length, packetSize_ - payloadSize_);
+        memcpy(slot_.data() + RTP_HEADER_SIZE + payloadSize_, data, n);
+        payloadSize_ += n;
+        data += n;
+        length -= n;
+        if (payloadSize_ == packetSize_) {
+            send(cb);
         }
     }
-    return ret;
+}
+
+void PcmuPacketizer::flush(const RtpPacketCallback& cb)
+{
+    if (payloadSize_ > 0) {
+        send(cb);
+    }
+    // The producer went quiet, so the next audio starts a new talkspurt.
+    talkspurt_ = true;
+}
+
+void PcmuPacketizer::packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb)
+{
+    rtpConf_->timestamp = frameTimestamper_.timestamp(rtpConf_->startTimestamp, timestamp);
+    while (length > 0) {
+        size_t n = std::min(length, packetSize_);
+        memcpy(slot_.data() + RTP_HEADER_SIZE, data, n);
+        payloadSize_ = n;
+        data += n;
+        length -= n;
+        send(cb);
+    }
+}
+
+void PcmuPacketizer::send(const RtpPacketCallback& cb)
+{
+    writeRtpFixedHeader(slot_.data(), rtpConf_->payloadType, talkspurt_, rtpConf_->sequenceNumber++, rtpConf_->timestamp, rtpConf_->ssrc);
+    // PCMU timestamps count samples, which is one per byte.
+    rtpConf_->timestamp += payloadSize_;
+    size_t size = RTP_HEADER_SIZE + payloadSize_;
+    payloadSize_ = 0;
+    talkspurt_ = false;
+    cb(slot_.data(), size);
 }
 
 } // namespace
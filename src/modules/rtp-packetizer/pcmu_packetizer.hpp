@@ -2,46 +2,80 @@
 
 #include "rtp_packetizer.hpp"
 
-#include <rtc/h264rtppacketizer.hpp>
-#include <rtc/rtppacketizer.hpp>
+#include <nabto/nabto_device_webrtc.hpp>
 #include <rtc/rtppacketizationconfig.hpp>
 
 #include <chrono>
 
 namespace nabto {
 
-class PcmuPacketizer : public RtpPacketizer
-{
-public:
-    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt) { return std::make_shared<PcmuPacketizer>(ssrc, trackId, pt); }
+// PCMU is 8000 samples per second of one byte each.
+const size_t PCMU_BYTES_PER_MS = 8;
 
-    PcmuPacketizer(uint32_t ssrc, std::string& trackId, int pt) {
-        rtpConf_ = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, trackId, pt, 8000);
-        packetizer_ = std::make_shared<rtc::RtpPacketizer>(rtpConf_);
+class PcmuPacketizerConf {
+public:
+    // Duration of the audio in each packet. 20 ms is the usual ptime for
+    // PCMU, use 10 ms for the lowest latency or 40 ms to halve the packet rate.
+    std::chrono::milliseconds ptime{20};
+    // If no data arrives for this long, audio not filling a whole packet is
+    // sent as a shorter packet. Zero disables this.
+    std::chrono::milliseconds idleFlush{0};
+};
 
+class PcmuPacketizer : public RtpPacketizer, public FramePacketizer
+{
+public:
+    static RtpPacketizerPtr create(uint32_t ssrc, std::string& trackId, int pt, const PcmuPacketizerConf& conf = PcmuPacketizerConf()) {
+        return std::make_shared<PcmuPacketizer>(ssrc, trackId, pt, conf);
     }
 
-    std::vector<std::vector<uint8_t> > packetize(std::vector<uint8_t> data);
+    PcmuPacketizer(uint32_t ssrc, std::string& trackId, int pt, const PcmuPacketizerConf& conf);
 
     std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data);
 
+    void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb);
+
+    std::chrono::milliseconds idleFlushTimeout() const { return conf_.idleFlush; }
+
+    void flush(const RtpPacketCallback& cb);
+
+    /**
+     * Packetize a frame of samples into packets of up to ptime. The frame
+     * is not combined with other frames, so the last packet may be shorter.
+     */
+    void packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const FramePacketCallback& cb);
+
 private:
-    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
-    std::shared_ptr<rtc::RtpPacketizer> packetizer_;
-    std::vector<uint8_t> buffer_;
+    void send(const RtpPacketCallback& cb);
 
+    PcmuPacketizerConf conf_;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_;
+    FrameTimestamper frameTimestamper_{8000};
+    // Payload bytes per packet
+    size_t packetSize_;
+    // The packet being filled. Data is copied straight into its payload, so
+    // nothing is ever moved to the front of a buffer.
+    std::vector<uint8_t> slot_;
+    size_t payloadSize_ = 0;
+    // Set the marker on the first packet of a talkspurt
+    bool talkspurt_ = true;
 };
 
 class PcmuPacketizerFactory : public RtpPacketizerFactory
 {
 public:
-    static RtpPacketizerFactoryPtr create(const std::string& trackId) {
-        return std::make_shared<PcmuPacketizerFactory>(trackId);
+    static RtpPacketizerFactoryPtr create(const std::string& trackId, const PcmuPacketizerConf& conf = PcmuPacketizerConf()) {
+        return std::make_shared<PcmuPacketizerFactory>(trackId, conf);
     }
-    PcmuPacketizerFactory(const std::string& trackId): RtpPacketizerFactory(trackId) { }
+    PcmuPacketizerFactory(const std::string& trackId, const PcmuPacketizerConf& conf): RtpPacketizerFactory(trackId), conf_(conf) { }
     RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) {
-        return PcmuPacketizer::create(ssrc, trackId_, pt);
+        return PcmuPacketizer::create(ssrc, trackId_, pt, conf_);
+    }
+    size_t maxPacketSize() const {
+        return RTP_HEADER_SIZE + conf_.ptime.count() * PCMU_BYTES_PER_MS;
     }
+private:
+    PcmuPacketizerConf conf_;
 };
 
 } // namespace
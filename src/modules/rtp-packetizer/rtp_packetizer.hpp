@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 #include <string>
@@ -12,10 +16,85 @@ typedef std::shared_ptr<RtpPacketizer> RtpPacketizerPtr;
 class RtpPacketizerFactory;
 typedef std::shared_ptr<RtpPacketizerFactory> RtpPacketizerFactoryPtr;
 
+// Receives a packet from a packetizer. The packet is only valid during the call.
+typedef std::function<void(const uint8_t* packet, size_t length)> RtpPacketCallback;
+
+const size_t RTP_HEADER_SIZE = 12;
+
+/**
+ * Write an RTP fixed header without CSRCs and extensions into the first
+ * RTP_HEADER_SIZE bytes of slot.
+ */
+inline size_t writeRtpFixedHeader(uint8_t* slot, uint8_t payloadType, bool marker, uint16_t seq, uint32_t timestamp, uint32_t ssrc)
+{
+    slot[0] = 0x80; // version 2
+    slot[1] = (payloadType & 0x7F) | (marker ? 0x80 : 0);
+    slot[2] = (uint8_t)(seq >> 8);
+    slot[3] = (uint8_t)seq;
+    slot[4] = (uint8_t)(timestamp >> 24);
+    slot[5] = (uint8_t)(timestamp >> 16);
+    slot[6] = (uint8_t)(timestamp >> 8);
+    slot[7] = (uint8_t)timestamp;
+    slot[8] = (uint8_t)(ssrc >> 24);
+    slot[9] = (uint8_t)(ssrc >> 16);
+    slot[10] = (uint8_t)(ssrc >> 8);
+    slot[11] = (uint8_t)ssrc;
+    return RTP_HEADER_SIZE;
+}
+
+/**
+ * Gives the RTP timestamps of frames passed to FramePacketizer::packetizeFrame()
+ * from their presentation times. The first frame gets the start timestamp.
+ */
+class FrameTimestamper {
+public:
+    FrameTimestamper(uint32_t clockRate) : clockRate_(clockRate) {}
+
+    uint32_t timestamp(uint32_t startTimestamp, std::chrono::microseconds pts)
+    {
+        if (!started_) {
+            firstPts_ = pts;
+            started_ = true;
+        }
+        int64_t ticks = (pts - firstPts_).count() * (int64_t)clockRate_ / 1000000;
+        return startTimestamp + (uint32_t)ticks;
+    }
+
+private:
+    uint32_t clockRate_;
+    bool started_ = false;
+    std::chrono::microseconds firstPts_{0};
+};
+
 class RtpPacketizer
 {
 public:
     virtual std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data) = 0;
+
+    /**
+     * Packetize a chunk of the source byte stream and pass each RTP packet to
+     * cb. Packetizers overriding this write packets into memory they own and
+     * reuse, so no allocations are made per packet. The default
+     * implementation calls incoming() above.
+     */
+    virtual void incoming(const uint8_t* data, size_t length, const RtpPacketCallback& cb)
+    {
+        auto packets = incoming(std::vector<uint8_t>(data, data + length));
+        for (const auto& p : packets) {
+            cb(p.data(), p.size());
+        }
+    }
+
+    /**
+     * Time without new data after which the source should call flush(). Zero
+     * if the packetizer never holds back data waiting for more.
+     */
+    virtual std::chrono::milliseconds idleFlushTimeout() const { return std::chrono::milliseconds(0); }
+
+    /**
+     * Send data held back because it does not fill a whole packet.
+     */
+    virtual void flush(const RtpPacketCallback& cb) {}
 };
 
 class RtpPacketizerFactory
@@ -23,6 +102,13 @@ class RtpPacketizerFactory
 public:
     RtpPacketizerFactory(const std::string& trackId) : trackId_(trackId) {}
     virtual RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) = 0;
+
+    /**
+     * Largest RTP packet, header included, made by the packetizers of this
+     * factory. Sources size the buffers the packets are copied into from it.
+     * 0 if the packetizers have no configured limit.
+     */
+    virtual size_t maxPacketSize() const { return 0; }
 protected:
     std::string trackId_;
 };
@@ -0,0 +1,63 @@
+#include "video_clock.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <cmath>
+
+namespace nabto {
+
+// Max number of frame timestamps waiting for their access unit.
+const size_t VIDEO_MAX_PENDING_TIMESTAMPS = 256;
+
+typedef std::chrono::duration<int64_t, std::ratio<1, 90000> > RtpTicks;
+
+VideoClock::VideoClock(VideoTimestampMode mode, double frameRate)
+    : mode_(mode), frameRate_(frameRate > 0 ? frameRate : 30), start_(std::chrono::steady_clock::now())
+{
+}
+
+void VideoClock::addFrameTimestamp(std::chrono::microseconds pts)
+{
+    if (frameTimestamps_.size() >= VIDEO_MAX_PENDING_TIMESTAMPS) {
+        NPLOGW << "Too many frame timestamps without access units, dropping the oldest";
+        frameTimestamps_.pop_front();
+    }
+    frameTimestamps_.push_back(pts);
+}
+
+uint32_t VideoClock::nextAccessUnit(uint32_t startTs, uint32_t current)
+{
+    uint32_t frameTicks = (uint32_t)std::lround(90000 / frameRate_);
+    uint32_t ts;
+    if (mode_ == VideoTimestampMode::FRAME_RATE) {
+        // Computed from the frame count so rounding errors do not add up.
+        ts = startTs + (uint32_t)std::llround(accessUnits_ * 90000 / frameRate_);
+    } else if (mode_ == VideoTimestampMode::EXPLICIT) {
+        if (!frameTimestamps_.empty()) {
+            std::chrono::microseconds pts = frameTimestamps_.front();
+            frameTimestamps_.pop_front();
+            if (!havePts_) {
+                // Later access units are placed relative to the first one
+                // with a presentation time, which may not be the first one.
+                havePts_ = true;
+                firstPts_ = pts;
+                firstPtsTs_ = accessUnits_ == 0 ? startTs : current + frameTicks;
+            }
+            ts = firstPtsTs_ + (uint32_t)std::chrono::duration_cast<RtpTicks>(pts - firstPts_).count();
+        } else {
+            ts = accessUnits_ == 0 ? startTs : current + frameTicks;
+        }
+    } else {
+        // A steady clock does not jump when the system time is adjusted.
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        ts = startTs + (uint32_t)std::chrono::duration_cast<RtpTicks>(elapsed).count();
+        // Access units parsed from the same read must not share a timestamp.
+        if (accessUnits_ > 0 && (int32_t)(ts - current) <= 0) {
+            ts = current + 1;
+        }
+    }
+    accessUnits_++;
+    return ts;
+}
+
+} // namespace
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+namespace nabto {
+
+/**
+ * Where the RTP timestamp of each access unit of a video stream comes from.
+ */
+enum class VideoTimestampMode {
+    // A monotonic clock sampled when the start of the access unit is parsed.
+    CLOCK,
+    // Advance by 90000 / frameRate for each access unit.
+    FRAME_RATE,
+    // Presentation times given by the producer, read from the frame headers
+    // of H264StreamFormat::LENGTH_PREFIXED_TIMESTAMPED_FRAMES or given with
+    // addFrameTimestamp() by code calling the packetizer directly.
+    EXPLICIT
+};
+
+/**
+ * Gives the 90 kHz RTP timestamps of the access units of a video stream
+ * packetized from a byte stream.
+ */
+class VideoClock {
+public:
+    /**
+     * @param mode       where timestamps come from
+     * @param frameRate  used by FRAME_RATE, and by EXPLICIT for access units
+     *                   without a timestamp. Values <= 0 mean 30.
+     */
+    VideoClock(VideoTimestampMode mode, double frameRate);
+
+    /**
+     * Get the timestamp of the next access unit.
+     *
+     * @param startTimestamp  RTP timestamp of the first access unit
+     * @param current         RTP timestamp of the previous access unit
+     */
+    uint32_t nextAccessUnit(uint32_t startTimestamp, uint32_t current);
+
+    /**
+     * Set the presentation time of the next access unit which has not got one
+     * yet. Only used with VideoTimestampMode::EXPLICIT.
+     */
+    void addFrameTimestamp(std::chrono::microseconds pts);
+
+private:
+    VideoTimestampMode mode_;
+    double frameRate_;
+    std::chrono::steady_clock::time_point start_;
+    // Access units started so far
+    uint64_t accessUnits_ = 0;
+    // Presentation times of the coming access units.
+    std::deque<std::chrono::microseconds> frameTimestamps_;
+    // The first presentation time seen and the RTP timestamp it was given.
+    bool havePts_ = false;
+    std::chrono::microseconds firstPts_{0};
+    uint32_t firstPtsTs_ = 0;
+};
+
+} // namespace
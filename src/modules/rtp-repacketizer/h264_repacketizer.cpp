@@ -0,0 +1,316 @@
+#include "h264_repacketizer.hpp"
+
+#include <algorithm>
+
+namespace nabto {
+
+const uint8_t H264_NAL_IDR = 5;
+const uint8_t H264_NAL_SPS = 7;
+const uint8_t H264_NAL_PPS = 8;
+const uint8_t H264_NAL_STAP_A = 24;
+const uint8_t H264_NAL_FU_A = 28;
+// FU indicator and FU header
+const size_t H264_FU_HEADER_SIZE = 2;
+// Smallest MTU accepted by H264Repacketizer
+const size_t H264_REPACKETIZER_MIN_MTU = 64;
+
+namespace {
+
+uint32_t rtpTimestamp(const uint8_t* packet)
+{
+    return ((uint32_t)packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+}
+
+bool isParameterSet(uint8_t type)
+{
+    return type == H264_NAL_SPS || type == H264_NAL_PPS;
+}
+
+uint32_t typeBit(uint8_t type)
+{
+    return 1u << type;
+}
+
+// The first bytes of the RBSP of a NAL unit, without the NAL unit header and
+// emulation prevention bytes.
+std::vector<uint8_t> rbspPrefix(const uint8_t* nal, size_t length, size_t max)
+{
+    std::vector<uint8_t> rbsp;
+    int zeros = 0;
+    for (size_t i = 1; i < length && rbsp.size() < max; i++) {
+        if (zeros >= 2 && nal[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp.push_back(nal[i]);
+    }
+    return rbsp;
+}
+
+// Read an Exp-Golomb coded value starting at byte `offset`. Returns false if the data ends first.
+bool readUe(const std::vector<uint8_t>& data, size_t offset, uint32_t* value)
+{
+    size_t bit = offset * 8;
+    auto next = [&data, &bit](uint32_t* b) {
+        if (bit >= data.size() * 8) {
+            return false;
+        }
+        *b = (data[bit / 8] >> (7 - bit % 8)) & 1;
+        bit++;
+        return true;
+    };
+    uint32_t b;
+    int zeros = 0;
+    do {
+        if (!next(&b) || (b == 0 && ++zeros > 31)) {
+            return false;
+        }
+    } while (b == 0);
+    uint32_t v = 0;
+    for (int i = 0; i < zeros; i++) {
+        if (!next(&b)) {
+            return false;
+        }
+        v = (v << 1) | b;
+    }
+    *value = (uint32_t)((1ull << zeros) - 1 + v);
+    return true;
+}
+
+// The id of an SPS or PPS, which other NAL units refer to it by. 0 if it cannot be read.
+uint32_t parameterSetId(uint8_t type, const uint8_t* nal, size_t length)
+{
+    // seq_parameter_set_id follows profile_idc, the constraint flags and
+    // level_idc. pic_parameter_set_id comes first.
+    size_t offset = type == H264_NAL_SPS ? 3 : 0;
+    uint32_t id = 0;
+    readUe(rbspPrefix(nal, length, offset + 8), offset, &id);
+    return id;
+}
+
+// Call cb(type, nal, length) for each NAL unit started in an RTP payload. For
+// the first fragment of an FU-A, nal is NULL since the NAL unit is incomplete.
+template <typename F>
+void forEachNalUnit(const uint8_t* p, size_t length, F cb)
+{
+    uint8_t type = p[0] & 0x1F;
+    if (type == H264_NAL_STAP_A) {
+        size_t i = 1;
+        while (i + 2 <= length) {
+            size_t size = (p[i] << 8) | p[i + 1];
+            i += 2;
+            if (size == 0 || i + size > length) {
+                break;
+            }
+            cb(p[i] & 0x1F, p + i, size);
+            i += size;
+        }
+    } else if (type == H264_NAL_FU_A) {
+        if (length >= H264_FU_HEADER_SIZE && (p[1] & 0x80)) {
+            cb(p[1] & 0x1F, (const uint8_t*)NULL, 0);
+        }
+    } else if (type > 0 && type < H264_NAL_STAP_A) {
+        cb(type, p, length);
+    }
+}
+
+} // namespace
+
+H264Repacketizer::H264Repacketizer(uint32_t ssrc, int dstPayloadType, size_t mtu)
+    : RtpRepacketizer(ssrc, dstPayloadType), mtu_(std::max(mtu, H264_REPACKETIZER_MIN_MTU))
+{
+}
+
+size_t H264Repacketizer::rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize)
+{
+    size_t offset;
+    size_t payloadLength;
+    if (slotSize < RTP_FIXED_HEADER_SIZE || !payload(packet, length, 1, &offset, &payloadLength) || payloadLength > mtu_) {
+        return 0;
+    }
+    if (missingParameterSets(packet, packet + offset, payloadLength) != 0) {
+        return 0;
+    }
+    updateAccessUnit(packet, packet + offset, payloadLength);
+    uint16_t seq = ((packet[2] << 8) | packet[3]) + seqOffset_;
+    writeRtpHeader(slot, packet, seq, packet[1] & 0x80);
+    // CSRCs, extensions and padding are sent with the rest of the packet.
+    slot[0] = packet[0];
+    return RTP_FIXED_HEADER_SIZE;
+}
+
+std::vector<std::vector<uint8_t>> H264Repacketizer::handlePacket(std::vector<uint8_t> data)
+{
+    std::vector<std::vector<uint8_t>> ret;
+    size_t offset;
+    size_t payloadLength;
+    if (!payload(data.data(), data.size(), 1, &offset, &payloadLength)) {
+        return ret;
+    }
+    const uint8_t* p = data.data() + offset;
+    uint8_t type = p[0] & 0x1F;
+
+    uint32_t missing = missingParameterSets(data.data(), p, payloadLength);
+    updateAccessUnit(data.data(), p, payloadLength);
+    if (missing != 0) {
+        addParameterSets(ret, missing);
+        auParameterSets_ |= missing;
+    }
+
+    if (payloadLength <= mtu_) {
+        addPacket(ret, NULL, 0, p, payloadLength);
+    } else if (type == H264_NAL_STAP_A) {
+        // Send the aggregated NAL units on their own
+        size_t i = 1;
+        while (i + 2 <= payloadLength) {
+            size_t size = (p[i] << 8) | p[i + 1];
+            i += 2;
+            if (size == 0 || i + size > payloadLength) {
+                break;
+            }
+            addNalUnit(ret, p + i, size);
+            i += size;
+        }
+    } else if (type == H264_NAL_FU_A) {
+        // Fragment the fragment. Only the first piece keeps the start bit and
+        // only the last keeps the end bit.
+        uint8_t fuHeader = p[1];
+        const uint8_t* frag = p + H264_FU_HEADER_SIZE;
+        size_t fragLength = payloadLength - H264_FU_HEADER_SIZE;
+        size_t chunk = mtu_ - H264_FU_HEADER_SIZE;
+        for (size_t i = 0; i < fragLength; i += chunk) {
+            size_t len = std::min(chunk, fragLength - i);
+            uint8_t header[H264_FU_HEADER_SIZE] = { p[0], (uint8_t)(fuHeader & 0x1F) };
+            if (i == 0) {
+                header[1] |= fuHeader & 0x80;
+            }
+            if (i + len == fragLength) {
+                header[1] |= fuHeader & 0x40;
+            }
+            addPacket(ret, header, sizeof(header), frag + i, len);
+        }
+    } else {
+        addNalUnit(ret, p, payloadLength);
+    }
+
+    if (ret.empty()) {
+        return ret;
+    }
+    // Consecutive sequence numbers from the one of the source packet, and
+    // the marker bit only on the last packet.
+    uint16_t seq = ((data[2] << 8) | data[3]) + seqOffset_;
+    bool marker = data[1] & 0x80;
+    for (size_t i = 0; i < ret.size(); i++) {
+        writeRtpHeader(ret[i].data(), data.data(), seq + i, marker && i == ret.size() - 1);
+    }
+    seqOffset_ += ret.size() - 1;
+    return ret;
+}
+
+void H264Repacketizer::setParameterSets(const std::vector<std::vector<uint8_t>>& parameterSets)
+{
+    parameterSets_.clear();
+    for (const auto& nal : parameterSets) {
+        if (nal.empty()) {
+            continue;
+        }
+        uint8_t type = nal[0] & 0x1F;
+        if (isParameterSet(type)) {
+            parameterSets_[{type, parameterSetId(type, nal.data(), nal.size())}] = nal;
+        }
+    }
+}
+
+uint32_t H264Repacketizer::missingParameterSets(const uint8_t* packet, const uint8_t* payload, size_t length) const
+{
+    if (parameterSets_.empty()) {
+        return 0;
+    }
+    bool sameAu = auStarted_ && rtpTimestamp(packet) == auTimestamp_;
+    uint32_t sent = sameAu ? auParameterSets_ : 0;
+    uint32_t missing = 0;
+    forEachNalUnit(payload, length, [&](uint8_t type, const uint8_t*, size_t) {
+        if (isParameterSet(type)) {
+            sent |= typeBit(type);
+        } else if (type == H264_NAL_IDR) {
+            for (const auto& [key, nal] : parameterSets_) {
+                missing |= typeBit(key.first) & ~sent;
+            }
+        }
+    });
+    return missing;
+}
+
+void H264Repacketizer::updateAccessUnit(const uint8_t* packet, const uint8_t* payload, size_t length)
+{
+    uint32_t timestamp = rtpTimestamp(packet);
+    if (!auStarted_ || timestamp != auTimestamp_) {
+        auStarted_ = true;
+        auTimestamp_ = timestamp;
+        auParameterSets_ = 0;
+    }
+    forEachNalUnit(payload, length, [this](uint8_t type, const uint8_t* nal, size_t nalLength) {
+        if (!isParameterSet(type)) {
+            return;
+        }
+        auParameterSets_ |= typeBit(type);
+        // The source sends parameter sets in-band, they may have changed
+        // since the SDP. Fragmented parameter sets are not cached.
+        if (nal != NULL) {
+            parameterSets_[{type, parameterSetId(type, nal, nalLength)}] = std::vector<uint8_t>(nal, nal + nalLength);
+        }
+    });
+}
+
+void H264Repacketizer::addParameterSets(std::vector<std::vector<uint8_t>>& out, uint32_t types)
+{
+    // SPS before PPS, as the map is ordered by type.
+    std::vector<const std::vector<uint8_t>*> nals;
+    size_t stapSize = 1;
+    uint8_t nri = 0;
+    for (const auto& [key, nal] : parameterSets_) {
+        if (typeBit(key.first) & types) {
+            nals.push_back(&nal);
+            stapSize += 2 + nal.size();
+            nri = std::max(nri, (uint8_t)(nal[0] & 0x60));
+        }
+    }
+    if (stapSize > mtu_ || nals.size() == 1) {
+        // Nothing to aggregate, or too large for one packet. Send single NAL unit packets.
+        for (const auto* nal : nals) {
+            addNalUnit(out, nal->data(), nal->size());
+        }
+        return;
+    }
+    std::vector<uint8_t> stap;
+    stap.reserve(stapSize);
+    stap.push_back(nri | H264_NAL_STAP_A);
+    for (const auto* nal : nals) {
+        stap.push_back((uint8_t)(nal->size() >> 8));
+        stap.push_back((uint8_t)nal->size());
+        stap.insert(stap.end(), nal->begin(), nal->end());
+    }
+    addPacket(out, NULL, 0, stap.data(), stap.size());
+}
+
+void H264Repacketizer::addNalUnit(std::vector<std::vector<uint8_t>>& out, const uint8_t* nal, size_t length)
+{
+    if (length <= mtu_) {
+        addPacket(out, NULL, 0, nal, length);
+        return;
+    }
+    // The FU indicator is the NAL unit header with the type changed to FU-A.
+    uint8_t type = nal[0] & 0x1F;
+    size_t chunk = mtu_ - H264_FU_HEADER_SIZE;
+    for (size_t i = 1; i < length; i += chunk) {
+        size_t len = std::min(chunk, length - i);
+        uint8_t header[H264_FU_HEADER_SIZE] = {
+            (uint8_t)((nal[0] & 0xE0) | H264_NAL_FU_A),
+            (uint8_t)((i == 1 ? 0x80 : 0) | (i + len == length ? 0x40 : 0) | type)
+        };
+        addPacket(out, header, sizeof(header), nal + i, len);
+    }
+}
+
+} // namespace
@@ -2,9 +2,7 @@
 
 #include "rtp_repacketizer.hpp"
 
-#include <rtc/rtc.hpp>
-
-
+#include <map>
 
 namespace nabto {
 
@@ -12,66 +10,83 @@ class H264Repacketizer;
 typedef std::shared_ptr<H264Repacketizer> H264RepacketizerPtr;
 
 
+// Default max RTP payload size of packets sent by H264Repacketizer
+const size_t H264_REPACKETIZER_MTU = 1200;
+
+/**
+ * Forwards H.264 RTP packets (RFC 6184) from an RTP or RTSP source, splitting
+ * packets with payloads larger than the MTU.
+ *
+ * Packets which fit are forwarded unchanged except for the SSRC, payload type
+ * and sequence number, so they take the zero-copy path of rewriteHeader().
+ * Larger single NAL unit packets are sent as FU-A fragments, larger FU-A
+ * fragments are fragmented further, and larger STAP-A packets are split into
+ * their NAL units. Only the non-interleaved packetization mode is supported.
+ *
+ * Many cameras only signal SPS and PPS in the sprop-parameter-sets of their
+ * SDP, or repeat only some of them in-band. Parameter sets are cached per
+ * type and id, starting with the configured ones, and the ones found in-band
+ * replace the cached ones with the same type and id. The cached parameter
+ * sets of the types missing from the access unit of an IDR frame are sent as
+ * a STAP-A packet ahead of it, so a viewer joining mid-stream can decode the
+ * first keyframe it gets.
+ *
+ * Sequence numbers are shifted to make room for the added packets, so losses
+ * in the source are still visible to the receiver.
+ */
 class H264Repacketizer : public RtpRepacketizer
 {
 public:
-    static RtpRepacketizerPtr create(std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf) { return std::make_shared<H264Repacketizer>(rtpConf); }
+    static RtpRepacketizerPtr create(uint32_t ssrc, int dstPayloadType, size_t mtu = H264_REPACKETIZER_MTU) {
+        return std::make_shared<H264Repacketizer>(ssrc, dstPayloadType, mtu);
+    }
 
+    H264Repacketizer(uint32_t ssrc, int dstPayloadType, size_t mtu);
 
-    H264Repacketizer(std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf) : RtpRepacketizer(rtpConf->ssrc, rtpConf->payloadType), rtpConf_(rtpConf)
-    {
-        // TODO: remove this workaround for https://github.com/paullouisageneau/libdatachannel/issues/1216
-        rtpConf_->playoutDelayId = 0;
-        packet_ = std::make_shared<rtc::H264RtpPacketizer>(rtc::NalUnit::Separator::LongStartSequence, rtpConf_);
+    std::vector<std::vector<uint8_t>> handlePacket(std::vector<uint8_t> data) override;
 
-    }
+    size_t rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize) override;
 
-    std::vector<std::vector<uint8_t>> handlePacket(std::vector<uint8_t> data)
-    {
-        std::vector<std::vector<uint8_t>> ret;
-        if (data.size() < 2 || data.at(1) == 200) {
-            // ignore RTCP packets for now
-            return ret;
-        }
-
-        auto src = reinterpret_cast<const std::byte*>(data.data());
-        rtc::message_ptr msg = std::make_shared<rtc::Message>(src, src + data.size());
-
-        rtc::message_vector vec;
-        vec.push_back(msg);
-
-        depacket_.incoming(vec, nullptr);
-
-        if (vec.size() > 0) {
-            rtpConf_->timestamp = vec[0]->frameInfo->timestamp;
-            packet_->outgoing(vec, nullptr);
-
-            for (auto m : vec) {
-                uint8_t* src = (uint8_t*)m->data();
-                ret.push_back(std::vector<uint8_t>(src, src+m->size()));
-            }
-        }
-        return ret;
-    }
-private:
-    rtc::H264RtpDepacketizer depacket_;
-    std::shared_ptr<rtc::H264RtpPacketizer> packet_ = nullptr;
-    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConf_ = nullptr;
+    void setParameterSets(const std::vector<std::vector<uint8_t>>& parameterSets) override;
 
+private:
+    // Bit per parameter set type to send ahead of the packet. Not 0 if it
+    // starts an IDR frame and the access unit lacks some of the cached types.
+    uint32_t missingParameterSets(const uint8_t* packet, const uint8_t* payload, size_t length) const;
+    // Follow the access unit of a forwarded packet and cache the parameter sets it carries.
+    void updateAccessUnit(const uint8_t* packet, const uint8_t* payload, size_t length);
+    // Add the cached parameter sets of the given types to out, as one STAP-A packet if they fit.
+    void addParameterSets(std::vector<std::vector<uint8_t>>& out, uint32_t types);
+    // Add a single NAL unit packet, or FU-A fragments if the NAL unit is larger than the MTU.
+    void addNalUnit(std::vector<std::vector<uint8_t>>& out, const uint8_t* nal, size_t length);
+
+    size_t mtu_;
+    // Added to the sequence numbers of the source to make room for the
+    // packets added by splitting and by injecting parameter sets.
+    uint16_t seqOffset_ = 0;
+    // SPS and PPS NAL units without start codes by NAL unit type and parameter set id.
+    std::map<std::pair<uint8_t, uint32_t>, std::vector<uint8_t>> parameterSets_;
+
+    // The access unit of the last forwarded packet, identified by its timestamp.
+    bool auStarted_ = false;
+    uint32_t auTimestamp_ = 0;
+    // Bit per parameter set type sent in the access unit, in-band or injected.
+    uint32_t auParameterSets_ = 0;
 };
 
 class H264RepacketizerFactory : public RtpRepacketizerFactory
 {
 public:
-    static RtpRepacketizerFactoryPtr create() {
-        return std::make_shared<H264RepacketizerFactory>();
+    static RtpRepacketizerFactoryPtr create(size_t mtu = H264_REPACKETIZER_MTU) {
+        return std::make_shared<H264RepacketizerFactory>(mtu);
     }
-    H264RepacketizerFactory() { }
-    RtpRepacketizerPtr createPacketizer(MediaTrackPtr track, uint32_t ssrc, int dstPayloadType)
+    H264RepacketizerFactory(size_t mtu) : mtu_(mtu) { }
+    RtpRepacketizerPtr createPacketizer(MediaTrackPtr, uint32_t ssrc, int dstPayloadType) override
     {
-        auto rtpConf = std::make_shared<rtc::RtpPacketizationConfig>(ssrc, track->getTrackId(), dstPayloadType, 90000);
-        return std::make_shared<H264Repacketizer>(rtpConf);
+        return H264Repacketizer::create(ssrc, dstPayloadType, mtu_);
     }
+private:
+    size_t mtu_;
 };
 
 } // namespace
@@ -0,0 +1,118 @@
+#include "h265_repacketizer.hpp"
+
+#include <algorithm>
+
+namespace nabto {
+
+const uint8_t H265_NAL_AP = 48;
+const uint8_t H265_NAL_FU = 49;
+const size_t H265_NAL_HEADER_SIZE = 2;
+// Payload header and FU header
+const size_t H265_FU_HEADER_SIZE = 3;
+// Smallest MTU accepted by H265Repacketizer
+const size_t H265_REPACKETIZER_MIN_MTU = 64;
+
+H265Repacketizer::H265Repacketizer(uint32_t ssrc, int dstPayloadType, size_t mtu)
+    : RtpRepacketizer(ssrc, dstPayloadType), mtu_(std::max(mtu, H265_REPACKETIZER_MIN_MTU))
+{
+}
+
+size_t H265Repacketizer::rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize)
+{
+    size_t offset;
+    size_t payloadLength;
+    if (slotSize < RTP_FIXED_HEADER_SIZE || !payload(packet, length, H265_NAL_HEADER_SIZE, &offset, &payloadLength) || payloadLength > mtu_) {
+        return 0;
+    }
+    uint16_t seq = ((packet[2] << 8) | packet[3]) + seqOffset_;
+    writeRtpHeader(slot, packet, seq, packet[1] & 0x80);
+    // CSRCs, extensions and padding are sent with the rest of the packet.
+    slot[0] = packet[0];
+    return RTP_FIXED_HEADER_SIZE;
+}
+
+std::vector<std::vector<uint8_t>> H265Repacketizer::handlePacket(std::vector<uint8_t> data)
+{
+    std::vector<std::vector<uint8_t>> ret;
+    size_t offset;
+    size_t payloadLength;
+    if (!payload(data.data(), data.size(), H265_NAL_HEADER_SIZE, &offset, &payloadLength)) {
+        return ret;
+    }
+    const uint8_t* p = data.data() + offset;
+    uint8_t type = (p[0] >> 1) & 0x3F;
+
+    if (payloadLength <= mtu_) {
+        addPacket(ret, NULL, 0, p, payloadLength);
+    } else if (type == H265_NAL_AP) {
+        // Send the aggregated NAL units on their own
+        size_t i = H265_NAL_HEADER_SIZE;
+        while (i + 2 <= payloadLength) {
+            size_t size = (p[i] << 8) | p[i + 1];
+            i += 2;
+            if (size < H265_NAL_HEADER_SIZE || i + size > payloadLength) {
+                break;
+            }
+            addNalUnit(ret, p + i, size);
+            i += size;
+        }
+    } else if (type == H265_NAL_FU) {
+        if (payloadLength <= H265_FU_HEADER_SIZE) {
+            return ret;
+        }
+        // Fragment the fragment. Only the first piece keeps the start bit and
+        // only the last keeps the end bit.
+        uint8_t fuHeader = p[2];
+        const uint8_t* frag = p + H265_FU_HEADER_SIZE;
+        size_t fragLength = payloadLength - H265_FU_HEADER_SIZE;
+        size_t chunk = mtu_ - H265_FU_HEADER_SIZE;
+        for (size_t i = 0; i < fragLength; i += chunk) {
+            size_t len = std::min(chunk, fragLength - i);
+            uint8_t header[H265_FU_HEADER_SIZE] = { p[0], p[1], (uint8_t)(fuHeader & 0x3F) };
+            if (i == 0) {
+                header[2] |= fuHeader & 0x80;
+            }
+            if (i + len == fragLength) {
+                header[2] |= fuHeader & 0x40;
+            }
+            addPacket(ret, header, sizeof(header), frag + i, len);
+        }
+    } else {
+        addNalUnit(ret, p, payloadLength);
+    }
+
+    if (ret.empty()) {
+        return ret;
+    }
+    // Consecutive sequence numbers from the one of the source packet, and
+    // the marker bit only on the last packet.
+    uint16_t seq = ((data[2] << 8) | data[3]) + seqOffset_;
+    bool marker = data[1] & 0x80;
+    for (size_t i = 0; i < ret.size(); i++) {
+        writeRtpHeader(ret[i].data(), data.data(), seq + i, marker && i == ret.size() - 1);
+    }
+    seqOffset_ += ret.size() - 1;
+    return ret;
+}
+
+void H265Repacketizer::addNalUnit(std::vector<std::vector<uint8_t>>& out, const uint8_t* nal, size_t length)
+{
+    if (length <= mtu_) {
+        addPacket(out, NULL, 0, nal, length);
+        return;
+    }
+    // The payload header is the NAL unit header with the type changed to FU.
+    uint8_t type = (nal[0] >> 1) & 0x3F;
+    size_t chunk = mtu_ - H265_FU_HEADER_SIZE;
+    for (size_t i = H265_NAL_HEADER_SIZE; i < length; i += chunk) {
+        size_t len = std::min(chunk, length - i);
+        uint8_t header[H265_FU_HEADER_SIZE] = {
+            (uint8_t)((nal[0] & 0b10000001) | (H265_NAL_FU << 1)),
+            nal[1],
+            (uint8_t)((i == H265_NAL_HEADER_SIZE ? 0x80 : 0) | (i + len == length ? 0x40 : 0) | type)
+        };
+        addPacket(out, header, sizeof(header), nal + i, len);
+    }
+}
+
+} // namespace
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "rtp_repacketizer.hpp"
+
+namespace nabto {
+
+// Default max RTP payload size of packets sent by H265Repacketizer
+const size_t H265_REPACKETIZER_MTU = 1200;
+
+/**
+ * Forwards H.265 RTP packets (RFC 7798) from an RTP or RTSP source, splitting
+ * packets with payloads larger than the MTU.
+ *
+ * Packets which fit are forwarded unchanged except for the SSRC, payload type
+ * and sequence number, so they take the zero-copy path of rewriteHeader().
+ * Larger single NAL unit packets are sent as fragmentation units, larger
+ * fragmentation units are fragmented further, and larger aggregation packets
+ * are split into their NAL units. Sequence numbers are shifted to make room
+ * for the extra packets, so losses in the source are still visible to the
+ * receiver.
+ *
+ * Sources must not use DONL fields (sprop-max-don-diff must be 0).
+ */
+class H265Repacketizer : public RtpRepacketizer
+{
+public:
+    static RtpRepacketizerPtr create(uint32_t ssrc, int dstPayloadType, size_t mtu = H265_REPACKETIZER_MTU) {
+        return std::make_shared<H265Repacketizer>(ssrc, dstPayloadType, mtu);
+    }
+
+    H265Repacketizer(uint32_t ssrc, int dstPayloadType, size_t mtu);
+
+    std::vector<std::vector<uint8_t>> handlePacket(std::vector<uint8_t> data);
+
+    size_t rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize);
+
+private:
+    void addNalUnit(std::vector<std::vector<uint8_t>>& out, const uint8_t* nal, size_t length);
+
+    size_t mtu_;
+    // Added to the sequence numbers of the source to make room for the
+    // packets added by splitting.
+    uint16_t seqOffset_ = 0;
+};
+
+class H265RepacketizerFactory : public RtpRepacketizerFactory
+{
+public:
+    static RtpRepacketizerFactoryPtr create(size_t mtu = H265_REPACKETIZER_MTU) {
+        return std::make_shared<H265RepacketizerFactory>(mtu);
+    }
+    H265RepacketizerFactory(size_t mtu) : mtu_(mtu) { }
+    RtpRepacketizerPtr createPacketizer(MediaTrackPtr track, uint32_t ssrc, int dstPayloadType)
+    {
+        return H265Repacketizer::create(ssrc, dstPayloadType, mtu_);
+    }
+private:
+    size_t mtu_;
+};
+
+} // namespace
@@ -1,6 +1,9 @@
 #include "rtp_repacketizer.hpp"
 #include <rtc/rtp.hpp>
 
+#include <algorithm>
+#include <cstring>
+
 namespace nabto {
 
 RtpRepacketizer::RtpRepacketizer(rtc::SSRC ssrc, int dstPayloadType) :
@@ -16,4 +19,69 @@ std::vector<std::vector<uint8_t>> RtpRepacketizer::handlePacket(std::vector<uint
     return ret;
 }
 
+size_t RtpRepacketizer::rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize)
+{
+    if (length < RTP_FIXED_HEADER_SIZE || slotSize < RTP_FIXED_HEADER_SIZE) {
+        return 0;
+    }
+    memcpy(slot, packet, RTP_FIXED_HEADER_SIZE);
+    auto rtp = reinterpret_cast<rtc::RtpHeader*>(slot);
+    rtp->setSsrc(ssrc_);
+    rtp->setPayloadType(dstPayloadType_);
+    return RTP_FIXED_HEADER_SIZE;
+}
+
+bool RtpRepacketizer::payload(const uint8_t* packet, size_t length, size_t minPayloadLength, size_t* offset, size_t* payloadLength)
+{
+    if (length < RTP_FIXED_HEADER_SIZE) {
+        return false;
+    }
+    // RTCP packet types 200-204 take the place of marker bit and payload type
+    if (packet[1] >= 200 && packet[1] <= 204) {
+        return false;
+    }
+    size_t o = RTP_FIXED_HEADER_SIZE + 4 * (packet[0] & 0x0F);
+    if (packet[0] & 0x10) {
+        if (length < o + 4) {
+            return false;
+        }
+        o += 4 + 4 * ((packet[o + 2] << 8) | packet[o + 3]);
+    }
+    size_t end = length;
+    if (packet[0] & 0x20) {
+        // Padding, the last byte is its length
+        end -= std::min(end, (size_t)packet[length - 1]);
+    }
+    if (o + minPayloadLength > end) {
+        return false;
+    }
+    *offset = o;
+    *payloadLength = end - o;
+    return true;
+}
+
+void RtpRepacketizer::writeRtpHeader(uint8_t* out, const uint8_t* source, uint16_t seq, bool marker)
+{
+    out[0] = 0x80; // version 2
+    out[1] = (dstPayloadType_ & 0x7F) | (marker ? 0x80 : 0);
+    out[2] = (uint8_t)(seq >> 8);
+    out[3] = (uint8_t)seq;
+    memcpy(out + 4, source + 4, 4);
+    out[8] = (uint8_t)(ssrc_ >> 24);
+    out[9] = (uint8_t)(ssrc_ >> 16);
+    out[10] = (uint8_t)(ssrc_ >> 8);
+    out[11] = (uint8_t)ssrc_;
+}
+
+void RtpRepacketizer::addPacket(std::vector<std::vector<uint8_t>>& out, const uint8_t* payloadHeader, size_t payloadHeaderLength, const uint8_t* data, size_t length)
+{
+    // The header is written once all packets made from the source packet are known.
+    std::vector<uint8_t> packet(RTP_FIXED_HEADER_SIZE + payloadHeaderLength + length);
+    if (payloadHeaderLength > 0) {
+        memcpy(packet.data() + RTP_FIXED_HEADER_SIZE, payloadHeader, payloadHeaderLength);
+    }
+    memcpy(packet.data() + RTP_FIXED_HEADER_SIZE + payloadHeaderLength, data, length);
+    out.push_back(std::move(packet));
+}
+
 } // namespace
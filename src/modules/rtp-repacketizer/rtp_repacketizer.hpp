@@ -15,12 +15,47 @@ class RtpRepacketizerFactory;
 typedef std::shared_ptr<RtpRepacketizerFactory> RtpRepacketizerFactoryPtr;
 
 
+// Size of the fixed part of an RTP header (RFC 3550 section 5.1)
+const size_t RTP_FIXED_HEADER_SIZE = 12;
+
 class RtpRepacketizer {
 public:
     RtpRepacketizer(uint32_t ssrc, int dstPayloadType);
     virtual std::vector<std::vector<uint8_t>> handlePacket(std::vector<uint8_t> data);
 
+    /**
+     * Rewrite the RTP header of a packet for zero-copy fan-out.
+     *
+     * If the repacketizer only has to change the SSRC and payload type of the
+     * packet, the rewritten fixed RTP header is written into `slot` and the
+     * number of bytes written is returned. The caller then sends the slot
+     * followed by the remaining bytes of the original packet, so the payload
+     * is shared between all tracks and never copied.
+     *
+     * Returns 0 if the packet must be passed through `handlePacket()` instead.
+     */
+    virtual size_t rewriteHeader(const uint8_t* packet, size_t length, uint8_t* slot, size_t slotSize);
+
+    /**
+     * Codec parameter sets signalled out-of-band by the source, eg. the SPS
+     * and PPS from the sprop-parameter-sets of an RTSP SDP, as NAL units
+     * without start codes. Repacketizers of codecs which need them send them
+     * ahead of keyframes. Ignored by default.
+     */
+    virtual void setParameterSets(const std::vector<std::vector<uint8_t>>&) { }
+
 protected:
+    /**
+     * Get the payload of an RTP packet without header and padding. Returns
+     * false for RTCP packets and for packets with less than
+     * minPayloadLength bytes of payload.
+     */
+    static bool payload(const uint8_t* packet, size_t length, size_t minPayloadLength, size_t* offset, size_t* payloadLength);
+    // Add a packet with room for the RTP header and the given payload to out.
+    static void addPacket(std::vector<std::vector<uint8_t>>& out, const uint8_t* payloadHeader, size_t payloadHeaderLength, const uint8_t* data, size_t length);
+    // Write a fixed RTP header with the SSRC and payload type of the repacketizer and the timestamp of `source`.
+    void writeRtpHeader(uint8_t* out, const uint8_t* source, uint16_t seq, bool marker);
+
     uint32_t ssrc_;
     int dstPayloadType_;
 };
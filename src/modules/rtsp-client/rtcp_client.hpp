@@ -1,5 +1,9 @@
 #pragma once
 
+#include <media-streams/udp_batch_receiver.hpp>
+#include <media-streams/rtp_reception_stats.hpp>
+#include <io-reactor/io_reactor.hpp>
+
 #include <rtc/rtc.hpp>
 
 #include <sys/socket.h>
@@ -10,12 +14,17 @@ typedef int SOCKET;
 #include <thread>
 #include <iostream>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <cstring>
 
 const int RTP_BUFFER_SIZE = 2048;
+const size_t RTCP_BATCH_SIZE = 16;
+const int RTCP_MAX_BATCHES_PER_WAKEUP = 4;
+// Receiver report with the max of 31 report blocks
+const size_t RTCP_REPORT_BUFFER_SIZE = 8 + 31 * 24;
 
 namespace nabto {
 
@@ -30,19 +39,33 @@ public:
         RECEIVER_REPORT,
     };
 
-    static RtcpClientPtr create(uint16_t port)
+    /**
+     * Create an RTCP client listening on port. The socket is read by reactor,
+     * or IoReactor::defaultReactor() if reactor is nullptr.
+     *
+     * Sender reports are answered with receiver reports built from stats,
+     * which should be the reception statistics of the RTP stream. If
+     * nullptr, the reports only carry the LSR and DLSR fields.
+     */
+    static RtcpClientPtr create(uint16_t port, IoReactorPtr reactor = nullptr, RtpReceptionStatsPtr stats = nullptr, size_t batchSize = RTCP_BATCH_SIZE)
     {
-        return std::make_shared<RtcpClient>(port);
+        return std::make_shared<RtcpClient>(port, reactor, stats, batchSize);
     }
 
-    RtcpClient(uint16_t port)
-        : port_(port)
+    RtcpClient(uint16_t port, IoReactorPtr reactor = nullptr, RtpReceptionStatsPtr stats = nullptr, size_t batchSize = RTCP_BATCH_SIZE)
+        : port_(port), reactor_(reactor), receiver_(RtpBufferPool::create(RTP_BUFFER_SIZE, batchSize), batchSize), stats_(stats)
     {
-
+        if (reactor_ == nullptr) {
+            reactor_ = IoReactor::defaultReactor();
+        }
+        if (stats_ == nullptr) {
+            stats_ = RtpReceptionStats::create(90000);
+        }
     }
 
     ~RtcpClient()
     {
+        stop();
     }
 
     void start()
@@ -64,52 +87,59 @@ public:
         int rcvBufSize = 212992;
         setsockopt(rtcpSock_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&rcvBufSize),
             sizeof(rcvBufSize));
-        rtcpThread_ = std::thread(rtcpRunner, this);
+        fcntl(rtcpSock_, F_SETFL, fcntl(rtcpSock_, F_GETFL) | O_NONBLOCK);
+        readerReg_ = reactor_->addReader(rtcpSock_, [this]() { handleReadable(); });
     }
 
     void stop()
     {
+        if (stopped_) {
+            return;
+        }
         NPLOGD << "RtcpClient stopped";
         stopped_ = true;
+        // Returns once the callback is no longer running, so the socket can be closed.
+        reactor_->removeReader(readerReg_);
         if (rtcpSock_ != 0) {
-            shutdown(rtcpSock_, SHUT_RDWR);
             close(rtcpSock_);
+            rtcpSock_ = 0;
         }
-        rtcpThread_.join();
-        NPLOGD << "RtcpClient thread joined";
+        NPLOGD << "RtcpClient removed from reactor";
     }
 
+    // Counters for the batched socket reads, eg. the average batch fill.
+    const UdpBatchStats& ingestStats() { return receiver_.stats(); }
+
 private:
-    static void rtcpRunner(RtcpClient* self)
+    void handleReadable()
     {
-        char buffer[RTP_BUFFER_SIZE];
-        char writeBuffer[64];
-        rtc::RtcpRr* rr = (rtc::RtcpRr*) writeBuffer;
-        memset(rr, 0, 64);
-        int len;
-        int count = 0;
-        struct sockaddr_in srcAddr;
-        socklen_t srcAddrLen = sizeof(srcAddr);
-        while ((len = recvfrom(self->rtcpSock_, buffer, RTP_BUFFER_SIZE, 0, (struct sockaddr*)&srcAddr, &srcAddrLen)) >= 0 && !self->stopped_) {
-            count++;
-            if (count % 100 == 0) {
-                std::cout << ".";
-            }
-            if (count % 1600 == 0) {
-                std::cout << std::endl;
-                count = 0;
+        uint8_t report[RTCP_REPORT_BUFFER_SIZE];
+        for (int b = 0; b < RTCP_MAX_BATCHES_PER_WAKEUP; b++) {
+            int n = receiver_.receive(rtcpSock_);
+            if (n <= 0) {
+                return;
             }
-
-            if (len < 28) {
-                // std::cout << "too small: " << len << "<" << 28 << std::endl;
-                continue;
+            auto arrival = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) {
+                const RtpBufferRef& buffer = receiver_.packet(i);
+                packetCount_++;
+                if (packetCount_ % 100 == 0) {
+                    std::cout << ".";
+                }
+                if (packetCount_ % 1600 == 0) {
+                    std::cout << std::endl;
+                    packetCount_ = 0;
+                }
+
+                if (!stats_->senderReportReceived(buffer->data(), buffer->size(), arrival)) {
+                    continue;
+                }
+                size_t length = stats_->buildReceiverReport(report, sizeof(report), arrival);
+                if (length == 0) {
+                    continue;
+                }
+                sendto(rtcpSock_, report, length, 0, (const struct sockaddr*)&receiver_.sourceAddress(i), receiver_.sourceAddressLength(i));
             }
-            auto sr = reinterpret_cast<rtc::RtcpSr*>(buffer);
-            rtc::RtcpReportBlock* rb = rr->getReportBlock(0);
-            rb->preparePacket(sr->senderSSRC(), 0, 0, 0, 0, 0, sr->ntpTimestamp(), 0);
-            rr->preparePacket(1, 1);
-
-            auto ret = sendto(self->rtcpSock_, rr, rr->header.lengthInBytes(), 0, (struct sockaddr*)&srcAddr, srcAddrLen);
         }
     }
 
@@ -118,7 +148,11 @@ private:
     uint16_t remotePort_ = 6002;
     std::string remoteHost_ = "127.0.0.1";
     SOCKET rtcpSock_ = 0;
-    std::thread rtcpThread_;
+    IoReactorPtr reactor_;
+    IoReactor::Registration readerReg_ = 0;
+    UdpBatchReceiver receiver_;
+    RtpReceptionStatsPtr stats_;
+    int packetCount_ = 0;
 
 };
 
@@ -15,32 +15,8 @@
 #include <sstream>
 #include <cstring>
 
-namespace rtc {
-using std::get;
-using std::holds_alternative;
-}  // namespace rtc
-
 namespace nabto {
 
-class MockMediaTrack : public MediaTrack {
-public:
-    static MediaTrackPtr create(const rtc::Description::Media& media)
-    {
-        return std::make_shared<MockMediaTrack>(media);
-    }
-
-    MockMediaTrack(const rtc::Description::Media& media): media_(media), MediaTrack("", media.generateSdp()) { }
-    std::string getTrackId() { return ""; }
-    std::string getSdp() { return media_.generateSdp(); }
-    void setSdp(const std::string& sdp) { return; }
-    bool send(const uint8_t* buffer, size_t length) {return false;}
-    void setReceiveCallback(MediaRecvCallback cb) {};
-    void setCloseCallback(std::function<void()> cb) {};
-    void setErrorState(enum ErrorState state){};
-private:
-    rtc::Description::Media media_;
-};
-
 std::string toHex(uint8_t* data, size_t len)
 {
     std::stringstream stream;
@@ -119,6 +95,12 @@ RtspClient::RtspClient(const RtspClientConf& conf)
 
     preferTcp_ = conf.preferTcp;
     port_ = conf.port;
+    reactor_ = conf.reactor;
+    sendQueue_ = conf.sendQueue;
+    sendWorker_ = conf.sendWorker;
+    gopCache_ = conf.gopCache;
+    keepAliveInterval_ = conf.keepAliveInterval;
+    description_ = conf.description;
 
     videoNegotiator_ = conf.videoNegotiator;
     if (conf.videoRepack != nullptr) {
@@ -141,6 +123,17 @@ RtspClient::~RtspClient()
 
 void RtspClient::stop()
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    stopCv_.notify_all();
+    if (videoStream_ != nullptr) {
+        videoStream_->keepListening(false);
+    }
+    if (audioStream_ != nullptr) {
+        audioStream_->keepListening(false);
+    }
     if (videoRtcp_ != nullptr) {
         videoRtcp_->stop();
     }
@@ -162,7 +155,7 @@ bool RtspClient::close(std::function<void()> cb)
 void RtspClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack)
 {
     if (tcpClient_ != nullptr) {
-        tcpClient_->setConnection(ref, videoTrack, audioTrack);
+        tcpClient_->addConnection(ref, videoTrack, audioTrack);
     }
     if (videoStream_ != nullptr && videoTrack != nullptr) {
         videoStream_->addConnection(ref, videoTrack);
@@ -174,6 +167,9 @@ void RtspClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr video
 
 void RtspClient::removeConnection(NabtoDeviceConnectionRef ref)
 {
+    if (tcpClient_ != nullptr) {
+        tcpClient_->removeConnection(ref);
+    }
     if (videoStream_ != nullptr) {
         videoStream_->removeConnection(ref);
     }
@@ -223,16 +219,38 @@ void RtspClient::setupRtsp() {
     CURLcode res = CURLE_OK;
     CURL* curl = curl_->getCurl();
 
-    // DESCRIBE REQ
-    auto ret = sendDescribe();
-    if (ret.has_value()) {
-        return resolveStart(ret);
-    }
-    NPLOGD << "Read SDP description: " << readBuffer_;
+    std::optional<RtspDescription> cached;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cached = description_;
+    }
+    if (cached.has_value()) {
+        // A previous session already described the stream.
+        NPLOGD << "Using cached SDP description";
+        readBuffer_ = cached->sdp;
+        contentBase_ = cached->contentBase;
+        if (cached->basicAuth && !setBasicAuthHeader()) {
+            return resolveStart("Unsupported basic auth required");
+        }
+        if (!parseSdpDescription(readBuffer_)) {
+            return resolveStart("Failed to parse cached SDP description");
+        }
+    } else {
+        // DESCRIBE REQ
+        auto ret = sendDescribe();
+        if (ret.has_value()) {
+            return resolveStart(ret);
+        }
+        NPLOGD << "Read SDP description: " << readBuffer_;
 
-    if (!parseDescribeHeaders() ||
-        !parseSdpDescription(readBuffer_)) {
-       return resolveStart("Failed to parse DESCRIBE response");
+        if (!parseDescribeHeaders() ||
+            !parseSdpDescription(readBuffer_)) {
+           return resolveStart("Failed to parse DESCRIBE response");
+        }
+        if (!isDigestAuth_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            description_ = RtspDescription{ readBuffer_, contentBase_, !authHeader_.empty() };
+        }
     }
 
     NPLOGD << "Parsed SDP description!" << std::endl << "  videoControlUrl: " << videoControlUrl_ << " video PT: " << videoPayloadType_;
@@ -260,14 +278,22 @@ void RtspClient::setupRtsp() {
 
         if (preferTcp_) {
             if (tcpClient_ == nullptr) {
-                TcpRtpClientConf conf = { curl_, sessionControlUrl_, videoNegotiator_, audioNegotiator_, videoRepack_, audioRepack_ };
+                TcpRtpClientConf conf = { curl_, sessionControlUrl_, videoNegotiator_, audioNegotiator_, videoRepack_, audioRepack_, sendQueue_, sendWorker_, gopCache_ };
+                conf.keepAliveInterval = keepAliveInterval();
+                conf.keepAlive = [this]() { return sendKeepAlive(); };
+                conf.videoParameterSets = videoParameterSets_;
                 tcpClient_ = TcpRtpClient::create(conf);
             }
         } else {
             nabto::RtpClientConf conf = { trackId_ + "-video", std::string(), port_, videoNegotiator_, videoRepack_ };
+            conf.reactor = reactor_;
+            conf.sendQueue = sendQueue_;
+            conf.sendWorker = sendWorker_;
+            conf.gopCache = gopCache_;
+            conf.parameterSets = videoParameterSets_;
             videoStream_ = RtpClient::create(conf);
 
-            videoRtcp_ = RtcpClient::create(port_ + 1);
+            videoRtcp_ = RtcpClient::create(port_ + 1, reactor_, videoStream_->receptionStats());
             videoRtcp_->start();
         }
     }
@@ -284,14 +310,20 @@ void RtspClient::setupRtsp() {
 
         if (preferTcp_) {
             if (tcpClient_ == nullptr) {
-                TcpRtpClientConf conf = { curl_, sessionControlUrl_, videoNegotiator_, audioNegotiator_, videoRepack_, audioRepack_ };
+                TcpRtpClientConf conf = { curl_, sessionControlUrl_, videoNegotiator_, audioNegotiator_, videoRepack_, audioRepack_, sendQueue_, sendWorker_, gopCache_ };
+                conf.keepAliveInterval = keepAliveInterval();
+                conf.keepAlive = [this]() { return sendKeepAlive(); };
+                conf.videoParameterSets = videoParameterSets_;
                 tcpClient_ = TcpRtpClient::create(conf);
             }
         } else {
             nabto::RtpClientConf conf = { trackId_ + "-audio", std::string(), (uint16_t)(port_ + 2), audioNegotiator_, audioRepack_ };
+            conf.reactor = reactor_;
+            conf.sendQueue = sendQueue_;
+            conf.sendWorker = sendWorker_;
             audioStream_ = RtpClient::create(conf);
 
-            audioRtcp_ = RtcpClient::create(port_ + 3);
+            audioRtcp_ = RtcpClient::create(port_ + 3, reactor_, audioStream_->receptionStats());
             audioRtcp_->start();
         }
     }
@@ -326,15 +358,103 @@ void RtspClient::setupRtsp() {
         return resolveStart("Failed to reset Curl RTSP range option");
     }
 
+    try {
+        // The server sends to the RTP ports for as long as the session plays, viewers or not.
+        if (videoStream_ != nullptr) {
+            videoStream_->keepListening(true);
+        }
+        if (audioStream_ != nullptr) {
+            audioStream_->keepListening(true);
+        }
+    } catch (std::exception& ex) {
+        return resolveStart(std::string(ex.what()));
+    }
+
     resolveStart();
 
     if (tcpClient_ != nullptr) {
         tcpClient_->run();
+    } else {
+        keepAliveRunner();
+    }
+}
+
+std::chrono::milliseconds RtspClient::keepAliveInterval()
+{
+    if (keepAliveInterval_.count() > 0) {
+        return keepAliveInterval_;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(sessionTimeout_) / 2;
+}
+
+void RtspClient::keepAliveRunner()
+{
+    // THIS IS CALLED FROM THE CURL WORKER THREAD!
+    auto interval = keepAliveInterval();
+    NPLOGD << "Sending RTSP keepalives every " << interval.count() << " ms";
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_ && !closing_) {
+        if (stopCv_.wait_for(lock, interval, [this]() { return stopped_ || closing_; })) {
+            break;
+        }
+        lock.unlock();
+        bool ok = sendKeepAlive();
+        lock.lock();
+        if (!ok) {
+            break;
+        }
+    }
+    NPLOGD << "RTSP keepalive runner returning";
+}
+
+bool RtspClient::sendKeepAlive()
+{
+    // THIS IS CALLED FROM THE CURL WORKER THREAD!
+    std::lock_guard<std::mutex> lock(curlMutex_);
+    CURL* curl = curl_->getCurl();
+    while (true) {
+        // RFC 2326 recommends an empty GET_PARAMETER, but not all servers implement it.
+        CURLcode res = CURLE_OK;
+        long request = keepAliveWithOptions_ ? CURL_RTSPREQ_OPTIONS : CURL_RTSPREQ_GET_PARAMETER;
+        std::string method = keepAliveWithOptions_ ? "OPTIONS" : "GET_PARAMETER";
+
+        if ((res = curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, sessionControlUrl_.c_str())) != CURLE_OK ||
+            (res = curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, request)) != CURLE_OK) {
+            NPLOGE << "Failed to create RTSP " << method << " request with: " << curl_easy_strerror(res);
+            return false;
+        }
+        if (isDigestAuth_ && !setDigestHeader(method, sessionControlUrl_)) {
+            NPLOGE << "Failed to set digest auth header";
+            return false;
+        }
+
+        uint16_t status = 0;
+        curl_->reinvokeStatus(&res, &status);
+        if (res != CURLE_OK) {
+            NPLOGE << "Failed to perform RTSP " << method << " keepalive with: " << curl_easy_strerror(res);
+            return false;
+        }
+        if ((status == 405 || status == 501) && !keepAliveWithOptions_) {
+            NPLOGD << "RTSP server does not support GET_PARAMETER, using OPTIONS as keepalive";
+            keepAliveWithOptions_ = true;
+            continue;
+        }
+        if (status > 299) {
+            NPLOGW << "RTSP " << method << " keepalive failed with status code: " << status;
+        }
+        return true;
     }
 }
 
 bool RtspClient::teardown(std::function<void()> cb)
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    stopCv_.notify_all();
+    std::lock_guard<std::mutex> lock(curlMutex_);
+
     // SENDING TEARDOWN REQ
     CURL* curl = curl_->getCurl();
     CURLcode res = CURLE_OK;
@@ -378,88 +498,20 @@ size_t RtspClient::writeFunc(void* ptr, size_t size, size_t nmemb, void* s)
 
 bool RtspClient::parseSdpDescription(const std::string& sdp)
 {
-
-    auto desc = rtc::Description(sdp);
-    auto atts = desc.attributes();
-
-    for (auto a : atts) {
-        if (a.rfind("control:",0) == 0) {
-            sessionControlUrl_ = parseControlAttribute(a);
-        }
+    auto desc = RtspSdp::parse(sdp, contentBase_, videoNegotiator_, audioNegotiator_);
+    sessionControlUrl_ = desc.sessionControlUrl;
+    if (desc.video.has_value()) {
+        videoControlUrl_ = desc.video->controlUrl;
+        videoPayloadType_ = desc.video->payloadType;
+        videoParameterSets_ = desc.video->parameterSets;
     }
-    if (sessionControlUrl_.empty()) {
-        sessionControlUrl_ = contentBase_;
-    }
-
-    auto count = desc.mediaCount();
-    for (size_t i = 0; i < count; i++) {
-        if (rtc::holds_alternative<rtc::Description::Media*>(desc.media(i))) {
-            auto m = rtc::get<rtc::Description::Media*>(desc.media(i));
-            NPLOGD << "Found Media type: " << m->type();
-            std::string controlUrl;
-
-            auto mAtts = m->attributes();
-            for (auto a : mAtts) {
-                if (a.rfind("control:", 0) == 0) {
-                    controlUrl = parseControlAttribute(a);
-                }
-            }
-
-            auto ptVec = m->payloadTypes();
-
-            if (m->type() == "video") {
-                videoControlUrl_ = controlUrl;
-                if (ptVec.size() > 0) {
-                    videoPayloadType_ = ptVec[0];
-                } else {
-                    videoPayloadType_ = videoNegotiator_->payloadType();
-                }
-                auto mediaMock = MockMediaTrack::create(*m);
-                if (videoNegotiator_->match(mediaMock) == 0) {
-                    NPLOGE << "RTSP server offered invalid video codec. The video feed likely won't work!";
-                }
-            }
-            else if (m->type() == "audio") {
-                audioControlUrl_ = controlUrl;
-                if (ptVec.size() > 0) {
-                    audioPayloadType_ = ptVec[0];
-                }
-                else {
-                    audioPayloadType_ = audioNegotiator_->payloadType();
-                }
-                auto mediaMock = MockMediaTrack::create(*m);
-                if (audioNegotiator_->match(mediaMock) == 0) {
-                    NPLOGE << "RTSP server offered invalid audio codec. The audio feed likely won't work!";
-                }
-            }
-            else {
-                NPLOGE << "control attribute for unknown media type: " << m->type();
-            }
-        } else {
-            NPLOGD << "media type not media";
-        }
+    if (desc.audio.has_value()) {
+        audioControlUrl_ = desc.audio->controlUrl;
+        audioPayloadType_ = desc.audio->payloadType;
     }
     return true;
 }
 
-std::string RtspClient::parseControlAttribute(const std::string& att)
-{
-    auto url = att.substr(strlen("control:"));
-    if (url.empty() || url[0] == '*') {
-        // if * use Content-Base
-        return contentBase_;
-    }
-    else if (url.rfind("rtsp://", 0) == 0) {
-        // is full url as it starts with rtsp://
-        return url;
-    }
-    else {
-        // is relative URL
-        return contentBase_ + url;
-    }
-
-}
-
 std::optional<std::string> RtspClient::performSetupReq(const std::string& url, const std::string& transport)
 {
     // THIS IS CALLED FROM THE CURL WORKER THREAD
@@ -486,11 +538,29 @@ std::optional<std::string> RtspClient::performSetupReq(const std::string& url, c
     }
 
 
-    res = curl_->reinvoke();
+    // Headers are read for the session timeout.
+    curlHeaders_.clear();
+    if ((res = curl_easy_setopt(curl, CURLOPT_HEADERDATA, &curlHeaders_)) != CURLE_OK ||
+        (res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFunc)) != CURLE_OK) {
+        NPLOGE << "Failed to set Curl header options: " << curl_easy_strerror(res);
+        return "Failed to create SETUP request";
+    }
+
+    uint16_t status = 0;
+    curl_->reinvokeStatus(&res, &status);
+
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, stdout);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NULL);
+
     if (res != CURLE_OK) {
         NPLOGE << "Failed to perform RTSP SETUP request: " << curl_easy_strerror(res);
         return "Failed to perform RTSP SETUP request";
     }
+    if (status > 299) {
+        NPLOGE << "RTSP SETUP request failed with status code: " << status;
+        return "RTSP SETUP request failed with status code: " + std::to_string(status);
+    }
+    parseSessionTimeout();
     return std::nullopt;
 
 }
@@ -529,18 +599,10 @@ std::optional<std::string> RtspClient::sendDescribe()
         NPLOGD << "Got 401 trying to authenticate";
         size_t pos = curlHeaders_.find("WWW-Authenticate: Basic");
         if (pos != std::string::npos) {
-#ifdef NABTO_RTSP_HAS_BASIC_AUTH
-            std::string credStr = username_ + ":" + password_;
-            NPLOGD << "Trying Basic auth with: " << credStr;
-            auto creds = jwt::base::encode<jwt::alphabet::base64>(credStr);
-            authHeader_ = "Authorization: Basic " + creds;
-            curlReqHeaders_ = curl_slist_append(curlReqHeaders_, authHeader_.c_str());
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curlReqHeaders_);
+            if (!setBasicAuthHeader()) {
+                return "Unsupported basic auth required";
+            }
             return sendDescribe();
-#else
-            NPLOGE << "Server requires Basic Auth, but Basic Auth is disabled";
-            return "Unsupported basic auth required";
-#endif
         }
 
         pos = curlHeaders_.find("WWW-Authenticate: Digest");
@@ -643,6 +705,49 @@ bool RtspClient::setDigestHeader(std::string method, std::string url)
 #endif
 }
 
+bool RtspClient::setBasicAuthHeader()
+{
+#ifdef NABTO_RTSP_HAS_BASIC_AUTH
+    std::string credStr = username_ + ":" + password_;
+    NPLOGD << "Trying Basic auth with: " << credStr;
+    auto creds = jwt::base::encode<jwt::alphabet::base64>(credStr);
+    authHeader_ = "Authorization: Basic " + creds;
+    curlReqHeaders_ = curl_slist_append(curlReqHeaders_, authHeader_.c_str());
+    CURL* curl = curl_->getCurl();
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curlReqHeaders_);
+    return true;
+#else
+    NPLOGE << "Server requires Basic Auth, but Basic Auth is disabled";
+    return false;
+#endif
+}
+
+void RtspClient::parseSessionTimeout()
+{
+    // Session: 12345678;timeout=60
+    size_t pos = curlHeaders_.find("Session:");
+    if (pos == std::string::npos) {
+        return;
+    }
+    auto session = curlHeaders_.substr(pos);
+    session = session.substr(0, session.find("\r\n"));
+    pos = session.find(";timeout=");
+    if (pos == std::string::npos) {
+        return;
+    }
+    int timeout = atoi(session.c_str() + pos + strlen(";timeout="));
+    if (timeout > 0) {
+        sessionTimeout_ = std::chrono::seconds(timeout);
+        NPLOGD << "RTSP session timeout is " << timeout << " seconds";
+    }
+}
+
+std::optional<RtspDescription> RtspClient::description()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return description_;
+}
+
 void RtspClient::resolveStart(std::optional<std::string> error)
 {
     if (startCb_) {
@@ -5,6 +5,7 @@
 #include <track-negotiators/pcmu.hpp>
 #include <rtp-repacketizer/rtp_repacketizer.hpp>
 #include "rtcp_client.hpp"
+#include "rtsp_sdp.hpp"
 #include "tcp_rtp_client.hpp"
 #include <util/util.hpp>
 
@@ -14,7 +15,10 @@
 #include <sys/socket.h>
 typedef int SOCKET;
 
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 namespace nabto {
@@ -25,6 +29,15 @@ class RtspClient;
 
 typedef std::shared_ptr<RtspClient> RtspClientPtr;
 
+// Result of a DESCRIBE request which can be reused by later sessions to the same URL.
+class RtspDescription {
+public:
+    std::string sdp;
+    std::string contentBase;
+    // The server required Basic authentication.
+    bool basicAuth = false;
+};
+
 class RtspClientConf {
 public:
     std::string trackId;
@@ -42,6 +55,20 @@ public:
     //   port+3: Port for Audio RTCP if exists
     // if unset port defaults to 42222 meaning 42222-42225 is used.
     uint16_t port = 42222;
+    // Reactor reading the RTP/RTCP sockets when not using TCP. If not set,
+    // IoReactor::defaultReactor() is used.
+    IoReactorPtr reactor = nullptr;
+    // Size and overflow policy of the send queues of the RTP clients.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued packets. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // GOP cache of the video stream.
+    GopCacheConf gopCache;
+    // Interval between RTSP keepalive requests while playing. If 0, half the
+    // session timeout announced by the server is used.
+    std::chrono::milliseconds keepAliveInterval{0};
+    // DESCRIBE result of an earlier session to use instead of sending DESCRIBE.
+    std::optional<RtspDescription> description;
 };
 
 class RtspClient : public std::enable_shared_from_this<RtspClient>
@@ -58,6 +85,11 @@ public:
     void addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack);
     void removeConnection(NabtoDeviceConnectionRef ref);
 
+    // DESCRIBE result of this session, for reuse by later sessions. Not set
+    // before the session is set up, or if the server requires Digest
+    // authentication as the nonce must come from a fresh DESCRIBE.
+    std::optional<RtspDescription> description();
+
 private:
     void setupRtsp();
     bool teardown(std::function<void()> cb);
@@ -69,19 +101,38 @@ private:
 
     std::optional<std::string> performSetupReq(const std::string& url, const std::string& transport);
     bool parseSdpDescription(const std::string& desc);
-    std::string parseControlAttribute(const std::string& att);
 
     static size_t writeFunc(void* ptr, size_t size, size_t nmemb, void* self);
 
     void resolveStart(std::optional<std::string> error = std::nullopt);
 
     bool setDigestHeader(std::string method, std::string url);
+    bool setBasicAuthHeader();
+
+    // Parse the session timeout from the headers of a SETUP response.
+    void parseSessionTimeout();
+    std::chrono::milliseconds keepAliveInterval();
+    // Send a GET_PARAMETER, or OPTIONS if the server does not support it, to keep the session alive.
+    bool sendKeepAlive();
+    // Sends keepalives until stopped when RTP is not interleaved on the RTSP connection.
+    void keepAliveRunner();
 
     std::string trackId_;
     std::string url_;
     uint16_t port_ = 42222;
     bool stopped_ = false;
+    // Set by close(), ends the keepalives so the curl thread can send TEARDOWN.
+    bool closing_ = false;
+    std::mutex mutex_;
+    std::condition_variable stopCv_;
+    // Held while building and sending keepalives and when building TEARDOWN,
+    // as close() can be called from another thread.
+    std::mutex curlMutex_;
     bool preferTcp_ = true;
+    IoReactorPtr reactor_ = nullptr;
+    ViewerQueueConf sendQueue_;
+    MediaSendWorkerPtr sendWorker_ = nullptr;
+    GopCacheConf gopCache_;
 
     std::function<void(std::optional<std::string> error)> startCb_;
 
@@ -102,6 +153,11 @@ private:
 
 
     std::string sessionControlUrl_;
+    // Session timeout from the SETUP response. RFC 2326 defaults to 60 seconds.
+    std::chrono::seconds sessionTimeout_{60};
+    std::chrono::milliseconds keepAliveInterval_{0};
+    bool keepAliveWithOptions_ = false;
+    std::optional<RtspDescription> description_;
 
     TcpRtpClientPtr tcpClient_ = nullptr;
 
@@ -109,6 +165,8 @@ private:
     TrackNegotiatorPtr videoNegotiator_;
     std::string videoControlUrl_;
     int videoPayloadType_;
+    // SPS and PPS from the SDP, injected ahead of IDR frames by the H.264 repacketizer.
+    std::vector<std::vector<uint8_t>> videoParameterSets_;
     RtcpClientPtr videoRtcp_ = nullptr;
     RtpRepacketizerFactoryPtr videoRepack_ = RtpRepacketizerFactory::create();
 
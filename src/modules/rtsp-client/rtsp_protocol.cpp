@@ -0,0 +1,417 @@
+#include "rtsp_protocol.hpp"
+
+#include <util/util.hpp>
+
+#ifdef NABTO_RTSP_HAS_DIGEST_AUTH
+#include <openssl/evp.h>
+#endif
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+namespace nabto {
+
+namespace {
+
+bool equalsIgnoreCase(const std::string& a, const std::string& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool startsWithIgnoreCase(const std::string& s, const std::string& prefix)
+{
+    return s.size() >= prefix.size() && equalsIgnoreCase(s.substr(0, prefix.size()), prefix);
+}
+
+std::string trim(const std::string& s)
+{
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// Find the end of the header block, returns the offset after the empty line.
+std::optional<size_t> findHeaderEnd(const uint8_t* data, size_t length)
+{
+    for (size_t i = 0; i + 3 < length; i++) {
+        if (data[i] == '\r' && data[i+1] == '\n' && data[i+2] == '\r' && data[i+3] == '\n') {
+            return i + 4;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+std::optional<RtspUrl> RtspUrl::parse(const std::string& url)
+{
+    const std::string scheme = "rtsp://";
+    if (!startsWithIgnoreCase(url, scheme)) {
+        return std::nullopt;
+    }
+    RtspUrl result;
+    std::string rest = url.substr(scheme.size());
+    size_t pathStart = rest.find('/');
+    std::string authority = rest.substr(0, pathStart);
+    std::string path = pathStart == std::string::npos ? "" : rest.substr(pathStart);
+
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        std::string userInfo = authority.substr(0, at);
+        authority = authority.substr(at + 1);
+        size_t col = userInfo.find(':');
+        result.username = urlDecode(userInfo.substr(0, col));
+        if (col != std::string::npos) {
+            result.password = urlDecode(userInfo.substr(col + 1));
+        }
+    }
+
+    size_t portStart = authority.rfind(':');
+    if (portStart != std::string::npos && authority.find(']', portStart) == std::string::npos) {
+        int port = atoi(authority.c_str() + portStart + 1);
+        if (port <= 0 || port > 65535) {
+            return std::nullopt;
+        }
+        result.port = (uint16_t)port;
+        result.host = authority.substr(0, portStart);
+    } else {
+        result.host = authority;
+    }
+    if (result.host.size() > 1 && result.host.front() == '[' && result.host.back() == ']') {
+        result.host = result.host.substr(1, result.host.size() - 2);
+    }
+    if (result.host.empty()) {
+        return std::nullopt;
+    }
+    result.url = scheme + authority + path;
+    return result;
+}
+
+std::optional<std::string> RtspResponse::header(const std::string& name) const
+{
+    for (const auto& [key, value] : headers) {
+        if (equalsIgnoreCase(key, name)) {
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<std::string> RtspResponse::headerValues(const std::string& name) const
+{
+    std::vector<std::string> values;
+    for (const auto& [key, value] : headers) {
+        if (equalsIgnoreCase(key, name)) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+int RtspResponse::cseq() const
+{
+    auto value = header("CSeq");
+    if (!value.has_value()) {
+        return -1;
+    }
+    return atoi(value->c_str());
+}
+
+std::optional<RtspInterleavedChannels> RtspInterleavedChannels::parse(const std::string& transport)
+{
+    std::string first = transport.substr(0, transport.find(','));
+    size_t start = 0;
+    while (start <= first.size()) {
+        size_t end = first.find(';', start);
+        std::string param = trim(first.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        const std::string name = "interleaved=";
+        if (startsWithIgnoreCase(param, name)) {
+            const char* p = param.c_str() + name.size();
+            char* rest;
+            long rtp = strtol(p, &rest, 10);
+            if (rest == p || rtp < 0 || rtp > 255) {
+                return std::nullopt;
+            }
+            long rtcp = rtp + 1;
+            if (*rest == '-') {
+                p = rest + 1;
+                rtcp = strtol(p, &rest, 10);
+                if (rest == p) {
+                    return std::nullopt;
+                }
+            }
+            if (*rest != '\0' || rtcp < 0 || rtcp > 255) {
+                return std::nullopt;
+            }
+            RtspInterleavedChannels channels;
+            channels.rtp = (uint8_t)rtp;
+            channels.rtcp = (uint8_t)rtcp;
+            return channels;
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return std::nullopt;
+}
+
+std::string RtspRequest::toString(int cseq) const
+{
+    std::string request = method + " " + url + " RTSP/1.0\r\n";
+    request += "CSeq: " + std::to_string(cseq) + "\r\n";
+    for (const auto& [key, value] : headers) {
+        request += key + ": " + value + "\r\n";
+    }
+    request += "\r\n";
+    return request;
+}
+
+std::optional<size_t> RtspParser::parse(const uint8_t* data, size_t length, const InterleavedCallback& onInterleaved, const ResponseCallback& onResponse)
+{
+    size_t offset = 0;
+    while (offset < length) {
+        const uint8_t* msg = data + offset;
+        size_t available = length - offset;
+
+        if (msg[0] == '\r' || msg[0] == '\n') {
+            // Some servers send empty lines between messages
+            offset++;
+            continue;
+        }
+
+        if (msg[0] == '$') {
+            if (available < 4) {
+                break;
+            }
+            size_t frameLength = (msg[2] << 8) + msg[3];
+            if (available < 4 + frameLength) {
+                break;
+            }
+            onInterleaved(msg[1], msg + 4, frameLength);
+            offset += 4 + frameLength;
+            continue;
+        }
+
+        auto headerEnd = findHeaderEnd(msg, available);
+        if (!headerEnd.has_value()) {
+            break;
+        }
+
+        std::string head((const char*)msg, *headerEnd - 4);
+        std::istringstream lines(head);
+        std::string line;
+        std::getline(lines, line);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        RtspResponse response;
+        bool isResponse = line.rfind("RTSP/", 0) == 0;
+        if (isResponse) {
+            size_t codeStart = line.find(' ');
+            if (codeStart == std::string::npos) {
+                return std::nullopt;
+            }
+            response.statusCode = atoi(line.c_str() + codeStart + 1);
+            size_t reasonStart = line.find(' ', codeStart + 1);
+            if (reasonStart != std::string::npos) {
+                response.reason = line.substr(reasonStart + 1);
+            }
+            if (response.statusCode < 100 || response.statusCode > 999) {
+                return std::nullopt;
+            }
+        } else if (line.find(" RTSP/") == std::string::npos) {
+            return std::nullopt;
+        }
+
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            size_t col = line.find(':');
+            if (col == std::string::npos) {
+                continue;
+            }
+            response.headers.push_back({ trim(line.substr(0, col)), trim(line.substr(col + 1)) });
+        }
+
+        size_t contentLength = 0;
+        auto cl = response.header("Content-Length");
+        if (cl.has_value()) {
+            // Bounded before it is added to the offsets, so it cannot overflow.
+            char* end;
+            unsigned long long value = strtoull(cl->c_str(), &end, 10);
+            if (cl->empty() || !isdigit((unsigned char)(*cl)[0]) || *end != '\0' || value > RTSP_MAX_CONTENT_LENGTH) {
+                return std::nullopt;
+            }
+            contentLength = (size_t)value;
+        }
+        if (available < *headerEnd + contentLength) {
+            break;
+        }
+        response.body = std::string((const char*)msg + *headerEnd, contentLength);
+        offset += *headerEnd + contentLength;
+
+        if (isResponse) {
+            onResponse(response);
+        }
+        // Requests from the server, eg. ANNOUNCE or keepalives, are not supported and ignored.
+    }
+    return offset;
+}
+
+bool RtspAuth::challenge(const std::vector<std::string>& wwwAuthenticate)
+{
+#ifdef NABTO_RTSP_HAS_DIGEST_AUTH
+    for (const auto& c : wwwAuthenticate) {
+        if (!startsWithIgnoreCase(c, "Digest ")) {
+            continue;
+        }
+        auto realm = param(c, "realm");
+        auto nonce = param(c, "nonce");
+        if (!realm.has_value() || !nonce.has_value()) {
+            continue;
+        }
+        scheme_ = DIGEST;
+        realm_ = *realm;
+        nonce_ = *nonce;
+        opaque_ = param(c, "opaque").value_or("");
+        auto qop = param(c, "qop");
+        qopAuth_ = qop.has_value() && qop->find("auth") != std::string::npos;
+        nonceCount_ = 0;
+        return true;
+    }
+#endif
+    for (const auto& c : wwwAuthenticate) {
+        if (startsWithIgnoreCase(c, "Basic")) {
+            return useBasic();
+        }
+    }
+    return false;
+}
+
+bool RtspAuth::useBasic()
+{
+#ifdef NABTO_RTSP_HAS_BASIC_AUTH
+    scheme_ = BASIC;
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string RtspAuth::authorization(const std::string& method, const std::string& uri)
+{
+    if (scheme_ == BASIC) {
+        return "Basic " + base64(username_ + ":" + password_);
+    } else if (scheme_ == DIGEST) {
+        std::string ha1 = md5(username_ + ":" + realm_ + ":" + password_);
+        std::string ha2 = md5(method + ":" + uri);
+        std::string header = "Digest username=\"" + username_ + "\", realm=\"" + realm_ +
+            "\", nonce=\"" + nonce_ + "\", uri=\"" + uri + "\"";
+        std::string response;
+        if (qopAuth_) {
+            std::stringstream nc;
+            nc << std::setfill('0') << std::setw(8) << std::hex << ++nonceCount_;
+            std::random_device rd;
+            std::stringstream cnonce;
+            cnonce << std::hex << rd() << rd();
+            response = md5(ha1 + ":" + nonce_ + ":" + nc.str() + ":" + cnonce.str() + ":auth:" + ha2);
+            header += ", qop=auth, nc=" + nc.str() + ", cnonce=\"" + cnonce.str() + "\"";
+        } else {
+            response = md5(ha1 + ":" + nonce_ + ":" + ha2);
+        }
+        header += ", response=\"" + response + "\"";
+        if (!opaque_.empty()) {
+            header += ", opaque=\"" + opaque_ + "\"";
+        }
+        return header;
+    }
+    return "";
+}
+
+std::optional<std::string> RtspAuth::param(const std::string& challenge, const std::string& name)
+{
+    // name="value" or name=value, separated by commas
+    size_t pos = 0;
+    while ((pos = challenge.find(name + "=", pos)) != std::string::npos) {
+        if (pos > 0 && challenge[pos-1] != ' ' && challenge[pos-1] != ',') {
+            pos++;
+            continue;
+        }
+        size_t start = pos + name.size() + 1;
+        if (start < challenge.size() && challenge[start] == '"') {
+            size_t end = challenge.find('"', start + 1);
+            if (end == std::string::npos) {
+                return std::nullopt;
+            }
+            return challenge.substr(start + 1, end - start - 1);
+        }
+        size_t end = challenge.find(',', start);
+        return trim(challenge.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    }
+    return std::nullopt;
+}
+
+std::string RtspAuth::base64(const std::string& in)
+{
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < in.size(); i += 3) {
+        uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i+1] << 8) | (uint8_t)in[i+2];
+        out += alphabet[(v >> 18) & 0x3f];
+        out += alphabet[(v >> 12) & 0x3f];
+        out += alphabet[(v >> 6) & 0x3f];
+        out += alphabet[v & 0x3f];
+    }
+    if (i + 1 == in.size()) {
+        uint32_t v = (uint8_t)in[i] << 16;
+        out += alphabet[(v >> 18) & 0x3f];
+        out += alphabet[(v >> 12) & 0x3f];
+        out += "==";
+    } else if (i + 2 == in.size()) {
+        uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i+1] << 8);
+        out += alphabet[(v >> 18) & 0x3f];
+        out += alphabet[(v >> 12) & 0x3f];
+        out += alphabet[(v >> 6) & 0x3f];
+        out += '=';
+    }
+    return out;
+}
+
+std::string RtspAuth::md5(const std::string& in)
+{
+#ifdef NABTO_RTSP_HAS_DIGEST_AUTH
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    if (!EVP_Digest(in.data(), in.size(), digest, &digestLength, EVP_md5(), NULL)) {
+        return "";
+    }
+    std::stringstream hex;
+    for (unsigned int i = 0; i < digestLength; i++) {
+        hex << std::setfill('0') << std::setw(2) << std::hex << (int)digest[i];
+    }
+    return hex.str();
+#else
+    return "";
+#endif
+}
+
+} // namespace
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nabto {
+
+// Largest message body accepted. A larger Content-Length makes the data invalid.
+const size_t RTSP_MAX_CONTENT_LENGTH = 64 * 1024;
+
+/**
+ * RTSP/1.0 message handling used by RtspReactorClient. Nothing in here does
+ * any IO, so it can be driven from any event loop.
+ */
+
+class RtspUrl {
+public:
+    /**
+     * Parse rtsp://[user:password@]host[:port][/path]. The credentials are
+     * URL decoded and removed from url.
+     */
+    static std::optional<RtspUrl> parse(const std::string& url);
+
+    // The URL without credentials, used in requests.
+    std::string url;
+    std::string host;
+    uint16_t port = 554;
+    std::string username;
+    std::string password;
+};
+
+class RtspResponse {
+public:
+    int statusCode = 0;
+    std::string reason;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Value of the first header named name, ignoring case.
+    std::optional<std::string> header(const std::string& name) const;
+    // Values of all headers named name, ignoring case.
+    std::vector<std::string> headerValues(const std::string& name) const;
+    // CSeq of the response, or -1 if missing.
+    int cseq() const;
+};
+
+/**
+ * The interleaved channels of a Transport header, eg.
+ * "RTP/AVP/TCP;unicast;interleaved=0-1" (RFC 2326 12.39).
+ */
+class RtspInterleavedChannels {
+public:
+    /**
+     * Parse the interleaved parameter of the first transport in the header.
+     * A single channel means RTCP uses the next one. std::nullopt if there is
+     * no valid interleaved parameter.
+     */
+    static std::optional<RtspInterleavedChannels> parse(const std::string& transport);
+
+    uint8_t rtp = 0;
+    uint8_t rtcp = 1;
+};
+
+class RtspRequest {
+public:
+    std::string method;
+    std::string url;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    // Serialize the request with the given CSeq.
+    std::string toString(int cseq) const;
+};
+
+/**
+ * Splits data received on an RTSP connection into responses and
+ * interleaved binary frames ($, channel, 16 bit length, data).
+ *
+ * Interleaved frames are passed on as pointers into the given data, so they
+ * are not copied. Requests sent by the server are skipped.
+ */
+class RtspParser {
+public:
+    typedef std::function<void(uint8_t channel, const uint8_t* data, size_t length)> InterleavedCallback;
+    typedef std::function<void(const RtspResponse& response)> ResponseCallback;
+
+    /**
+     * Parse complete messages from the start of data.
+     *
+     * @return the number of bytes consumed. The remaining bytes are the start
+     *         of a message which is not complete yet, and must be passed again
+     *         with more data appended. std::nullopt if the data is not valid
+     *         RTSP, or a Content-Length is invalid or larger than
+     *         RTSP_MAX_CONTENT_LENGTH.
+     */
+    static std::optional<size_t> parse(const uint8_t* data, size_t length, const InterleavedCallback& onInterleaved, const ResponseCallback& onResponse);
+};
+
+/**
+ * Builds Authorization headers from the challenge in a 401 response.
+ *
+ * Basic and Digest (RFC 2617, with or without qop=auth) are supported,
+ * subject to the RTSP_HAS_BASIC_AUTH and RTSP_HAS_DIGEST_AUTH build options.
+ */
+class RtspAuth {
+public:
+    RtspAuth() {}
+    RtspAuth(const std::string& username, const std::string& password)
+        : username_(username), password_(password) {}
+
+    /**
+     * Take the WWW-Authenticate headers of a 401 response. Digest is
+     * preferred if the server offers both.
+     *
+     * @return false if no offered scheme is supported.
+     */
+    bool challenge(const std::vector<std::string>& wwwAuthenticate);
+
+    // Use Basic authentication without waiting for a challenge.
+    bool useBasic();
+
+    // Authorization header value for a request, empty before a challenge.
+    std::string authorization(const std::string& method, const std::string& uri);
+
+    bool isBasic() const { return scheme_ == BASIC; }
+    bool isDigest() const { return scheme_ == DIGEST; }
+
+    static std::string base64(const std::string& in);
+    // Lower case hex MD5 digest, empty if Digest authentication is disabled.
+    static std::string md5(const std::string& in);
+
+private:
+    enum Scheme {
+        NONE,
+        BASIC,
+        DIGEST
+    };
+
+    static std::optional<std::string> param(const std::string& challenge, const std::string& name);
+
+    std::string username_;
+    std::string password_;
+    Scheme scheme_ = NONE;
+    std::string realm_;
+    std::string nonce_;
+    std::string opaque_;
+    bool qopAuth_ = false;
+    uint32_t nonceCount_ = 0;
+};
+
+} // namespace
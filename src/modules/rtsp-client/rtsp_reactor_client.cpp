@@ -0,0 +1,795 @@
+#include "rtsp_reactor_client.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+namespace nabto {
+
+// Large enough for a full interleaved frame (64 KiB) and the next header,
+// or a response with a body of RTSP_MAX_CONTENT_LENGTH and its headers.
+const size_t RTSP_RECV_BUFFER_SIZE = 128 * 1024;
+// Reads before the connection is handed back to the reactor, so one busy
+// stream cannot starve the other registrations.
+const int RTSP_MAX_READS_PER_WAKEUP = 16;
+// Unsent requests and reports beyond this mean the server stopped reading.
+const size_t RTSP_SEND_BUFFER_MAX = 64 * 1024;
+// Interleaved header plus a receiver report with the max of 31 report blocks
+const size_t RTSP_RTCP_REPORT_SIZE = 4 + 8 + 31 * 24;
+
+RtspReactorClientPtr RtspReactorClient::create(const RtspClientConf& conf)
+{
+    return std::make_shared<RtspReactorClient>(conf);
+}
+
+RtspReactorClient::RtspReactorClient(const RtspClientConf& conf)
+    : trackId_(conf.trackId), recvBuffer_(RTSP_RECV_BUFFER_SIZE)
+{
+    url_ = RtspUrl::parse(conf.url);
+    if (!url_.has_value()) {
+        NPLOGE << "Invalid RTSP URL: " << conf.url;
+    } else {
+        auth_ = RtspAuth(url_->username, url_->password);
+        NPLOGI << "Parsed URL     : " << url_->url;
+    }
+
+    preferTcp_ = conf.preferTcp;
+    port_ = conf.port;
+    reactor_ = conf.reactor;
+    if (reactor_ == nullptr) {
+        reactor_ = IoReactor::defaultReactor();
+    }
+    sendQueue_ = conf.sendQueue;
+    sendWorker_ = conf.sendWorker;
+    gopCache_ = conf.gopCache;
+    keepAliveInterval_ = conf.keepAliveInterval;
+    description_ = conf.description;
+
+    videoNegotiator_ = conf.videoNegotiator;
+    if (conf.videoRepack != nullptr) {
+        videoRepack_ = conf.videoRepack;
+    }
+
+    audioNegotiator_ = conf.audioNegotiator;
+    if (conf.audioRepack != nullptr) {
+        audioRepack_ = conf.audioRepack;
+    }
+}
+
+RtspReactorClient::~RtspReactorClient()
+{
+    stop();
+}
+
+bool RtspReactorClient::start(std::function<void(std::optional<std::string> error)> cb)
+{
+    if (!url_.has_value()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_ != IDLE) {
+            return false;
+        }
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    int ec = getaddrinfo(url_->host.c_str(), std::to_string(url_->port).c_str(), &hints, &res);
+    if (ec != 0 || res == NULL) {
+        NPLOGE << "Failed to resolve RTSP host " << url_->host << ": " << gai_strerror(ec);
+        return false;
+    }
+
+    int sock = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        NPLOGE << "Failed to create RTSP socket: " << strerror(errno);
+        freeaddrinfo(res);
+        return false;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(sock, res->ai_addr, res->ai_addrlen) != 0 && errno != EINPROGRESS) {
+        NPLOGE << "Failed to connect to RTSP server " << url_->host << ":" << url_->port << ": " << strerror(errno);
+        freeaddrinfo(res);
+        ::close(sock);
+        return false;
+    }
+    freeaddrinfo(res);
+
+    NPLOGD << "Connecting to RTSP server " << url_->host << ":" << url_->port;
+    std::weak_ptr<RtspReactorClient> weak = shared_from_this();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_ != IDLE) {
+        // Stopped while resolving
+        ::close(sock);
+        return false;
+    }
+    startCb_ = cb;
+    state_ = CONNECTING;
+    sock_ = sock;
+    // The callback locks mutex_ before looking at sockReg_, so it is set in time.
+    sockReg_ = reactor_->addWriter(sock_, [weak]() {
+        auto self = weak.lock();
+        if (self) {
+            self->handleConnected();
+        }
+    });
+    return true;
+}
+
+bool RtspReactorClient::close(std::function<void()> cb)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (sock_ >= 0 && sockReg_ != 0 && !sessionId_.empty() && state_ != TEARDOWN && state_ != CLOSED) {
+            NPLOGD << "Sending RTSP TEARDOWN request";
+            closeCb_ = cb;
+            state_ = TEARDOWN;
+            sendRequest("TEARDOWN", sdp_.sessionControlUrl);
+        } else if (cb) {
+            // Nothing to tear down
+            deferred_.push_back(cb);
+        }
+    }
+    runDeferred();
+    return true;
+}
+
+void RtspReactorClient::stop()
+{
+    TcpRtpClientPtr tcpClient;
+    RtpClientPtr videoStream;
+    RtpClientPtr audioStream;
+    RtcpClientPtr videoRtcp;
+    RtcpClientPtr audioRtcp;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = CLOSED;
+        startCb_ = nullptr;
+        closeCb_ = nullptr;
+        failedCb_ = nullptr;
+        deferred_.clear();
+        tcpClient = tcpClient_;
+        videoStream = videoStream_;
+        audioStream = audioStream_;
+        videoRtcp = videoRtcp_;
+        audioRtcp = audioRtcp_;
+    }
+    closeSocket();
+    if (videoStream != nullptr) {
+        videoStream->keepListening(false);
+    }
+    if (audioStream != nullptr) {
+        audioStream->keepListening(false);
+    }
+    if (videoRtcp != nullptr) {
+        videoRtcp->stop();
+    }
+    if (audioRtcp != nullptr) {
+        audioRtcp->stop();
+    }
+    if (tcpClient != nullptr) {
+        tcpClient->stop();
+    }
+}
+
+void RtspReactorClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tcpClient_ != nullptr) {
+        tcpClient_->addConnection(ref, videoTrack, audioTrack);
+    }
+    if (videoStream_ != nullptr && videoTrack != nullptr) {
+        videoStream_->addConnection(ref, videoTrack);
+    }
+    if (audioStream_ != nullptr && audioTrack != nullptr) {
+        audioStream_->addConnection(ref, audioTrack);
+    }
+}
+
+void RtspReactorClient::removeConnection(NabtoDeviceConnectionRef ref)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tcpClient_ != nullptr) {
+        tcpClient_->removeConnection(ref);
+    }
+    if (videoStream_ != nullptr) {
+        videoStream_->removeConnection(ref);
+    }
+    if (audioStream_ != nullptr) {
+        audioStream_->removeConnection(ref);
+    }
+}
+
+std::optional<RtspDescription> RtspReactorClient::description()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return description_;
+}
+
+std::vector<RtpReceptionReport> RtspReactorClient::videoReceptionReports()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tcpClient_ != nullptr) {
+        return tcpClient_->videoReceptionStats()->reports();
+    }
+    if (videoStream_ != nullptr) {
+        return videoStream_->receptionStats()->reports();
+    }
+    return {};
+}
+
+std::vector<RtpReceptionReport> RtspReactorClient::audioReceptionReports()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tcpClient_ != nullptr) {
+        return tcpClient_->audioReceptionStats()->reports();
+    }
+    if (audioStream_ != nullptr) {
+        return audioStream_->receptionStats()->reports();
+    }
+    return {};
+}
+
+void RtspReactorClient::handleConnected()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (state_ != CONNECTING) {
+            return;
+        }
+        // Removing the running registration returns immediately.
+        reactor_->removeReader(sockReg_);
+        sockReg_ = 0;
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(sock_, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+            err = errno;
+        }
+        if (err != 0) {
+            NPLOGE << "Failed to connect to RTSP server: " << strerror(err);
+            fail("Failed to connect to RTSP server");
+        } else {
+            std::weak_ptr<RtspReactorClient> weak = shared_from_this();
+            sockReg_ = reactor_->addReader(sock_, [weak]() {
+                auto self = weak.lock();
+                if (self) {
+                    self->handleReadable();
+                }
+            });
+            NPLOGD << "Sending RTSP OPTIONS request";
+            state_ = OPTIONS;
+            sendRequest("OPTIONS", url_->url);
+        }
+    }
+    runDeferred();
+}
+
+void RtspReactorClient::handleReadable()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // The callback also runs when the socket is writable while data is queued.
+        if (!sendBuffer_.empty() && state_ != CLOSED && !flushSendBuffer()) {
+            fail("Failed to send on RTSP connection");
+        }
+        for (int i = 0; i < RTSP_MAX_READS_PER_WAKEUP && sock_ >= 0 && state_ != CLOSED; i++) {
+            if (recvLength_ == recvBuffer_.size()) {
+                fail("RTSP message too large");
+                break;
+            }
+            ssize_t n = recv(sock_, recvBuffer_.data() + recvLength_, recvBuffer_.size() - recvLength_, 0);
+            if (n == 0) {
+                connectionClosed();
+                break;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    NPLOGE << "Failed to read from RTSP connection: " << strerror(errno);
+                    connectionClosed();
+                }
+                break;
+            }
+            recvLength_ += n;
+
+            auto consumed = RtspParser::parse(recvBuffer_.data(), recvLength_,
+                [this](uint8_t channel, const uint8_t* data, size_t length) { handleInterleaved(channel, data, length); },
+                [this](const RtspResponse& response) { handleResponse(response); });
+            if (!consumed.has_value()) {
+                fail("Invalid data received from RTSP server");
+                break;
+            }
+            // Only the start of an incomplete message is moved, usually a few bytes.
+            if (*consumed > 0) {
+                memmove(recvBuffer_.data(), recvBuffer_.data() + *consumed, recvLength_ - *consumed);
+                recvLength_ -= *consumed;
+            }
+        }
+#ifndef __linux__
+        // Without timerfd, keepalives are sent when data arrives, which it
+        // does continuously while playing.
+        if (state_ == PLAYING && std::chrono::steady_clock::now() >= nextKeepAlive_) {
+            sendKeepAlive();
+        }
+#endif
+    }
+    runDeferred();
+}
+
+void RtspReactorClient::handleTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t expirations;
+        if (timerFd_ < 0 || read(timerFd_, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return;
+        }
+        if (state_ == PLAYING) {
+            sendKeepAlive();
+        }
+    }
+    runDeferred();
+}
+
+void RtspReactorClient::handleResponse(const RtspResponse& response)
+{
+    if (response.cseq() != pendingCseq_) {
+        NPLOGD << "Ignoring RTSP response with CSeq " << response.cseq();
+        return;
+    }
+    pendingCseq_ = -1;
+
+    if (response.statusCode == 401 && !authRetried_) {
+        // Also covers a Digest nonce which has gone stale during the session.
+        if (!auth_.challenge(response.headerValues("WWW-Authenticate"))) {
+            return fail("RTSP server requires an unsupported authentication scheme");
+        }
+        authRetried_ = true;
+        return sendPending();
+    }
+
+    bool ok = response.statusCode >= 200 && response.statusCode <= 299;
+    std::string method = pending_.method;
+    switch (state_) {
+    case OPTIONS:
+        if (!ok) {
+            return fail("RTSP OPTIONS request failed with status code: " + std::to_string(response.statusCode));
+        }
+        if (description_.has_value()) {
+            NPLOGD << "Using cached RTSP description";
+            contentBase_ = description_->contentBase;
+            if (description_->basicAuth) {
+                auth_.useBasic();
+            }
+            sdp_ = RtspSdp::parse(description_->sdp, contentBase_, videoNegotiator_, audioNegotiator_);
+            if (!sdp_.video.has_value() && !sdp_.audio.has_value()) {
+                description_ = std::nullopt;
+                return fail("Describe response contained no feeds");
+            }
+            state_ = DESCRIBE;
+            return setupNext();
+        }
+        NPLOGD << "Sending RTSP DESCRIBE request";
+        state_ = DESCRIBE;
+        return sendRequest("DESCRIBE", url_->url, {{"Accept", "application/sdp"}});
+    case DESCRIBE:
+        if (!ok) {
+            return fail("RTSP DESCRIBE request failed with status code: " + std::to_string(response.statusCode));
+        }
+        return handleDescribe(response);
+    case SETUP_VIDEO:
+    case SETUP_AUDIO:
+        if (!ok) {
+            return fail("RTSP SETUP request failed with status code: " + std::to_string(response.statusCode));
+        }
+        if (handleSetup(response)) {
+            setupNext();
+        }
+        return;
+    case PLAY:
+        if (!ok) {
+            return fail("RTSP PLAY request failed with status code: " + std::to_string(response.statusCode));
+        }
+        return handlePlay(response);
+    case PLAYING:
+        if (!ok && !keepAliveWithOptions_ && (response.statusCode == 405 || response.statusCode == 501)) {
+            NPLOGD << "RTSP server does not support GET_PARAMETER, using OPTIONS for keepalives";
+            keepAliveWithOptions_ = true;
+            return sendKeepAlive();
+        }
+        if (!ok) {
+            NPLOGW << "RTSP " << method << " keepalive failed with status code: " << response.statusCode;
+        }
+        return;
+    case TEARDOWN:
+        NPLOGD << "RTSP TEARDOWN completed with status code: " << response.statusCode;
+        state_ = CLOSED;
+        if (closeCb_) {
+            deferred_.push_back(closeCb_);
+            closeCb_ = nullptr;
+        }
+        deferred_.push_back([this]() { closeSocket(); });
+        return;
+    default:
+        return;
+    }
+}
+
+void RtspReactorClient::handleDescribe(const RtspResponse& response)
+{
+    auto base = response.header("Content-Base");
+    if (!base.has_value()) {
+        base = response.header("Content-Location");
+    }
+    contentBase_ = base.value_or(url_->url);
+    // Relative control URLs are appended to the content base.
+    if (contentBase_.empty() || contentBase_.back() != '/') {
+        contentBase_ += "/";
+    }
+    NPLOGD << "Using Content-Base: " << contentBase_;
+
+    sdp_ = RtspSdp::parse(response.body, contentBase_, videoNegotiator_, audioNegotiator_);
+    if (!sdp_.video.has_value() && !sdp_.audio.has_value()) {
+        return fail("Describe response contained no feeds");
+    }
+    if (!auth_.isDigest()) {
+        // A Digest nonce cannot be reused, so the description is only cached without it.
+        description_ = RtspDescription{ response.body, contentBase_, auth_.isBasic() };
+    }
+    setupNext();
+}
+
+void RtspReactorClient::setupNext()
+{
+    if (state_ < SETUP_VIDEO && sdp_.video.has_value()) {
+        NPLOGD << "Sending RTSP SETUP request for video stream";
+        state_ = SETUP_VIDEO;
+        std::string transport = "RTP/AVP;unicast;client_port=" + std::to_string(port_) + "-" + std::to_string(port_ + 1);
+        if (preferTcp_) {
+            transport = "RTP/AVP/TCP;unicast;interleaved=0-1";
+        }
+        return sendRequest("SETUP", sdp_.video->controlUrl, {{"Transport", transport}});
+    }
+    if (state_ < SETUP_AUDIO && sdp_.audio.has_value()) {
+        NPLOGD << "Sending RTSP SETUP request for audio stream";
+        state_ = SETUP_AUDIO;
+        std::string transport = "RTP/AVP;unicast;client_port=" + std::to_string(port_ + 2) + "-" + std::to_string(port_ + 3);
+        if (preferTcp_) {
+            transport = "RTP/AVP/TCP;unicast;interleaved=2-3";
+        }
+        return sendRequest("SETUP", sdp_.audio->controlUrl, {{"Transport", transport}});
+    }
+    NPLOGD << "Sending RTSP PLAY request";
+    state_ = PLAY;
+    sendRequest("PLAY", sdp_.sessionControlUrl, {{"Range", "npt=now-"}});
+}
+
+bool RtspReactorClient::handleSetup(const RtspResponse& response)
+{
+    // Session: 12345678;timeout=60
+    auto session = response.header("Session");
+    if (session.has_value()) {
+        sessionId_ = session->substr(0, session->find(';'));
+        size_t pos = session->find("timeout=");
+        if (pos != std::string::npos) {
+            int timeout = atoi(session->c_str() + pos + strlen("timeout="));
+            if (timeout > 0) {
+                sessionTimeout_ = std::chrono::seconds(timeout);
+                NPLOGD << "RTSP session timeout is " << timeout << " seconds";
+            }
+        }
+    }
+
+    bool video = state_ == SETUP_VIDEO;
+    try {
+        if (preferTcp_) {
+            if (tcpClient_ == nullptr) {
+                TcpRtpClientConf conf = { nullptr, sdp_.sessionControlUrl, videoNegotiator_, audioNegotiator_, videoRepack_, audioRepack_, sendQueue_, sendWorker_, gopCache_ };
+                if (sdp_.video.has_value()) {
+                    conf.videoParameterSets = sdp_.video->parameterSets;
+                }
+                auto viewerDisconnected = viewerDisconnectedCb_;
+                if (viewerDisconnected) {
+                    // Interleaved packets are forwarded with mutex_ held, so the owner is told once it is released.
+                    conf.viewerDisconnected = [this, viewerDisconnected](NabtoDeviceConnectionRef ref) {
+                        deferred_.push_back([viewerDisconnected, ref]() { viewerDisconnected(ref); });
+                    };
+                }
+                tcpClient_ = TcpRtpClient::create(conf);
+            }
+            // The server may assign other channels than the ones requested.
+            auto transport = response.header("Transport");
+            auto channels = transport.has_value() ? RtspInterleavedChannels::parse(*transport) : std::nullopt;
+            if (channels.has_value()) {
+                NPLOGD << "RTSP " << (video ? "video" : "audio") << " is interleaved on channels " << (int)channels->rtp << "-" << (int)channels->rtcp;
+                if (video) {
+                    tcpClient_->setVideoChannels(*channels);
+                } else {
+                    tcpClient_->setAudioChannels(*channels);
+                }
+            }
+        } else if (video) {
+            nabto::RtpClientConf conf = { trackId_ + "-video", std::string(), port_, videoNegotiator_, videoRepack_ };
+            conf.reactor = reactor_;
+            conf.sendQueue = sendQueue_;
+            conf.sendWorker = sendWorker_;
+            conf.gopCache = gopCache_;
+            conf.parameterSets = sdp_.video->parameterSets;
+            videoStream_ = RtpClient::create(conf);
+
+            videoRtcp_ = RtcpClient::create(port_ + 1, reactor_, videoStream_->receptionStats());
+            videoRtcp_->start();
+        } else {
+            nabto::RtpClientConf conf = { trackId_ + "-audio", std::string(), (uint16_t)(port_ + 2), audioNegotiator_, audioRepack_ };
+            conf.reactor = reactor_;
+            conf.sendQueue = sendQueue_;
+            conf.sendWorker = sendWorker_;
+            audioStream_ = RtpClient::create(conf);
+
+            audioRtcp_ = RtcpClient::create(port_ + 3, reactor_, audioStream_->receptionStats());
+            audioRtcp_->start();
+        }
+    } catch (std::exception& ex) {
+        fail(ex.what());
+        return false;
+    }
+    return true;
+}
+
+void RtspReactorClient::handlePlay(const RtspResponse& response)
+{
+    try {
+        // The server sends to the RTP ports for as long as the session plays, viewers or not.
+        if (videoStream_ != nullptr) {
+            videoStream_->keepListening(true);
+        }
+        if (audioStream_ != nullptr) {
+            audioStream_->keepListening(true);
+        }
+    } catch (std::exception& ex) {
+        return fail(ex.what());
+    }
+    if (!startKeepAliveTimer()) {
+        return fail("Failed to start RTSP keepalive timer");
+    }
+    NPLOGI << "RTSP session " << sessionId_ << " playing";
+    state_ = PLAYING;
+    if (startCb_) {
+        auto cb = startCb_;
+        startCb_ = nullptr;
+        deferred_.push_back([cb]() { cb(std::nullopt); });
+    }
+}
+
+void RtspReactorClient::handleInterleaved(uint8_t channel, const uint8_t* data, size_t length)
+{
+    if (tcpClient_ == nullptr) {
+        return;
+    }
+    if (!tcpClient_->isRtcpChannel(channel)) {
+        tcpClient_->handleRtp(channel, data, length);
+        return;
+    }
+
+    // Answer sender reports with the reception statistics of the channel.
+    if (state_ == CLOSED) {
+        return;
+    }
+    uint8_t report[RTSP_RTCP_REPORT_SIZE];
+    size_t reportLength = tcpClient_->handleRtcp(channel, data, length, report, sizeof(report));
+    // The report is interleaved with requests on the connection, so it is
+    // queued whole or the session fails. A partial frame would corrupt the stream.
+    if (reportLength > 0 && !queueSend(report, reportLength)) {
+        fail("Failed to send RTCP receiver report");
+    }
+}
+
+void RtspReactorClient::sendRequest(const std::string& method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers)
+{
+    pending_.method = method;
+    pending_.url = url;
+    pending_.headers = headers;
+    authRetried_ = false;
+    sendPending();
+}
+
+void RtspReactorClient::sendPending()
+{
+    RtspRequest request = pending_;
+    std::string authorization = auth_.authorization(request.method, request.url);
+    if (!authorization.empty()) {
+        request.headers.push_back({"Authorization", authorization});
+    }
+    if (!sessionId_.empty()) {
+        request.headers.push_back({"Session", sessionId_});
+    }
+    pendingCseq_ = ++cseq_;
+    std::string data = request.toString(pendingCseq_);
+    if (!queueSend((const uint8_t*)data.data(), data.size())) {
+        fail("Failed to send RTSP " + request.method + " request");
+    }
+}
+
+void RtspReactorClient::sendKeepAlive()
+{
+    // RFC 2326 recommends an empty GET_PARAMETER, but not all servers implement it.
+    sendRequest(keepAliveWithOptions_ ? "OPTIONS" : "GET_PARAMETER", sdp_.sessionControlUrl);
+#ifndef __linux__
+    nextKeepAlive_ = std::chrono::steady_clock::now() + (keepAliveInterval_.count() > 0 ? keepAliveInterval_ : std::chrono::duration_cast<std::chrono::milliseconds>(sessionTimeout_) / 2);
+#endif
+}
+
+bool RtspReactorClient::queueSend(const uint8_t* data, size_t length)
+{
+    if (sendBuffer_.size() + length > RTSP_SEND_BUFFER_MAX) {
+        NPLOGE << "RTSP server is not reading, " << sendBuffer_.size() << " bytes are waiting to be sent";
+        return false;
+    }
+    // Data queued before goes first.
+    bool wasEmpty = sendBuffer_.empty();
+    sendBuffer_.insert(sendBuffer_.end(), data, data + length);
+    if (!wasEmpty) {
+        return true;
+    }
+    return flushSendBuffer();
+}
+
+bool RtspReactorClient::flushSendBuffer()
+{
+    size_t sent = 0;
+    while (sent < sendBuffer_.size()) {
+        ssize_t n = send(sock_, sendBuffer_.data() + sent, sendBuffer_.size() - sent, MSG_NOSIGNAL);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            NPLOGE << "Failed to send on RTSP connection: " << strerror(errno);
+            return false;
+        }
+        break;
+    }
+    sendBuffer_.erase(sendBuffer_.begin(), sendBuffer_.begin() + sent);
+    // The rest is sent from handleReadable() once the socket is writable.
+    if (sockReg_ != 0) {
+        reactor_->setWritable(sockReg_, !sendBuffer_.empty());
+    }
+    return true;
+}
+
+bool RtspReactorClient::startKeepAliveTimer()
+{
+    auto interval = keepAliveInterval_;
+    if (interval.count() <= 0) {
+        interval = std::chrono::duration_cast<std::chrono::milliseconds>(sessionTimeout_) / 2;
+    }
+    NPLOGD << "Sending RTSP keepalives every " << interval.count() << " ms";
+#ifdef __linux__
+    timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd_ < 0) {
+        NPLOGE << "Failed to create keepalive timer: " << strerror(errno);
+        return false;
+    }
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(timerFd_, 0, &spec, NULL) != 0) {
+        NPLOGE << "Failed to start keepalive timer: " << strerror(errno);
+        return false;
+    }
+    std::weak_ptr<RtspReactorClient> weak = shared_from_this();
+    timerReg_ = reactor_->addReader(timerFd_, [weak]() {
+        auto self = weak.lock();
+        if (self) {
+            self->handleTimer();
+        }
+    });
+#else
+    nextKeepAlive_ = std::chrono::steady_clock::now() + interval;
+#endif
+    return true;
+}
+
+void RtspReactorClient::fail(const std::string& error)
+{
+    NPLOGE << "RTSP session failed: " << error;
+    state_ = CLOSED;
+    if (startCb_) {
+        auto cb = startCb_;
+        startCb_ = nullptr;
+        deferred_.push_back([cb, error]() { cb(error); });
+    } else if (failedCb_ && !closeCb_) {
+        // The session was playing, and the owner has to drop it.
+        auto cb = failedCb_;
+        failedCb_ = nullptr;
+        deferred_.push_back([cb, error]() { cb(error); });
+    }
+    if (closeCb_) {
+        deferred_.push_back(closeCb_);
+        closeCb_ = nullptr;
+    }
+    deferred_.push_back([this]() { closeSocket(); });
+}
+
+void RtspReactorClient::connectionClosed()
+{
+    if (state_ == TEARDOWN) {
+        // Some servers close the connection instead of answering TEARDOWN.
+        state_ = CLOSED;
+        if (closeCb_) {
+            deferred_.push_back(closeCb_);
+            closeCb_ = nullptr;
+        }
+        deferred_.push_back([this]() { closeSocket(); });
+        return;
+    }
+    fail("RTSP server closed the connection");
+}
+
+void RtspReactorClient::runDeferred()
+{
+    // Callbacks may call back into this client, so they run without mutex_.
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callbacks.swap(deferred_);
+    }
+    for (auto& cb : callbacks) {
+        cb();
+    }
+}
+
+void RtspReactorClient::closeSocket()
+{
+    IoReactor::Registration sockReg;
+    IoReactor::Registration timerReg;
+    int sock;
+    int timerFd;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sockReg = sockReg_;
+        timerReg = timerReg_;
+        sock = sock_;
+        timerFd = timerFd_;
+        sockReg_ = 0;
+        timerReg_ = 0;
+        sock_ = -1;
+        timerFd_ = -1;
+        sendBuffer_.clear();
+    }
+    // Returns once the callbacks are no longer running, so the fds can be closed.
+    if (sockReg != 0) {
+        reactor_->removeReader(sockReg);
+    }
+    if (timerReg != 0) {
+        reactor_->removeReader(timerReg);
+    }
+    if (sock >= 0) {
+        ::close(sock);
+    }
+    if (timerFd >= 0) {
+        ::close(timerFd);
+    }
+}
+
+} // namespace
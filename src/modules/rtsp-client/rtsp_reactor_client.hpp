@@ -0,0 +1,169 @@
+#pragma once
+
+#include "rtsp_client.hpp"
+#include "rtsp_protocol.hpp"
+#include "rtsp_sdp.hpp"
+
+#include <io-reactor/io_reactor.hpp>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace nabto {
+
+class RtspReactorClient;
+typedef std::shared_ptr<RtspReactorClient> RtspReactorClientPtr;
+
+/**
+ * RTSP client driven by an IoReactor instead of a curl thread per session.
+ *
+ * The RTSP connection is a non-blocking socket registered with the reactor
+ * of the configuration, so any number of sessions share the reactor
+ * threads. Responses and interleaved RTP are parsed straight out of the
+ * receive buffer, and interleaved packets are handed to a TcpRtpClient
+ * without further copies. Keepalives are sent from a timer on the reactor.
+ *
+ * The API matches RtspClient. The start callback, the close callback and
+ * the failed callback are invoked on a reactor thread. Resolving the host
+ * name in start() is blocking, so it must not be called from them.
+ * Requests and receiver reports the socket cannot take right away are
+ * queued and sent when the reactor reports it writable.
+ */
+class RtspReactorClient : public std::enable_shared_from_this<RtspReactorClient>
+{
+public:
+    static RtspReactorClientPtr create(const RtspClientConf& conf);
+    RtspReactorClient(const RtspClientConf& conf);
+    ~RtspReactorClient();
+
+    /**
+     * Connect and set up the session. cb is invoked once the session is
+     * playing, or failed. Returns false, without invoking cb, if the
+     * connection could not be initiated or the client was stopped.
+     */
+    bool start(std::function<void(std::optional<std::string> error)> cb);
+    // Send TEARDOWN and invoke cb when the server has answered.
+    bool close(std::function<void()> cb);
+    void stop();
+
+    /**
+     * Set a callback invoked if the session fails after start() reported it
+     * playing, eg. because the server closed the connection. Not invoked
+     * after stop() or during close(). Must be set before start().
+     */
+    void setFailedCallback(std::function<void(const std::string& error)> cb) { failedCb_ = cb; }
+
+    /**
+     * Set a callback invoked when a viewer of an interleaved session is
+     * disconnected because its send queue overflowed. The viewer is already
+     * removed from the session. Must be set before start().
+     */
+    void setViewerDisconnectedCallback(ViewerDisconnectCallback cb) { viewerDisconnectedCb_ = cb; }
+
+    void addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack);
+    void removeConnection(NabtoDeviceConnectionRef ref);
+
+    // DESCRIBE result of this session, see RtspClient::description().
+    std::optional<RtspDescription> description();
+
+    // Loss and jitter of the streams from the server, empty before the session is set up.
+    std::vector<RtpReceptionReport> videoReceptionReports();
+    std::vector<RtpReceptionReport> audioReceptionReports();
+
+private:
+    enum State {
+        IDLE,
+        CONNECTING,
+        OPTIONS,
+        DESCRIBE,
+        SETUP_VIDEO,
+        SETUP_AUDIO,
+        PLAY,
+        PLAYING,
+        TEARDOWN,
+        CLOSED
+    };
+
+    // Reactor callbacks
+    void handleConnected();
+    void handleReadable();
+    void handleTimer();
+
+    // The following are called with mutex_ held.
+    void handleResponse(const RtspResponse& response);
+    void handleInterleaved(uint8_t channel, const uint8_t* data, size_t length);
+    void handleDescribe(const RtspResponse& response);
+    bool handleSetup(const RtspResponse& response);
+    void handlePlay(const RtspResponse& response);
+    void setupNext();
+    void sendRequest(const std::string& method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers = {});
+    void sendPending();
+    void sendKeepAlive();
+    // Send data after the data already queued, queueing what the socket does not take.
+    bool queueSend(const uint8_t* data, size_t length);
+    // Send queued data until the socket would block.
+    bool flushSendBuffer();
+    bool startKeepAliveTimer();
+    void fail(const std::string& error);
+    void connectionClosed();
+
+    // Run callbacks queued while mutex_ was held.
+    void runDeferred();
+    void closeSocket();
+
+    std::string trackId_;
+    std::optional<RtspUrl> url_;
+    bool preferTcp_ = true;
+    uint16_t port_ = 42222;
+    IoReactorPtr reactor_;
+    ViewerQueueConf sendQueue_;
+    MediaSendWorkerPtr sendWorker_ = nullptr;
+    GopCacheConf gopCache_;
+    std::chrono::milliseconds keepAliveInterval_{0};
+    TrackNegotiatorPtr videoNegotiator_;
+    TrackNegotiatorPtr audioNegotiator_;
+    RtpRepacketizerFactoryPtr videoRepack_ = RtpRepacketizerFactory::create();
+    RtpRepacketizerFactoryPtr audioRepack_ = RtpRepacketizerFactory::create();
+
+    std::mutex mutex_;
+    State state_ = IDLE;
+    std::vector<std::function<void()>> deferred_;
+    std::function<void(std::optional<std::string> error)> startCb_;
+    std::function<void()> closeCb_;
+    std::function<void(const std::string& error)> failedCb_;
+    ViewerDisconnectCallback viewerDisconnectedCb_;
+
+    int sock_ = -1;
+    IoReactor::Registration sockReg_ = 0;
+    int timerFd_ = -1;
+    IoReactor::Registration timerReg_ = 0;
+    std::chrono::steady_clock::time_point nextKeepAlive_;
+    std::vector<uint8_t> recvBuffer_;
+    size_t recvLength_ = 0;
+    // Requests and receiver reports not taken by the socket yet.
+    std::vector<uint8_t> sendBuffer_;
+
+    RtspAuth auth_;
+    int cseq_ = 0;
+    RtspRequest pending_;
+    int pendingCseq_ = -1;
+    bool authRetried_ = false;
+
+    std::string contentBase_;
+    RtspSdp sdp_;
+    std::optional<RtspDescription> description_;
+    std::string sessionId_;
+    std::chrono::seconds sessionTimeout_{60};
+    bool keepAliveWithOptions_ = false;
+
+    TcpRtpClientPtr tcpClient_ = nullptr;
+    RtpClientPtr videoStream_ = nullptr;
+    RtcpClientPtr videoRtcp_ = nullptr;
+    RtpClientPtr audioStream_ = nullptr;
+    RtcpClientPtr audioRtcp_ = nullptr;
+};
+
+} // namespace
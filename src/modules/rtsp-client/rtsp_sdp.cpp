@@ -0,0 +1,179 @@
+#include "rtsp_sdp.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <cstring>
+
+namespace rtc {
+using std::get;
+using std::holds_alternative;
+}  // namespace rtc
+
+namespace nabto {
+
+namespace {
+
+class MockMediaTrack : public MediaTrack {
+public:
+    static MediaTrackPtr create(const rtc::Description::Media& media)
+    {
+        return std::make_shared<MockMediaTrack>(media);
+    }
+
+    MockMediaTrack(const rtc::Description::Media& media): media_(media), MediaTrack("", media.generateSdp()) { }
+    std::string getTrackId() { return ""; }
+    std::string getSdp() { return media_.generateSdp(); }
+    void setSdp(const std::string& sdp) { return; }
+    bool send(const uint8_t* buffer, size_t length) {return false;}
+    void setReceiveCallback(MediaRecvCallback cb) {};
+    void setCloseCallback(std::function<void()> cb) {};
+    void setErrorState(enum ErrorState state){};
+private:
+    rtc::Description::Media media_;
+};
+
+std::string parseControlAttribute(const std::string& att, const std::string& contentBase)
+{
+    auto url = att.substr(strlen("control:"));
+    if (url.empty() || url[0] == '*') {
+        // if * use Content-Base
+        return contentBase;
+    }
+    else if (url.rfind("rtsp://", 0) == 0) {
+        // is full url as it starts with rtsp://
+        return url;
+    }
+    else {
+        // is relative URL
+        return contentBase + url;
+    }
+}
+
+std::vector<uint8_t> decodeBase64(const std::string& in)
+{
+    std::vector<uint8_t> out;
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : in) {
+        int d;
+        if (c >= 'A' && c <= 'Z') {
+            d = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            d = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            d = c - '0' + 52;
+        } else if (c == '+') {
+            d = 62;
+        } else if (c == '/') {
+            d = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return {};
+        }
+        v = (v << 6) | d;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back((uint8_t)(v >> bits));
+        }
+    }
+    return out;
+}
+
+// Decode the sprop-parameter-sets of an H.264 fmtp line (RFC 6184 section 8.1).
+std::vector<std::vector<uint8_t>> parseParameterSets(const std::string& fmtp)
+{
+    std::vector<std::vector<uint8_t>> sets;
+    const std::string key = "sprop-parameter-sets=";
+    size_t start = fmtp.find(key);
+    if (start == std::string::npos) {
+        return sets;
+    }
+    start += key.size();
+    size_t end = fmtp.find(';', start);
+    std::string value = fmtp.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t comma = value.find(',', pos);
+        auto nal = decodeBase64(value.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos));
+        if (!nal.empty()) {
+            sets.push_back(nal);
+        }
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+    return sets;
+}
+
+} // namespace
+
+RtspSdp RtspSdp::parse(const std::string& sdp, const std::string& contentBase, TrackNegotiatorPtr videoNegotiator, TrackNegotiatorPtr audioNegotiator)
+{
+    RtspSdp result;
+    auto desc = rtc::Description(sdp);
+    auto atts = desc.attributes();
+
+    for (auto a : atts) {
+        if (a.rfind("control:",0) == 0) {
+            result.sessionControlUrl = parseControlAttribute(a, contentBase);
+        }
+    }
+    if (result.sessionControlUrl.empty()) {
+        result.sessionControlUrl = contentBase;
+    }
+
+    auto count = desc.mediaCount();
+    for (size_t i = 0; i < count; i++) {
+        if (rtc::holds_alternative<rtc::Description::Media*>(desc.media(i))) {
+            auto m = rtc::get<rtc::Description::Media*>(desc.media(i));
+            NPLOGD << "Found Media type: " << m->type();
+            RtspSdpMedia media;
+
+            auto mAtts = m->attributes();
+            for (auto a : mAtts) {
+                if (a.rfind("control:", 0) == 0) {
+                    media.controlUrl = parseControlAttribute(a, contentBase);
+                }
+            }
+
+            auto ptVec = m->payloadTypes();
+
+            if (m->type() == "video") {
+                media.payloadType = ptVec.size() > 0 ? ptVec[0] : videoNegotiator->payloadType();
+                if (m->hasPayloadType(media.payloadType)) {
+                    for (const auto& fmtp : m->rtpMap(media.payloadType)->fmtps) {
+                        auto sets = parseParameterSets(fmtp);
+                        if (!sets.empty()) {
+                            NPLOGD << "Found " << sets.size() << " out-of-band parameter sets in the SDP";
+                            media.parameterSets = sets;
+                        }
+                    }
+                }
+                auto mediaMock = MockMediaTrack::create(*m);
+                if (videoNegotiator->match(mediaMock) == 0) {
+                    NPLOGE << "RTSP server offered invalid video codec. The video feed likely won't work!";
+                }
+                result.video = media;
+            }
+            else if (m->type() == "audio") {
+                media.payloadType = ptVec.size() > 0 ? ptVec[0] : audioNegotiator->payloadType();
+                auto mediaMock = MockMediaTrack::create(*m);
+                if (audioNegotiator->match(mediaMock) == 0) {
+                    NPLOGE << "RTSP server offered invalid audio codec. The audio feed likely won't work!";
+                }
+                result.audio = media;
+            }
+            else {
+                NPLOGE << "control attribute for unknown media type: " << m->type();
+            }
+        } else {
+            NPLOGD << "media type not media";
+        }
+    }
+    return result;
+}
+
+} // namespace
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <track-negotiators/track_negotiator.hpp>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace nabto {
+
+class RtspSdpMedia {
+public:
+    // URL to SETUP the media with.
+    std::string controlUrl;
+    int payloadType = 0;
+    // H.264 SPS and PPS from the sprop-parameter-sets fmtp parameter, without start codes.
+    std::vector<std::vector<uint8_t>> parameterSets;
+};
+
+/**
+ * The parts of the SDP in a DESCRIBE response needed to set up a session.
+ */
+class RtspSdp {
+public:
+    /**
+     * Parse the SDP of a DESCRIBE response. Relative control URLs are
+     * resolved against contentBase. The negotiators are used to check the
+     * codecs offered by the server.
+     */
+    static RtspSdp parse(const std::string& sdp, const std::string& contentBase, TrackNegotiatorPtr videoNegotiator, TrackNegotiatorPtr audioNegotiator);
+
+    // URL for session wide requests like PLAY.
+    std::string sessionControlUrl;
+    std::optional<RtspSdpMedia> video;
+    std::optional<RtspSdpMedia> audio;
+};
+
+} // namespace
@@ -3,25 +3,46 @@
 
 namespace nabto {
 
+// Time from a session failing until a new one is set up, so a camera which
+// is restarting is not asked again right away.
+const std::chrono::milliseconds RTSP_RESTART_DELAY(1000);
+
 RtspClientConf RtspStream::buildClientConf(std::string trackId, uint16_t port)
 {
-    RtspClientConf conf = { trackId, config_.url, config_.videoNegotiator, config_.audioNegotiator, config_.videoRepack, config_.audioRepack, config_.preferTcp, port };
+    RtspClientConf conf = { trackId, config_.url, config_.videoNegotiator, config_.audioNegotiator, config_.videoRepack, config_.audioRepack, config_.preferTcp, port, config_.reactor, config_.sendQueue, config_.sendWorker, config_.gopCache, config_.keepAliveInterval, description_ };
     return conf;
 }
 
 RtspStreamPtr RtspStream::create(const RtspStreamConf& conf)
 {
-    return std::make_shared<RtspStream>(conf);
-
+    auto stream = std::make_shared<RtspStream>(conf);
+    if (conf.prewarm) {
+        RtspReactorClientPtr client;
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex_);
+            client = stream->createClient();
+        }
+        stream->startClient(client);
+    }
+    return stream;
 }
 
 RtspStream::RtspStream(const RtspStreamConf& conf)
     : config_(conf)
 {
+    sessionThread_ = std::thread([this]() { sessionRunner(); });
 }
 
 RtspStream::~RtspStream()
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    sessionCv_.notify_all();
+    if (sessionThread_.joinable()) {
+        sessionThread_.join();
+    }
 }
 
 bool RtspStream::isTrack(const std::string& trackId)
@@ -60,54 +81,236 @@ bool RtspStream::matchMedia(MediaTrackPtr media)
     }
 }
 
-void RtspStream::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media)
+void RtspStream::stop()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto conn = connections_.find(ref);
-    if (conn == connections_.end()) {
-        RtspConnection rtsp;
-        RtspClientConf conf = buildClientConf(media->getTrackId(), 42222 + (counter_ * 4));
-        rtsp.client = RtspClient::create(conf);
-
-        connections_[ref] = rtsp;
-        counter_++;
-        auto self = shared_from_this();
-        rtsp.client->start([self, ref](std::optional<std::string> error) {
-            if (error.has_value()) {
-                NPLOGE << "Failed to start RTSP client with error: " << error.value();
-                return;
-            }
-            std::lock_guard<std::mutex> lock(self->mutex_);
-            try {
-                auto conn = self->connections_.at(ref);
-                conn.client->addConnection(ref, conn.videoTrack, conn.audioTrack);
-            } catch (std::out_of_range& ex) {
-                NPLOGE << "RTSP client start callback received on closed connection";
-            }
-        });
-        conn = connections_.find(ref);
+    RtspReactorClientPtr client;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        lingerDeadline_.reset();
+        restartDeadline_.reset();
+        client = client_;
+        client_ = nullptr;
+        clientStarted_ = false;
+        connections_.clear();
+    }
+    sessionCv_.notify_all();
+    if (sessionThread_.joinable()) {
+        sessionThread_.join();
+    }
+    // Stopping waits for the reactor callbacks of the client, which may be waiting for mutex_ in the start callback.
+    if (client != nullptr) {
+        client->stop();
+    }
+}
+
+RtspReactorClientPtr RtspStream::createClient()
+{
+    NPLOGI << "Starting RTSP session for " << config_.trackIdBase;
+    auto client = RtspReactorClient::create(buildClientConf(config_.trackIdBase, 42222));
+    client_ = client;
+    clientStarted_ = false;
+    std::weak_ptr<RtspStream> weak = weak_from_this();
+    client->setFailedCallback([weak, client](const std::string& error) {
+        auto self = weak.lock();
+        if (self) {
+            self->clientFailed(client, error);
+        }
+    });
+    client->setViewerDisconnectedCallback([weak](NabtoDeviceConnectionRef ref) {
+        auto self = weak.lock();
+        if (self) {
+            // Stops the session if it was the last viewer, like a viewer leaving.
+            self->removeConnection(ref);
+        }
+    });
+    return client;
+}
+
+void RtspStream::startClient(RtspReactorClientPtr client)
+{
+    std::weak_ptr<RtspStream> weak = weak_from_this();
+    bool started = client->start([weak, client](std::optional<std::string> error) {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        if (self->client_ != client) {
+            NPLOGD << "RTSP client start callback received on stopped session";
+            return;
+        }
+        if (error.has_value()) {
+            NPLOGE << "Failed to start RTSP client with error: " << error.value();
+            // The next viewer retries from a fresh DESCRIBE. The failed client
+            // has already closed its connection.
+            self->client_ = nullptr;
+            self->description_.reset();
+            return;
+        }
+        self->clientStarted_ = true;
+        self->description_ = client->description();
+        // Add the viewers which connected while the session was being set up.
+        for (const auto& [ref, conn] : self->connections_) {
+            client->addConnection(ref, conn.videoTrack, conn.audioTrack);
+        }
+    });
+    if (!started) {
+        // Also the case if the session was stopped before it got started.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (client_ == client) {
+            NPLOGE << "Failed to start RTSP client";
+            client_ = nullptr;
+        }
+    }
+}
+
+void RtspStream::clientFailed(RtspReactorClientPtr client, const std::string& error)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (client_ != client) {
+            NPLOGD << "RTSP client failed callback received on stopped session";
+            return;
+        }
+        NPLOGE << "RTSP session for " << config_.trackIdBase << " failed: " << error;
+        client_ = nullptr;
+        clientStarted_ = false;
+        // The camera may have come back with another configuration.
+        description_.reset();
+        if (!stopped_ && (!connections_.empty() || config_.prewarm)) {
+            // This runs on a reactor thread, which must not wait for the
+            // host name of the camera to resolve. The start callback adds the
+            // viewers in connections_ to the new session.
+            restartDeadline_ = std::chrono::steady_clock::now() + RTSP_RESTART_DELAY;
+            sessionCv_.notify_all();
+        }
     }
+    // Releases the viewers of the failed session.
+    client->stop();
+}
+
+void RtspStream::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    MediaTrackPtr videoTrack = nullptr;
+    MediaTrackPtr audioTrack = nullptr;
     if (media->getTrackId() == config_.trackIdBase + "-audio") {
-        conn->second.audioTrack = media;
+        audioTrack = media;
+        connections_[ref].audioTrack = media;
     }
     else if (media->getTrackId() == config_.trackIdBase + "-video") {
-        conn->second.videoTrack = media;
+        videoTrack = media;
+        connections_[ref].videoTrack = media;
     }
     else {
         NPLOGE << "addConnection called with invalid track ID";
+        return;
+    }
+
+    lingerDeadline_.reset();
+    if (client_ == nullptr) {
+        auto client = createClient();
+        lock.unlock();
+        startClient(client);
+    } else if (clientStarted_) {
+        // The session is already running, the viewer joins it right away.
+        client_->addConnection(ref, videoTrack, audioTrack);
     }
 }
 
 void RtspStream::removeConnection(NabtoDeviceConnectionRef ref)
+{
+    RtspReactorClientPtr client;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto conn = connections_.find(ref);
+        if (conn == connections_.end()) {
+            // main makes this call for both video and audio, so this is just the second call where the connection is already removed.
+            return;
+        }
+        connections_.erase(conn);
+        if (client_ == nullptr) {
+            return;
+        }
+        if (clientStarted_) {
+            client_->removeConnection(ref);
+        }
+        if (!connections_.empty() || config_.prewarm) {
+            return;
+        }
+        if (config_.linger.count() > 0) {
+            NPLOGI << "Last viewer of " << config_.trackIdBase << " left, keeping RTSP session for " << config_.linger.count() << " ms";
+            lingerDeadline_ = std::chrono::steady_clock::now() + config_.linger;
+            sessionCv_.notify_all();
+            return;
+        }
+        NPLOGI << "Last viewer of " << config_.trackIdBase << " left, stopping RTSP session";
+        client = client_;
+        client_ = nullptr;
+        clientStarted_ = false;
+    }
+    // Stopping waits for the reactor callbacks of the client, which may be waiting for mutex_ in the start callback.
+    client->stop();
+}
+
+std::vector<RtpReceptionReport> RtspStream::videoReceptionReports()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    try {
-        auto conn = connections_.at(ref);
-        conn.client->removeConnection(ref);
-        conn.client->stop();
-        connections_.erase(ref);
-    } catch (std::out_of_range& ex) {
-        // main makes this call for both video and audio, so this is just the second call where the connection is already removed.
+    if (client_ == nullptr) {
+        return {};
+    }
+    return client_->videoReceptionReports();
+}
+
+std::vector<RtpReceptionReport> RtspStream::audioReceptionReports()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (client_ == nullptr) {
+        return {};
+    }
+    return client_->audioReceptionReports();
+}
+
+void RtspStream::sessionRunner()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+        auto now = std::chrono::steady_clock::now();
+        if (restartDeadline_.has_value() && now >= restartDeadline_.value()) {
+            restartDeadline_.reset();
+            // A viewer arriving meanwhile may have set up a session already.
+            if (client_ == nullptr && (!connections_.empty() || config_.prewarm)) {
+                auto client = createClient();
+                lock.unlock();
+                startClient(client);
+                lock.lock();
+            }
+            continue;
+        }
+        if (lingerDeadline_.has_value() && now >= lingerDeadline_.value()) {
+            lingerDeadline_.reset();
+            auto client = client_;
+            client_ = nullptr;
+            clientStarted_ = false;
+            if (client != nullptr) {
+                NPLOGI << "No viewers of " << config_.trackIdBase << " joined, stopping RTSP session";
+                // Stopping waits for the reactor callbacks of the client, which may be waiting for mutex_ in the start callback.
+                lock.unlock();
+                client->stop();
+                lock.lock();
+            }
+            continue;
+        }
+        std::optional<std::chrono::steady_clock::time_point> deadline = lingerDeadline_;
+        if (restartDeadline_.has_value() && (!deadline.has_value() || restartDeadline_.value() < deadline.value())) {
+            deadline = restartDeadline_;
+        }
+        if (deadline.has_value()) {
+            sessionCv_.wait_until(lock, deadline.value());
+        } else {
+            sessionCv_.wait(lock);
+        }
     }
 }
 
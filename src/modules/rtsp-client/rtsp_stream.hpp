@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rtsp_client.hpp"
+#include "rtsp_reactor_client.hpp"
 
 #include <rtp-repacketizer/rtp_repacketizer.hpp>
 
@@ -20,7 +21,6 @@ class RtspConnection
 public:
     MediaTrackPtr videoTrack;
     MediaTrackPtr audioTrack;
-    RtspClientPtr client;
 };
 
 class RtspStreamConf {
@@ -32,8 +32,42 @@ public:
     RtpRepacketizerFactoryPtr videoRepack;
     RtpRepacketizerFactoryPtr audioRepack;
     bool preferTcp = true;
+    // Reactor reading the RTP/RTCP sockets of the stream.
+    // If not set, IoReactor::defaultReactor() is used.
+    IoReactorPtr reactor = nullptr;
+    // Size and overflow policy of the send queue of each viewer.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued packets. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // GOP cache of the video stream.
+    GopCacheConf gopCache;
+    // Set up the RTSP session when the stream is created instead of when the
+    // first viewer connects, and keep it while there are no viewers.
+    bool prewarm = false;
+    // Time the RTSP session is kept after the last viewer leaves, so a viewer
+    // arriving meanwhile joins it right away. 0 tears it down at once.
+    std::chrono::milliseconds linger{0};
+    // Interval between RTSP keepalive requests. If 0, half the session
+    // timeout announced by the server is used.
+    std::chrono::milliseconds keepAliveInterval{0};
 };
 
+/**
+ * Media stream forwarding an RTSP source to WebRTC viewers.
+ *
+ * All viewers share one RTSP session with the camera. The session is set up
+ * when the first viewer connects and torn down when the last one leaves, so
+ * the load on the camera does not grow with the number of viewers.
+ *
+ * Setting up a session takes several round trips to the camera. With
+ * prewarm or linger the session is kept alive with keepalive requests while
+ * there are no viewers, and new viewers start from the GOP cache without
+ * waiting for the camera. The DESCRIBE result is reused when a new session
+ * is set up.
+ *
+ * If the session fails while playing, eg. because the camera restarted, a
+ * new session is set up for the viewers of the stream after a short delay.
+ */
 class RtspStream : public MediaStream, public std::enable_shared_from_this<RtspStream>
 {
 public:
@@ -42,18 +76,18 @@ public:
 
     ~RtspStream();
 
-    void stop() {
-        for (const auto& [key, value] : connections_) {
-            value.client->stop();
-        }
-        connections_.clear();
-    }
+    void stop();
 
     bool isTrack(const std::string& trackId);
     bool matchMedia(MediaTrackPtr media);
     void addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media);
     void removeConnection(NabtoDeviceConnectionRef ref);
 
+    // Loss and jitter of the streams from the camera, the same values as sent
+    // to it in RTCP receiver reports. Empty while there is no session.
+    std::vector<RtpReceptionReport> videoReceptionReports();
+    std::vector<RtpReceptionReport> audioReceptionReports();
+
     MediaTrackPtr createMedia(const std::string& trackId) {
         if (trackId == config_.trackIdBase + "-audio") {
             auto m = config_.audioNegotiator->createMedia();
@@ -77,10 +111,36 @@ public:
 
 private:
     RtspClientConf buildClientConf(std::string trackId, uint16_t port);
+    // Create the shared RTSP session and make it client_. Called with mutex_
+    // held. The caller starts it with startClient() once mutex_ is released.
+    RtspReactorClientPtr createClient();
+    // Start a session made by createClient(). Resolving the camera host name
+    // blocks, so it is called without mutex_ held and never on a reactor thread.
+    void startClient(RtspReactorClientPtr client);
+    // Drop a session which failed while playing, and have sessionRunner() set
+    // up a new one if it still has viewers.
+    void clientFailed(RtspReactorClientPtr client, const std::string& error);
+    // Stops the session when the linger time after the last viewer has
+    // passed, and sets up a new session after one failed.
+    void sessionRunner();
+
     RtspStreamConf config_;
 
     std::mutex mutex_;
-    size_t counter_ = 0;
+    // The RTSP session shared by all viewers. nullptr while there are no viewers.
+    RtspReactorClientPtr client_ = nullptr;
+    // True once client_ has set up the session and can take viewers.
+    bool clientStarted_ = false;
+    // DESCRIBE result of the last session, reused by the next one.
+    std::optional<RtspDescription> description_;
+
+    bool stopped_ = false;
+    std::thread sessionThread_;
+    std::condition_variable sessionCv_;
+    // Set while there are no viewers and the session lingers.
+    std::optional<std::chrono::steady_clock::time_point> lingerDeadline_;
+    // Set while a new session is waiting to replace one which failed.
+    std::optional<std::chrono::steady_clock::time_point> restartDeadline_;
 
     std::map<NabtoDeviceConnectionRef, RtspConnection> connections_;
 };
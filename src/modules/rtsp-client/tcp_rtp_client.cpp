@@ -1,8 +1,23 @@
 #include "tcp_rtp_client.hpp"
 #include <curl/curl.h>
 
+#include <cstring>
+
 namespace nabto {
 
+// Interleaved packets are copied into pooled buffers of this size before being queued.
+const size_t TCP_RTP_BUFFER_SIZE = 4096;
+// Largest interleaved packet, limited by the 16 bit length of the framing.
+// Packets larger than TCP_RTP_BUFFER_SIZE use buffers of this size, which are
+// only allocated if the server sends such packets.
+const size_t TCP_RTP_MAX_PACKET_SIZE = 65535;
+// Room for the RTP header rewritten by RtpRepacketizer::rewriteHeader()
+const size_t TCP_RTP_HEADER_SLOT_SIZE = 16;
+// Interleaved header plus a receiver report with the max of 31 report blocks
+const size_t TCP_RTCP_REPORT_SIZE = 4 + 8 + 31 * 24;
+// Receiver reports waiting for run() beyond this are dropped.
+const size_t TCP_RTCP_PENDING_MAX = 4 * TCP_RTCP_REPORT_SIZE;
+
 TcpRtpClientPtr TcpRtpClient::create(const TcpRtpClientConf& conf)
 {
     // THIS IS CALLED FROM THE CURL WORKER THREAD!
@@ -18,40 +33,189 @@ TcpRtpClient::TcpRtpClient(const TcpRtpClientConf& conf)
     if (conf.videoRepack != nullptr) {
         videoRepack_ = conf.videoRepack;
     }
+    videoParameterSets_ = conf.videoParameterSets;
     audioNegotiator_ = conf.audioNegotiator;
     if (conf.audioRepack != nullptr) {
         audioRepack_ = conf.audioRepack;
     }
+    queueConf_ = conf.sendQueue;
+    sendWorker_ = conf.sendWorker;
+    if (sendWorker_ == nullptr) {
+        sendWorker_ = MediaSendWorker::defaultWorker();
+    }
+    bufferPool_ = RtpBufferPool::create(TCP_RTP_BUFFER_SIZE);
+    largeBufferPool_ = RtpBufferPool::create(TCP_RTP_MAX_PACKET_SIZE, 0);
+    videoStats_ = RtpReceptionStats::create(videoNegotiator_ != nullptr ? videoNegotiator_->clockRate() : 90000);
+    audioStats_ = RtpReceptionStats::create(audioNegotiator_ != nullptr ? audioNegotiator_->clockRate() : 48000);
+    viewerDisconnected_ = conf.viewerDisconnected;
+    keepAlive_ = conf.keepAlive;
+    keepAliveInterval_ = conf.keepAliveInterval;
+    if (videoNegotiator_ != nullptr) {
+        auto negotiator = videoNegotiator_;
+        videoGopCache_ = createGopCache(conf.gopCache,
+            [negotiator](const uint8_t* packet, size_t length) {
+                return negotiator->isKeyframe(packet, length);
+            }, bufferPool_, queueConf_);
+    }
 }
 
 TcpRtpClient::~TcpRtpClient() {}
 
 
-void TcpRtpClient::setConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack)
+void TcpRtpClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack)
 {
-    NPLOGD << "TcpRtpClient setConnection";
+    NPLOGD << "TcpRtpClient addConnection";
     if (videoTrack != nullptr) {
-        videoTrack_ = videoTrack;
-        auto sdp = videoTrack_->getSdp();
-        rtc::Description::Media desc(sdp);
-        auto pts = desc.payloadTypes();
-        int pt = pts.empty() ? 0 : pts[0];
-        const rtc::SSRC ssrc = videoNegotiator_->ssrc();
-        videoRepacketizer_ = videoRepack_->createPacketizer(videoTrack_, ssrc, pt);
-        videoSrcPt_ = videoNegotiator_->payloadType();
-        videoDstPt_ = pt;
+        auto track = createTrack(ref, videoTrack, videoRepack_, videoNegotiator_);
+        if (!videoParameterSets_.empty()) {
+            track.repacketizer->setParameterSets(videoParameterSets_);
+        }
+        addTrack(videoTracks_, ref, track);
     }
     if (audioTrack != nullptr) {
-        audioTrack_ = audioTrack;
-        auto sdp = audioTrack_->getSdp();
-        rtc::Description::Media desc(sdp);
-        auto pts = desc.payloadTypes();
-        int pt = pts.empty() ? 0 : pts[0];
-        const rtc::SSRC ssrc = audioNegotiator_->ssrc();
-        audioRepacketizer_ = audioRepack_->createPacketizer(audioTrack_, ssrc, pt);
-        audioSrcPt_ = audioNegotiator_->payloadType();
-        audioDstPt_ = pt;
+        addTrack(audioTracks_, ref, createTrack(ref, audioTrack, audioRepack_, audioNegotiator_));
+    }
+}
+
+void TcpRtpClient::removeConnection(NabtoDeviceConnectionRef ref)
+{
+    NPLOGD << "TcpRtpClient removeConnection";
+    removeTrack(videoTracks_, ref);
+    removeTrack(audioTracks_, ref);
+}
+
+TcpRtpTrack TcpRtpClient::createTrack(NabtoDeviceConnectionRef ref, MediaTrackPtr track, RtpRepacketizerFactoryPtr repack, TrackNegotiatorPtr negotiator)
+{
+    auto sdp = track->getSdp();
+    rtc::Description::Media desc(sdp);
+    auto pts = desc.payloadTypes();
+    int pt = pts.empty() ? 0 : pts[0];
+    const rtc::SSRC ssrc = negotiator->ssrc();
+
+    TcpRtpTrack t = { track, repack->createPacketizer(track, ssrc, pt) };
+    auto repacketizer = t.repacketizer;
+    t.queue = ViewerQueue::create(queueConf_, sendWorker_,
+        [track, repacketizer](const RtpBufferRef& buffer) {
+            // Only the header is rewritten, the payload is sent from the pooled buffer.
+            uint8_t header[TCP_RTP_HEADER_SLOT_SIZE];
+            size_t headerLen = repacketizer->rewriteHeader(buffer->data(), buffer->size(), header, sizeof(header));
+            if (headerLen > 0) {
+                track->send(header, headerLen, buffer->data() + headerLen, buffer->size() - headerLen);
+                return;
+            }
+            auto packets = repacketizer->handlePacket(std::vector<uint8_t>(buffer->data(), buffer->data() + buffer->size()));
+            for (const auto& p : packets) {
+                track->send(p.data(), p.size());
+            }
+        },
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, ref);
+    return t;
+}
+
+void TcpRtpClient::addTrack(SubscriberSet<TcpRtpTrack>& tracks, NabtoDeviceConnectionRef ref, const TcpRtpTrack& track)
+{
+    auto existing = tracks.find(ref);
+    if (existing.has_value()) {
+        existing->queue->close();
+    }
+    tracks.insert(ref, track);
+}
+
+void TcpRtpClient::removeTrack(SubscriberSet<TcpRtpTrack>& tracks, NabtoDeviceConnectionRef ref)
+{
+    auto existing = tracks.find(ref);
+    if (existing.has_value()) {
+        existing->queue->close();
+        tracks.erase(ref);
+    }
+}
+
+void TcpRtpClient::closeTracks(SubscriberSet<TcpRtpTrack>& tracks)
+{
+    for (const auto& [key, value] : *tracks.snapshot()) {
+        value.queue->close();
+    }
+    tracks.clear();
+}
+
+void TcpRtpClient::forwardPacket(const SubscriberSet<TcpRtpTrack>& tracks, GopCachePtr gopCache, const uint8_t* data, size_t length)
+{
+    auto snapshot = tracks.snapshot();
+    if (snapshot->empty() && gopCache == nullptr) {
+        return;
+    }
+    // The curl buffer is only valid during the callback, so the packet is
+    // copied once into a pooled buffer shared by all viewers.
+    RtpBufferRef buffer = length > bufferPool_->bufferCapacity() ? largeBufferPool_->acquire() : bufferPool_->acquire();
+    if (length > buffer->capacity()) {
+        NPLOGE << "Interleaved RTP packet of " << length << " bytes is too large, dropping it";
+        return;
+    }
+    memcpy(buffer->data(), data, length);
+    buffer->setSize(length);
+    fanOutPacket(*snapshot, gopCache, buffer, [this](NabtoDeviceConnectionRef ref) {
+        NPLOGW << "Viewer send queue overflowed, no longer forwarding RTP to the viewer";
+        removeConnection(ref);
+        if (viewerDisconnected_) {
+            viewerDisconnected_(ref);
+        }
+    });
+}
+
+void TcpRtpClient::handleRtp(uint8_t channel, const uint8_t* data, size_t length)
+{
+    if (channel == videoChannels_.rtp) {
+        videoStats_->rtpReceived(data, length, std::chrono::steady_clock::now());
+        forwardPacket(videoTracks_, videoGopCache_, data, length);
+    } else if (channel == audioChannels_.rtp) {
+        audioStats_->rtpReceived(data, length, std::chrono::steady_clock::now());
+        forwardPacket(audioTracks_, nullptr, data, length);
+    }
+}
+
+size_t TcpRtpClient::handleRtcp(uint8_t channel, const uint8_t* data, size_t length, uint8_t* report, size_t reportLength)
+{
+    RtpReceptionStatsPtr stats;
+    if (channel == videoChannels_.rtcp) {
+        stats = videoStats_;
+    } else if (channel == audioChannels_.rtcp) {
+        stats = audioStats_;
+    } else {
+        return 0;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (reportLength < 4 || !stats->senderReportReceived(data, length, now)) {
+        return 0;
+    }
+    size_t rrLength = stats->buildReceiverReport(report + 4, reportLength - 4, now);
+    if (rrLength == 0) {
+        return 0;
+    }
+    report[0] = '$';
+    report[1] = channel;
+    report[2] = (uint8_t)(rrLength >> 8);
+    report[3] = (uint8_t)(rrLength & 0xff);
+    return 4 + rrLength;
+}
+
+std::optional<ViewerQueueStats> TcpRtpClient::videoQueueStats(NabtoDeviceConnectionRef ref)
+{
+    auto track = videoTracks_.find(ref);
+    if (!track.has_value()) {
+        return std::nullopt;
+    }
+    return track->queue->stats();
+}
+
+std::optional<ViewerQueueStats> TcpRtpClient::audioQueueStats(NabtoDeviceConnectionRef ref)
+{
+    auto track = audioTracks_.find(ref);
+    if (!track.has_value()) {
+        return std::nullopt;
     }
+    return track->queue->stats();
 }
 
 void TcpRtpClient::run()
@@ -64,6 +228,7 @@ void TcpRtpClient::run()
 
     auto curl = curl_->getCurl();
     CURLcode res = CURLE_OK;
+    auto nextKeepAlive = std::chrono::steady_clock::now() + keepAliveInterval_;
     while (1) {
         {
             std::lock_guard<std::mutex> lock(mutex_);
@@ -87,16 +252,23 @@ void TcpRtpClient::run()
             break;
         }
 
+        if (keepAlive_ && keepAliveInterval_.count() > 0 && std::chrono::steady_clock::now() >= nextKeepAlive) {
+            nextKeepAlive = std::chrono::steady_clock::now() + keepAliveInterval_;
+            if (!keepAlive_()) {
+                NPLOGE << "Failed to keep RTSP session alive";
+                break;
+            }
+        }
+
         std::lock_guard<std::mutex> lock(mutex_);
-        if (sendRtcp_) {
-            sendRtcp_ = false;
+        if (!pendingRtcp_.empty()) {
             CURLcode res = CURLE_OK;
             curl_socket_t sockfd;
             res = curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &sockfd);
             if (!res && sockfd != CURL_SOCKET_BAD) {
-                uint16_t len = *(uint16_t*)(rtcpWriteBuf_+2)+4;
-                // NPLOGD << "Sending RR on channel: " << (int)rtcpWriteBuf_[1];
-                auto ret = write(sockfd, rtcpWriteBuf_, len);
+                ssize_t len = pendingRtcp_.size();
+                auto ret = write(sockfd, pendingRtcp_.data(), len);
+                pendingRtcp_.clear();
                 if (ret < len) {
                     NPLOGE << "Failed to write RTCP RR to TCP socket. ret: " << ret;
                     break;
@@ -130,42 +302,16 @@ size_t TcpRtpClient::rtp_write(void* ptr, size_t size, size_t nmemb, void* userp
     uint8_t channel = ((uint8_t*)ptr)[1];
     // NPLOGE << "Received data on channel: " << (int)channel << " with len: " << len << " dataLen: " << dataLen;
 
-    if (channel == 0) {
-        // video RTP
-        std::lock_guard<std::mutex> lock(self->mutex_);
-        if (self->videoTrack_ != nullptr) {
-            uint8_t* buf = ((uint8_t*)ptr) + 4;
-            auto packets = self->videoRepacketizer_->handlePacket(std::vector<uint8_t>(buf, buf + dataLen));
-            for (auto p : packets) {
-                self->videoTrack_->send(p.data(), p.size());
-            }
-
-        }
-    } else if (channel == 2) {
-        // Audio RTP
-        std::lock_guard<std::mutex> lock(self->mutex_);
-        if (self->audioTrack_ != nullptr) {
-            uint8_t* buf = ((uint8_t*)ptr) + 4;
-            auto packets = self->audioRepacketizer_->handlePacket(std::vector<uint8_t>(buf, buf + dataLen));
-            for (auto p : packets) {
-                self->audioTrack_->send(p.data(), p.size());
-            }
-
-        }
+    if (!self->isRtcpChannel(channel)) {
+        self->handleRtp(channel, ((uint8_t*)ptr) + 4, dataLen);
     } else {
+        uint8_t report[TCP_RTCP_REPORT_SIZE];
+        size_t reportLength = self->handleRtcp(channel, ((uint8_t*)ptr) + 4, dataLen, report, sizeof(report));
         std::lock_guard<std::mutex> lock(self->mutex_);
-        char* buffer = (char*)ptr + 4;
-        auto sr = reinterpret_cast<rtc::RtcpSr*>(buffer);
-        memset(self->rtcpWriteBuf_, 0, 64);
-        self->rtcpWriteBuf_[0] = '$';
-        self->rtcpWriteBuf_[1] = channel;
-        rtc::RtcpRr* rr = (rtc::RtcpRr*)(self->rtcpWriteBuf_ + 4);
-        rtc::RtcpReportBlock* rb = rr->getReportBlock(0);
-        rb->preparePacket(sr->senderSSRC(), 0, 0, 0, 0, 0, sr->ntpTimestamp(), 0);
-        rr->preparePacket(1, 1);
-        uint16_t* p = (uint16_t*)&self->rtcpWriteBuf_[2];
-        *p = rr->header.lengthInBytes();
-        self->sendRtcp_ = true;
+        // Reports for both channels can arrive before run() gets to send them.
+        if (reportLength > 0 && self->pendingRtcp_.size() + reportLength <= TCP_RTCP_PENDING_MAX) {
+            self->pendingRtcp_.insert(self->pendingRtcp_.end(), report, report + reportLength);
+        }
     }
 
 
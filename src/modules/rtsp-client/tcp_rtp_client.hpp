@@ -1,27 +1,69 @@
 #pragma once
 
 #include <media-streams/media_stream.hpp>
+#include <media-streams/subscriber_set.hpp>
+#include <media-streams/media_send_worker.hpp>
+#include <media-streams/gop_cache.hpp>
+#include <media-streams/viewer_fanout.hpp>
+#include <media-streams/rtp_reception_stats.hpp>
 #include <track-negotiators/track_negotiator.hpp>
 #include <rtp-repacketizer/rtp_repacketizer.hpp>
 
+#include "rtsp_protocol.hpp"
+
 #include <util/util.hpp>
 
+#include <chrono>
+#include <functional>
+
 
 namespace nabto {
 
 class TcpRtpClient;
 typedef std::shared_ptr<TcpRtpClient> TcpRtpClientPtr;
 
+class TcpRtpTrack
+{
+public:
+    MediaTrackPtr track;
+    RtpRepacketizerPtr repacketizer = nullptr;
+    // Packets are queued here and sent by a MediaSendWorker.
+    ViewerQueuePtr queue = nullptr;
+};
+
 class TcpRtpClientConf {
 public:
+    // Curl handle running the RTSP session, used by run(). nullptr if the
+    // owner reads the RTSP connection itself and calls handleRtp().
     CurlAsyncPtr curl;
     std::string url;
     TrackNegotiatorPtr videoNegotiator;
     TrackNegotiatorPtr audioNegotiator;
     RtpRepacketizerFactoryPtr videoRepack;
     RtpRepacketizerFactoryPtr audioRepack;
+    // Size and overflow policy of the video and audio send queues of each viewer.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued packets. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // Replay the current video GOP to new viewers.
+    GopCacheConf gopCache;
+    // Called from run() every keepAliveInterval to keep the RTSP session
+    // alive. run() returns if it fails.
+    std::function<bool()> keepAlive;
+    std::chrono::milliseconds keepAliveInterval{0};
+    // Out-of-band parameter sets of the video, see RtpRepacketizer::setParameterSets().
+    std::vector<std::vector<uint8_t>> videoParameterSets;
+    // Called on the ingest thread when a viewer is disconnected because its
+    // send queue overflowed, after its tracks are removed. Lets the owner of
+    // the session remove the viewer too.
+    ViewerDisconnectCallback viewerDisconnected;
 };
 
+/**
+ * Receives RTP interleaved on the RTSP connection and forwards it to all
+ * viewers of the stream. Each packet is copied once into a pooled buffer
+ * which is shared by the send queues of the viewers.
+ */
 class TcpRtpClient : public std::enable_shared_from_this<TcpRtpClient>
 {
 public:
@@ -30,44 +72,100 @@ public:
 
     ~TcpRtpClient();
 
-    void setConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack);
+    // Add a viewer. Either track can be nullptr. Tracks of an existing
+    // viewer are replaced.
+    void addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr videoTrack, MediaTrackPtr audioTrack);
+    void removeConnection(NabtoDeviceConnectionRef ref);
 
     void stop() {
         {
             std::lock_guard<std::mutex> lock(mutex_);
             stopped_ = true;
         }
-        curl_->stop();
+        closeTracks(videoTracks_);
+        closeTracks(audioTracks_);
+        if (curl_ != nullptr) {
+            curl_->stop();
+        }
     }
 
+    // Send queue depth and drop counters of the video and audio tracks of a viewer, if set.
+    std::optional<ViewerQueueStats> videoQueueStats(NabtoDeviceConnectionRef ref);
+    std::optional<ViewerQueueStats> audioQueueStats(NabtoDeviceConnectionRef ref);
+
     void run();
 
+    /**
+     * Set the interleaved channels given by the server in the Transport
+     * header of the SETUP response. Video defaults to 0-1 and audio to 2-3,
+     * the channels requested in SETUP. Must be called by the owner reading
+     * the RTSP connection, serialized with handleRtp() and handleRtcp().
+     */
+    void setVideoChannels(const RtspInterleavedChannels& channels) { videoChannels_ = channels; }
+    void setAudioChannels(const RtspInterleavedChannels& channels) { audioChannels_ = channels; }
+
+    // True if packets on the interleaved channel go to handleRtcp(), false if they go to handleRtp().
+    bool isRtcpChannel(uint8_t channel) const { return channel == videoChannels_.rtcp || channel == audioChannels_.rtcp; }
+
+    // Forward an RTP packet received on the video or audio RTP channel. data
+    // is only used during the call.
+    void handleRtp(uint8_t channel, const uint8_t* data, size_t length);
+
+    /**
+     * Take an RTCP packet received on the video or audio RTCP channel. If it
+     * has a sender report, a receiver report for the channel, framed for the
+     * RTSP connection, is written to report.
+     *
+     * @return the length written to report, 0 if there is nothing to send.
+     */
+    size_t handleRtcp(uint8_t channel, const uint8_t* data, size_t length, uint8_t* report, size_t reportLength);
+
+    // Loss and jitter of the received video and audio streams.
+    RtpReceptionStatsPtr videoReceptionStats() { return videoStats_; }
+    RtpReceptionStatsPtr audioReceptionStats() { return audioStats_; }
+
 private:
     static size_t rtp_write(void* ptr, size_t size, size_t nmemb, void* userp);
+    TcpRtpTrack createTrack(NabtoDeviceConnectionRef ref, MediaTrackPtr track, RtpRepacketizerFactoryPtr repack, TrackNegotiatorPtr negotiator);
+    void addTrack(SubscriberSet<TcpRtpTrack>& tracks, NabtoDeviceConnectionRef ref, const TcpRtpTrack& track);
+    void removeTrack(SubscriberSet<TcpRtpTrack>& tracks, NabtoDeviceConnectionRef ref);
+    static void closeTracks(SubscriberSet<TcpRtpTrack>& tracks);
+    void forwardPacket(const SubscriberSet<TcpRtpTrack>& tracks, GopCachePtr gopCache, const uint8_t* data, size_t length);
 
     CurlAsyncPtr curl_;
     std::string url_;
     bool stopped_ = true;
     std::mutex mutex_;
 
+    ViewerQueueConf queueConf_;
+    MediaSendWorkerPtr sendWorker_;
+    RtpBufferPoolPtr bufferPool_;
+    // Buffers for the rare packets not fitting the buffers of bufferPool_.
+    RtpBufferPoolPtr largeBufferPool_;
+
+    RtspInterleavedChannels videoChannels_ = { 0, 1 };
+    RtspInterleavedChannels audioChannels_ = { 2, 3 };
+
     TrackNegotiatorPtr videoNegotiator_ = nullptr;
     RtpRepacketizerFactoryPtr videoRepack_ = RtpRepacketizerFactory::create();
-    RtpRepacketizerPtr videoRepacketizer_ = nullptr;
-    MediaTrackPtr videoTrack_ = nullptr;
-    uint32_t videoSsrc_ = 0;
-    int videoSrcPt_ = 0;
-    int videoDstPt_ = 0;
+    std::vector<std::vector<uint8_t>> videoParameterSets_;
+    SubscriberSet<TcpRtpTrack> videoTracks_;
+    // Only used from the curl callback. nullptr if disabled.
+    GopCachePtr videoGopCache_ = nullptr;
+    RtpReceptionStatsPtr videoStats_;
 
     TrackNegotiatorPtr audioNegotiator_ = nullptr;
     RtpRepacketizerFactoryPtr audioRepack_ = RtpRepacketizerFactory::create();
-    RtpRepacketizerPtr audioRepacketizer_ = nullptr;
-    MediaTrackPtr audioTrack_ = nullptr;
-    uint32_t audioSsrc_ = 0;
-    int audioSrcPt_ = 0;
-    int audioDstPt_ = 0;
-
-    char rtcpWriteBuf_[64];
-    bool sendRtcp_ = false;
+    SubscriberSet<TcpRtpTrack> audioTracks_;
+    RtpReceptionStatsPtr audioStats_;
+
+    ViewerDisconnectCallback viewerDisconnected_;
+
+    std::function<bool()> keepAlive_;
+    std::chrono::milliseconds keepAliveInterval_{0};
+
+    // Receiver reports written by rtp_write, sent by run().
+    std::vector<uint8_t> pendingRtcp_;
 };
 
 
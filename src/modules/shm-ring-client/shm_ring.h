@@ -0,0 +1,353 @@
+#ifndef NABTO_SHM_RING_H
+#define NABTO_SHM_RING_H
+
+/*
+ * Shared memory ring buffer carrying encoded media frames from a producer
+ * process (e.g. an encoder) to the ShmRingClient of the WebRTC device.
+ *
+ * The ring is a memfd shared between the two processes. The producer writes
+ * frames into it and the device reads them in place, so frame data is copied
+ * at most once on its way to the packetizer, and the producer can let its
+ * encoder write straight into the ring with nabto_shm_ring_reserve() and
+ * nabto_shm_ring_commit().
+ *
+ * The producer owns the ring. It listens on a unix socket, and passes the
+ * memfd and an eventfd to each device connecting to it. The eventfd is only
+ * signalled when the device is waiting for data. The device detects that the
+ * producer is gone when the socket is closed.
+ *
+ * There is a single producer and a single consumer. When the ring is full, new
+ * frames are dropped by the producer, the frames in the ring are never
+ * overwritten.
+ *
+ * This file is the complete producer library. It is plain C99 with GCC
+ * atomic builtins and Linux system calls, and can be copied into the producer
+ * project. It is also used by the device for the ring layout.
+ *
+ * Producer example:
+ *
+ *   NabtoShmRingProducer producer;
+ *   if (nabto_shm_ring_producer_open(&producer, "/tmp/video.ring", 4*1024*1024) != 0) { ... }
+ *   while (...) {
+ *       uint8_t* buffer = nabto_shm_ring_reserve(&producer, maxFrameSize);
+ *       if (buffer != NULL) {
+ *           size_t length = encode(buffer, maxFrameSize);
+ *           nabto_shm_ring_commit(&producer, length, ptsUs, keyframe ? NABTO_SHM_RING_FLAG_KEYFRAME : 0);
+ *       }
+ *   }
+ *   nabto_shm_ring_producer_close(&producer);
+ */
+
+/* syscall() and ftruncate() are not declared in strict C99 mode. This only
+ * takes effect if the file is included before any system header. */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NABTO_SHM_RING_MAGIC 0x4e52494eu /* "NRIN" */
+#define NABTO_SHM_RING_VERSION 1
+
+/* The frame can be decoded without earlier frames. */
+#define NABTO_SHM_RING_FLAG_KEYFRAME 0x00000001u
+/* Internal: record filling the space to the end of the ring. */
+#define NABTO_SHM_RING_FLAG_PADDING 0x80000000u
+
+/* Offset of the data area in the shared memory. */
+#define NABTO_SHM_RING_DATA_OFFSET 256
+/* Size of a record header. Records are 8 byte aligned. */
+#define NABTO_SHM_RING_RECORD_HEADER_SIZE 16
+#define NABTO_SHM_RING_RECORD_SIZE(length) ((((uint64_t)(length)) + NABTO_SHM_RING_RECORD_HEADER_SIZE + 7) & ~(uint64_t)7)
+
+/*
+ * Header at the start of the shared memory. The producer and consumer
+ * positions are kept on separate cache lines. Positions count bytes written
+ * and read since the ring was created, the offset in the data area is the
+ * position modulo the capacity.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* Size of the data area, a power of two */
+    uint64_t capacity;
+    uint8_t reserved0[48];
+
+    /* Written by the producer */
+    uint64_t writePos;
+    /* Number of frames dropped because the ring was full */
+    uint64_t droppedFrames;
+    uint8_t reserved1[48];
+
+    /* Written by the consumer */
+    uint64_t readPos;
+    /* Non-zero while the consumer waits on the eventfd */
+    uint32_t consumerWaiting;
+    uint8_t reserved2[52];
+} NabtoShmRingHeader;
+
+typedef struct {
+    /* Length of the frame data following the record header */
+    uint32_t length;
+    uint32_t flags;
+    /* Presentation time of the frame in microseconds */
+    int64_t timestampUs;
+} NabtoShmRingRecord;
+
+typedef struct {
+    int memFd;
+    int eventFd;
+    int listenFd;
+    /* Connection of the current consumer or -1 */
+    int connFd;
+    NabtoShmRingHeader* header;
+    uint8_t* data;
+    size_t mapSize;
+    /* Position of the reserved record, valid while reserved is set */
+    uint64_t reservedPos;
+    size_t reservedLength;
+    int reserved;
+    char socketPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} NabtoShmRingProducer;
+
+/*
+ * Create a ring with a data area of capacity bytes, rounded up to a power of
+ * two, and listen for the device on a unix socket at socketPath. An existing
+ * file at socketPath is removed.
+ *
+ * Returns 0 on success and -1 with errno set on failure.
+ */
+static inline int nabto_shm_ring_producer_open(NabtoShmRingProducer* p, const char* socketPath, size_t capacity)
+{
+    uint64_t cap = 4096;
+    struct sockaddr_un addr;
+    int err;
+    memset(p, 0, sizeof(*p));
+    p->memFd = p->eventFd = p->listenFd = p->connFd = -1;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    if (strlen(socketPath) >= sizeof(p->socketPath)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(p->socketPath, socketPath);
+
+    /* memfd_create is called through syscall() as older C libraries lack the wrapper. 1 is MFD_CLOEXEC. */
+    p->memFd = (int)syscall(SYS_memfd_create, "nabto-shm-ring", 1u);
+    if (p->memFd < 0) {
+        goto fail;
+    }
+    p->mapSize = NABTO_SHM_RING_DATA_OFFSET + cap;
+    if (ftruncate(p->memFd, (off_t)p->mapSize) != 0) {
+        goto fail;
+    }
+    p->header = (NabtoShmRingHeader*)mmap(NULL, p->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, p->memFd, 0);
+    if (p->header == (NabtoShmRingHeader*)MAP_FAILED) {
+        p->header = NULL;
+        goto fail;
+    }
+    p->data = (uint8_t*)p->header + NABTO_SHM_RING_DATA_OFFSET;
+    p->header->version = NABTO_SHM_RING_VERSION;
+    p->header->capacity = cap;
+    __atomic_store_n(&p->header->magic, NABTO_SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    p->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (p->eventFd < 0) {
+        goto fail;
+    }
+
+    p->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (p->listenFd < 0) {
+        goto fail;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, p->socketPath);
+    unlink(p->socketPath);
+    if (bind(p->listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(p->listenFd, 1) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    if (p->listenFd >= 0) { close(p->listenFd); }
+    if (p->eventFd >= 0) { close(p->eventFd); }
+    if (p->header != NULL) { munmap(p->header, p->mapSize); }
+    if (p->memFd >= 0) { close(p->memFd); }
+    p->memFd = p->eventFd = p->listenFd = -1;
+    p->header = NULL;
+    errno = err;
+    return -1;
+}
+
+/*
+ * Close the ring. A connected device sees the socket close and stops reading.
+ */
+static inline void nabto_shm_ring_producer_close(NabtoShmRingProducer* p)
+{
+    if (p->connFd >= 0) { close(p->connFd); }
+    if (p->listenFd >= 0) {
+        close(p->listenFd);
+        unlink(p->socketPath);
+    }
+    if (p->eventFd >= 0) { close(p->eventFd); }
+    if (p->header != NULL) { munmap(p->header, p->mapSize); }
+    if (p->memFd >= 0) { close(p->memFd); }
+    p->memFd = p->eventFd = p->listenFd = p->connFd = -1;
+    p->header = NULL;
+}
+
+/*
+ * Accept a device connecting to the socket and pass it the ring. Called by
+ * nabto_shm_ring_commit(), so a producer writing frames regularly need not
+ * call it. A new connection replaces the previous one.
+ */
+static inline void nabto_shm_ring_producer_serve(NabtoShmRingProducer* p)
+{
+    int fds[2];
+    char byte = 0;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct cmsghdr* cmsg;
+
+    int fd = accept(p->listenFd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    fds[0] = p->memFd;
+    fds[1] = p->eventFd;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1) {
+        close(fd);
+        return;
+    }
+    if (p->connFd >= 0) {
+        close(p->connFd);
+    }
+    p->connFd = fd;
+}
+
+/*
+ * Reserve room for a frame of up to maxLength bytes and get a pointer to
+ * write it to. The frame is not visible to the device until it is committed.
+ * A frame can be at most half the ring capacity.
+ *
+ * Returns NULL if the ring is full, in which case the frame should be
+ * dropped. It is counted as dropped in the ring header.
+ */
+static inline uint8_t* nabto_shm_ring_reserve(NabtoShmRingProducer* p, size_t maxLength)
+{
+    NabtoShmRingHeader* h = p->header;
+    uint64_t cap = h->capacity;
+    uint64_t size = NABTO_SHM_RING_RECORD_SIZE(maxLength);
+    uint64_t write = __atomic_load_n(&h->writePos, __ATOMIC_RELAXED);
+    uint64_t read = __atomic_load_n(&h->readPos, __ATOMIC_ACQUIRE);
+    uint64_t offset = write & (cap - 1);
+    uint64_t pad = offset + size > cap ? cap - offset : 0;
+
+    p->reserved = 0;
+    if (size > cap / 2 || write + pad + size - read > cap) {
+        __atomic_fetch_add(&h->droppedFrames, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (pad >= NABTO_SHM_RING_RECORD_HEADER_SIZE) {
+        /* Records never wrap. The rest of the ring is skipped by the reader. */
+        NabtoShmRingRecord* r = (NabtoShmRingRecord*)(p->data + offset);
+        r->length = (uint32_t)(pad - NABTO_SHM_RING_RECORD_HEADER_SIZE);
+        r->flags = NABTO_SHM_RING_FLAG_PADDING;
+        r->timestampUs = 0;
+    }
+    p->reservedPos = write + pad;
+    p->reservedLength = maxLength;
+    p->reserved = 1;
+    return p->data + (p->reservedPos & (cap - 1)) + NABTO_SHM_RING_RECORD_HEADER_SIZE;
+}
+
+/*
+ * Publish the frame written to the buffer returned by nabto_shm_ring_reserve()
+ * and wake up the device if it is waiting.
+ *
+ * Returns 0 on success and -1 if nothing was reserved or length is larger
+ * than the reserved size.
+ */
+static inline int nabto_shm_ring_commit(NabtoShmRingProducer* p, size_t length, int64_t timestampUs, uint32_t flags)
+{
+    NabtoShmRingHeader* h = p->header;
+    NabtoShmRingRecord* r;
+    if (!p->reserved || length > p->reservedLength) {
+        return -1;
+    }
+    p->reserved = 0;
+    r = (NabtoShmRingRecord*)(p->data + (p->reservedPos & (h->capacity - 1)));
+    r->length = (uint32_t)length;
+    r->flags = flags & ~NABTO_SHM_RING_FLAG_PADDING;
+    r->timestampUs = timestampUs;
+
+    /* Sequentially consistent with the consumer setting consumerWaiting and
+     * then checking writePos, so one of the two always sees the other. */
+    __atomic_store_n(&h->writePos, p->reservedPos + NABTO_SHM_RING_RECORD_SIZE(length), __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->consumerWaiting, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        ssize_t ret = write(p->eventFd, &one, sizeof(one));
+        (void)ret;
+    }
+    nabto_shm_ring_producer_serve(p);
+    return 0;
+}
+
+/*
+ * Copy a frame into the ring.
+ *
+ * Returns 0 on success and -1 if the ring is full and the frame was dropped.
+ */
+static inline int nabto_shm_ring_write(NabtoShmRingProducer* p, const uint8_t* frame, size_t length, int64_t timestampUs, uint32_t flags)
+{
+    uint8_t* buffer = nabto_shm_ring_reserve(p, length);
+    if (buffer == NULL) {
+        nabto_shm_ring_producer_serve(p);
+        return -1;
+    }
+    memcpy(buffer, frame, length);
+    return nabto_shm_ring_commit(p, length, timestampUs, flags);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,313 @@
+#include "shm_ring_client.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// Packetized data is copied into pooled buffers of this size and shared by all
+// viewers. Larger if the packetizer is configured with a larger MTU.
+const int SHM_RING_RTP_BUFFER_SIZE = 2048;
+// Time between attempts to attach to a producer which is not running.
+const int SHM_RING_RETRY_MS = 1000;
+
+namespace nabto {
+
+ShmRingClientPtr ShmRingClient::create(const ShmRingClientConf& conf)
+{
+    return std::make_shared<ShmRingClient>(conf);
+}
+
+ShmRingClient::ShmRingClient(const ShmRingClientConf& conf)
+    : trackId_(conf.trackId),
+    socketPath_(conf.socketPath),
+    waitForKeyframe_(conf.waitForKeyframe),
+    negotiator_(conf.negotiator),
+    packetizer_(conf.packetizer),
+    queueConf_(conf.sendQueue),
+    sendWorker_(conf.sendWorker),
+    bufferPool_(RtpBufferPool::create(std::max((size_t)SHM_RING_RTP_BUFFER_SIZE, conf.packetizer->maxPacketSize())))
+{
+    if (sendWorker_ == nullptr) {
+        sendWorker_ = MediaSendWorker::defaultWorker();
+    }
+    auto negotiator = negotiator_;
+    gopCache_ = createGopCache(conf.gopCache,
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, bufferPool_, queueConf_);
+}
+
+ShmRingClient::~ShmRingClient()
+{
+    stop();
+}
+
+bool ShmRingClient::isTrack(const std::string& trackId)
+{
+    return trackId == trackId_;
+}
+
+bool ShmRingClient::matchMedia(MediaTrackPtr media)
+{
+    int pt = negotiator_->match(media);
+    if (pt == 0) {
+        NPLOGE << "Codec matching failed for shared memory ring track " << trackId_;
+        return false;
+    }
+    return true;
+}
+
+void ShmRingClient::addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media)
+{
+    auto sdp = media->getSdp();
+
+    rtc::Description::Media desc(sdp);
+    auto pts = desc.payloadTypes();
+
+    // exactly 1 payload type should exist, else something has failed previously, so we just pick the first one blindly.
+    int pt = pts.empty() ? 0 : pts[0];
+
+    ShmRingTrack track = {
+        media,
+        std::make_shared<RtpRepacketizer>(negotiator_->ssrc(), pt)
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    waitForTeardown(lock);
+    auto existing = mediaTracks_.find(ref);
+    if (existing.has_value()) {
+        existing->queue->close();
+    }
+    auto negotiator = negotiator_;
+    track.queue = ViewerQueue::create(queueConf_, sendWorker_,
+        [track](const RtpBufferRef& buffer) {
+            // Only the RTP header differs between viewers, the payload is sent from the shared buffer.
+            uint8_t header[RTP_FIXED_HEADER_SIZE];
+            size_t headerLen = track.repacketizer->rewriteHeader(buffer->data(), buffer->size(), header, sizeof(header));
+            if (headerLen > 0) {
+                track.track->send(header, headerLen, buffer->data() + headerLen, buffer->size() - headerLen);
+            }
+        },
+        [negotiator](const uint8_t* packet, size_t length) {
+            return negotiator->isKeyframe(packet, length);
+        }, ref);
+    mediaTracks_.insert(ref, track);
+    NPLOGD << "Adding shared memory ring connection";
+    if (stopped_) {
+        start();
+    }
+}
+
+void ShmRingClient::removeConnection(NabtoDeviceConnectionRef ref)
+{
+    NPLOGD << "Removing Nabto Connection from shared memory ring";
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto track = mediaTracks_.find(ref);
+    if (track.has_value()) {
+        track->queue->close();
+    }
+    if (mediaTracks_.erase(ref) == 0) {
+        NPLOGD << "Connection was last one. Stopping";
+        stop(lock);
+    }
+}
+
+std::optional<ViewerQueueStats> ShmRingClient::queueStats(NabtoDeviceConnectionRef ref)
+{
+    auto track = mediaTracks_.find(ref);
+    if (!track.has_value()) {
+        return std::nullopt;
+    }
+    return track->queue->stats();
+}
+
+void ShmRingClient::start()
+{
+    NPLOGI << "Starting shared memory ring client for " << socketPath_;
+    stopped_ = false;
+    // Packets for all viewers are made with the negotiated source SSRC and
+    // payload type and rewritten per viewer.
+    sourcePacketizer_ = packetizer_->createPacketizer(negotiator_->ssrc(), negotiator_->payloadType());
+    framePacketizer_ = std::dynamic_pointer_cast<FramePacketizer>(sourcePacketizer_);
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ >= 0 && stopFd_ >= 0) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = stopFd_;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, stopFd_, &ev);
+    }
+    thread_ = std::thread([this]() { ringRunner(); });
+}
+
+void ShmRingClient::stop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop(lock);
+}
+
+void ShmRingClient::stop(std::unique_lock<std::mutex>& lock)
+{
+    // Viewers added after this find the client stopped and start it again.
+    for (const auto& [key, value] : *mediaTracks_.snapshot()) {
+        value.queue->close();
+    }
+    mediaTracks_.clear();
+    if (stopped_) {
+        return;
+    }
+    stopped_ = true;
+    uint64_t one = 1;
+    auto ret = write(stopFd_, &one, sizeof(one));
+    (void)ret;
+    // Only the thread of this run is joined. A start() meanwhile waits for
+    // it in waitForTeardown() before reusing the reader resources.
+    std::thread thread = std::move(thread_);
+    tearingDown_ = true;
+    lock.unlock();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+    close(epollFd_);
+    close(stopFd_);
+    epollFd_ = -1;
+    stopFd_ = -1;
+    if (gopCache_ != nullptr) {
+        gopCache_->clear();
+    }
+    NPLOGD << "Shared memory ring client stopped";
+
+    lock.lock();
+    tearingDown_ = false;
+    teardownCond_.notify_all();
+}
+
+void ShmRingClient::waitForTeardown(std::unique_lock<std::mutex>& lock)
+{
+    teardownCond_.wait(lock, [this]() { return !tearingDown_; });
+}
+
+bool ShmRingClient::attach()
+{
+    reader_ = ShmRingReader::connect(socketPath_);
+    if (reader_ == nullptr) {
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = reader_->eventFd();
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, reader_->eventFd(), &ev);
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = reader_->connectionFd();
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, reader_->connectionFd(), &ev);
+    waitingForKeyframe_ = waitForKeyframe_;
+    NPLOGI << "Attached to shared memory ring at " << socketPath_;
+    return true;
+}
+
+void ShmRingClient::detach()
+{
+    if (reader_ == nullptr) {
+        return;
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, reader_->eventFd(), NULL);
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, reader_->connectionFd(), NULL);
+    if (reader_->droppedFrames() > 0) {
+        NPLOGI << "Shared memory ring producer dropped " << reader_->droppedFrames() << " frames because the ring was full";
+    }
+    reader_ = nullptr;
+}
+
+void ShmRingClient::ringRunner()
+{
+    struct epoll_event events[3];
+    while (!stopped_) {
+        if (reader_ == nullptr && !attach()) {
+            // Only the stop eventfd is watched until the producer is up.
+            epoll_wait(epollFd_, events, 3, SHM_RING_RETRY_MS);
+            continue;
+        }
+
+        ShmRingFrame frame;
+        while (!stopped_ && reader_->peek(frame)) {
+            try {
+                handleFrame(frame);
+            } catch (std::exception& ex) {
+                NPLOGE << "Failed to packetize frame from shared memory ring: " << ex.what();
+            }
+            reader_->pop();
+        }
+        if (stopped_ || !reader_->prepareWait()) {
+            continue;
+        }
+
+        int n = epoll_wait(epollFd_, events, 3, -1);
+        reader_->finishWait();
+        if (n < 0 && errno != EINTR) {
+            NPLOGE << "Failed to wait for shared memory ring data: " << strerror(errno);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == reader_->connectionFd()) {
+                NPLOGI << "Shared memory ring producer at " << socketPath_ << " went away";
+                detach();
+                break;
+            }
+        }
+    }
+    detach();
+    NPLOGI << "Shared memory ring reader thread returning";
+}
+
+void ShmRingClient::handleFrame(const ShmRingFrame& frame)
+{
+    if (waitingForKeyframe_) {
+        if (!frame.keyframe) {
+            return;
+        }
+        waitingForKeyframe_ = false;
+    }
+    // The frame is packetized once, and the packets are shared by the send queues of all viewers.
+    auto tracks = mediaTracks_.snapshot();
+    RtpPacketCallback cb = [this, &tracks](const uint8_t* packet, size_t length) {
+        sendPacket(*tracks, packet, length);
+    };
+    if (framePacketizer_ != nullptr) {
+        framePacketizer_->packetizeFrame(frame.data, frame.length, frame.timestamp, cb);
+    } else {
+        // Stream packetizers hold back the end of the frame until more data
+        // arrives, but the frame is known to be complete here.
+        sourcePacketizer_->incoming(frame.data, frame.length, cb);
+        sourcePacketizer_->flush(cb);
+    }
+}
+
+void ShmRingClient::sendPacket(const SubscriberSet<ShmRingTrack>::Snapshot& tracks, const uint8_t* packet, size_t length)
+{
+    RtpBufferRef buffer = bufferPool_->acquire();
+    if (length > buffer->capacity()) {
+        NPLOGE << "Packet of " << length << " bytes is too large, dropping it";
+        return;
+    }
+    memcpy(buffer->data(), packet, length);
+    buffer->setSize(length);
+
+    fanOutPacket(tracks, gopCache_, buffer, [this](NabtoDeviceConnectionRef ref) {
+        NPLOGW << "Viewer send queue overflowed, disconnecting viewer from shared memory ring stream";
+        // Removing the last viewer stops the client, which joins this thread.
+        std::weak_ptr<ShmRingClient> weak = weak_from_this();
+        sendWorker_->post([weak, ref]() {
+            if (auto self = weak.lock()) {
+                self->removeConnection(ref);
+            }
+        });
+    });
+}
+
+} // namespace
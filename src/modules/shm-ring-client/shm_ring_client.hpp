@@ -0,0 +1,139 @@
+#pragma once
+#include "shm_ring_reader.hpp"
+
+#include <media-streams/media_stream.hpp>
+#include <media-streams/subscriber_set.hpp>
+#include <media-streams/media_send_worker.hpp>
+#include <media-streams/gop_cache.hpp>
+#include <media-streams/viewer_fanout.hpp>
+#include <track-negotiators/track_negotiator.hpp>
+#include <rtp-packetizer/rtp_packetizer.hpp>
+#include <rtp-repacketizer/rtp_repacketizer.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace nabto {
+
+class ShmRingClient;
+typedef std::shared_ptr<ShmRingClient> ShmRingClientPtr;
+
+class ShmRingTrack
+{
+public:
+    MediaTrackPtr track;
+    // Rewrites the SSRC and payload type of the shared packets for this track.
+    RtpRepacketizerPtr repacketizer = nullptr;
+    // Packets are queued here and sent by a MediaSendWorker.
+    ViewerQueuePtr queue = nullptr;
+};
+
+class ShmRingClientConf {
+public:
+    std::string trackId;
+    // Unix socket the producer serves the ring on
+    std::string socketPath;
+    TrackNegotiatorPtr negotiator;
+    RtpPacketizerFactoryPtr packetizer;
+    // Size and overflow policy of the send queue of each viewer.
+    ViewerQueueConf sendQueue;
+    // Worker sending queued data. If not set, MediaSendWorker::defaultWorker() is used.
+    MediaSendWorkerPtr sendWorker = nullptr;
+    // Replay the current GOP to new viewers so they get a picture right away.
+    GopCacheConf gopCache;
+    // Skip frames until one flagged as keyframe by the producer after
+    // attaching to the ring. Disable this for audio producers which do not
+    // flag their frames.
+    bool waitForKeyframe = true;
+};
+
+/**
+ * Media stream reading encoded frames from a shared memory ring written by a
+ * producer process using shm_ring.h.
+ *
+ * This is an alternative to FifoFileClient which avoids moving every byte
+ * through a pipe. Each frame carries its own timestamp and keyframe flag, and
+ * is packetized as soon as it is read. Packetizers implementing
+ * FramePacketizer (H264, Opus, PCMU) are given whole frames, other
+ * packetizers are flushed after each frame.
+ *
+ * The client attaches to the ring when the first viewer connects and starts
+ * at the newest frame. If the producer is not running, or exits, the client
+ * retries once a second.
+ */
+class ShmRingClient : public MediaStream, public std::enable_shared_from_this<ShmRingClient>
+{
+public:
+    static ShmRingClientPtr create(const ShmRingClientConf& conf);
+    ShmRingClient(const ShmRingClientConf& conf);
+    ~ShmRingClient();
+
+    bool isTrack(const std::string& trackId);
+    void addConnection(NabtoDeviceConnectionRef ref, MediaTrackPtr media);
+    void removeConnection(NabtoDeviceConnectionRef ref);
+    bool matchMedia(MediaTrackPtr media);
+
+    MediaTrackPtr createMedia(const std::string& trackId) {
+        auto m = negotiator_->createMedia();
+        m.addSSRC(negotiator_->ssrc(), trackId_);
+        auto sdp = m.generateSdp();
+        return MediaTrack::create(trackId, sdp);
+    }
+
+    TrackNegotiatorPtr getTrackNegotiator() { return negotiator_; }
+
+    // Send queue depth and drop counters of a viewer, if it is connected.
+    std::optional<ViewerQueueStats> queueStats(NabtoDeviceConnectionRef ref);
+
+private:
+    void start();
+    void stop();
+    // Stop with mutex_ held by lock. The lock is released while the reader thread is joined.
+    void stop(std::unique_lock<std::mutex>& lock);
+    // Wait until a stop() in another thread has joined the reader thread and released its resources.
+    void waitForTeardown(std::unique_lock<std::mutex>& lock);
+    void ringRunner();
+    // Connect to the producer and watch the ring. Returns false if the
+    // producer is not available.
+    bool attach();
+    void detach();
+    void handleFrame(const ShmRingFrame& frame);
+    void sendPacket(const SubscriberSet<ShmRingTrack>::Snapshot& tracks, const uint8_t* packet, size_t length);
+
+    std::string trackId_;
+    std::string socketPath_;
+    bool waitForKeyframe_;
+
+    std::atomic<bool> stopped_{true};
+    // Serializes start/stop and adding and removing viewers, so removing the
+    // last viewer and stopping is one decision. Not used when forwarding data.
+    std::mutex mutex_;
+    // Set while stop() joins the reader thread without holding mutex_.
+    bool tearingDown_ = false;
+    std::condition_variable teardownCond_;
+    SubscriberSet<ShmRingTrack> mediaTracks_;
+    TrackNegotiatorPtr negotiator_;
+    RtpPacketizerFactoryPtr packetizer_;
+    ViewerQueueConf queueConf_;
+    MediaSendWorkerPtr sendWorker_;
+    RtpBufferPoolPtr bufferPool_;
+    std::thread thread_;
+
+    // Only used on the ring reader thread.
+    RtpPacketizerPtr sourcePacketizer_ = nullptr;
+    // sourcePacketizer_ if it can packetize whole frames
+    FramePacketizerPtr framePacketizer_ = nullptr;
+    // nullptr if disabled.
+    GopCachePtr gopCache_ = nullptr;
+    ShmRingReaderPtr reader_ = nullptr;
+    bool waitingForKeyframe_ = true;
+
+    int epollFd_ = -1;
+    // Signalled by stop() to wake up the reader thread.
+    int stopFd_ = -1;
+};
+
+} // namespace
@@ -0,0 +1,197 @@
+#include "shm_ring_reader.hpp"
+
+#include <nabto/nabto_device_webrtc.hpp>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace nabto {
+
+// Max time to wait for the producer to hand over the ring after connecting.
+// The producer does this when it writes its next frame.
+const int SHM_RING_HANDOVER_TIMEOUT_MS = 500;
+
+ShmRingReaderPtr ShmRingReader::connect(const std::string& socketPath)
+{
+    struct sockaddr_un addr = {};
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        NPLOGE << "Shared memory ring socket path is too long: " << socketPath;
+        return nullptr;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        NPLOGE << "Failed to create unix socket: " << strerror(errno);
+        return nullptr;
+    }
+    struct timeval tv = { 0, SHM_RING_HANDOVER_TIMEOUT_MS * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        NPLOGD << "No shared memory ring producer at " << socketPath << ": " << strerror(errno);
+        close(fd);
+        return nullptr;
+    }
+
+    int fds[2];
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (r != 1 || cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        NPLOGD << "Shared memory ring producer at " << socketPath << " did not hand over the ring";
+        close(fd);
+        return nullptr;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    auto reader = std::make_shared<ShmRingReader>(fd, fds[0], fds[1]);
+    if (!reader->map()) {
+        return nullptr;
+    }
+    return reader;
+}
+
+ShmRingReader::ShmRingReader(int connFd, int memFd, int eventFd)
+    : connFd_(connFd), memFd_(memFd), eventFd_(eventFd)
+{
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    if (header_ != nullptr) {
+        __atomic_store_n(&header_->consumerWaiting, 0, __ATOMIC_RELAXED);
+        munmap(header_, mapSize_);
+    }
+    close(eventFd_);
+    close(memFd_);
+    close(connFd_);
+}
+
+bool ShmRingReader::map()
+{
+    struct stat st;
+    if (fstat(memFd_, &st) != 0 || (size_t)st.st_size < NABTO_SHM_RING_DATA_OFFSET) {
+        NPLOGE << "Invalid shared memory ring";
+        return false;
+    }
+    mapSize_ = st.st_size;
+    void* p = mmap(NULL, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, memFd_, 0);
+    if (p == MAP_FAILED) {
+        NPLOGE << "Failed to map shared memory ring: " << strerror(errno);
+        return false;
+    }
+    header_ = (NabtoShmRingHeader*)p;
+    data_ = (const uint8_t*)p + NABTO_SHM_RING_DATA_OFFSET;
+    capacity_ = header_->capacity;
+    if (__atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) != NABTO_SHM_RING_MAGIC ||
+        header_->version != NABTO_SHM_RING_VERSION ||
+        capacity_ == 0 || (capacity_ & (capacity_ - 1)) != 0 ||
+        capacity_ > mapSize_ - NABTO_SHM_RING_DATA_OFFSET)
+    {
+        NPLOGE << "Invalid shared memory ring header";
+        return false;
+    }
+    skipToEnd();
+    return true;
+}
+
+void ShmRingReader::skipToEnd()
+{
+    readPos_ = __atomic_load_n(&header_->writePos, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&header_->readPos, readPos_, __ATOMIC_RELEASE);
+    peekedSize_ = 0;
+}
+
+bool ShmRingReader::peek(ShmRingFrame& frame)
+{
+    uint64_t writePos = __atomic_load_n(&header_->writePos, __ATOMIC_ACQUIRE);
+    while (readPos_ != writePos) {
+        uint64_t offset = readPos_ & (capacity_ - 1);
+        uint64_t space = capacity_ - offset;
+        if (writePos - readPos_ > capacity_) {
+            NPLOGE << "Shared memory ring positions are inconsistent, skipping to the newest data";
+            skipToEnd();
+            return false;
+        }
+        if (space < NABTO_SHM_RING_RECORD_HEADER_SIZE) {
+            // Too little room for a record before the end of the ring
+            readPos_ += space;
+            continue;
+        }
+        NabtoShmRingRecord record;
+        memcpy(&record, data_ + offset, sizeof(record));
+        if (record.flags & NABTO_SHM_RING_FLAG_PADDING) {
+            readPos_ += space;
+            continue;
+        }
+        uint64_t size = NABTO_SHM_RING_RECORD_SIZE(record.length);
+        if (size > space || size > writePos - readPos_) {
+            NPLOGE << "Invalid frame of " << record.length << " bytes in shared memory ring, skipping to the newest data";
+            skipToEnd();
+            return false;
+        }
+        frame.data = data_ + offset + NABTO_SHM_RING_RECORD_HEADER_SIZE;
+        frame.length = record.length;
+        frame.timestamp = std::chrono::microseconds(record.timestampUs);
+        frame.keyframe = (record.flags & NABTO_SHM_RING_FLAG_KEYFRAME) != 0;
+        peekedSize_ = size;
+        return true;
+    }
+    // Publish skipped padding
+    __atomic_store_n(&header_->readPos, readPos_, __ATOMIC_RELEASE);
+    return false;
+}
+
+void ShmRingReader::pop()
+{
+    readPos_ += peekedSize_;
+    peekedSize_ = 0;
+    __atomic_store_n(&header_->readPos, readPos_, __ATOMIC_RELEASE);
+}
+
+bool ShmRingReader::prepareWait()
+{
+    // Sequentially consistent with the producer publishing writePos and then
+    // checking consumerWaiting, see nabto_shm_ring_commit().
+    __atomic_store_n(&header_->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header_->writePos, __ATOMIC_SEQ_CST) != readPos_) {
+        __atomic_store_n(&header_->consumerWaiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void ShmRingReader::finishWait()
+{
+    __atomic_store_n(&header_->consumerWaiting, 0, __ATOMIC_RELAXED);
+    uint64_t count;
+    auto ret = read(eventFd_, &count, sizeof(count));
+    (void)ret;
+}
+
+uint64_t ShmRingReader::droppedFrames() const
+{
+    return __atomic_load_n(&header_->droppedFrames, __ATOMIC_RELAXED);
+}
+
+} // namespace
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "shm_ring.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nabto {
+
+class ShmRingReader;
+typedef std::shared_ptr<ShmRingReader> ShmRingReaderPtr;
+
+class ShmRingFrame {
+public:
+    // Frame data in the shared memory. Valid until pop() is called.
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+    std::chrono::microseconds timestamp{0};
+    bool keyframe = false;
+};
+
+/**
+ * Consumer side of a shared memory ring written by a producer using
+ * shm_ring.h.
+ *
+ * Frames are read in place from the shared memory. A reader must only be used
+ * from one thread at a time.
+ */
+class ShmRingReader {
+public:
+    /**
+     * Connect to the producer listening on socketPath and map its ring.
+     *
+     * @return nullptr if no producer is listening or the ring is invalid.
+     */
+    static ShmRingReaderPtr connect(const std::string& socketPath);
+
+    ShmRingReader(int connFd, int memFd, int eventFd);
+    ~ShmRingReader();
+
+    /**
+     * Signalled by the producer after writing a frame while the reader waits.
+     */
+    int eventFd() const { return eventFd_; }
+
+    /**
+     * Socket to the producer. It becomes readable when the producer closes
+     * the ring or exits.
+     */
+    int connectionFd() const { return connFd_; }
+
+    /**
+     * Skip all frames written so far.
+     */
+    void skipToEnd();
+
+    /**
+     * Get the next frame without removing it from the ring.
+     *
+     * @return false if the ring is empty.
+     */
+    bool peek(ShmRingFrame& frame);
+
+    /**
+     * Remove the frame returned by peek() from the ring so the producer can
+     * reuse the space.
+     */
+    void pop();
+
+    /**
+     * Tell the producer to signal the eventfd when it writes the next frame.
+     *
+     * @return false if a frame has arrived meanwhile, in which case the reader
+     * must not wait.
+     */
+    bool prepareWait();
+
+    /**
+     * Called when the reader is done waiting on the eventfd.
+     */
+    void finishWait();
+
+    // Number of frames the producer has dropped because the ring was full
+    uint64_t droppedFrames() const;
+
+    /**
+     * Map the ring and check its header. Called by connect().
+     */
+    bool map();
+
+private:
+
+    int connFd_;
+    int memFd_;
+    int eventFd_;
+
+    NabtoShmRingHeader* header_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    size_t mapSize_ = 0;
+    uint64_t capacity_ = 0;
+
+    // Local copy of the read position, published when a frame is popped.
+    uint64_t readPos_ = 0;
+    // Size of the record returned by peek()
+    uint64_t peekedSize_ = 0;
+};
+
+} // namespace
@@ -0,0 +1,122 @@
+#include "av1.hpp"
+
+namespace nabto {
+
+int AV1Negotiator::match(MediaTrackPtr track)
+{
+    // We must go through all codecs in the Media Description and remove all codecs other than the one we support.
+    // We start by getting and parsing the SDP
+    auto sdp = track->getSdp();
+    NPLOGD << "    Got offer SDP: " << sdp;
+    rtc::Description::Media media(sdp);
+
+    rtc::Description::Media::RtpMap* rtp = NULL;
+    // Loop all payload types offered by the client
+    for (auto pt : media.payloadTypes()) {
+        rtc::Description::Media::RtpMap* r = NULL;
+        try {
+            // Get the RTP description for this payload type
+            r = media.rtpMap(pt);
+        } catch (std::exception& ex) {
+            // Since we are getting the description based on the list of payload types this should never fail, but just in case.
+            NPLOGE << "Bad rtpMap for pt: " << pt;
+            continue;
+        }
+        // If this payload type is AV1/90000
+        if (r != NULL && (r->format == "AV1" || r->format == "av1") && r->clockRate == 90000) {
+            // Browsers may offer a payload type per profile. Any profile is
+            // accepted, but the Main profile (profile=0, also the default
+            // when no profile is given) is preferred.
+            auto isMain = [](rtc::Description::Media::RtpMap* m) {
+                return m->fmtps.size() == 0 || m->fmtps[0].find("profile=") == std::string::npos || m->fmtps[0].find("profile=0") != std::string::npos;
+            };
+            if (rtp != NULL && (isMain(rtp) || !isMain(r))) {
+                NPLOGD << "av1 pt: " << pt << " no match, removing";
+                media.removeRtpMap(pt);
+                continue;
+            }
+            if (rtp != NULL) {
+                NPLOGD << "Found better AV1 codec match, pt: " << pt;
+                media.removeRtpMap(rtp->payloadType);
+            } else {
+                NPLOGD << "Found AV1 codec match, pt: " << pt;
+            }
+            rtp = r;
+
+            // Our implementation does not support these feedback extensions, so we remove them (if they exist)
+            // Though the technically correct way to do it, trial and error has shown this has no practial effect.
+            rtp->removeFeedback("nack");
+            rtp->removeFeedback("goog-remb");
+            rtp->removeFeedback("transport-cc");
+            rtp->removeFeedback("ccm fir");
+        }
+        else {
+            // We remove any payload type not matching our codec
+            NPLOGD << "pt: " << pt << " no match, removing";
+            media.removeRtpMap(pt);
+        }
+    }
+    if (rtp == NULL) {
+        return 0;
+    }
+    // Add the ssrc to the track
+    auto trackId = track->getTrackId();
+    media.addSSRC(ssrc(), trackId);
+    // Generate the SDP string of the updated Media Description
+    auto newSdp = media.generateSdp();
+    NPLOGD << "    Setting new SDP: " << newSdp;
+    // and set the new SDP on the track
+    track->setSdp(newSdp);
+    return rtp->payloadType;
+}
+
+rtc::Description::Media AV1Negotiator::createMedia()
+{
+    // Create a Video media description.
+    // We support both sending and receiving video
+    std::string mid = MidGenerator::generateMid();
+    rtc::Description::Video media(mid, rtc::Description::Direction::SendRecv);
+
+    // Since we are creating the media track, only the supported payload type exists, so we might as well reuse the same value for the RTP session in WebRTC as the one we use in the RTP source (eg. Gstreamer)
+    // Main profile, level 3.1, main tier, which is what browsers offer.
+    media.addVideoCodec(payloadType_, "AV1", "profile=0;level-idx=5;tier=0");
+
+    // Again to be technically correct, we remove the unsupported feedback extensions
+    auto r = media.rtpMap(payloadType_);
+    r->removeFeedback("nack");
+    r->removeFeedback("goog-remb");
+    return media;
+}
+
+bool AV1Negotiator::isKeyframe(const uint8_t* packet, size_t length)
+{
+    // The N bit of the aggregation header is set on the first packet of a
+    // coded video sequence, which starts with a keyframe (AV1 RTP
+    // specification section 4.4). Packetizers not setting it still put the
+    // sequence header first in the packet.
+    const uint8_t OBU_SEQUENCE_HEADER = 1;
+
+    size_t offset = rtpPayloadOffset(packet, length);
+    if (offset == 0 || offset + 1 >= length) {
+        return false;
+    }
+    uint8_t aggregationHeader = packet[offset];
+    if (aggregationHeader & 0x08) {
+        return true;
+    }
+    if (aggregationHeader & 0x80) {
+        // Starts with the continuation of an OBU
+        return false;
+    }
+    size_t i = offset + 1;
+    if (((aggregationHeader >> 4) & 0x03) != 1) {
+        // The first OBU element has a length field, skip it
+        while (i < length && (packet[i] & 0x80)) {
+            i++;
+        }
+        i++;
+    }
+    return i < length && ((packet[i] >> 3) & 0x0F) == OBU_SEQUENCE_HEADER;
+}
+
+} // namespace
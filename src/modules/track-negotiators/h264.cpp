@@ -110,4 +110,41 @@ rtc::Description::Media H264Negotiator::createMedia()
     return media;
 }
 
+bool H264Negotiator::isKeyframe(const uint8_t* packet, size_t length)
+{
+    // A keyframe starts with SPS or an IDR slice (RFC 6184).
+    const uint8_t NAL_IDR = 5;
+    const uint8_t NAL_SPS = 7;
+    const uint8_t NAL_STAP_A = 24;
+    const uint8_t NAL_FU_A = 28;
+
+    size_t offset = rtpPayloadOffset(packet, length);
+    if (offset == 0) {
+        return false;
+    }
+    uint8_t type = packet[offset] & 0x1F;
+    if (type == NAL_IDR || type == NAL_SPS) {
+        return true;
+    }
+    if (type == NAL_STAP_A) {
+        // Aggregated NAL units each prefixed with a 16 bit size
+        size_t i = offset + 1;
+        while (i + 2 < length) {
+            size_t size = (packet[i] << 8) | packet[i + 1];
+            uint8_t t = packet[i + 2] & 0x1F;
+            if (t == NAL_IDR || t == NAL_SPS) {
+                return true;
+            }
+            i += 2 + size;
+        }
+        return false;
+    }
+    if (type == NAL_FU_A && offset + 1 < length) {
+        // First fragment of an IDR slice
+        uint8_t fuHeader = packet[offset + 1];
+        return (fuHeader & 0x80) && (fuHeader & 0x1F) == NAL_IDR;
+    }
+    return false;
+}
+
 } // namespace
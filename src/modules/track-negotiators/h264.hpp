@@ -13,6 +13,7 @@ public:
     H264Negotiator() : TrackNegotiator(96, SEND_RECV) { }
     int match(MediaTrackPtr media);
     rtc::Description::Media createMedia();
+    bool isKeyframe(const uint8_t* packet, size_t length);
 };
 
 } // namespace
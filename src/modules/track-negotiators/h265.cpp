@@ -0,0 +1,132 @@
+
+#include "h265.hpp"
+
+namespace nabto {
+
+int H265Negotiator::match(MediaTrackPtr track)
+{
+    // We must go through all codecs in the Media Description and remove all codecs other than the one we support.
+    // We start by getting and parsing the SDP
+    auto sdp = track->getSdp();
+    NPLOGD << "    Got offer SDP: " << sdp;
+    rtc::Description::Media media(sdp);
+
+    rtc::Description::Media::RtpMap* rtp = NULL;
+    // Loop all payload types offered by the client
+    for (auto pt : media.payloadTypes()) {
+        rtc::Description::Media::RtpMap* r = NULL;
+        try {
+            // Get the RTP description for this payload type
+            r = media.rtpMap(pt);
+        } catch (std::exception& ex) {
+            // Since we are getting the description based on the list of payload types this should never fail, but just in case.
+            NPLOGE << "Bad rtpMap for pt: " << pt;
+            continue;
+        }
+        // If this payload type is H265/90000
+        if (r != NULL && (r->format == "H265" || r->format == "h265") && r->clockRate == 90000) {
+            // Browsers offer a payload type per profile. Any profile is
+            // accepted, but the Main profile (profile-id=1) is preferred.
+            bool isMain = fmtpParameter(r->fmtps, "profile-id") == "1";
+            bool currentIsMain = rtp != NULL && fmtpParameter(rtp->fmtps, "profile-id") == "1";
+            if (rtp != NULL && (currentIsMain || !isMain)) {
+                NPLOGD << "h265 pt: " << pt << " no match, removing";
+                media.removeRtpMap(pt);
+                continue;
+            }
+            if (rtp != NULL) {
+                NPLOGD << "Found better H265 codec match, pt: " << pt;
+                media.removeRtpMap(rtp->payloadType);
+            } else {
+                NPLOGD << "Found H265 codec match, pt: " << pt;
+            }
+            rtp = r;
+
+            // Our implementation does not support these feedback extensions, so we remove them (if they exist)
+            // Though the technically correct way to do it, trial and error has shown this has no practial effect.
+            rtp->removeFeedback("nack");
+            rtp->removeFeedback("goog-remb");
+            rtp->removeFeedback("transport-cc");
+            rtp->removeFeedback("ccm fir");
+        }
+        else {
+            // We remove any payload type not matching our codec
+            NPLOGD << "pt: " << pt << " no match, removing";
+            media.removeRtpMap(pt);
+        }
+    }
+    if (rtp == NULL) {
+        return 0;
+    }
+    // Add the ssrc to the track
+    auto trackId = track->getTrackId();
+    media.addSSRC(ssrc(), trackId);
+    // Generate the SDP string of the updated Media Description
+    auto newSdp = media.generateSdp();
+    NPLOGD << "    Setting new SDP: " << newSdp;
+    // and set the new SDP on the track
+    track->setSdp(newSdp);
+    return rtp->payloadType;
+}
+
+rtc::Description::Media H265Negotiator::createMedia()
+{
+    // Create a Video media description.
+    // We support both sending and receiving video
+    std::string mid = MidGenerator::generateMid();
+    rtc::Description::Video media(mid, rtc::Description::Direction::SendRecv);
+
+    // Since we are creating the media track, only the supported payload type exists, so we might as well reuse the same value for the RTP session in WebRTC as the one we use in the RTP source (eg. Gstreamer)
+    // Main profile, level 3.1, which is what browsers supporting H265 offer.
+    media.addVideoCodec(payloadType_, "H265", "profile-id=1;tier-flag=0;level-id=93;tx-mode=SRST");
+
+    // Again to be technically correct, we remove the unsupported feedback extensions
+    auto r = media.rtpMap(payloadType_);
+    r->removeFeedback("nack");
+    r->removeFeedback("goog-remb");
+    return media;
+}
+
+bool H265Negotiator::isKeyframe(const uint8_t* packet, size_t length)
+{
+    // A keyframe starts with a VPS, SPS or an IRAP picture (RFC 7798).
+    const uint8_t NAL_IRAP_FIRST = 16;
+    const uint8_t NAL_IRAP_LAST = 23;
+    const uint8_t NAL_VPS = 32;
+    const uint8_t NAL_SPS = 33;
+    const uint8_t NAL_AP = 48;
+    const uint8_t NAL_FU = 49;
+    auto isKeyType = [&](uint8_t t) {
+        return t == NAL_VPS || t == NAL_SPS || (t >= NAL_IRAP_FIRST && t <= NAL_IRAP_LAST);
+    };
+
+    size_t offset = rtpPayloadOffset(packet, length);
+    if (offset == 0 || offset + 2 > length) {
+        return false;
+    }
+    uint8_t type = (packet[offset] >> 1) & 0x3F;
+    if (isKeyType(type)) {
+        return true;
+    }
+    if (type == NAL_AP) {
+        // Aggregated NAL units each prefixed with a 16 bit size. DONL fields
+        // are not used as sprop-max-don-diff is not signalled.
+        size_t i = offset + 2;
+        while (i + 2 < length) {
+            size_t size = (packet[i] << 8) | packet[i + 1];
+            if (isKeyType((packet[i + 2] >> 1) & 0x3F)) {
+                return true;
+            }
+            i += 2 + size;
+        }
+        return false;
+    }
+    if (type == NAL_FU && offset + 2 < length) {
+        // First fragment of an IRAP picture
+        uint8_t fuHeader = packet[offset + 2];
+        return (fuHeader & 0x80) && isKeyType(fuHeader & 0x3F);
+    }
+    return false;
+}
+
+} // namespace
@@ -13,6 +13,7 @@ public:
     OpusNegotiator() : TrackNegotiator(111, SEND_RECV) {}
     int match(MediaTrackPtr media);
     rtc::Description::Media createMedia();
+    uint32_t clockRate() { return 48000; }
 };
 
 } // namespace
@@ -13,6 +13,7 @@ public:
     PcmuNegotiator() : TrackNegotiator(0, SEND_RECV) {}
     int match(MediaTrackPtr media);
     rtc::Description::Media createMedia();
+    uint32_t clockRate() { return 8000; }
 };
 
 
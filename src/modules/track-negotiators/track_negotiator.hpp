@@ -1,6 +1,7 @@
 #pragma once
 
 #include <media-streams/media_stream.hpp>
+#include <optional>
 #include <sstream>
 
 namespace nabto {
@@ -84,7 +85,79 @@ public:
      */
     virtual enum Direction direction() { return dire_; }
 
+    /**
+     * RTP timestamp clock rate of the media, used for the jitter in RTCP
+     * receiver reports. 90 kHz for video.
+     */
+    virtual uint32_t clockRate() { return 90000; }
+
+    /**
+     * Check if a decoder can start with this RTP packet from the source (eg.
+     * the first packet of a keyframe). Used to resume sending to a viewer
+     * after dropping packets. Codecs without keyframes return true for all
+     * packets.
+     *
+     * This is called on the ingest thread and must not change any state.
+     */
+    virtual bool isKeyframe(const uint8_t* packet, size_t length) { return true; }
+
 protected:
+    /**
+     * Offset of the payload in an RTP packet, skipping CSRCs and the header
+     * extension. Returns 0 if the packet is too short.
+     */
+    static size_t rtpPayloadOffset(const uint8_t* packet, size_t length)
+    {
+        if (length < 12) {
+            return 0;
+        }
+        size_t offset = 12 + 4 * (packet[0] & 0x0F);
+        if (packet[0] & 0x10) {
+            if (length < offset + 4) {
+                return 0;
+            }
+            size_t extWords = (packet[offset + 2] << 8) | packet[offset + 3];
+            offset += 4 + 4 * extWords;
+        }
+        if (offset >= length) {
+            return 0;
+        }
+        return offset;
+    }
+
+    /**
+     * Value of a parameter in the fmtp lines of an RTP map, eg. "1" for
+     * "profile-id" in "profile-id=1;level-id=93". Names are compared exactly,
+     * so "profile-id" does not match "profile-idc".
+     */
+    static std::optional<std::string> fmtpParameter(const std::vector<std::string>& fmtps, const std::string& name)
+    {
+        for (const auto& fmtp : fmtps) {
+            size_t start = 0;
+            while (start < fmtp.size()) {
+                size_t end = fmtp.find(';', start);
+                if (end == std::string::npos) {
+                    end = fmtp.size();
+                }
+                std::string param = fmtp.substr(start, end - start);
+                size_t first = param.find_first_not_of(" \t");
+                size_t eq = param.find('=');
+                if (first != std::string::npos && eq != std::string::npos && eq > first) {
+                    std::string key = param.substr(first, eq - first);
+                    key.erase(key.find_last_not_of(" \t") + 1);
+                    if (key == name) {
+                        std::string value = param.substr(eq + 1);
+                        value.erase(0, value.find_first_not_of(" \t"));
+                        value.erase(value.find_last_not_of(" \t") + 1);
+                        return value;
+                    }
+                }
+                start = end + 1;
+            }
+        }
+        return std::nullopt;
+    }
+
     int payloadType_;
     uint32_t ssrc_;
     enum Direction dire_;
@@ -68,5 +68,47 @@ rtc::Description::Media VP8Negotiator::createMedia()
     return media;
 }
 
+bool VP8Negotiator::isKeyframe(const uint8_t* packet, size_t length)
+{
+    // VP8 payload descriptor (RFC 7741 section 4.2)
+    size_t offset = rtpPayloadOffset(packet, length);
+    if (offset == 0) {
+        return false;
+    }
+    size_t i = offset;
+    uint8_t desc = packet[i++];
+    bool start = desc & 0x10;
+    uint8_t partitionId = desc & 0x0F;
+    if (!start || partitionId != 0) {
+        return false;
+    }
+    if (desc & 0x80) {
+        // Extended control bits
+        if (i >= length) {
+            return false;
+        }
+        uint8_t ext = packet[i++];
+        if (ext & 0x80) {
+            // PictureID, 15 bits if M is set
+            if (i >= length) {
+                return false;
+            }
+            i += (packet[i] & 0x80) ? 2 : 1;
+        }
+        if (ext & 0x40) {
+            // TL0PICIDX
+            i++;
+        }
+        if (ext & 0x30) {
+            // TID/Y/KEYIDX
+            i++;
+        }
+    }
+    if (i >= length) {
+        return false;
+    }
+    // P bit of the VP8 payload header is 0 for keyframes (RFC 6386 section 9.1)
+    return (packet[i] & 0x01) == 0;
+}
 
 } // namespace
@@ -13,6 +13,7 @@ public:
     VP8Negotiator() : TrackNegotiator(127, SEND_RECV) {}
     int match(MediaTrackPtr media);
     rtc::Description::Media createMedia();
+    bool isKeyframe(const uint8_t* packet, size_t length);
 };
 
 } // namespace
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Minimal benchmark harness for the webrtc_benchmark executable.
+ *
+ * Benchmarks are registered with NABTO_BENCHMARK(name) and print their own
+ * results. measure() reports heap allocations and thread CPU time per
+ * iteration of the measured function. Allocations are counted by replacing
+ * the global operator new in benchmark_main.cpp.
+ */
+
+namespace nabto {
+namespace benchmark {
+
+struct Measurement {
+    double allocationsPerIteration = 0;
+    double cpuNsPerIteration = 0;
+};
+
+// Number of calls to the global operator new since the program started.
+uint64_t allocationCount();
+
+// CPU time consumed by the calling thread in nanoseconds.
+uint64_t threadCpuNs();
+
+// Monotonic wall clock time in nanoseconds.
+uint64_t wallClockNs();
+
+Measurement measure(size_t iterations, const std::function<void()>& f);
+
+typedef std::function<void()> BenchmarkFunction;
+
+class Registrar {
+public:
+    Registrar(const std::string& name, BenchmarkFunction f);
+};
+
+} } // namespace
+
+#define NABTO_BENCHMARK(name) \
+    static void name(); \
+    static nabto::benchmark::Registrar name##_registrar(#name, name); \
+    static void name()
@@ -0,0 +1,118 @@
+#include "benchmark.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <time.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+std::vector<std::pair<std::string, nabto::benchmark::BenchmarkFunction> >& registry()
+{
+    static std::vector<std::pair<std::string, nabto::benchmark::BenchmarkFunction> > r;
+    return r;
+}
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace nabto {
+namespace benchmark {
+
+uint64_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t threadCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t wallClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Measurement measure(size_t iterations, const std::function<void()>& f)
+{
+    // Warm up pools and caches before measuring
+    for (size_t i = 0; i < iterations / 10 + 1; i++) {
+        f();
+    }
+    uint64_t allocs = allocationCount();
+    uint64_t cpu = threadCpuNs();
+    for (size_t i = 0; i < iterations; i++) {
+        f();
+    }
+    Measurement m;
+    m.cpuNsPerIteration = (double)(threadCpuNs() - cpu) / iterations;
+    m.allocationsPerIteration = (double)(allocationCount() - allocs) / iterations;
+    return m;
+}
+
+Registrar::Registrar(const std::string& name, BenchmarkFunction f)
+{
+    registry().push_back(std::make_pair(name, f));
+}
+
+} } // namespace
+
+int main(int argc, char** argv)
+{
+    // Usage: webrtc_benchmark [name-filter]
+    std::string filter = argc > 1 ? argv[1] : "";
+    for (const auto& [name, f] : registry()) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::cout << "=== " << name << std::endl;
+        f();
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "benchmark.hpp"
+
+#include <rtp-packetizer/h264_packetizer.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+/**
+ * Cost of packetizing a 200 KB IDR frame read from a FIFO in 4 KB chunks.
+ *
+ * vector:   incoming() returning a vector of packet vectors.
+ * callback: incoming() writing each packet into the packetizer's slot and
+ *           passing it to a callback.
+ */
+
+namespace {
+
+const size_t IDR_SIZE = 200 * 1024;
+const size_t CHUNK_SIZE = 4096;
+const size_t ITERATIONS = 200;
+
+std::vector<std::vector<uint8_t> > makeChunks()
+{
+    std::mt19937 rng(42);
+    std::vector<uint8_t> frame = { 0x00, 0x00, 0x00, 0x01, 0x65 };
+    while (frame.size() < IDR_SIZE) {
+        // Never 0x00, so the payload cannot contain a start code
+        frame.push_back(1 + rng() % 255);
+    }
+    std::vector<std::vector<uint8_t> > chunks;
+    for (size_t pos = 0; pos < frame.size(); pos += CHUNK_SIZE) {
+        size_t len = std::min(CHUNK_SIZE, frame.size() - pos);
+        chunks.push_back(std::vector<uint8_t>(frame.begin() + pos, frame.begin() + pos + len));
+    }
+    return chunks;
+}
+
+void printResult(const char* mode, size_t packets, const nabto::benchmark::Measurement& m)
+{
+    std::cout << std::setw(10) << mode
+              << std::setw(14) << packets
+              << std::setw(16) << std::fixed << std::setprecision(1) << m.allocationsPerIteration
+              << std::setw(16) << std::setprecision(0) << m.cpuNsPerIteration
+              << std::endl;
+}
+
+} // namespace
+
+NABTO_BENCHMARK(h264_packetizer)
+{
+    auto chunks = makeChunks();
+    std::string trackId = "bench";
+
+    std::cout << std::setw(10) << "mode" << std::setw(14) << "packets/IDR" << std::setw(16) << "allocs/IDR"
+              << std::setw(16) << "cpu ns/IDR" << std::endl;
+
+    // Each frame is packetized when the start code of the next one is seen,
+    // so every iteration packetizes the frame of the previous iteration.
+    auto vectorPacketizer = nabto::H264Packetizer::create(1, trackId, 96);
+    size_t packets = 0;
+    auto vectorResult = nabto::benchmark::measure(ITERATIONS, [&]() {
+        packets = 0;
+        for (const auto& c : chunks) {
+            packets += vectorPacketizer->incoming(c).size();
+        }
+    });
+    printResult("vector", packets, vectorResult);
+
+    auto callbackPacketizer = nabto::H264Packetizer::create(1, trackId, 96);
+    size_t bytes = 0;
+    nabto::RtpPacketCallback cb = [&](const uint8_t* packet, size_t length) {
+        packets++;
+        bytes += length;
+    };
+    auto callbackResult = nabto::benchmark::measure(ITERATIONS, [&]() {
+        packets = 0;
+        for (const auto& c : chunks) {
+            callbackPacketizer->incoming(c.data(), c.size(), cb);
+        }
+    });
+    printResult("callback", packets, callbackResult);
+}
@@ -0,0 +1,97 @@
+#include "benchmark.hpp"
+
+#include <rtp-client/rtp_track.hpp>
+#include <rtp-repacketizer/rtp_repacketizer.hpp>
+#include <media-streams/rtp_buffer_pool.hpp>
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+/**
+ * Compares the per packet cost of fanning an RTP packet out to a number of
+ * viewers in RtpClient.
+ *
+ * legacy: the packet is copied into a vector per viewer and the repacketizer
+ *         returns a vector of vectors (the fan-out used before pooled buffers).
+ * shared: the packet is received once into a pooled buffer and each viewer
+ *         only rewrites the RTP header.
+ *
+ * The tracks are not connected, so the time spent by libdatachannel on SRTP is
+ * not included.
+ */
+
+namespace {
+
+const size_t PACKET_SIZE = 1200;
+const size_t ITERATIONS = 200000;
+
+std::vector<uint8_t> makePacket()
+{
+    std::vector<uint8_t> packet(PACKET_SIZE, 0xAB);
+    packet[0] = 0x80;
+    packet[1] = 96;
+    return packet;
+}
+
+std::vector<nabto::RtpTrack> makeTracks(size_t viewers)
+{
+    std::vector<nabto::RtpTrack> tracks;
+    for (size_t i = 0; i < viewers; i++) {
+        nabto::RtpTrack track;
+        track.track = nabto::MediaTrack::create("bench-" + std::to_string(i), "");
+        track.ssrc = 1000 + i;
+        track.srcPayloadType = 96;
+        track.dstPayloadType = 102;
+        track.repacketizer = std::make_shared<nabto::RtpRepacketizer>(track.ssrc, track.dstPayloadType);
+        tracks.push_back(track);
+    }
+    return tracks;
+}
+
+void printResult(const char* mode, size_t viewers, const nabto::benchmark::Measurement& m)
+{
+    std::cout << std::setw(8) << mode
+              << std::setw(9) << viewers
+              << std::setw(16) << std::fixed << std::setprecision(2) << m.allocationsPerIteration
+              << std::setw(16) << std::setprecision(1) << m.cpuNsPerIteration
+              << std::setw(18) << std::setprecision(1) << m.cpuNsPerIteration / viewers
+              << std::endl;
+}
+
+} // namespace
+
+NABTO_BENCHMARK(rtp_fanout)
+{
+    auto packet = makePacket();
+    auto pool = nabto::RtpBufferPool::create(2048);
+
+    std::cout << std::setw(8) << "mode" << std::setw(9) << "viewers" << std::setw(16) << "allocs/packet"
+              << std::setw(16) << "cpu ns/packet" << std::setw(18) << "cpu ns/viewer" << std::endl;
+
+    for (size_t viewers : { 1, 2, 4, 8 }) {
+        auto tracks = makeTracks(viewers);
+
+        auto legacy = nabto::benchmark::measure(ITERATIONS, [&]() {
+            uint8_t buffer[2048];
+            memcpy(buffer, packet.data(), packet.size());
+            for (const auto& t : tracks) {
+                auto packets = t.repacketizer->handlePacket(std::vector<uint8_t>(buffer, buffer + packet.size()));
+                for (auto p : packets) {
+                    t.track->send(p.data(), p.size());
+                }
+            }
+        });
+        printResult("legacy", viewers, legacy);
+
+        auto shared = nabto::benchmark::measure(ITERATIONS, [&]() {
+            nabto::RtpBufferRef buffer = pool->acquire();
+            memcpy(buffer->data(), packet.data(), packet.size());
+            buffer->setSize(packet.size());
+            for (const auto& t : tracks) {
+                t.send(buffer->data(), buffer->size());
+            }
+        });
+        printResult("shared", viewers, shared);
+    }
+}
@@ -0,0 +1,120 @@
+#include "benchmark.hpp"
+
+#include <media-streams/media_send_worker.hpp>
+#include <media-streams/viewer_queue.hpp>
+#include <media-streams/rtp_buffer_pool.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Measures how the send side scales with the number of MediaSendWorker
+ * threads, reported as the number of 1080p viewers one core can serve.
+ *
+ * Unconnected tracks do not run SRTP, so each viewer's sink instead runs a
+ * synthetic per byte keystream over its own copy of the packet, which
+ * stands in for the encryption and authentication libdatachannel does per
+ * viewer.
+ */
+
+namespace {
+
+const size_t PACKET_SIZE = 1200;
+const size_t VIEWERS = 64;
+const size_t PACKETS_PER_VIEWER = 2000;
+// Roughly a 4 Mbit/s 1080p stream in 1200 byte packets.
+const double PACKETS_PER_SECOND_1080P = 420;
+
+class CipherSink {
+public:
+    CipherSink(uint64_t key) : state_(key) {}
+
+    void operator()(const nabto::RtpBufferRef& buffer)
+    {
+        const uint8_t* in = buffer->data();
+        size_t len = buffer->size();
+        uint64_t acc = 0;
+        for (size_t i = 0; i < len; i++) {
+            state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+            out_[i] = in[i] ^ (uint8_t)(state_ >> 56);
+            acc += out_[i];
+        }
+        checksum_.fetch_add(acc, std::memory_order_relaxed);
+    }
+
+    static std::atomic<uint64_t> checksum_;
+
+private:
+    uint64_t state_;
+    uint8_t out_[2048];
+};
+
+std::atomic<uint64_t> CipherSink::checksum_(0);
+
+double run(size_t threads, uint64_t& steals)
+{
+    auto pool = nabto::RtpBufferPool::create(2048, 256);
+    auto worker = nabto::MediaSendWorker::create(threads);
+    nabto::ViewerQueueConf conf;
+    conf.capacity = PACKETS_PER_VIEWER;
+
+    std::vector<nabto::ViewerQueuePtr> queues;
+    for (size_t i = 0; i < VIEWERS; i++) {
+        auto sink = std::make_shared<CipherSink>(i + 1);
+        queues.push_back(nabto::ViewerQueue::create(conf, worker,
+            [sink](const nabto::RtpBufferRef& buffer) { (*sink)(buffer); },
+            nullptr, i + 1));
+    }
+
+    uint64_t start = nabto::benchmark::wallClockNs();
+    for (size_t p = 0; p < PACKETS_PER_VIEWER; p++) {
+        nabto::RtpBufferRef buffer = pool->acquire();
+        memset(buffer->data(), (int)p, PACKET_SIZE);
+        buffer->setSize(PACKET_SIZE);
+        for (auto q : queues) {
+            q->push(buffer);
+        }
+    }
+    for (auto q : queues) {
+        while (q->stats().sent + q->stats().dropped < PACKETS_PER_VIEWER) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    uint64_t elapsed = nabto::benchmark::wallClockNs() - start;
+    steals = worker->steals();
+    worker->stop();
+    return (double)(VIEWERS * PACKETS_PER_VIEWER) * 1e9 / elapsed;
+}
+
+} // namespace
+
+NABTO_BENCHMARK(send_worker_scaling)
+{
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores == 0) {
+        cores = 1;
+    }
+
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "packets/s" << std::setw(10) << "speedup"
+              << std::setw(18) << "viewers/core" << std::setw(10) << "steals" << std::endl;
+
+    double baseline = 0;
+    for (size_t threads = 1; threads <= cores; threads *= 2) {
+        uint64_t steals = 0;
+        double rate = run(threads, steals);
+        if (baseline == 0) {
+            baseline = rate;
+        }
+        std::cout << std::setw(8) << threads
+                  << std::setw(14) << std::fixed << std::setprecision(0) << rate
+                  << std::setw(10) << std::setprecision(2) << rate / baseline
+                  << std::setw(18) << std::setprecision(1) << rate / threads / PACKETS_PER_SECOND_1080P
+                  << std::setw(10) << steals
+                  << std::endl;
+    }
+}
@@ -0,0 +1,156 @@
+#include <boost/test/unit_test.hpp>
+
+#include <fifo-file-client/fifo_file_client.hpp>
+#include <track-negotiators/h264.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string fifoPath()
+{
+    return "/tmp/nabto_fifo_client_test_" + std::to_string(getpid()) + ".fifo";
+}
+
+// Sends only, so the client does not open a FIFO for received data.
+class SendOnlyNegotiator : public nabto::H264Negotiator
+{
+public:
+    enum Direction direction() override { return SEND_ONLY; }
+};
+
+// The data read from the FIFO, as passed to the source packetizer.
+class FifoData
+{
+public:
+    void append(const uint8_t* data, size_t length)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        data_.insert(data_.end(), data, data + length);
+        cond_.notify_all();
+    }
+
+    // Wait until at least length bytes have been read.
+    std::vector<uint8_t> waitFor(size_t length)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock, std::chrono::seconds(10), [this, length]() { return data_.size() >= length; });
+        return data_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<uint8_t> data_;
+};
+
+class RecordingPacketizer : public nabto::RtpPacketizer
+{
+public:
+    RecordingPacketizer(std::shared_ptr<FifoData> data) : data_(data) {}
+
+    std::vector<std::vector<uint8_t> > incoming(const std::vector<uint8_t>& data) override
+    {
+        data_->append(data.data(), data.size());
+        return {};
+    }
+
+private:
+    std::shared_ptr<FifoData> data_;
+};
+
+class RecordingPacketizerFactory : public nabto::RtpPacketizerFactory
+{
+public:
+    RecordingPacketizerFactory(std::shared_ptr<FifoData> data) : nabto::RtpPacketizerFactory("video"), data_(data) {}
+
+    nabto::RtpPacketizerPtr createPacketizer(uint32_t ssrc, int pt) override
+    {
+        return std::make_shared<RecordingPacketizer>(data_);
+    }
+
+private:
+    std::shared_ptr<FifoData> data_;
+};
+
+class FifoFixture
+{
+public:
+    FifoFixture()
+    {
+        unlink(path.c_str());
+        BOOST_REQUIRE(mkfifo(path.c_str(), 0600) == 0);
+        nabto::FifoFileClientConf conf;
+        conf.trackId = "video";
+        conf.filePath = path;
+        conf.negotiator = std::make_shared<SendOnlyNegotiator>();
+        conf.packetizer = std::make_shared<RecordingPacketizerFactory>(data);
+        client = nabto::FifoFileClient::create(conf);
+    }
+
+    ~FifoFixture()
+    {
+        client = nullptr;
+        unlink(path.c_str());
+    }
+
+    // Open the FIFO for writing, waiting for the client to open it for reading.
+    void write(const std::string& payload)
+    {
+        int fd = open(path.c_str(), O_WRONLY);
+        BOOST_REQUIRE(fd >= 0);
+        BOOST_TEST(::write(fd, payload.data(), payload.size()) == (ssize_t)payload.size());
+        close(fd);
+    }
+
+    std::string path = fifoPath();
+    std::shared_ptr<FifoData> data = std::make_shared<FifoData>();
+    nabto::FifoFileClientPtr client;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(fifo_file_client)
+
+BOOST_AUTO_TEST_CASE(reads_from_next_writer, *boost::unit_test::timeout(180))
+{
+    FifoFixture fifo;
+    NabtoDeviceConnectionRef ref = 1;
+    fifo.client->addConnection(ref, fifo.client->createMedia("video"));
+
+    std::string first = "first writer";
+    fifo.write(first);
+    auto data = fifo.data->waitFor(first.size());
+    BOOST_TEST(std::string(data.begin(), data.end()) == first);
+
+    std::string second = "second writer";
+    fifo.write(second);
+    data = fifo.data->waitFor(first.size() + second.size());
+    BOOST_TEST(std::string(data.begin(), data.end()) == first + second);
+
+    fifo.client->removeConnection(ref);
+}
+
+BOOST_AUTO_TEST_CASE(stop_without_writer, *boost::unit_test::timeout(180))
+{
+    FifoFixture fifo;
+    NabtoDeviceConnectionRef ref = 1;
+    fifo.client->addConnection(ref, fifo.client->createMedia("video"));
+    // Let the reader thread open the FIFO and wait for a writer.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto begin = std::chrono::steady_clock::now();
+    // Removing the last viewer stops the client.
+    fifo.client->removeConnection(ref);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    BOOST_TEST(elapsed.count() < 1000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,159 @@
+#include <boost/test/unit_test.hpp>
+
+#include <io-reactor/io_reactor.hpp>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <future>
+
+namespace {
+
+int bindLoopback(struct sockaddr_in& addr)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    socklen_t addrLen = sizeof(addr);
+    getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &addrLen);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    return sock;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(io_reactor)
+
+BOOST_AUTO_TEST_CASE(dispatch_readable, *boost::unit_test::timeout(180))
+{
+    auto reactor = nabto::IoReactor::create(2);
+    struct sockaddr_in addr;
+    int sock = bindLoopback(addr);
+
+    std::promise<size_t> promise;
+    auto future = promise.get_future();
+    size_t received = 0;
+    nabto::IoReactor::Registration reg = 0;
+    reg = reactor->addReader(sock, [&]() {
+        uint8_t buffer[64];
+        while (recv(sock, buffer, sizeof(buffer), 0) > 0) {
+            received++;
+        }
+        if (received == 3) {
+            // Removing from within the callback must not block
+            reactor->removeReader(reg);
+            promise.set_value(received);
+        }
+    });
+
+    int sendSock = socket(AF_INET, SOCK_DGRAM, 0);
+    uint8_t data[16] = {};
+    for (int i = 0; i < 3; i++) {
+        sendto(sendSock, data, sizeof(data), 0, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    }
+
+    BOOST_REQUIRE(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    BOOST_TEST(future.get() == (size_t)3);
+
+    reactor->stop();
+    close(sendSock);
+    close(sock);
+}
+
+BOOST_AUTO_TEST_CASE(remove_waits_for_callback, *boost::unit_test::timeout(180))
+{
+    auto reactor = nabto::IoReactor::create(1);
+    struct sockaddr_in addr;
+    int sock = bindLoopback(addr);
+
+    std::promise<void> entered;
+    std::atomic<bool> done(false);
+    auto reg = reactor->addReader(sock, [&]() {
+        uint8_t buffer[64];
+        while (recv(sock, buffer, sizeof(buffer), 0) > 0) {}
+        if (!done) {
+            entered.set_value();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            done = true;
+        }
+    });
+
+    int sendSock = socket(AF_INET, SOCK_DGRAM, 0);
+    uint8_t data[16] = {};
+    sendto(sendSock, data, sizeof(data), 0, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+
+    entered.get_future().wait();
+    reactor->removeReader(reg);
+    BOOST_TEST(done == true);
+
+    close(sendSock);
+    close(sock);
+}
+
+BOOST_AUTO_TEST_CASE(dispatch_writable_on_connect, *boost::unit_test::timeout(180))
+{
+    auto reactor = nabto::IoReactor::create(1);
+    int listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    bind(listenSock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    socklen_t addrLen = sizeof(addr);
+    getsockname(listenSock, reinterpret_cast<sockaddr*>(&addr), &addrLen);
+    listen(listenSock, 1);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+
+    std::promise<int> promise;
+    nabto::IoReactor::Registration reg = 0;
+    reg = reactor->addWriter(sock, [&]() {
+        reactor->removeReader(reg);
+        int err = -1;
+        socklen_t len = sizeof(err);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        promise.set_value(err);
+    });
+    auto future = promise.get_future();
+    BOOST_REQUIRE(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    BOOST_TEST(future.get() == 0);
+
+    reactor->stop();
+    close(sock);
+    close(listenSock);
+}
+
+BOOST_AUTO_TEST_CASE(reader_waits_for_writable, *boost::unit_test::timeout(180))
+{
+    auto reactor = nabto::IoReactor::create(1);
+    struct sockaddr_in addr;
+    int sock = bindLoopback(addr);
+
+    // Without data to read, the callback only runs while writability is wanted.
+    std::atomic<int> calls(0);
+    std::promise<void> called;
+    nabto::IoReactor::Registration reg = 0;
+    reg = reactor->addReader(sock, [&]() {
+        if (calls++ == 0) {
+            reactor->setWritable(reg, false);
+            called.set_value();
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_TEST(calls == 0);
+
+    reactor->setWritable(reg, true);
+    BOOST_REQUIRE(called.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_TEST(calls == 1);
+
+    reactor->removeReader(reg);
+    reactor->stop();
+    close(sock);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,175 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/gop_cache.hpp>
+#include <media-streams/media_send_worker.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include <cstring>
+
+namespace {
+
+const uint8_t KEYFRAME = 1;
+const uint8_t DELTA = 0;
+
+nabto::RtpBufferRef makeRtp(nabto::RtpBufferPoolPtr pool, uint16_t seq, uint32_t timestamp, uint8_t type)
+{
+    auto buffer = pool->acquire();
+    uint8_t* d = buffer->data();
+    memset(d, 0, 13);
+    d[0] = 0x80;
+    d[1] = 96;
+    d[2] = seq >> 8;
+    d[3] = seq & 0xff;
+    d[4] = timestamp >> 24;
+    d[5] = timestamp >> 16;
+    d[6] = timestamp >> 8;
+    d[7] = timestamp;
+    d[12] = type;
+    buffer->setSize(13);
+    return buffer;
+}
+
+uint16_t seqOf(const std::vector<uint8_t>& p) { return (p[2] << 8) | p[3]; }
+uint32_t timestampOf(const std::vector<uint8_t>& p) { return ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7]; }
+
+class RecordingSink {
+public:
+    void operator()(const nabto::RtpBufferRef& buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sent_.push_back(std::vector<uint8_t>(buffer->data(), buffer->data() + buffer->size()));
+    }
+
+    std::vector<std::vector<uint8_t> > sent()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sent_;
+    }
+
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t> > sent_;
+};
+
+nabto::ViewerQueuePtr createQueue(nabto::MediaSendWorkerPtr worker, std::shared_ptr<RecordingSink> sink)
+{
+    return nabto::ViewerQueue::create(nabto::ViewerQueueConf(), worker,
+        [sink](const nabto::RtpBufferRef& buffer) { (*sink)(buffer); });
+}
+
+void waitForSent(nabto::ViewerQueuePtr queue, uint64_t count)
+{
+    for (int i = 0; i < 500 && queue->stats().sent < count; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+nabto::KeyframePredicate keyframePredicate(size_t offset)
+{
+    return [offset](const uint8_t* data, size_t length) { return length > offset && data[offset] == KEYFRAME; };
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(gop_cache)
+
+BOOST_AUTO_TEST_CASE(rtp_replay_from_last_keyframe, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    nabto::GopCacheConf conf;
+    conf.enabled = true;
+    auto cache = nabto::GopCache::create(conf, keyframePredicate(12), pool);
+
+    cache->add(makeRtp(pool, 1, 90000, DELTA));
+    cache->add(makeRtp(pool, 2, 93000, KEYFRAME));
+    cache->add(makeRtp(pool, 3, 96000, DELTA));
+    // Keyframe starting a new GOP, split over two packets (eg. SPS and IDR)
+    cache->add(makeRtp(pool, 4, 99000, KEYFRAME));
+    cache->add(makeRtp(pool, 5, 99000, KEYFRAME));
+    cache->add(makeRtp(pool, 6, 99000, DELTA));
+    cache->add(makeRtp(pool, 7, 102000, DELTA));
+    cache->add(makeRtp(pool, 8, 105000, DELTA));
+    BOOST_TEST(cache->size() == (size_t)5);
+
+    auto sink = std::make_shared<RecordingSink>();
+    auto queue = createQueue(worker, sink);
+    BOOST_TEST(!queue->started());
+    BOOST_TEST(cache->replay(*queue));
+    BOOST_TEST(queue->started());
+    waitForSent(queue, 5);
+    worker->stop();
+
+    auto sent = sink->sent();
+    BOOST_REQUIRE(sent.size() == (size_t)5);
+    std::vector<uint16_t> seqs;
+    std::vector<uint32_t> timestamps;
+    for (const auto& p : sent) {
+        seqs.push_back(seqOf(p));
+        timestamps.push_back(timestampOf(p));
+    }
+    // Sequence numbers are untouched, frames are compressed up to the newest.
+    std::vector<uint16_t> expectedSeqs = { 4, 5, 6, 7, 8 };
+    std::vector<uint32_t> expectedTimestamps = { 105000 - 180, 105000 - 180, 105000 - 180, 105000 - 90, 105000 };
+    BOOST_TEST(seqs == expectedSeqs, boost::test_tools::per_element());
+    BOOST_TEST(timestamps == expectedTimestamps, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(rtp_overflow_waits_for_keyframe, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    nabto::GopCacheConf conf;
+    conf.enabled = true;
+    conf.maxPackets = 3;
+    auto cache = nabto::GopCache::create(conf, keyframePredicate(12), pool);
+
+    cache->add(makeRtp(pool, 1, 1000, KEYFRAME));
+    cache->add(makeRtp(pool, 2, 2000, DELTA));
+    cache->add(makeRtp(pool, 3, 3000, DELTA));
+    cache->add(makeRtp(pool, 4, 4000, DELTA));
+    BOOST_TEST(cache->size() == (size_t)0);
+    cache->add(makeRtp(pool, 5, 5000, DELTA));
+    BOOST_TEST(cache->size() == (size_t)0);
+    cache->add(makeRtp(pool, 6, 6000, KEYFRAME));
+    BOOST_TEST(cache->size() == (size_t)1);
+
+    // A GOP larger than the viewer queue is not replayed
+    auto worker = nabto::MediaSendWorker::create(1);
+    nabto::ViewerQueueConf queueConf;
+    queueConf.capacity = 1;
+    auto queue = nabto::ViewerQueue::create(queueConf, worker, [](const nabto::RtpBufferRef& buffer) {});
+    cache->add(makeRtp(pool, 7, 7000, DELTA));
+    BOOST_TEST(!cache->replay(*queue));
+    worker->stop();
+}
+
+BOOST_AUTO_TEST_CASE(rtp_replay_large_packet, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto largePool = nabto::RtpBufferPool::create(1024, 0);
+    auto worker = nabto::MediaSendWorker::create(1);
+    nabto::GopCacheConf conf;
+    conf.enabled = true;
+    auto cache = nabto::GopCache::create(conf, keyframePredicate(12), pool);
+
+    // A packet larger than the buffers of the cache pool, eg. a large interleaved packet
+    auto large = makeRtp(largePool, 1, 1000, KEYFRAME);
+    large->setSize(500);
+    cache->add(large);
+    cache->add(makeRtp(pool, 2, 4000, DELTA));
+
+    auto sink = std::make_shared<RecordingSink>();
+    auto queue = createQueue(worker, sink);
+    BOOST_TEST(cache->replay(*queue));
+    waitForSent(queue, 2);
+    worker->stop();
+
+    auto sent = sink->sent();
+    BOOST_REQUIRE(sent.size() == (size_t)2);
+    BOOST_TEST(sent[0].size() == (size_t)500);
+    BOOST_TEST(timestampOf(sent[0]) == (uint32_t)(4000 - 90));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
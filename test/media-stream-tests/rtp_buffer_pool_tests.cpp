@@ -0,0 +1,48 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/rtp_buffer_pool.hpp>
+
+BOOST_AUTO_TEST_SUITE(rtp_buffer_pool)
+
+BOOST_AUTO_TEST_CASE(reuse_released_buffers, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(2048, 2);
+    nabto::RtpBuffer* first = nullptr;
+    {
+        auto buffer = pool->acquire();
+        BOOST_TEST(buffer->capacity() == (size_t)2048);
+        BOOST_TEST(buffer->size() == (size_t)0);
+        buffer->setSize(100);
+        first = buffer.get();
+    }
+    auto buffer = pool->acquire();
+    BOOST_TEST(buffer.get() == first);
+    BOOST_TEST(buffer->size() == (size_t)0);
+    BOOST_TEST(pool->bufferCount() == (size_t)2);
+}
+
+BOOST_AUTO_TEST_CASE(shared_references, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(2048, 1);
+    auto a = pool->acquire();
+    nabto::RtpBufferRef b = a;
+    a.reset();
+    // b still holds the only buffer, so the pool must grow
+    auto c = pool->acquire();
+    BOOST_TEST(c.get() != b.get());
+    BOOST_TEST(pool->bufferCount() == (size_t)2);
+}
+
+BOOST_AUTO_TEST_CASE(buffer_outlives_pool, *boost::unit_test::timeout(180))
+{
+    nabto::RtpBufferRef buffer;
+    {
+        auto pool = nabto::RtpBufferPool::create(2048, 1);
+        buffer = pool->acquire();
+    }
+    buffer->setSize(10);
+    BOOST_TEST(buffer->size() == (size_t)10);
+    buffer.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/rtp_reception_stats.hpp>
+
+#include <vector>
+
+namespace {
+
+const uint32_t SSRC = 0x11223344;
+
+std::vector<uint8_t> makeRtp(uint16_t seq, uint32_t timestamp, uint32_t ssrc = SSRC)
+{
+    std::vector<uint8_t> p(12);
+    p[0] = 0x80;
+    p[1] = 96;
+    p[2] = seq >> 8;
+    p[3] = seq & 0xff;
+    p[4] = timestamp >> 24;
+    p[5] = timestamp >> 16;
+    p[6] = timestamp >> 8;
+    p[7] = timestamp;
+    p[8] = ssrc >> 24;
+    p[9] = ssrc >> 16;
+    p[10] = ssrc >> 8;
+    p[11] = ssrc;
+    return p;
+}
+
+std::vector<uint8_t> makeSr(uint32_t ssrc, uint64_t ntp)
+{
+    std::vector<uint8_t> p(28);
+    p[0] = 0x80;
+    p[1] = 200;
+    p[3] = 6;
+    for (int i = 0; i < 4; i++) {
+        p[4 + i] = (uint8_t)(ssrc >> (24 - 8 * i));
+    }
+    for (int i = 0; i < 8; i++) {
+        p[8 + i] = (uint8_t)(ntp >> (56 - 8 * i));
+    }
+    return p;
+}
+
+uint32_t readU32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(rtp_reception_stats)
+
+BOOST_AUTO_TEST_CASE(counts_loss_and_wraparound, *boost::unit_test::timeout(180))
+{
+    auto stats = nabto::RtpReceptionStats::create(90000);
+    auto now = std::chrono::steady_clock::now();
+
+    // 100 packets across the sequence number wraparound with 10 missing
+    uint16_t seq = 65500;
+    for (int i = 0; i < 100; i++, seq++) {
+        if (i >= 50 && i < 60) {
+            continue;
+        }
+        auto p = makeRtp(seq, 3000 * i);
+        stats->rtpReceived(p.data(), p.size(), now + std::chrono::microseconds(33333 * i));
+    }
+    auto reports = stats->reports();
+    BOOST_REQUIRE(reports.size() == (size_t)1);
+    BOOST_TEST(reports[0].ssrc == SSRC);
+    // The first packet is the probation packet of the new source
+    BOOST_TEST(reports[0].packetsReceived == (uint64_t)89);
+    BOOST_TEST(reports[0].cumulativeLost == 10);
+    BOOST_TEST(reports[0].extendedHighestSeq == (uint32_t)(65536 + (uint16_t)(65500 + 99)));
+    // Packets arrive exactly on their timestamps
+    BOOST_TEST(reports[0].jitter <= (uint32_t)1);
+
+    uint8_t rr[64];
+    size_t length = stats->buildReceiverReport(rr, sizeof(rr), now);
+    BOOST_REQUIRE(length == (size_t)32);
+    BOOST_TEST(rr[0] == 0x81);
+    BOOST_TEST(rr[1] == 201);
+    BOOST_TEST(rr[3] == 7);
+    BOOST_TEST(readU32(rr + 4) == stats->ssrc());
+    BOOST_TEST(readU32(rr + 8) == SSRC);
+    // 10 of 99 expected packets lost, in 1/256
+    BOOST_TEST(rr[12] == (10 * 256) / 99);
+    BOOST_TEST((readU32(rr + 12) & 0xffffff) == (uint32_t)10);
+    BOOST_TEST(readU32(rr + 16) == reports[0].extendedHighestSeq);
+
+    // Nothing lost since the last report
+    auto p = makeRtp(seq, 3000 * 100);
+    stats->rtpReceived(p.data(), p.size(), now + std::chrono::milliseconds(3300));
+    stats->buildReceiverReport(rr, sizeof(rr), now);
+    BOOST_TEST(rr[12] == 0);
+    BOOST_TEST(stats->reports()[0].cumulativeLost == 10);
+
+    BOOST_TEST(stats->buildReceiverReport(rr, 16, now) == (size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(measures_jitter, *boost::unit_test::timeout(180))
+{
+    auto stats = nabto::RtpReceptionStats::create(90000);
+    auto now = std::chrono::steady_clock::now();
+    // Every other packet arrives 10 ms late
+    for (int i = 0; i < 500; i++) {
+        auto p = makeRtp(i, 3000 * i);
+        auto arrival = now + std::chrono::milliseconds(33 * i + (i % 2 == 0 ? 0 : 10));
+        stats->rtpReceived(p.data(), p.size(), arrival + std::chrono::microseconds(333 * i));
+    }
+    auto reports = stats->reports();
+    BOOST_REQUIRE(reports.size() == (size_t)1);
+    // The transit time changes by 10 ms on every packet
+    BOOST_TEST(reports[0].jitterMs > 9.0);
+    BOOST_TEST(reports[0].jitterMs < 11.0);
+}
+
+BOOST_AUTO_TEST_CASE(reports_last_sender_report, *boost::unit_test::timeout(180))
+{
+    auto stats = nabto::RtpReceptionStats::create(90000);
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> compound = makeSr(SSRC, 0x0102030405060708ull);
+    // An SDES packet after the sender report
+    std::vector<uint8_t> sdes = { 0x81, 202, 0, 1, 0, 0, 0, 0 };
+    compound.insert(compound.end(), sdes.begin(), sdes.end());
+    BOOST_TEST(stats->senderReportReceived(compound.data(), compound.size(), now));
+    BOOST_TEST(!stats->senderReportReceived(sdes.data(), sdes.size(), now));
+
+    uint8_t rr[64];
+    size_t length = stats->buildReceiverReport(rr, sizeof(rr), now + std::chrono::milliseconds(500));
+    BOOST_REQUIRE(length == (size_t)32);
+    BOOST_TEST(readU32(rr + 8) == SSRC);
+    BOOST_TEST(readU32(rr + 24) == (uint32_t)0x03040506);
+    BOOST_TEST(readU32(rr + 28) == (uint32_t)32768);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,58 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/subscriber_set.hpp>
+
+#include <atomic>
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(subscriber_set)
+
+BOOST_AUTO_TEST_CASE(insert_replace_erase, *boost::unit_test::timeout(180))
+{
+    nabto::SubscriberSet<int> set;
+    BOOST_TEST(set.insert(1, 10) == (size_t)1);
+    BOOST_TEST(set.insert(2, 20) == (size_t)2);
+    auto before = set.snapshot();
+    BOOST_TEST(set.insert(1, 11) == (size_t)2);
+    BOOST_TEST(set.erase(2) == (size_t)1);
+    BOOST_TEST(set.erase(3) == (size_t)1);
+
+    // Snapshots taken earlier are not affected by later changes
+    BOOST_TEST(before->size() == (size_t)2);
+    BOOST_TEST(before->at(0).second == 10);
+
+    auto after = set.snapshot();
+    BOOST_REQUIRE(after->size() == (size_t)1);
+    BOOST_TEST(after->at(0).first == (NabtoDeviceConnectionRef)1);
+    BOOST_TEST(after->at(0).second == 11);
+
+    set.clear();
+    BOOST_TEST(set.size() == (size_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_readers, *boost::unit_test::timeout(180))
+{
+    nabto::SubscriberSet<std::shared_ptr<int> > set;
+    std::atomic<bool> done(false);
+    std::atomic<bool> consistent(true);
+    // Boost.Test assertions are not thread safe, so the reader only records failures
+    std::thread reader([&]() {
+        while (!done) {
+            auto snapshot = set.snapshot();
+            for (const auto& [ref, value] : *snapshot) {
+                if (*value != (int)ref) {
+                    consistent = false;
+                }
+            }
+        }
+    });
+    for (int i = 0; i < 1000; i++) {
+        set.insert(i % 16, std::make_shared<int>(i % 16));
+        set.erase((i + 8) % 16);
+    }
+    done = true;
+    reader.join();
+    BOOST_TEST(consistent == true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
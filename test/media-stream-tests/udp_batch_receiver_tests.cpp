@@ -0,0 +1,56 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/udp_batch_receiver.hpp>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <cstring>
+
+BOOST_AUTO_TEST_SUITE(udp_batch_receiver)
+
+BOOST_AUTO_TEST_CASE(receive_batches, *boost::unit_test::timeout(180))
+{
+    int recvSock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    BOOST_REQUIRE(bind(recvSock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0);
+    socklen_t addrLen = sizeof(addr);
+    BOOST_REQUIRE(getsockname(recvSock, reinterpret_cast<sockaddr*>(&addr), &addrLen) == 0);
+
+    int sendSock = socket(AF_INET, SOCK_DGRAM, 0);
+    for (uint8_t i = 0; i < 10; i++) {
+        uint8_t data[64];
+        memset(data, i, sizeof(data));
+        sendto(sendSock, data, 32 + i, 0, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    }
+
+    nabto::UdpBatchReceiver receiver(nabto::RtpBufferPool::create(2048, 4), 4);
+    nabto::RtpBufferRef kept;
+    size_t total = 0;
+    while (total < 10) {
+        int n = receiver.receive(recvSock);
+        BOOST_REQUIRE(n > 0);
+        BOOST_TEST(n <= 4);
+        for (int i = 0; i < n; i++) {
+            const auto& packet = receiver.packet(i);
+            BOOST_TEST(packet->size() == 32 + total + i);
+            BOOST_TEST(packet->data()[0] == total + i);
+        }
+        if (total == 0) {
+            kept = receiver.packet(0);
+        }
+        total += n;
+    }
+    // A buffer referenced outside the receiver must not be reused for later batches.
+    BOOST_TEST(kept->data()[0] == 0);
+    BOOST_TEST(receiver.stats().packets() == 10);
+    BOOST_TEST(receiver.stats().averageBatchFill() > 1.0);
+
+    close(sendSock);
+    close(recvSock);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
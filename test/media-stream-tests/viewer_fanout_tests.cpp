@@ -0,0 +1,212 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/viewer_fanout.hpp>
+#include <media-streams/subscriber_set.hpp>
+#include <media-streams/media_send_worker.hpp>
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include <cstring>
+
+namespace {
+
+const uint8_t KEYFRAME = 1;
+const uint8_t DELTA = 0;
+
+class Viewer {
+public:
+    nabto::ViewerQueuePtr queue;
+};
+
+nabto::RtpBufferRef makeRtp(nabto::RtpBufferPoolPtr pool, uint16_t seq, uint32_t timestamp, uint8_t type)
+{
+    auto buffer = pool->acquire();
+    uint8_t* d = buffer->data();
+    memset(d, 0, 13);
+    d[0] = 0x80;
+    d[1] = 96;
+    d[2] = seq >> 8;
+    d[3] = seq & 0xff;
+    d[4] = timestamp >> 24;
+    d[5] = timestamp >> 16;
+    d[6] = timestamp >> 8;
+    d[7] = timestamp;
+    d[12] = type;
+    buffer->setSize(13);
+    return buffer;
+}
+
+class RecordingSink {
+public:
+    void operator()(const nabto::RtpBufferRef& buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seqs_.push_back((buffer->data()[2] << 8) | buffer->data()[3]);
+    }
+
+    std::vector<uint16_t> seqs()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return seqs_;
+    }
+
+    std::mutex mutex_;
+    std::vector<uint16_t> seqs_;
+};
+
+/**
+ * Sink which blocks on the first packet until released, so the queue of the
+ * viewer fills up.
+ */
+class BlockingSink {
+public:
+    void operator()(const nabto::RtpBufferRef& buffer)
+    {
+        if (!entered_) {
+            entered_ = true;
+            enteredPromise_.set_value();
+            released_.get_future().wait();
+        }
+    }
+
+    bool entered_ = false;
+    std::promise<void> enteredPromise_;
+    std::promise<void> released_;
+};
+
+Viewer createViewer(nabto::MediaSendWorkerPtr worker, std::shared_ptr<RecordingSink> sink, const nabto::ViewerQueueConf& conf = nabto::ViewerQueueConf())
+{
+    Viewer viewer;
+    viewer.queue = nabto::ViewerQueue::create(conf, worker,
+        [sink](const nabto::RtpBufferRef& buffer) { (*sink)(buffer); });
+    return viewer;
+}
+
+void waitForSent(nabto::ViewerQueuePtr queue, uint64_t count)
+{
+    for (int i = 0; i < 500 && queue->stats().sent < count; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+nabto::KeyframePredicate keyframePredicate()
+{
+    return [](const uint8_t* data, size_t length) { return length > 12 && data[12] == KEYFRAME; };
+}
+
+NabtoDeviceConnectionRef ref(uint64_t n) { return (NabtoDeviceConnectionRef)n; }
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(viewer_fanout)
+
+BOOST_AUTO_TEST_CASE(gop_cache_queue_capacity)
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    nabto::ViewerQueueConf queueConf;
+    queueConf.capacity = 16;
+    nabto::GopCacheConf conf;
+    conf.maxPackets = 100;
+    BOOST_TEST(nabto::createGopCache(conf, keyframePredicate(), pool, queueConf) == nullptr);
+    BOOST_TEST(queueConf.capacity == (size_t)16);
+
+    conf.enabled = true;
+    BOOST_TEST(nabto::createGopCache(conf, keyframePredicate(), pool, queueConf) != nullptr);
+    BOOST_TEST(queueConf.capacity == (size_t)200);
+}
+
+BOOST_AUTO_TEST_CASE(new_viewer_starts_from_keyframe, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    nabto::ViewerQueueConf queueConf;
+    nabto::GopCacheConf conf;
+    conf.enabled = true;
+    auto cache = nabto::createGopCache(conf, keyframePredicate(), pool, queueConf);
+    nabto::SubscriberSet<Viewer> viewers;
+    nabto::ViewerDisconnectCallback onDisconnect = [](NabtoDeviceConnectionRef ref) { BOOST_FAIL("unexpected disconnect"); };
+
+    auto earlySink = std::make_shared<RecordingSink>();
+    auto early = createViewer(worker, earlySink, queueConf);
+    viewers.insert(ref(1), early);
+    nabto::fanOutPacket(*viewers.snapshot(), cache, makeRtp(pool, 1, 3000, KEYFRAME), onDisconnect);
+    nabto::fanOutPacket(*viewers.snapshot(), cache, makeRtp(pool, 2, 6000, DELTA), onDisconnect);
+
+    auto lateSink = std::make_shared<RecordingSink>();
+    auto late = createViewer(worker, lateSink, queueConf);
+    viewers.insert(ref(2), late);
+    nabto::fanOutPacket(*viewers.snapshot(), cache, makeRtp(pool, 3, 9000, DELTA), onDisconnect);
+
+    waitForSent(early.queue, 3);
+    waitForSent(late.queue, 3);
+    worker->stop();
+
+    // Both get every packet once, the late viewer from the cache.
+    std::vector<uint16_t> expected = { 1, 2, 3 };
+    auto earlySeqs = earlySink->seqs();
+    auto lateSeqs = lateSink->seqs();
+    BOOST_TEST(earlySeqs == expected, boost::test_tools::per_element());
+    BOOST_TEST(lateSeqs == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(disconnected_viewer_is_removed, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    nabto::SubscriberSet<Viewer> viewers;
+
+    nabto::ViewerQueueConf slowConf;
+    slowConf.capacity = 4;
+    slowConf.policy = nabto::ViewerOverflowPolicy::DISCONNECT;
+    auto blocking = std::make_shared<BlockingSink>();
+    Viewer slow;
+    slow.queue = nabto::ViewerQueue::create(slowConf, worker,
+        [blocking](const nabto::RtpBufferRef& buffer) { (*blocking)(buffer); }, nullptr, 1);
+    viewers.insert(ref(1), slow);
+
+    auto fastSink = std::make_shared<RecordingSink>();
+    auto fast = createViewer(worker, fastSink);
+    viewers.insert(ref(2), fast);
+
+    // Removes the viewer on the worker like the removeConnection() of a stream.
+    std::vector<NabtoDeviceConnectionRef> removed;
+    bool sourceStopped = false;
+    std::promise<void> removedPromise;
+    nabto::ViewerDisconnectCallback onDisconnect = [&](NabtoDeviceConnectionRef r) {
+        worker->post([&, r]() {
+            removed.push_back(r);
+            if (viewers.erase(r) == 0) {
+                sourceStopped = true;
+            }
+            removedPromise.set_value();
+        });
+    };
+
+    // The whole burst is fanned out with one snapshot, as the RTP client does for a batch.
+    auto snapshot = viewers.snapshot();
+    nabto::fanOutPacket(*snapshot, nullptr, makeRtp(pool, 1, 3000, KEYFRAME), onDisconnect);
+    blocking->enteredPromise_.get_future().wait();
+    for (uint16_t seq = 2; seq <= 10; seq++) {
+        nabto::fanOutPacket(*snapshot, nullptr, makeRtp(pool, seq, 3000 * seq, DELTA), onDisconnect);
+    }
+
+    // The slow viewer is closed right away, and removed once by the worker
+    // when the blocked send returns. The other one is not affected.
+    BOOST_TEST(slow.queue->closed());
+    blocking->released_.set_value();
+    removedPromise.get_future().wait();
+    waitForSent(fast.queue, 10);
+    worker->stop();
+    std::vector<NabtoDeviceConnectionRef> expectedRemoved = { ref(1) };
+    BOOST_TEST((removed == expectedRemoved));
+    BOOST_TEST(!viewers.find(ref(1)).has_value());
+    BOOST_TEST(viewers.size() == (size_t)1);
+    BOOST_TEST(!sourceStopped);
+    BOOST_TEST(fastSink->seqs().size() == (size_t)10);
+    BOOST_TEST(slow.queue->stats().sent <= (uint64_t)1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,204 @@
+#include <boost/test/unit_test.hpp>
+
+#include <media-streams/viewer_queue.hpp>
+#include <media-streams/media_send_worker.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+/**
+ * Sink which blocks on the first packet until released, so the test can fill
+ * the queue while the worker is busy.
+ */
+class BlockingSink {
+public:
+    void operator()(const nabto::RtpBufferRef& buffer)
+    {
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            first = sent_.empty();
+            sent_.push_back(buffer->data()[0]);
+        }
+        if (first) {
+            entered_.set_value();
+            released_.get_future().wait();
+        }
+    }
+
+    std::vector<uint8_t> sent()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sent_;
+    }
+
+    std::mutex mutex_;
+    std::vector<uint8_t> sent_;
+    std::promise<void> entered_;
+    std::promise<void> released_;
+};
+
+nabto::RtpBufferRef makePacket(nabto::RtpBufferPoolPtr pool, uint8_t id)
+{
+    auto buffer = pool->acquire();
+    buffer->data()[0] = id;
+    buffer->setSize(1);
+    return buffer;
+}
+
+void waitForSent(nabto::ViewerQueuePtr queue, uint64_t count)
+{
+    for (int i = 0; i < 500 && queue->stats().sent < count; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+nabto::ViewerQueuePtr createQueue(nabto::ViewerOverflowPolicy policy, std::shared_ptr<BlockingSink> sink, nabto::MediaSendWorkerPtr worker)
+{
+    nabto::ViewerQueueConf conf;
+    conf.capacity = 4;
+    conf.policy = policy;
+    return nabto::ViewerQueue::create(conf, worker,
+        [sink](const nabto::RtpBufferRef& buffer) { (*sink)(buffer); },
+        [](const uint8_t* data, size_t length) { return data[0] >= 100; });
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(viewer_queue)
+
+BOOST_AUTO_TEST_CASE(drop_oldest, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    auto sink = std::make_shared<BlockingSink>();
+    auto queue = createQueue(nabto::ViewerOverflowPolicy::DROP_OLDEST, sink, worker);
+
+    BOOST_TEST(queue->push(makePacket(pool, 0)));
+    sink->entered_.get_future().wait();
+    for (uint8_t i = 1; i <= 10; i++) {
+        BOOST_TEST(queue->push(makePacket(pool, i)));
+    }
+    BOOST_TEST(queue->stats().depth == (size_t)4);
+    BOOST_TEST(queue->stats().dropped == (uint64_t)6);
+
+    sink->released_.set_value();
+    waitForSent(queue, 5);
+    std::vector<uint8_t> expected = { 0, 7, 8, 9, 10 };
+    BOOST_TEST(sink->sent() == expected, boost::test_tools::per_element());
+    worker->stop();
+}
+
+BOOST_AUTO_TEST_CASE(drop_until_keyframe, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    auto sink = std::make_shared<BlockingSink>();
+    auto queue = createQueue(nabto::ViewerOverflowPolicy::DROP_UNTIL_KEYFRAME, sink, worker);
+
+    BOOST_TEST(queue->push(makePacket(pool, 0)));
+    sink->entered_.get_future().wait();
+    for (uint8_t i = 1; i <= 6; i++) {
+        BOOST_TEST(queue->push(makePacket(pool, i)));
+    }
+    // 1-4 flushed when 5 overflowed, 5 and 6 dropped waiting for a keyframe
+    BOOST_TEST(queue->stats().depth == (size_t)0);
+    BOOST_TEST(queue->stats().dropped == (uint64_t)6);
+    BOOST_TEST(queue->push(makePacket(pool, 100)));
+    BOOST_TEST(queue->push(makePacket(pool, 7)));
+
+    sink->released_.set_value();
+    waitForSent(queue, 3);
+    std::vector<uint8_t> expected = { 0, 100, 7 };
+    BOOST_TEST(sink->sent() == expected, boost::test_tools::per_element());
+    worker->stop();
+}
+
+BOOST_AUTO_TEST_CASE(disconnect, *boost::unit_test::timeout(180))
+{
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(1);
+    auto sink = std::make_shared<BlockingSink>();
+    auto queue = createQueue(nabto::ViewerOverflowPolicy::DISCONNECT, sink, worker);
+
+    BOOST_TEST(queue->push(makePacket(pool, 0)));
+    sink->entered_.get_future().wait();
+    for (uint8_t i = 1; i <= 4; i++) {
+        BOOST_TEST(queue->push(makePacket(pool, i)));
+    }
+    BOOST_TEST(!queue->push(makePacket(pool, 5)));
+    BOOST_TEST(queue->stats().disconnected);
+    BOOST_TEST(!queue->push(makePacket(pool, 100)));
+
+    sink->released_.set_value();
+    waitForSent(queue, 1);
+    std::vector<uint8_t> expected = { 0 };
+    BOOST_TEST(sink->sent() == expected, boost::test_tools::per_element());
+    worker->stop();
+}
+
+BOOST_AUTO_TEST_CASE(order_with_several_threads, *boost::unit_test::timeout(180))
+{
+    // All queues use the same shard key, so the other threads have to steal
+    // them. Each queue must still be drained in order by one thread at a time.
+    const size_t queueCount = 8;
+    const uint8_t packetCount = 200;
+    auto pool = nabto::RtpBufferPool::create(64);
+    auto worker = nabto::MediaSendWorker::create(4);
+    nabto::ViewerQueueConf conf;
+    conf.capacity = 256;
+
+    std::vector<std::vector<uint8_t> > sent(queueCount);
+    std::vector<std::unique_ptr<std::atomic<int> > > inSink;
+    std::atomic<bool> concurrent(false);
+    std::vector<nabto::ViewerQueuePtr> queues;
+    for (size_t i = 0; i < queueCount; i++) {
+        inSink.push_back(std::make_unique<std::atomic<int> >(0));
+        auto& received = sent[i];
+        auto& active = *inSink[i];
+        queues.push_back(nabto::ViewerQueue::create(conf, worker,
+            [&received, &active, &concurrent](const nabto::RtpBufferRef& buffer) {
+                if (active.fetch_add(1) != 0) {
+                    concurrent = true;
+                }
+                received.push_back(buffer->data()[0]);
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+                active.fetch_sub(1);
+            }, nullptr, 1));
+    }
+
+    for (uint8_t id = 0; id < packetCount; id++) {
+        for (auto q : queues) {
+            BOOST_TEST(q->push(makePacket(pool, id)));
+        }
+    }
+    for (auto q : queues) {
+        waitForSent(q, packetCount);
+    }
+    worker->stop();
+
+    BOOST_TEST(!concurrent);
+    for (size_t i = 0; i < queueCount; i++) {
+        BOOST_TEST(queues[i]->stats().dropped == (uint64_t)0);
+        BOOST_REQUIRE(sent[i].size() == (size_t)packetCount);
+        for (uint8_t id = 0; id < packetCount; id++) {
+            BOOST_TEST(sent[i][id] == id);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(posted_task_runs_on_worker, *boost::unit_test::timeout(180))
+{
+    auto worker = nabto::MediaSendWorker::create(2);
+    std::promise<std::thread::id> ran;
+    worker->post([&ran]() { ran.set_value(std::this_thread::get_id()); });
+    BOOST_TEST((ran.get_future().get() != std::this_thread::get_id()));
+    worker->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+#include <boost/test/unit_test.hpp>
+
+#include <nabto/nabto_device_webrtc.hpp>
+#include <api/media_track_impl.hpp>
+
+#include <rtc/rtc.hpp>
+
+#include <future>
+
+namespace {
+
+// Records the first byte of each frame it is asked to packetize and sends it
+// as a single packet.
+class RecordingPacketizer : public nabto::FramePacketizer {
+public:
+    void packetizeFrame(const uint8_t* data, size_t length, std::chrono::microseconds timestamp, const nabto::FramePacketCallback& cb) override
+    {
+        frames.push_back(data[0]);
+        std::vector<uint8_t> packet(12);
+        packet[0] = 0x80;
+        packet[1] = 96;
+        cb(packet.data(), packet.size());
+    }
+
+    std::vector<uint8_t> frames;
+};
+
+/**
+ * Two peer connections negotiating directly with each other over loopback,
+ * with a send only video track on the first one.
+ */
+class LoopbackConnection {
+public:
+    LoopbackConnection()
+    {
+        rtc::Configuration conf;
+        offerer_ = std::make_shared<rtc::PeerConnection>(conf);
+        answerer_ = std::make_shared<rtc::PeerConnection>(conf);
+
+        rtc::PeerConnection* offerer = offerer_.get();
+        rtc::PeerConnection* answerer = answerer_.get();
+        offerer_->onLocalDescription([answerer](rtc::Description desc) { answerer->setRemoteDescription(desc); });
+        offerer_->onLocalCandidate([answerer](rtc::Candidate cand) { answerer->addRemoteCandidate(cand); });
+        answerer_->onLocalDescription([offerer](rtc::Description desc) { offerer->setRemoteDescription(desc); });
+        answerer_->onLocalCandidate([offerer](rtc::Candidate cand) { offerer->addRemoteCandidate(cand); });
+        answerer_->onTrack([this](std::shared_ptr<rtc::Track> track) { remoteTrack_ = track; });
+
+        rtc::Description::Video media("video", rtc::Description::Direction::SendOnly);
+        media.addH264Codec(96);
+        media.addSSRC(42, "video");
+        track_ = offerer_->addTrack(media);
+        track_->onOpen([this]() { opened_.set_value(); });
+        offerer_->setLocalDescription();
+    }
+
+    ~LoopbackConnection()
+    {
+        offerer_->close();
+        answerer_->close();
+    }
+
+    std::shared_ptr<rtc::Track> openTrack()
+    {
+        BOOST_REQUIRE(opened_.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        return track_;
+    }
+
+private:
+    std::shared_ptr<rtc::PeerConnection> offerer_;
+    std::shared_ptr<rtc::PeerConnection> answerer_;
+    std::shared_ptr<rtc::Track> track_;
+    std::shared_ptr<rtc::Track> remoteTrack_;
+    std::promise<void> opened_;
+};
+
+void sendFrames(nabto::MediaTrackPtr track, const std::vector<std::pair<uint8_t, bool> >& frames)
+{
+    for (const auto& [id, isKeyframe] : frames) {
+        uint8_t data[4] = { id, 0, 0, 0 };
+        track->sendFrame(data, sizeof(data), std::chrono::microseconds(id * 33333), isKeyframe);
+    }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(media_track)
+
+BOOST_AUTO_TEST_CASE(send_frame_waits_for_keyframe, *boost::unit_test::timeout(180))
+{
+    auto packetizer = std::make_shared<RecordingPacketizer>();
+    auto track = nabto::MediaTrack::create("video", "");
+    track->setFramePacketizer(packetizer);
+
+    LoopbackConnection conn;
+    track->getImpl()->setRtcTrack(conn.openTrack());
+
+    uint8_t delta[1] = { 1 };
+    BOOST_TEST(!track->sendFrame(delta, sizeof(delta), std::chrono::microseconds(0), false));
+    sendFrames(track, { { 2, false }, { 3, true }, { 4, false }, { 5, false }, { 6, true }, { 7, false } });
+
+    std::vector<uint8_t> expected = { 3, 4, 5, 6, 7 };
+    BOOST_TEST(packetizer->frames == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(send_frame_waits_for_keyframe_on_new_connection, *boost::unit_test::timeout(180))
+{
+    auto packetizer = std::make_shared<RecordingPacketizer>();
+    auto track = nabto::MediaTrack::create("video", "");
+    track->setFramePacketizer(packetizer);
+
+    LoopbackConnection conn1;
+    track->getImpl()->setRtcTrack(conn1.openTrack());
+    sendFrames(track, { { 1, true }, { 2, false } });
+
+    // The track is attached to a new connection before the old one closes,
+    // so sendFrame() never sees a closed track in between.
+    LoopbackConnection conn2;
+    track->getImpl()->setRtcTrack(conn2.openTrack());
+    sendFrames(track, { { 3, false }, { 4, false }, { 5, true }, { 6, false } });
+
+    std::vector<uint8_t> expected = { 1, 2, 5, 6 };
+    BOOST_TEST(packetizer->frames == expected, boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
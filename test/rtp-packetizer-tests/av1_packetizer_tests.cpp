@@ -0,0 +1,222 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-packetizer/av1_packetizer.hpp>
+
+namespace {
+
+const uint8_t OBU_SEQUENCE_HEADER = 1;
+const uint8_t OBU_TEMPORAL_DELIMITER = 2;
+const uint8_t OBU_FRAME = 6;
+const uint8_t OBU_PADDING = 15;
+
+typedef std::vector<uint8_t> Obu;
+
+class Av1Stream {
+public:
+    // Add an OBU with its size field to the stream. Returns the OBU as it
+    // is expected in the RTP packets, without the size field.
+    void add(uint8_t type, size_t payloadSize, uint8_t fill = 0xAA)
+    {
+        uint8_t header = (type << 3) | 0x02;
+        data.push_back(header);
+        size_t size = payloadSize;
+        while (size >= 0x80) {
+            data.push_back((uint8_t)(size & 0x7F) | 0x80);
+            size >>= 7;
+        }
+        data.push_back((uint8_t)size);
+        data.insert(data.end(), payloadSize, fill);
+
+        if (type == OBU_TEMPORAL_DELIMITER) {
+            temporalUnits.push_back({});
+        } else if (type != OBU_PADDING) {
+            Obu obu(1, (uint8_t)(type << 3));
+            obu.insert(obu.end(), payloadSize, fill);
+            temporalUnits.back().push_back(obu);
+        }
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<std::vector<Obu> > temporalUnits;
+};
+
+Av1Stream makeStream()
+{
+    Av1Stream s;
+    s.add(OBU_TEMPORAL_DELIMITER, 0);
+    s.add(OBU_SEQUENCE_HEADER, 10, 0x01);
+    s.add(OBU_FRAME, 3000, 0x02);
+    s.add(OBU_PADDING, 20);
+    s.add(OBU_TEMPORAL_DELIMITER, 0);
+    s.add(OBU_FRAME, 100, 0x03);
+    s.add(OBU_FRAME, 200, 0x04);
+    s.add(OBU_TEMPORAL_DELIMITER, 0);
+    s.add(OBU_FRAME, 1190, 0x05);
+    // Ends the previous temporal unit
+    s.add(OBU_TEMPORAL_DELIMITER, 0);
+    return s;
+}
+
+std::vector<std::vector<uint8_t> > packetize(nabto::RtpPacketizerPtr packetizer, const std::vector<uint8_t>& stream, size_t chunkSize)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    for (size_t pos = 0; pos < stream.size(); pos += chunkSize) {
+        size_t len = std::min(chunkSize, stream.size() - pos);
+        packetizer->incoming(stream.data() + pos, len, [&ret](const uint8_t* packet, size_t length) {
+            ret.push_back(std::vector<uint8_t>(packet, packet + length));
+        });
+    }
+    return ret;
+}
+
+size_t readLeb128(const std::vector<uint8_t>& p, size_t& i)
+{
+    size_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t b = p.at(i++);
+        value |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/**
+ * Depacketize into temporal units of OBUs using the marker bit.
+ */
+std::vector<std::vector<Obu> > depacketize(const std::vector<std::vector<uint8_t> >& packets)
+{
+    std::vector<std::vector<Obu> > temporalUnits(1);
+    bool continues = false;
+    for (const auto& p : packets) {
+        uint8_t aggregationHeader = p.at(12);
+        bool z = aggregationHeader & 0x80;
+        bool y = aggregationHeader & 0x40;
+        size_t w = (aggregationHeader >> 4) & 0x03;
+        BOOST_TEST(z == continues);
+
+        size_t i = 13;
+        size_t element = 0;
+        while (i < p.size()) {
+            element++;
+            size_t length = (w != 0 && element == w) ? p.size() - i : readLeb128(p, i);
+            BOOST_REQUIRE(i + length <= p.size());
+            auto& tu = temporalUnits.back();
+            if (element == 1 && z) {
+                tu.back().insert(tu.back().end(), p.begin() + i, p.begin() + i + length);
+            } else {
+                tu.push_back(Obu(p.begin() + i, p.begin() + i + length));
+            }
+            i += length;
+        }
+        BOOST_TEST((w == 0 || element == w));
+        continues = y;
+        if (p[1] & 0x80) {
+            temporalUnits.push_back({});
+        }
+    }
+    temporalUnits.pop_back();
+    return temporalUnits;
+}
+
+bool startsSequence(const std::vector<uint8_t>& p) { return (p[12] & 0x08) != 0; }
+uint32_t timestamp(const std::vector<uint8_t>& p) { return (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]; }
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(av1_packetizer)
+
+BOOST_AUTO_TEST_CASE(packetize_temporal_units)
+{
+    std::string trackId = "video";
+    nabto::AV1PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    auto stream = makeStream();
+    auto packets = packetize(nabto::AV1Packetizer::create(42, trackId, 96, conf), stream.data, stream.data.size());
+
+    // The 3000 byte frame is split in 3 packets, the first also holding the
+    // sequence header. Both small frames fit in one packet and the last frame
+    // fills a packet.
+    BOOST_REQUIRE(packets.size() == (size_t)5);
+    for (const auto& p : packets) {
+        BOOST_TEST(p.size() <= (size_t)(12 + nabto::AV1_MTU));
+    }
+    BOOST_TEST(startsSequence(packets[0]));
+    for (size_t i = 1; i < packets.size(); i++) {
+        BOOST_TEST(!startsSequence(packets[i]));
+    }
+    BOOST_TEST(timestamp(packets[2]) == timestamp(packets[0]));
+    BOOST_TEST(timestamp(packets[3]) - timestamp(packets[0]) == (uint32_t)3000);
+    BOOST_TEST(timestamp(packets[4]) - timestamp(packets[3]) == (uint32_t)3000);
+
+    auto temporalUnits = depacketize(packets);
+    BOOST_REQUIRE(temporalUnits.size() == (size_t)3);
+    for (size_t i = 0; i < temporalUnits.size(); i++) {
+        BOOST_TEST((temporalUnits[i] == stream.temporalUnits[i]), "temporal unit " << i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(independent_of_chunk_size)
+{
+    std::string trackId = "video";
+    nabto::AV1PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    auto stream = makeStream();
+    auto reference = packetize(nabto::AV1Packetizer::create(42, trackId, 96, conf), stream.data, stream.data.size());
+    for (size_t chunkSize : { 1, 7, 1000 }) {
+        auto packets = packetize(nabto::AV1Packetizer::create(42, trackId, 96, conf), stream.data, chunkSize);
+        BOOST_TEST((packets == reference), "chunk size " << chunkSize);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(small_mtu)
+{
+    std::string trackId = "video";
+    nabto::AV1PacketizerConf conf;
+    conf.mtu = 100;
+    auto stream = makeStream();
+    auto packets = packetize(nabto::AV1Packetizer::create(42, trackId, 96, conf), stream.data, 512);
+    for (const auto& p : packets) {
+        BOOST_TEST(p.size() <= (size_t)(12 + 100));
+    }
+    auto temporalUnits = depacketize(packets);
+    BOOST_REQUIRE(temporalUnits.size() == (size_t)3);
+    for (size_t i = 0; i < temporalUnits.size(); i++) {
+        BOOST_TEST((temporalUnits[i] == stream.temporalUnits[i]), "temporal unit " << i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(skip_to_temporal_delimiter)
+{
+    std::string trackId = "video";
+    auto stream = makeStream();
+    // Start reading in the middle of a temporal unit
+    std::vector<uint8_t> data = { 0x32, 0x05, 0xAA, 0xAA };
+    data.insert(data.end(), stream.data.begin(), stream.data.end());
+    auto packets = packetize(nabto::AV1Packetizer::create(42, trackId, 96), data, 3);
+    auto temporalUnits = depacketize(packets);
+    BOOST_REQUIRE(temporalUnits.size() == (size_t)3);
+    BOOST_TEST((temporalUnits[0] == stream.temporalUnits[0]));
+}
+
+BOOST_AUTO_TEST_CASE(idle_flush)
+{
+    std::string trackId = "video";
+    nabto::AV1PacketizerConf conf;
+    conf.idleFlush = std::chrono::milliseconds(10);
+    auto packetizer = nabto::AV1Packetizer::create(42, trackId, 96, conf);
+    BOOST_TEST(packetizer->idleFlushTimeout().count() == 10);
+
+    Av1Stream s;
+    s.add(OBU_TEMPORAL_DELIMITER, 0);
+    s.add(OBU_FRAME, 100);
+    auto packets = packetize(packetizer, s.data, s.data.size());
+    BOOST_TEST(packets.size() == (size_t)0);
+    packetizer->flush([&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    BOOST_REQUIRE(packets.size() == (size_t)1);
+    BOOST_TEST((packets[0][1] & 0x80) != 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
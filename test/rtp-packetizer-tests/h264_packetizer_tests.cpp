@@ -0,0 +1,473 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-packetizer/h264_packetizer.hpp>
+
+#include <random>
+
+namespace {
+
+/**
+ * Annex B stream of a few GOPs with long and short start codes and NAL units
+ * large enough to be fragmented.
+ */
+std::vector<uint8_t> makeStream()
+{
+    std::mt19937 rng(42);
+    std::vector<uint8_t> stream;
+    auto nal = [&](bool longSep, uint8_t type, size_t len) {
+        if (longSep) {
+            stream.push_back(0x00);
+        }
+        stream.insert(stream.end(), { 0x00, 0x00, 0x01, (uint8_t)(0x60 | type) });
+        for (size_t i = 0; i < len; i++) {
+            uint8_t b = rng() & 0xff;
+            // Emulation prevention, the payload never contains a start code
+            if (stream[stream.size()-1] == 0x00 && stream[stream.size()-2] == 0x00 && b <= 3) {
+                b = 3;
+            }
+            stream.push_back(b);
+        }
+    };
+    for (int gop = 0; gop < 3; gop++) {
+        nal(true, 7, 20);
+        nal(true, 8, 5);
+        nal(true, 5, 30000);
+        for (int f = 0; f < 10; f++) {
+            nal(true, 1, 500 + rng() % 5000);
+            nal(false, 1, 300);
+        }
+    }
+    nal(true, 1, 10);
+    return stream;
+}
+
+std::vector<std::vector<uint8_t> > packetize(nabto::RtpPacketizerPtr packetizer, const std::vector<uint8_t>& stream, size_t chunkSize)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    for (size_t pos = 0; pos < stream.size(); pos += chunkSize) {
+        size_t len = std::min(chunkSize, stream.size() - pos);
+        auto packets = packetizer->incoming(std::vector<uint8_t>(stream.begin() + pos, stream.begin() + pos + len));
+        ret.insert(ret.end(), packets.begin(), packets.end());
+    }
+    return ret;
+}
+
+std::vector<std::vector<uint8_t> > packetizeAll(nabto::RtpPacketizerPtr packetizer, const std::vector<uint8_t>& stream)
+{
+    std::vector<std::vector<uint8_t> > packets;
+    packetizer->incoming(stream.data(), stream.size(), [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+    return packets;
+}
+
+/**
+ * Keyframe access unit with an AUD, parameter sets and a fragmented IDR,
+ * followed by small P frames.
+ */
+std::vector<uint8_t> makeKeyframe()
+{
+    std::vector<uint8_t> stream;
+    auto nal = [&](uint8_t header, size_t len) {
+        stream.insert(stream.end(), { 0x00, 0x00, 0x00, 0x01, header });
+        stream.insert(stream.end(), len, 0xAA);
+    };
+    nal(0x09, 1);     // AUD
+    nal(0x67, 10);    // SPS
+    nal(0x68, 4);     // PPS
+    nal(0x65, 2000);  // IDR
+    nal(0x41, 50);    // P
+    // The last NAL unit is sent once the one after it is complete
+    nal(0x41, 50);
+    nal(0x41, 50);
+    return stream;
+}
+
+std::vector<std::vector<uint8_t> > payloads(const std::vector<std::vector<uint8_t> >& packets)
+{
+    // RTP timestamps depend on the wall clock, compare payloads only.
+    std::vector<std::vector<uint8_t> > ret;
+    for (const auto& p : packets) {
+        ret.push_back(std::vector<uint8_t>(p.begin() + 12, p.end()));
+    }
+    return ret;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(h264_packetizer)
+
+BOOST_AUTO_TEST_CASE(independent_of_chunk_size)
+{
+    std::string trackId = "video";
+    auto stream = makeStream();
+    auto reference = payloads(packetize(nabto::H264Packetizer::create(42, trackId, 96), stream, stream.size()));
+    BOOST_TEST(reference.size() > (size_t)100);
+
+    for (size_t chunkSize : { 1, 3, 7, 1000, 4096 }) {
+        auto packets = payloads(packetize(nabto::H264Packetizer::create(42, trackId, 96), stream, chunkSize));
+        BOOST_TEST(packets.size() == reference.size());
+        BOOST_TEST((packets == reference), "chunk size " << chunkSize);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(resyncs_after_garbage)
+{
+    std::string trackId = "video";
+    auto stream = makeStream();
+    auto reference = payloads(packetize(nabto::H264Packetizer::create(42, trackId, 96), stream, 4096));
+
+    // Data without start codes is dropped instead of buffered forever, and
+    // packetizing resumes at the next start code.
+    auto packetizer = nabto::H264Packetizer::create(42, trackId, 96);
+    std::vector<uint8_t> garbage(1024 * 1024, 0x55);
+    for (int i = 0; i < 8; i++) {
+        BOOST_TEST(packetizer->incoming(garbage).empty());
+    }
+    auto packets = payloads(packetize(packetizer, stream, 4096));
+    BOOST_TEST((packets == reference));
+}
+
+BOOST_AUTO_TEST_CASE(fu_a_fragmentation)
+{
+    // A NAL unit whose payload is exactly two fragments. It is packetized
+    // once the NAL unit after it is complete.
+    std::string trackId = "video";
+    std::vector<uint8_t> stream = { 0x00, 0x00, 0x00, 0x01, 0x65 };
+    stream.insert(stream.end(), 2 * (nabto::H264_MTU - 2), 0xAA);
+    stream.insert(stream.end(), { 0x00, 0x00, 0x00, 0x01, 0x41, 0xBB });
+    stream.insert(stream.end(), { 0x00, 0x00, 0x00, 0x01, 0x41, 0xCC });
+
+    auto packetizer = nabto::H264Packetizer::create(42, trackId, 96);
+    std::vector<std::vector<uint8_t> > packets;
+    packetizer->incoming(stream.data(), stream.size(), [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    });
+
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const auto& p = packets[i];
+        BOOST_TEST(p.size() == 12 + nabto::H264_MTU);
+        BOOST_TEST(p[0] == 0x80);
+        BOOST_TEST((p[1] & 0x7F) == 96);
+        BOOST_TEST(p[12] == (0x60 | 28)); // FU indicator keeps NRI
+        BOOST_TEST((p[13] & 0x1F) == 5);  // FU header keeps the IDR type
+    }
+    BOOST_TEST((packets[0][13] & 0x80) != 0); // start
+    BOOST_TEST((packets[0][13] & 0x40) == 0);
+    BOOST_TEST((packets[1][13] & 0x80) == 0);
+    BOOST_TEST((packets[1][13] & 0x40) != 0); // end
+    // The access unit ends with the IDR
+    BOOST_TEST((packets[0][1] & 0x80) == 0);
+    BOOST_TEST((packets[1][1] & 0x80) != 0);
+    uint16_t seq0 = (packets[0][2] << 8) | packets[0][3];
+    uint16_t seq1 = (packets[1][2] << 8) | packets[1][3];
+    BOOST_TEST(seq1 == (uint16_t)(seq0 + 1));
+}
+
+BOOST_AUTO_TEST_CASE(stap_a_aggregation)
+{
+    std::string trackId = "video";
+    auto packets = packetizeAll(nabto::H264Packetizer::create(42, trackId, 96), makeKeyframe());
+
+    // AUD, SPS and PPS in one STAP-A, two IDR fragments and the P frame.
+    BOOST_REQUIRE(packets.size() == (size_t)4);
+    const auto& stap = packets[0];
+    BOOST_TEST(stap[12] == (0x60 | 24)); // highest NRI of the aggregated NAL units
+    BOOST_TEST(stap.size() == (size_t)(12 + 1 + (2 + 2) + (2 + 11) + (2 + 5)));
+    BOOST_TEST((stap[13] << 8 | stap[14]) == 2);
+    BOOST_TEST(stap[15] == 0x09);
+    BOOST_TEST((stap[17] << 8 | stap[18]) == 11);
+    BOOST_TEST(stap[19] == 0x67);
+    BOOST_TEST((stap[30] << 8 | stap[31]) == 5);
+    BOOST_TEST(stap[32] == 0x68);
+    BOOST_TEST((stap[1] & 0x80) == 0);
+
+    BOOST_TEST(packets[1][12] == (0x60 | 28));
+    BOOST_TEST(packets[2][12] == (0x60 | 28));
+    BOOST_TEST((packets[2][1] & 0x80) != 0);
+    // A single small NAL unit is not wrapped in a STAP-A
+    BOOST_TEST(packets[3].size() == (size_t)(12 + 51));
+    BOOST_TEST(packets[3][12] == 0x41);
+    BOOST_TEST((packets[3][1] & 0x80) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(packetizer_options)
+{
+    std::string trackId = "video";
+    nabto::H264PacketizerConf conf;
+    conf.dropAud = true;
+    auto packets = packetizeAll(nabto::H264Packetizer::create(42, trackId, 96, conf), makeKeyframe());
+    BOOST_REQUIRE(packets.size() == (size_t)4);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 1 + (2 + 11) + (2 + 5)));
+    BOOST_TEST(packets[0][15] == 0x67);
+
+    conf = nabto::H264PacketizerConf();
+    conf.aggregate = false;
+    packets = packetizeAll(nabto::H264Packetizer::create(42, trackId, 96, conf), makeKeyframe());
+    BOOST_TEST(packets.size() == (size_t)6);
+
+    conf = nabto::H264PacketizerConf();
+    conf.mtu = 500;
+    packets = packetizeAll(nabto::H264Packetizer::create(42, trackId, 96, conf), makeKeyframe());
+    // 2001 byte IDR in fragments of 498 bytes
+    BOOST_TEST(packets.size() == (size_t)(1 + 5 + 1));
+    for (const auto& p : packets) {
+        BOOST_TEST(p.size() <= (size_t)(12 + 500));
+    }
+}
+
+std::vector<uint32_t> accessUnitTimestamps(const std::vector<std::vector<uint8_t> >& packets)
+{
+    // Timestamp of each packet with the marker bit set
+    std::vector<uint32_t> ret;
+    for (const auto& p : packets) {
+        if (p[1] & 0x80) {
+            ret.push_back((uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]);
+        }
+    }
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(frame_rate_timestamps)
+{
+    std::string trackId = "video";
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    conf.frameRate = 25;
+    auto stream = makeStream();
+    // Timestamps do not depend on when the data is read.
+    auto ts = accessUnitTimestamps(packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), stream, 7));
+    BOOST_REQUIRE(ts.size() > (size_t)30);
+    for (size_t i = 1; i < ts.size(); i++) {
+        BOOST_TEST(ts[i] - ts[i-1] == (uint32_t)3600);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(explicit_timestamps)
+{
+    std::string trackId = "video";
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::EXPLICIT;
+    auto packetizer = nabto::H264Packetizer::create(42, trackId, 96, conf);
+    auto h264 = std::dynamic_pointer_cast<nabto::H264Packetizer>(packetizer);
+
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    // Presentation times in microseconds, the second frame is late.
+    for (int64_t pts : { 1000000, 1040000, 1060000, 1100000 }) {
+        h264->addFrameTimestamp(std::chrono::microseconds(pts));
+        std::vector<uint8_t> au = { 0x00, 0x00, 0x00, 0x01, 0x65 };
+        au.insert(au.end(), 100, 0xAA);
+        packetizer->incoming(au.data(), au.size(), cb);
+    }
+    // Complete the last access unit
+    std::vector<uint8_t> end = { 0x00, 0x00, 0x00, 0x01, 0x41, 0xAA, 0x00, 0x00, 0x00, 0x01 };
+    packetizer->incoming(end.data(), end.size(), cb);
+
+    auto ts = accessUnitTimestamps(packets);
+    BOOST_REQUIRE(ts.size() == (size_t)4);
+    BOOST_TEST(ts[1] - ts[0] == (uint32_t)3600);
+    BOOST_TEST(ts[2] - ts[1] == (uint32_t)1800);
+    BOOST_TEST(ts[3] - ts[2] == (uint32_t)3600);
+}
+
+BOOST_AUTO_TEST_CASE(explicit_timestamps_after_unstamped_frame)
+{
+    std::string trackId = "video";
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::EXPLICIT;
+    conf.frameRate = 25;
+    auto packetizer = nabto::H264Packetizer::create(42, trackId, 96, conf);
+    auto h264 = std::dynamic_pointer_cast<nabto::H264Packetizer>(packetizer);
+
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    std::vector<uint8_t> au = { 0x00, 0x00, 0x00, 0x01, 0x65 };
+    au.insert(au.end(), 100, 0xAA);
+    // The first access unit is complete before any presentation time is given
+    std::vector<uint8_t> first = au;
+    first.insert(first.end(), au.begin(), au.begin() + 50);
+    packetizer->incoming(first.data(), first.size(), cb);
+    h264->addFrameTimestamp(std::chrono::microseconds(5000000));
+    packetizer->incoming(au.data() + 50, au.size() - 50, cb);
+    h264->addFrameTimestamp(std::chrono::microseconds(5020000));
+    packetizer->incoming(au.data(), au.size(), cb);
+    std::vector<uint8_t> end = { 0x00, 0x00, 0x00, 0x01, 0x41, 0xAA, 0x00, 0x00, 0x00, 0x01 };
+    packetizer->incoming(end.data(), end.size(), cb);
+
+    auto ts = accessUnitTimestamps(packets);
+    BOOST_REQUIRE(ts.size() == (size_t)3);
+    BOOST_TEST(ts[1] - ts[0] == (uint32_t)3600);
+    BOOST_TEST(ts[2] - ts[1] == (uint32_t)1800);
+}
+
+/**
+ * The same access units in the stream formats. Slices start with a
+ * byte with first_mb_in_slice coded as 0 on the first slice of a picture.
+ */
+struct FormattedStreams {
+    std::vector<uint8_t> annexB;
+    std::vector<uint8_t> lengthPrefixed;
+    std::vector<uint8_t> lengthPrefixedFrames;
+    // Access unit i has the presentation time 1 s + i * 40 ms, except the
+    // third which is 20 ms late.
+    std::vector<uint8_t> lengthPrefixedTimestampedFrames;
+    // Each access unit on its own in the Annex B format
+    std::vector<std::vector<uint8_t> > annexBFrames;
+};
+
+FormattedStreams makeFormattedStreams()
+{
+    std::vector<std::vector<std::vector<uint8_t> > > accessUnits;
+    auto nal = [](uint8_t header, uint8_t first, size_t len) {
+        std::vector<uint8_t> n = { header, first };
+        n.insert(n.end(), len - 1, 0xAA);
+        return n;
+    };
+    accessUnits.push_back({ nal(0x67, 0x42, 10), nal(0x68, 0xCE, 4), nal(0x65, 0x88, 3000), nal(0x65, 0x40, 500) });
+    for (int i = 0; i < 5; i++) {
+        accessUnits.push_back({ nal(0x06, 0x05, 20), nal(0x41, 0x9A, 200), nal(0x41, 0x20, 200) });
+    }
+    accessUnits.push_back({ nal(0x41, 0x9A, 200) });
+
+    FormattedStreams s;
+    auto putLength = [](std::vector<uint8_t>& out, size_t length) {
+        out.insert(out.end(), { (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length });
+    };
+    for (size_t n = 0; n < accessUnits.size(); n++) {
+        const auto& au = accessUnits[n];
+        size_t frameLength = 0;
+        size_t frameStart = s.annexB.size();
+        for (size_t i = 0; i < au.size(); i++) {
+            if (i == 0) {
+                s.annexB.push_back(0x00);
+            }
+            s.annexB.insert(s.annexB.end(), { 0x00, 0x00, 0x01 });
+            s.annexB.insert(s.annexB.end(), au[i].begin(), au[i].end());
+            putLength(s.lengthPrefixed, au[i].size());
+            s.lengthPrefixed.insert(s.lengthPrefixed.end(), au[i].begin(), au[i].end());
+            frameLength += 4 + au[i].size();
+        }
+        s.annexBFrames.push_back(std::vector<uint8_t>(s.annexB.begin() + frameStart, s.annexB.end()));
+        putLength(s.lengthPrefixedFrames, frameLength);
+        s.lengthPrefixedFrames.insert(s.lengthPrefixedFrames.end(), s.lengthPrefixed.end() - frameLength, s.lengthPrefixed.end());
+        putLength(s.lengthPrefixedTimestampedFrames, frameLength);
+        uint64_t pts = 1000000 + 40000 * n + (n == 2 ? 20000 : 0);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            s.lengthPrefixedTimestampedFrames.push_back((uint8_t)(pts >> shift));
+        }
+        s.lengthPrefixedTimestampedFrames.insert(s.lengthPrefixedTimestampedFrames.end(), s.lengthPrefixed.end() - frameLength, s.lengthPrefixed.end());
+    }
+    // Complete the last NAL unit of the Annex B stream like the length fields do
+    s.annexB.insert(s.annexB.end(), { 0x00, 0x00, 0x00, 0x01 });
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(length_prefixed_input)
+{
+    std::string trackId = "video";
+    auto streams = makeFormattedStreams();
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    auto reference = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.annexB, 4096);
+    BOOST_REQUIRE(accessUnitTimestamps(reference).size() == (size_t)6);
+
+    // Access unit boundaries are found from the NAL units instead of the start codes.
+    conf.format = nabto::H264StreamFormat::LENGTH_PREFIXED;
+    for (size_t chunkSize : { 1, 5, 4096 }) {
+        auto packets = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixed, chunkSize);
+        BOOST_TEST((packets == reference), "chunk size " << chunkSize);
+    }
+
+    // With frame headers, the last access unit is sent as soon as it is read.
+    conf.format = nabto::H264StreamFormat::LENGTH_PREFIXED_FRAMES;
+    for (size_t chunkSize : { 1, 5, 4096 }) {
+        auto packets = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixedFrames, chunkSize);
+        BOOST_REQUIRE(packets.size() == reference.size() + 1);
+        BOOST_TEST((std::vector<std::vector<uint8_t> >(packets.begin(), packets.end() - 1) == reference), "chunk size " << chunkSize);
+        BOOST_TEST((packets.back()[1] & 0x80) != 0);
+        BOOST_TEST(accessUnitTimestamps(packets).size() == (size_t)7);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(length_prefixed_timestamped_frames)
+{
+    std::string trackId = "video";
+    auto streams = makeFormattedStreams();
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    conf.format = nabto::H264StreamFormat::LENGTH_PREFIXED_FRAMES;
+    auto reference = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixedFrames, 4096);
+
+    // Without EXPLICIT the presentation times are skipped.
+    conf.format = nabto::H264StreamFormat::LENGTH_PREFIXED_TIMESTAMPED_FRAMES;
+    for (size_t chunkSize : { 1, 5, 4096 }) {
+        auto packets = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixedTimestampedFrames, chunkSize);
+        BOOST_TEST((packets == reference), "chunk size " << chunkSize);
+    }
+
+    // With EXPLICIT they give the RTP timestamps instead of the frame rate.
+    conf.timestampMode = nabto::VideoTimestampMode::EXPLICIT;
+    conf.frameRate = 10;
+    for (size_t chunkSize : { 1, 5, 4096 }) {
+        auto packets = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixedTimestampedFrames, chunkSize);
+        BOOST_TEST((payloads(packets) == payloads(reference)), "chunk size " << chunkSize);
+        auto ts = accessUnitTimestamps(packets);
+        BOOST_REQUIRE(ts.size() == (size_t)7);
+        for (size_t i = 1; i < ts.size(); i++) {
+            uint32_t expected = i == 2 ? 5400 : i == 3 ? 1800 : 3600;
+            BOOST_TEST(ts[i] - ts[i-1] == expected, "chunk size " << chunkSize << " access unit " << i);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(packetize_frames)
+{
+    std::string trackId = "video";
+    auto streams = makeFormattedStreams();
+    nabto::H264PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    conf.frameRate = 25;
+    auto reference = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.annexB, 4096);
+
+    // Frames given one at a time are packetized like the stream, and each
+    // frame is sent completely without waiting for the next one.
+    auto packetizer = std::make_shared<nabto::H264Packetizer>(42, trackId, 96, conf);
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    for (size_t i = 0; i < streams.annexBFrames.size(); i++) {
+        const auto& frame = streams.annexBFrames[i];
+        size_t before = packets.size();
+        packetizer->packetizeFrame(frame.data(), frame.size(), std::chrono::microseconds(1000000 + 40000 * i), cb);
+        BOOST_REQUIRE(packets.size() > before);
+        BOOST_TEST((packets.back()[1] & 0x80) != 0);
+    }
+    BOOST_REQUIRE(packets.size() == reference.size() + 1);
+    BOOST_TEST((std::vector<std::vector<uint8_t> >(packets.begin(), packets.end() - 1) == reference));
+}
+
+BOOST_AUTO_TEST_CASE(length_prefixed_invalid_length)
+{
+    std::string trackId = "video";
+    auto streams = makeFormattedStreams();
+    nabto::H264PacketizerConf conf;
+    conf.format = nabto::H264StreamFormat::LENGTH_PREFIXED_FRAMES;
+    auto reference = packetize(nabto::H264Packetizer::create(42, trackId, 96, conf), streams.lengthPrefixedFrames, 4096);
+
+    // A NAL unit longer than its frame drops the buffered data, and the next
+    // write is read as the start of a frame.
+    auto packetizer = nabto::H264Packetizer::create(42, trackId, 96, conf);
+    std::vector<uint8_t> broken = { 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x10, 0x00, 0x41, 0xAA, 0xAA, 0xAA };
+    BOOST_TEST(packetizer->incoming(broken).empty());
+    auto packets = payloads(packetize(packetizer, streams.lengthPrefixedFrames, 4096));
+    BOOST_TEST((packets == payloads(reference)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-packetizer/h265_packetizer.hpp>
+
+namespace {
+
+/**
+ * Annex B stream with a keyframe of parameter sets and a fragmented IRAP
+ * picture in two slices, followed by small P frames.
+ */
+std::vector<uint8_t> makeStream()
+{
+    std::vector<uint8_t> stream;
+    auto nal = [&](uint8_t type, bool firstSlice, size_t len) {
+        stream.insert(stream.end(), { 0x00, 0x00, 0x00, 0x01, (uint8_t)(type << 1), 0x01 });
+        stream.push_back(firstSlice ? 0x80 : 0x00);
+        stream.insert(stream.end(), len - 1, 0xAA);
+    };
+    nal(32, false, 20);   // VPS
+    nal(33, false, 30);   // SPS
+    nal(34, false, 6);    // PPS
+    nal(19, true, 3000);  // IDR_W_RADL
+    nal(19, false, 500);  // second slice of the IDR picture
+    nal(1, true, 100);    // TRAIL_R
+    nal(1, true, 100);
+    // A NAL unit is only sent once the next one is complete, so the last
+    // two are never sent.
+    nal(1, true, 100);
+    nal(1, true, 100);
+    return stream;
+}
+
+std::vector<std::vector<uint8_t> > packetize(nabto::RtpPacketizerPtr packetizer, const std::vector<uint8_t>& stream, size_t chunkSize)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    for (size_t pos = 0; pos < stream.size(); pos += chunkSize) {
+        size_t len = std::min(chunkSize, stream.size() - pos);
+        packetizer->incoming(stream.data() + pos, len, [&ret](const uint8_t* packet, size_t length) {
+            ret.push_back(std::vector<uint8_t>(packet, packet + length));
+        });
+    }
+    return ret;
+}
+
+bool marker(const std::vector<uint8_t>& p) { return (p[1] & 0x80) != 0; }
+uint8_t payloadType(const std::vector<uint8_t>& p) { return (p[12] >> 1) & 0x3F; }
+uint32_t timestamp(const std::vector<uint8_t>& p) { return (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]; }
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(h265_packetizer)
+
+BOOST_AUTO_TEST_CASE(packetize_access_units)
+{
+    std::string trackId = "video";
+    nabto::H265PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    auto stream = makeStream();
+    auto packets = packetize(nabto::H265Packetizer::create(42, trackId, 96, conf), stream, stream.size());
+
+    // AP of the parameter sets, three fragments of the first slice, the
+    // second slice and two P frames.
+    BOOST_REQUIRE(packets.size() == (size_t)7);
+
+    const auto& ap = packets[0];
+    BOOST_TEST(payloadType(ap) == 48);
+    BOOST_TEST(ap[13] == 0x01); // LayerId 0, TID 1
+    BOOST_TEST(ap.size() == (size_t)(12 + 2 + (2 + 22) + (2 + 32) + (2 + 8)));
+    BOOST_TEST((ap[14] << 8 | ap[15]) == 22);
+    BOOST_TEST(((ap[16] >> 1) & 0x3F) == 32);
+
+    for (int i = 1; i <= 3; i++) {
+        BOOST_TEST(payloadType(packets[i]) == 49);
+        BOOST_TEST(packets[i].size() <= (size_t)(12 + nabto::H265_MTU));
+        BOOST_TEST((packets[i][14] & 0x3F) == 19);
+    }
+    BOOST_TEST((packets[1][14] & 0xC0) == 0x80);
+    BOOST_TEST((packets[2][14] & 0xC0) == 0x00);
+    BOOST_TEST((packets[3][14] & 0xC0) == 0x40);
+
+    // The picture ends with its second slice
+    for (int i = 0; i < 4; i++) {
+        BOOST_TEST(!marker(packets[i]));
+    }
+    BOOST_TEST(payloadType(packets[4]) == 19);
+    BOOST_TEST(marker(packets[4]));
+    BOOST_TEST(timestamp(packets[4]) == timestamp(packets[0]));
+
+    BOOST_TEST(payloadType(packets[5]) == 1);
+    BOOST_TEST(marker(packets[5]));
+    BOOST_TEST(timestamp(packets[5]) - timestamp(packets[0]) == (uint32_t)3000);
+    BOOST_TEST(timestamp(packets[6]) - timestamp(packets[5]) == (uint32_t)3000);
+}
+
+BOOST_AUTO_TEST_CASE(independent_of_chunk_size)
+{
+    std::string trackId = "video";
+    nabto::H265PacketizerConf conf;
+    conf.timestampMode = nabto::VideoTimestampMode::FRAME_RATE;
+    auto stream = makeStream();
+    auto reference = packetize(nabto::H265Packetizer::create(42, trackId, 96, conf), stream, stream.size());
+    for (size_t chunkSize : { 1, 5, 1000 }) {
+        auto packets = packetize(nabto::H265Packetizer::create(42, trackId, 96, conf), stream, chunkSize);
+        BOOST_TEST((packets == reference), "chunk size " << chunkSize);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(without_aggregation)
+{
+    std::string trackId = "video";
+    nabto::H265PacketizerConf conf;
+    conf.aggregate = false;
+    auto packets = packetize(nabto::H265Packetizer::create(42, trackId, 96, conf), makeStream(), 4096);
+    BOOST_REQUIRE(packets.size() == (size_t)9);
+    BOOST_TEST(payloadType(packets[0]) == 32);
+    BOOST_TEST(payloadType(packets[1]) == 33);
+    BOOST_TEST(payloadType(packets[2]) == 34);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,192 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-packetizer/opus_packetizer.hpp>
+#include <media-streams/rtp_buffer_pool.hpp>
+
+#include <cstring>
+
+namespace {
+
+/**
+ * Ogg page holding the given packets. If the last packet is a multiple of
+ * 255 bytes long, it is left open to be continued on the next page.
+ */
+std::vector<uint8_t> oggPage(const std::vector<std::vector<uint8_t> >& packets, bool continued, bool openEnd = false)
+{
+    std::vector<uint8_t> lacing;
+    std::vector<uint8_t> body;
+    for (size_t i = 0; i < packets.size(); i++) {
+        const auto& p = packets[i];
+        size_t left = p.size();
+        while (left >= 255) {
+            lacing.push_back(255);
+            left -= 255;
+        }
+        if (!(openEnd && i == packets.size() - 1)) {
+            lacing.push_back((uint8_t)left);
+        }
+        body.insert(body.end(), p.begin(), p.end());
+    }
+    std::vector<uint8_t> page = { 'O', 'g', 'g', 'S', 0, (uint8_t)(continued ? 1 : 0) };
+    // Granule position, serial number, page sequence number and CRC are not used.
+    page.insert(page.end(), 20, 0);
+    page.push_back((uint8_t)lacing.size());
+    page.insert(page.end(), lacing.begin(), lacing.end());
+    page.insert(page.end(), body.begin(), body.end());
+    return page;
+}
+
+std::vector<uint8_t> opusPacket(uint8_t toc, size_t length)
+{
+    std::vector<uint8_t> p(length, 0xAA);
+    p[0] = toc;
+    return p;
+}
+
+std::vector<std::vector<uint8_t> > packetize(nabto::RtpPacketizerPtr packetizer, const std::vector<uint8_t>& stream, size_t chunkSize)
+{
+    std::vector<std::vector<uint8_t> > ret;
+    for (size_t pos = 0; pos < stream.size(); pos += chunkSize) {
+        size_t len = std::min(chunkSize, stream.size() - pos);
+        auto packets = packetizer->incoming(std::vector<uint8_t>(stream.begin() + pos, stream.begin() + pos + len));
+        ret.insert(ret.end(), packets.begin(), packets.end());
+    }
+    return ret;
+}
+
+uint32_t timestamp(const std::vector<uint8_t>& p)
+{
+    return (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(opus_packetizer)
+
+BOOST_AUTO_TEST_CASE(toc_durations)
+{
+    uint8_t twoFrames[] = { (31 << 3) | 1, 0 };
+    BOOST_TEST(nabto::OpusPacketizer::packetSamples(twoFrames, 2) == (uint32_t)1920);
+    uint8_t silk60[] = { (3 << 3) };
+    BOOST_TEST(nabto::OpusPacketizer::packetSamples(silk60, 1) == (uint32_t)2880);
+    uint8_t hybrid10[] = { (12 << 3) };
+    BOOST_TEST(nabto::OpusPacketizer::packetSamples(hybrid10, 1) == (uint32_t)480);
+    uint8_t celtCode3[] = { (16 << 3) | 3, 6 };
+    BOOST_TEST(nabto::OpusPacketizer::packetSamples(celtCode3, 2) == (uint32_t)720);
+    BOOST_TEST(nabto::OpusPacketizer::packetSamples(celtCode3, 1) == (uint32_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(ogg_stream)
+{
+    std::vector<uint8_t> head = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2, 0, 0, 0x80, 0xBB, 0, 0, 0, 0, 0 };
+    std::vector<uint8_t> tags = { 'O', 'p', 'u', 's', 'T', 'a', 'g', 's', 0, 0, 0, 0, 0, 0, 0, 0 };
+    // 20 ms CELT packets, one of them spanning two pages
+    auto p20 = opusPacket(31 << 3, 100);
+    auto large = opusPacket(31 << 3, 600);
+    std::vector<uint8_t> largeStart(large.begin(), large.begin() + 510);
+    std::vector<uint8_t> largeEnd(large.begin() + 510, large.end());
+    // 10 ms SILK packet
+    auto p10 = opusPacket(0, 40);
+
+    std::vector<uint8_t> stream;
+    for (auto page : { oggPage({ head }, false), oggPage({ tags }, false),
+                       oggPage({ p20, p20, largeStart }, false, true),
+                       oggPage({ largeEnd, p10, p20 }, true) }) {
+        stream.insert(stream.end(), page.begin(), page.end());
+    }
+
+    for (size_t chunkSize : { (size_t)1, (size_t)13, stream.size() }) {
+        std::string trackId = "audio";
+        auto packets = packetize(nabto::OpusPacketizer::create(42, trackId, 111), stream, chunkSize);
+        BOOST_REQUIRE(packets.size() == (size_t)5);
+        BOOST_TEST(packets[2].size() == (size_t)(12 + 600));
+        BOOST_TEST((std::vector<uint8_t>(packets[2].begin() + 12, packets[2].end()) == large));
+        BOOST_TEST((packets[0][1] & 0x7F) == 111);
+        uint32_t ts0 = timestamp(packets[0]);
+        BOOST_TEST(timestamp(packets[1]) - ts0 == (uint32_t)960);
+        BOOST_TEST(timestamp(packets[2]) - ts0 == (uint32_t)1920);
+        BOOST_TEST(timestamp(packets[3]) - ts0 == (uint32_t)2880);
+        BOOST_TEST(timestamp(packets[4]) - ts0 == (uint32_t)3360);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ogg_resync)
+{
+    // Joining mid-stream: garbage and the end of a continued packet are skipped.
+    auto p20 = opusPacket(31 << 3, 100);
+    std::vector<uint8_t> stream(500, 0x55);
+    auto page = oggPage({ opusPacket(31 << 3, 50), p20 }, true);
+    stream.insert(stream.end(), page.begin(), page.end());
+    page = oggPage({ p20 }, false);
+    stream.insert(stream.end(), page.begin(), page.end());
+
+    std::string trackId = "audio";
+    auto packets = packetize(nabto::OpusPacketizer::create(42, trackId, 111), stream, 64);
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 100));
+}
+
+BOOST_AUTO_TEST_CASE(length_prefixed_stream)
+{
+    nabto::OpusPacketizerConf conf;
+    conf.format = nabto::OpusStreamFormat::LENGTH_PREFIXED;
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < 10; i++) {
+        auto p = opusPacket(31 << 3, 80 + i);
+        stream.push_back(0);
+        stream.push_back((uint8_t)p.size());
+        stream.insert(stream.end(), p.begin(), p.end());
+    }
+    std::string trackId = "audio";
+    auto packets = packetize(nabto::OpusPacketizer::create(42, trackId, 111, conf), stream, 7);
+    BOOST_REQUIRE(packets.size() == (size_t)10);
+    for (size_t i = 0; i < packets.size(); i++) {
+        BOOST_TEST(packets[i].size() == 12 + 80 + i);
+        BOOST_TEST(timestamp(packets[i]) - timestamp(packets[0]) == 960 * i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(large_packet_fits_pool)
+{
+    nabto::OpusPacketizerConf conf;
+    conf.format = nabto::OpusStreamFormat::LENGTH_PREFIXED;
+    auto factory = nabto::OpusPacketizerFactory::create("audio", conf);
+    BOOST_TEST(factory->maxPacketSize() == nabto::RTP_HEADER_SIZE + nabto::OPUS_MAX_PACKET_SIZE);
+
+    // 120 ms of 2.5 ms CELT frames, far larger than the default buffers
+    auto p = opusPacket((16 << 3) | 3, 40000);
+    p[1] = 48;
+    std::vector<uint8_t> stream = { (uint8_t)(p.size() >> 8), (uint8_t)p.size() };
+    stream.insert(stream.end(), p.begin(), p.end());
+    auto packets = packetize(factory->createPacketizer(42, 111), stream, 4096);
+    BOOST_REQUIRE(packets.size() == (size_t)1);
+
+    // Sources size their pool like this, so the packet is copied whole.
+    auto pool = nabto::RtpBufferPool::create(std::max((size_t)2048, factory->maxPacketSize()));
+    nabto::RtpBufferRef buffer = pool->acquire();
+    BOOST_REQUIRE(packets[0].size() <= buffer->capacity());
+    memcpy(buffer->data(), packets[0].data(), packets[0].size());
+    buffer->setSize(packets[0].size());
+    BOOST_TEST((std::vector<uint8_t>(buffer->data() + 12, buffer->data() + buffer->size()) == p));
+}
+
+BOOST_AUTO_TEST_CASE(packetize_frames)
+{
+    std::string trackId = "audio";
+    auto packetizer = std::make_shared<nabto::OpusPacketizer>(42, trackId, 111, nabto::OpusPacketizerConf());
+
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    // One packet per frame with the timestamp taken from the frame time
+    auto frame = opusPacket(31 << 3, 100);
+    packetizer->packetizeFrame(frame.data(), frame.size(), std::chrono::microseconds(2000000), cb);
+    packetizer->packetizeFrame(frame.data(), frame.size(), std::chrono::microseconds(2040000), cb);
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 100));
+    BOOST_TEST(std::vector<uint8_t>(packets[1].begin() + 12, packets[1].end()) == frame);
+    BOOST_TEST(timestamp(packets[1]) - timestamp(packets[0]) == (uint32_t)1920);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-packetizer/pcmu_packetizer.hpp>
+
+namespace {
+
+uint32_t timestamp(const std::vector<uint8_t>& p)
+{
+    return (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+}
+
+uint16_t sequenceNumber(const std::vector<uint8_t>& p)
+{
+    return (uint16_t)(p[2] << 8 | p[3]);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(pcmu_packetizer)
+
+BOOST_AUTO_TEST_CASE(packets_of_ptime)
+{
+    std::string trackId = "audio";
+    nabto::PcmuPacketizerConf conf;
+    conf.ptime = std::chrono::milliseconds(20);
+    auto packetizer = nabto::PcmuPacketizer::create(42, trackId, 0, conf);
+
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    std::vector<uint8_t> data(100);
+    for (int i = 0; i < 41; i++) {
+        std::fill(data.begin(), data.end(), (uint8_t)i);
+        packetizer->incoming(data.data(), data.size(), cb);
+    }
+
+    // 4100 bytes of audio is 25 packets of 160 samples
+    BOOST_REQUIRE(packets.size() == (size_t)25);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const auto& p = packets[i];
+        BOOST_TEST(p.size() == (size_t)(12 + 160));
+        BOOST_TEST((p[1] & 0x7F) == 0);
+        BOOST_TEST(timestamp(p) == timestamp(packets[0]) + 160 * i);
+        BOOST_TEST(sequenceNumber(p) == (uint16_t)(sequenceNumber(packets[0]) + i));
+        // Payload is the audio in order
+        BOOST_TEST(p[12] == (uint8_t)(i * 160 / 100));
+    }
+    BOOST_TEST((packets[0][1] & 0x80) != 0);
+    BOOST_TEST((packets[1][1] & 0x80) == 0);
+
+    // The remaining 100 bytes are sent on flush, and the next audio starts a talkspurt.
+    packetizer->flush(cb);
+    BOOST_REQUIRE(packets.size() == (size_t)26);
+    BOOST_TEST(packets[25].size() == (size_t)(12 + 100));
+    BOOST_TEST(timestamp(packets[25]) == timestamp(packets[0]) + 25 * 160);
+    packetizer->flush(cb);
+    BOOST_TEST(packets.size() == (size_t)26);
+
+    data.resize(160);
+    packetizer->incoming(data.data(), data.size(), cb);
+    BOOST_REQUIRE(packets.size() == (size_t)27);
+    BOOST_TEST(timestamp(packets[26]) == timestamp(packets[0]) + 25 * 160 + 100);
+    BOOST_TEST((packets[26][1] & 0x80) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(packetize_frames)
+{
+    std::string trackId = "audio";
+    auto packetizer = std::make_shared<nabto::PcmuPacketizer>(42, trackId, 0, nabto::PcmuPacketizerConf());
+
+    std::vector<std::vector<uint8_t> > packets;
+    auto cb = [&packets](const uint8_t* packet, size_t length) {
+        packets.push_back(std::vector<uint8_t>(packet, packet + length));
+    };
+    // 50 ms frames, split into 20 ms packets. Timestamps follow the frame
+    // times even when a frame is missing.
+    std::vector<uint8_t> frame(400, 0xFF);
+    packetizer->packetizeFrame(frame.data(), frame.size(), std::chrono::microseconds(5000000), cb);
+    packetizer->packetizeFrame(frame.data(), frame.size(), std::chrono::microseconds(5100000), cb);
+    BOOST_REQUIRE(packets.size() == (size_t)6);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 160));
+    BOOST_TEST(packets[2].size() == (size_t)(12 + 80));
+    BOOST_TEST(timestamp(packets[1]) - timestamp(packets[0]) == (uint32_t)160);
+    BOOST_TEST(timestamp(packets[3]) - timestamp(packets[0]) == (uint32_t)800);
+    BOOST_TEST(timestamp(packets[5]) - timestamp(packets[0]) == (uint32_t)1120);
+    for (size_t i = 1; i < packets.size(); i++) {
+        BOOST_TEST(sequenceNumber(packets[i]) == (uint16_t)(sequenceNumber(packets[0]) + i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(configurable_ptime)
+{
+    std::string trackId = "audio";
+    for (int ms : { 10, 20, 40 }) {
+        nabto::PcmuPacketizerConf conf;
+        conf.ptime = std::chrono::milliseconds(ms);
+        auto packets = nabto::PcmuPacketizer::create(42, trackId, 0, conf)->incoming(std::vector<uint8_t>(8000));
+        BOOST_TEST(packets.size() == (size_t)(1000 / ms));
+        BOOST_TEST(packets[0].size() == (size_t)(12 + 8 * ms));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,234 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-repacketizer/h264_repacketizer.hpp>
+
+namespace {
+
+const std::vector<uint8_t> sps = { 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe8 };
+const std::vector<uint8_t> pps = { 0x68, 0xce, 0x3c, 0x80 };
+
+std::vector<uint8_t> rtpPacket(uint16_t seq, uint32_t timestamp, bool marker, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> p = { 0x80, (uint8_t)((marker ? 0x80 : 0) | 100), (uint8_t)(seq >> 8), (uint8_t)seq,
+                               (uint8_t)(timestamp >> 24), (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 8), (uint8_t)timestamp,
+                               0x11, 0x22, 0x33, 0x44 };
+    p.insert(p.end(), payload.begin(), payload.end());
+    return p;
+}
+
+std::vector<uint8_t> nalUnit(uint8_t header, size_t length)
+{
+    std::vector<uint8_t> nal(length, 0xAA);
+    nal[0] = header;
+    return nal;
+}
+
+nabto::RtpRepacketizerPtr createRepacketizer()
+{
+    return nabto::H264Repacketizer::create(0xAABBCCDD, 96);
+}
+
+uint8_t nalType(const std::vector<uint8_t>& p) { return p[12] & 0x1F; }
+uint16_t seq(const std::vector<uint8_t>& p) { return (uint16_t)(p[2] << 8 | p[3]); }
+uint32_t timestamp(const std::vector<uint8_t>& p) { return (uint32_t)(p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]); }
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(h264_repacketizer)
+
+BOOST_AUTO_TEST_CASE(injects_parameter_sets_before_idr)
+{
+    auto repacketizer = createRepacketizer();
+    repacketizer->setParameterSets({sps, pps});
+
+    auto packets = repacketizer->handlePacket(rtpPacket(1, 3000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    const auto& stap = packets[0];
+    BOOST_TEST(nalType(stap) == 24);
+    BOOST_TEST((stap[1] & 0x7F) == 96);
+    BOOST_TEST((stap[1] & 0x80) == 0);
+    BOOST_TEST(stap[8] == 0xAA);
+    std::vector<uint8_t> expected = { 0x78, 0x00, (uint8_t)sps.size() };
+    expected.insert(expected.end(), sps.begin(), sps.end());
+    expected.push_back(0x00);
+    expected.push_back((uint8_t)pps.size());
+    expected.insert(expected.end(), pps.begin(), pps.end());
+    BOOST_TEST((std::vector<uint8_t>(stap.begin() + 12, stap.end()) == expected));
+
+    const auto& idr = packets[1];
+    BOOST_TEST(nalType(idr) == 5);
+    BOOST_TEST(seq(idr) == (uint16_t)(seq(stap) + 1));
+    BOOST_TEST(timestamp(idr) == timestamp(stap));
+    uint16_t idrSeq = seq(idr);
+
+    // Other frames are forwarded as is
+    packets = repacketizer->handlePacket(rtpPacket(2, 6000, true, nalUnit(0x41, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)1);
+    BOOST_TEST(nalType(packets[0]) == 1);
+    BOOST_TEST(seq(packets[0]) == (uint16_t)(idrSeq + 1));
+
+    // Every IDR frame gets the parameter sets
+    packets = repacketizer->handlePacket(rtpPacket(3, 9000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(nalType(packets[0]) == 24);
+}
+
+BOOST_AUTO_TEST_CASE(prefers_in_band_parameter_sets)
+{
+    auto repacketizer = createRepacketizer();
+    repacketizer->setParameterSets({sps, pps});
+
+    // Parameter sets sent in-band are not duplicated
+    auto inBandSps = sps;
+    inBandSps[3] = 0x28;
+    std::vector<std::vector<uint8_t>> packets;
+    for (const auto& p : { rtpPacket(1, 3000, false, inBandSps), rtpPacket(2, 3000, false, pps), rtpPacket(3, 3000, true, nalUnit(0x65, 100)) }) {
+        auto out = repacketizer->handlePacket(p);
+        packets.insert(packets.end(), out.begin(), out.end());
+    }
+    for (const auto& p : packets) {
+        BOOST_TEST(nalType(p) != 24);
+    }
+
+    // and replace the ones from the SDP for later IDR frames
+    packets = repacketizer->handlePacket(rtpPacket(4, 6000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(nalType(packets[0]) == 24);
+    BOOST_TEST(packets[0][13 + 2 + 3] == 0x28);
+}
+
+BOOST_AUTO_TEST_CASE(no_parameter_sets)
+{
+    auto repacketizer = createRepacketizer();
+    auto packets = repacketizer->handlePacket(rtpPacket(1, 3000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)1);
+    BOOST_TEST(nalType(packets[0]) == 5);
+}
+
+BOOST_AUTO_TEST_CASE(forward_and_split)
+{
+    auto repacketizer = nabto::H264Repacketizer::create(0xAABBCCDD, 96, 1200);
+    repacketizer->setParameterSets({sps, pps});
+    uint8_t header[nabto::RTP_FIXED_HEADER_SIZE];
+
+    // Packets within the MTU only get a new header
+    auto small = rtpPacket(10, 0, true, nalUnit(0x41, 500));
+    BOOST_TEST(repacketizer->rewriteHeader(small.data(), small.size(), header, sizeof(header)) == nabto::RTP_FIXED_HEADER_SIZE);
+    BOOST_TEST((header[1] & 0x7F) == 96);
+    BOOST_TEST((header[1] & 0x80) != 0);
+    BOOST_TEST(header[8] == 0xAA);
+    BOOST_TEST(seq(std::vector<uint8_t>(header, header + 12)) == 10);
+
+    // An IDR frame needing parameter sets takes the slow path
+    auto idr = rtpPacket(11, 3000, false, nalUnit(0x65, 3000));
+    BOOST_TEST(repacketizer->rewriteHeader(idr.data(), idr.size(), header, sizeof(header)) == (size_t)0);
+    auto packets = repacketizer->handlePacket(idr);
+    BOOST_REQUIRE(packets.size() == (size_t)4);
+    BOOST_TEST(nalType(packets[0]) == 24);
+    std::vector<uint8_t> reassembled = { 0x65 };
+    for (size_t i = 0; i < packets.size(); i++) {
+        const auto& p = packets[i];
+        BOOST_TEST(p.size() <= (size_t)(12 + 1200));
+        BOOST_TEST(seq(p) == 11 + i);
+        BOOST_TEST((p[1] & 0x80) == 0);
+        BOOST_TEST(timestamp(p) == (uint32_t)3000);
+        if (i > 0) {
+            BOOST_TEST(nalType(p) == 28);
+            BOOST_TEST((p[13] & 0x1F) == 5);
+            BOOST_TEST(((p[13] & 0x80) != 0) == (i == 1));
+            BOOST_TEST(((p[13] & 0x40) != 0) == (i == 3));
+            reassembled.insert(reassembled.end(), p.begin() + 14, p.end());
+        }
+    }
+    BOOST_TEST((reassembled == nalUnit(0x65, 3000)));
+
+    // The rest of the frame and later packets are shifted to make room for the extra packets
+    auto next = rtpPacket(12, 3000, true, nalUnit(0x65, 100));
+    BOOST_TEST(repacketizer->rewriteHeader(next.data(), next.size(), header, sizeof(header)) == nabto::RTP_FIXED_HEADER_SIZE);
+    BOOST_TEST(seq(std::vector<uint8_t>(header, header + 12)) == 15);
+}
+
+BOOST_AUTO_TEST_CASE(idr_with_only_pps)
+{
+    auto repacketizer = createRepacketizer();
+    repacketizer->setParameterSets({sps, pps});
+    uint8_t header[nabto::RTP_FIXED_HEADER_SIZE];
+
+    // The encoder repeats only the PPS before the IDR frame, so the SPS is sent ahead of it
+    auto inBandPps = rtpPacket(1, 3000, false, pps);
+    BOOST_TEST(repacketizer->rewriteHeader(inBandPps.data(), inBandPps.size(), header, sizeof(header)) == nabto::RTP_FIXED_HEADER_SIZE);
+    auto idr = rtpPacket(2, 3000, true, nalUnit(0x65, 100));
+    BOOST_TEST(repacketizer->rewriteHeader(idr.data(), idr.size(), header, sizeof(header)) == (size_t)0);
+    auto packets = repacketizer->handlePacket(idr);
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST((std::vector<uint8_t>(packets[0].begin() + 12, packets[0].end()) == sps));
+    BOOST_TEST(seq(packets[0]) == 2);
+    BOOST_TEST(nalType(packets[1]) == 5);
+    BOOST_TEST(seq(packets[1]) == 3);
+
+    // The SPS is still cached for IDR frames without any parameter sets
+    packets = repacketizer->handlePacket(rtpPacket(3, 6000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(nalType(packets[0]) == 24);
+    BOOST_TEST(packets[0][13 + 2] == sps[0]);
+    BOOST_TEST(packets[0][13 + 2 + sps.size() + 2] == pps[0]);
+}
+
+BOOST_AUTO_TEST_CASE(sps_and_pps_in_separate_frames)
+{
+    auto repacketizer = createRepacketizer();
+    repacketizer->setParameterSets({sps, pps});
+
+    // A new SPS with the same id replaces the configured one, and the PPS is added
+    auto inBandSps = sps;
+    inBandSps[3] = 0x28;
+    std::vector<std::vector<uint8_t>> packets;
+    for (const auto& p : { rtpPacket(1, 3000, false, inBandSps), rtpPacket(2, 3000, true, nalUnit(0x65, 100)) }) {
+        auto out = repacketizer->handlePacket(p);
+        packets.insert(packets.end(), out.begin(), out.end());
+    }
+    BOOST_REQUIRE(packets.size() == (size_t)3);
+    BOOST_TEST(nalType(packets[0]) == 7);
+    BOOST_TEST((std::vector<uint8_t>(packets[1].begin() + 12, packets[1].end()) == pps));
+    BOOST_TEST(nalType(packets[2]) == 5);
+
+    // The PPS arrives with a later frame
+    auto inBandPps = pps;
+    inBandPps[3] = 0x81;
+    repacketizer->handlePacket(rtpPacket(3, 6000, false, inBandPps));
+    repacketizer->handlePacket(rtpPacket(4, 6000, true, nalUnit(0x41, 100)));
+
+    // Both are sent ahead of the next IDR frame
+    packets = repacketizer->handlePacket(rtpPacket(5, 9000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    std::vector<uint8_t> expected = { 0x78, 0x00, (uint8_t)inBandSps.size() };
+    expected.insert(expected.end(), inBandSps.begin(), inBandSps.end());
+    expected.push_back(0x00);
+    expected.push_back((uint8_t)inBandPps.size());
+    expected.insert(expected.end(), inBandPps.begin(), inBandPps.end());
+    BOOST_TEST((std::vector<uint8_t>(packets[0].begin() + 12, packets[0].end()) == expected));
+}
+
+BOOST_AUTO_TEST_CASE(parameter_sets_by_id)
+{
+    auto repacketizer = createRepacketizer();
+    // pic_parameter_set_id 1 (010) and 0 (1)
+    const std::vector<uint8_t> pps1 = { 0x68, 0x4e, 0x3c, 0x80 };
+    repacketizer->setParameterSets({sps, pps, pps1});
+
+    auto packets = repacketizer->handlePacket(rtpPacket(1, 3000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 1 + 3 * 2 + sps.size() + pps.size() + pps1.size()));
+
+    // An in-band PPS with id 1 does not replace the one with id 0
+    auto inBandPps1 = pps1;
+    inBandPps1[3] = 0x81;
+    repacketizer->handlePacket(rtpPacket(2, 6000, false, inBandPps1));
+    packets = repacketizer->handlePacket(rtpPacket(3, 9000, true, nalUnit(0x65, 100)));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    const auto& stap = packets[0];
+    BOOST_TEST(stap.size() == (size_t)(12 + 1 + 3 * 2 + sps.size() + pps.size() + pps1.size()));
+    BOOST_TEST(stap.back() == 0x81);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,95 @@
+#include <boost/test/unit_test.hpp>
+
+#include <rtp-repacketizer/h265_repacketizer.hpp>
+
+namespace {
+
+std::vector<uint8_t> rtpPacket(uint16_t seq, bool marker, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> p = { 0x80, (uint8_t)((marker ? 0x80 : 0) | 100), (uint8_t)(seq >> 8), (uint8_t)seq,
+                               0x00, 0x00, 0x10, 0x00, 0x11, 0x22, 0x33, 0x44 };
+    p.insert(p.end(), payload.begin(), payload.end());
+    return p;
+}
+
+std::vector<uint8_t> nalUnit(uint8_t type, size_t length)
+{
+    std::vector<uint8_t> nal(length, 0xAA);
+    nal[0] = type << 1;
+    nal[1] = 0x01;
+    return nal;
+}
+
+uint16_t seq(const std::vector<uint8_t>& p) { return (uint16_t)(p[2] << 8 | p[3]); }
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(h265_repacketizer)
+
+BOOST_AUTO_TEST_CASE(forward_and_split)
+{
+    auto repacketizer = nabto::H265Repacketizer::create(0xAABBCCDD, 96, 1200);
+    uint8_t header[nabto::RTP_FIXED_HEADER_SIZE];
+
+    // Packets within the MTU only get a new header
+    auto small = rtpPacket(10, false, nalUnit(1, 500));
+    BOOST_TEST(repacketizer->rewriteHeader(small.data(), small.size(), header, sizeof(header)) == nabto::RTP_FIXED_HEADER_SIZE);
+    BOOST_TEST((header[1] & 0x7F) == 96);
+    BOOST_TEST(header[8] == 0xAA);
+    BOOST_TEST(seq(std::vector<uint8_t>(header, header + 12)) == 10);
+
+    // A large single NAL unit packet is fragmented
+    auto nal = nalUnit(19, 3000);
+    auto large = rtpPacket(11, true, nal);
+    BOOST_TEST(repacketizer->rewriteHeader(large.data(), large.size(), header, sizeof(header)) == (size_t)0);
+    auto packets = repacketizer->handlePacket(large);
+    BOOST_REQUIRE(packets.size() == (size_t)3);
+    std::vector<uint8_t> reassembled(nal.begin(), nal.begin() + 2);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const auto& p = packets[i];
+        BOOST_TEST(p.size() <= (size_t)(12 + 1200));
+        BOOST_TEST(seq(p) == 11 + i);
+        BOOST_TEST(((p[1] & 0x80) != 0) == (i == 2));
+        BOOST_TEST(p[4] == 0x00);
+        BOOST_TEST(p[6] == 0x10);
+        BOOST_TEST(((p[12] >> 1) & 0x3F) == 49);
+        BOOST_TEST((p[14] & 0x3F) == 19);
+        reassembled.insert(reassembled.end(), p.begin() + 15, p.end());
+    }
+    BOOST_TEST((reassembled == nal));
+
+    // Later packets are shifted to make room for the extra packets
+    auto next = rtpPacket(12, false, nalUnit(1, 100));
+    repacketizer->rewriteHeader(next.data(), next.size(), header, sizeof(header));
+    BOOST_TEST(seq(std::vector<uint8_t>(header, header + 12)) == 14);
+}
+
+BOOST_AUTO_TEST_CASE(split_aggregation_and_fragments)
+{
+    auto repacketizer = nabto::H265Repacketizer::create(1, 96, 500);
+
+    // An AP larger than the MTU is split into its NAL units
+    std::vector<uint8_t> ap = { 48 << 1, 0x01 };
+    for (size_t size : { 300, 400 }) {
+        ap.push_back((uint8_t)(size >> 8));
+        ap.push_back((uint8_t)size);
+        auto nal = nalUnit(32, size);
+        ap.insert(ap.end(), nal.begin(), nal.end());
+    }
+    auto packets = repacketizer->handlePacket(rtpPacket(100, false, ap));
+    BOOST_REQUIRE(packets.size() == (size_t)2);
+    BOOST_TEST(packets[0].size() == (size_t)(12 + 300));
+    BOOST_TEST(packets[1].size() == (size_t)(12 + 400));
+
+    // A FU larger than the MTU is fragmented further, keeping the start bit on the first piece only.
+    std::vector<uint8_t> fu = { 49 << 1, 0x01, 0x80 | 19 };
+    fu.insert(fu.end(), 1000, 0xBB);
+    packets = repacketizer->handlePacket(rtpPacket(101, false, fu));
+    BOOST_REQUIRE(packets.size() == (size_t)3);
+    BOOST_TEST(packets[0][14] == (0x80 | 19));
+    BOOST_TEST(packets[1][14] == 19);
+    BOOST_TEST(packets[2][14] == 19);
+    BOOST_TEST(seq(packets[0]) == 102);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
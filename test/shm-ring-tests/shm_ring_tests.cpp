@@ -0,0 +1,145 @@
+#include <boost/test/unit_test.hpp>
+
+#include <shm-ring-client/shm_ring_reader.hpp>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string socketPath()
+{
+    return "/tmp/nabto_shm_ring_test_" + std::to_string(getpid()) + ".sock";
+}
+
+// Connect a reader, serving the producer until the ring is handed over.
+nabto::ShmRingReaderPtr connectReader(NabtoShmRingProducer& producer, const std::string& path)
+{
+    auto future = std::async(std::launch::async, [path]() { return nabto::ShmRingReader::connect(path); });
+    while (future.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready) {
+        nabto_shm_ring_producer_serve(&producer);
+    }
+    return future.get();
+}
+
+std::vector<uint8_t> makeFrame(size_t length, uint8_t seed)
+{
+    std::vector<uint8_t> frame(length);
+    for (size_t i = 0; i < length; i++) {
+        frame[i] = (uint8_t)(seed + i);
+    }
+    return frame;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(shm_ring)
+
+BOOST_AUTO_TEST_CASE(frames_wrap_around, *boost::unit_test::timeout(60))
+{
+    auto path = socketPath();
+    NabtoShmRingProducer producer;
+    BOOST_REQUIRE(nabto_shm_ring_producer_open(&producer, path.c_str(), 4096) == 0);
+    auto reader = connectReader(producer, path);
+    BOOST_REQUIRE(reader != nullptr);
+
+    // Odd frame sizes make records end at varying offsets, so some records
+    // wrap by padding and some leave less than a record header at the end.
+    nabto::ShmRingFrame frame;
+    for (int i = 0; i < 200; i++) {
+        auto data = makeFrame(100 + (i * 37) % 900, (uint8_t)i);
+        BOOST_REQUIRE(nabto_shm_ring_write(&producer, data.data(), data.size(), 1000 * i, i % 10 == 0 ? NABTO_SHM_RING_FLAG_KEYFRAME : 0) == 0);
+        BOOST_REQUIRE(reader->peek(frame));
+        BOOST_TEST(std::vector<uint8_t>(frame.data, frame.data + frame.length) == data);
+        BOOST_TEST(frame.timestamp.count() == 1000 * i);
+        BOOST_TEST(frame.keyframe == (i % 10 == 0));
+        reader->pop();
+        BOOST_TEST(!reader->peek(frame));
+    }
+    BOOST_TEST(reader->droppedFrames() == (uint64_t)0);
+
+    reader.reset();
+    nabto_shm_ring_producer_close(&producer);
+}
+
+BOOST_AUTO_TEST_CASE(full_ring_drops_new_frames, *boost::unit_test::timeout(60))
+{
+    auto path = socketPath();
+    NabtoShmRingProducer producer;
+    BOOST_REQUIRE(nabto_shm_ring_producer_open(&producer, path.c_str(), 4096) == 0);
+    auto reader = connectReader(producer, path);
+    BOOST_REQUIRE(reader != nullptr);
+
+    // Frames larger than half the ring are never accepted
+    std::vector<uint8_t> large(4096);
+    BOOST_TEST(nabto_shm_ring_write(&producer, large.data(), large.size(), 0, 0) == -1);
+
+    size_t written = 0;
+    for (int i = 0; i < 20; i++) {
+        auto data = makeFrame(1000, (uint8_t)i);
+        if (nabto_shm_ring_write(&producer, data.data(), data.size(), i, 0) == 0) {
+            written++;
+        }
+    }
+    BOOST_TEST(written == (size_t)4);
+    BOOST_TEST(reader->droppedFrames() == (uint64_t)17);
+
+    // The frames in the ring are kept, the newest ones were dropped
+    nabto::ShmRingFrame frame;
+    for (size_t i = 0; i < written; i++) {
+        BOOST_REQUIRE(reader->peek(frame));
+        BOOST_TEST(frame.timestamp.count() == (int64_t)i);
+        reader->pop();
+    }
+    BOOST_TEST(!reader->peek(frame));
+
+    reader.reset();
+    nabto_shm_ring_producer_close(&producer);
+}
+
+BOOST_AUTO_TEST_CASE(wakeup_and_producer_exit, *boost::unit_test::timeout(60))
+{
+    auto path = socketPath();
+    NabtoShmRingProducer producer;
+    BOOST_REQUIRE(nabto_shm_ring_producer_open(&producer, path.c_str(), 64 * 1024) == 0);
+
+    // Frames written before the reader attaches are skipped
+    auto data = makeFrame(500, 1);
+    BOOST_REQUIRE(nabto_shm_ring_write(&producer, data.data(), data.size(), 1, 0) == 0);
+    auto reader = connectReader(producer, path);
+    BOOST_REQUIRE(reader != nullptr);
+    nabto::ShmRingFrame frame;
+    BOOST_TEST(!reader->peek(frame));
+
+    // The eventfd is only signalled while the reader waits
+    struct pollfd pfd = { reader->eventFd(), POLLIN, 0 };
+    BOOST_REQUIRE(nabto_shm_ring_write(&producer, data.data(), data.size(), 2, 0) == 0);
+    BOOST_TEST(poll(&pfd, 1, 0) == 0);
+    BOOST_TEST(!reader->prepareWait());
+    BOOST_REQUIRE(reader->peek(frame));
+    reader->pop();
+
+    BOOST_REQUIRE(reader->prepareWait());
+    BOOST_REQUIRE(nabto_shm_ring_write(&producer, data.data(), data.size(), 3, 0) == 0);
+    BOOST_TEST(poll(&pfd, 1, 1000) == 1);
+    reader->finishWait();
+    BOOST_TEST(poll(&pfd, 1, 0) == 0);
+    BOOST_REQUIRE(reader->peek(frame));
+    BOOST_TEST(frame.timestamp.count() == 3);
+    reader->pop();
+
+    // The connection socket tells the reader when the producer is gone
+    struct pollfd conn = { reader->connectionFd(), POLLIN, 0 };
+    BOOST_TEST(poll(&conn, 1, 0) == 0);
+    nabto_shm_ring_producer_close(&producer);
+    BOOST_TEST(poll(&conn, 1, 1000) == 1);
+
+    // Without a producer, connecting fails
+    BOOST_TEST(nabto::ShmRingReader::connect(path) == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()